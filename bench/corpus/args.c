@@ -0,0 +1,14 @@
+// More arguments than argument registers: the ninth word and the 64-bit
+// accumulator are passed on the stack, the result comes back in a0/a1
+long long mix(int a, int b, int c, int d, int e, int f, int g, int h, int i, long long acc) {
+    int s = a + b + c + d + e + f + g + h + i;
+    return acc + s;
+}
+
+int main(void) {
+    long long acc = 0xfffff000;
+    for (int k = 0; k < 100; k++) {
+        acc = mix(k, k + 1, k + 2, k + 3, k + 4, k + 5, k + 6, k + 7, k + 8, acc);
+    }
+    return (int)((acc >> 32) + acc) & 255;
+}
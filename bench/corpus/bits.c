@@ -0,0 +1,31 @@
+// Bit manipulation: population count and bit reversal
+int popcount(int x) {
+    int c = 0;
+    while (x != 0) {
+        x = x & (x - 1);
+        c = c + 1;
+    }
+    return c;
+}
+
+int reverse(int x) {
+    int r = 0;
+    int i = 0;
+    while (i < 32) {
+        r = (r << 1) | (x & 1);
+        x = x >> 1;
+        i = i + 1;
+    }
+    return r;
+}
+
+int main(void) {
+    int s = 0;
+    int i = 0;
+    while (i < 1000) {
+        int x = i * 40503;
+        s = s + popcount(x) + (reverse(x) & 15);
+        i = i + 1;
+    }
+    return s & 255;
+}
@@ -0,0 +1,25 @@
+// Configuration constants: the debug code and the branches on them are
+// dead once the constants are known, as is the unused value
+#define DEBUG 0
+#define SCALE 4
+
+int checksum(int x) {
+    int unused = x * 7;
+    if (DEBUG) {
+        x = x + 1000;
+    }
+    if (SCALE > 2) {
+        x = x * SCALE;
+    } else {
+        x = x + SCALE;
+    }
+    return x ^ (x >> 3);
+}
+
+int main(void) {
+    int s = 0;
+    for (int i = 0; i < 200; i++) {
+        s = s + checksum(i);
+    }
+    return s & 255;
+}
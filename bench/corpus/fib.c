@@ -0,0 +1,11 @@
+// Doubly recursive Fibonacci: call overhead dominates
+int fib(int n) {
+    if (n < 2) {
+        return n;
+    }
+    return fib(n - 1) + fib(n - 2);
+}
+
+int main(void) {
+    return fib(20) & 255;
+}
@@ -0,0 +1,14 @@
+// Identifier characters, with the && and || chains of a hand-written lexer
+int main(void) {
+    char* text = "int main(void) { return foo_bar + 42 * x1 - (y2 >> 3); } // scanned 20 times";
+    int n = 0;
+    for (int k = 0; k < 20; k++) {
+        for (int i = 0; text[i] != 0; i++) {
+            char ch = text[i];
+            if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_' || (ch >= '0' && ch <= '9')) {
+                n++;
+            }
+        }
+    }
+    return n & 255;
+}
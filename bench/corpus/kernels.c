@@ -0,0 +1,42 @@
+// Arithmetic kernels: a dot product and Euclid's algorithm, which
+// go through the multiplication and division runtime helpers
+int a[32];
+int b[32];
+
+int dot(int n) {
+    int s = 0;
+    int i = 0;
+    while (i < n) {
+        s = s + a[i] * b[i];
+        i = i + 1;
+    }
+    return s;
+}
+
+int gcd(int x, int y) {
+    while (y != 0) {
+        int t = x % y;
+        x = y;
+        y = t;
+    }
+    return x;
+}
+
+int main(void) {
+    int i = 0;
+    while (i < 32) {
+        a[i] = i + 1;
+        b[i] = 32 - i;
+        i = i + 1;
+    }
+
+    int s = dot(32);
+    int g = 0;
+    int k = 1;
+    while (k < 200) {
+        g = g + gcd(k * 7, 84) + k / 10;
+        k = k + 1;
+    }
+
+    return (s + g) & 255;
+}
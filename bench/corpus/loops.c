@@ -0,0 +1,23 @@
+// Fills a global 8x8 matrix, then sums it with two nested loops
+int m[64];
+
+int main(void) {
+    int i = 0;
+    while (i < 64) {
+        m[i] = i * 3 + 1;
+        i = i + 1;
+    }
+
+    int sum = 0;
+    int r = 0;
+    while (r < 8) {
+        int c = 0;
+        while (c < 8) {
+            sum = sum + m[r * 8 + c];
+            c = c + 1;
+        }
+        r = r + 1;
+    }
+
+    return sum & 255;
+}
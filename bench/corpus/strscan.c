@@ -0,0 +1,30 @@
+// String scanning: byte loads until the terminator
+int count(char* s, int ch) {
+    int n = 0;
+    while (*s != 0) {
+        if (*s == ch) {
+            n = n + 1;
+        }
+        s = s + 1;
+    }
+    return n;
+}
+
+int length(char* s) {
+    int n = 0;
+    while (s[n] != 0) {
+        n = n + 1;
+    }
+    return n;
+}
+
+int main(void) {
+    char* text = "the quick brown fox jumps over the lazy dog";
+    int total = 0;
+    int k = 0;
+    while (k < 50) {
+        total = total + count(text, ' ') + length(text);
+        k = k + 1;
+    }
+    return total & 255;
+}
@@ -0,0 +1,352 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "codegen/codegen.h"
+#include "codegen/encode.h"
+#include "codegen/object.h"
+#include "codegen/target.h"
+#include "machine.h"
+#include "programs.h"
+#include "utils/timereport.h"
+
+// Compiles every program of the corpus, runs it on the simulator next to
+// the runtime objects and compares the results with the baselines.
+
+typedef struct result {
+    char name[32];
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t size;
+} result_t;
+
+#define MAX_PROGRAMS 64
+#define MAX_PATH 4096
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s [options] <runtime object>...\n"
+            "\n"
+            "Options:\n"
+            "  --baselines=FILE   baseline results to compare with (default bench/baselines.txt)\n"
+            "  --out=DIR          where to write the objects of the programs (default obj/bench)\n"
+            "  --tolerance=PCT    allowed growth of each metric before it counts as a regression (default 0)\n"
+            "  --update           write the results as the new baselines instead of comparing\n"
+            "  --target=FILE      target description the code is scheduled for and the simulator models\n"
+            "                     (default: the built-in %s)\n"
+            "  --report           print what the optimizations did to each function on stderr\n"
+            "  --no-dce           don't eliminate dead code\n"
+            "  --no-gvn           don't eliminate common subexpressions\n"
+            "  --no-loops         don't optimize loops\n"
+            "  --no-sched         don't schedule the instructions\n"
+            "  --inline=N         inline the callees of at most N instructions, 0 to disable (default 16)\n"
+            "  --inline-growth=PCT  how much inlining may grow each program (default 50)\n"
+            "  --time-report[=FMT]  print the time, allocations and memory high-water mark of each compiler\n"
+            "                     phase on stderr, as a text table (the default) or json\n",
+            name, TARGET_DEFAULT.name);
+}
+
+// Bytes of code generated for the module, without the runtime
+static int code_size(module_t m, uint64_t* sizep) {
+    buf_t code = buf_new(4096);
+    relocs_t relocs = relocs_new();
+    int ok = code && relocs;
+
+    for (int i = 0; ok && i < m->nfuncs; i++) {
+        ok = encode_function(m->funcs[i], code, relocs);
+    }
+    if (ok) {
+        *sizep = code->len;
+    }
+
+    relocs_free(&relocs);
+    buf_free(&code);
+    return ok;
+}
+
+static int run_program(const program_t* p, const codegen_options_t* opts, const char* out, char** runtime, int nruntime,
+                       result_t* r) {
+    module_t m = p->build();
+    if (!m) {
+        fprintf(stderr, "Error: couldn't build %s\n", p->name);
+        return 0;
+    }
+
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/%s.o", out, p->name);
+
+    int ok = codegen_module(m, opts);
+    if (ok) {
+        phase_t prev = phase_enter(PHASE_CODEGEN);
+        ok = code_size(m, &r->size);
+        phase_leave(prev);
+    }
+    if (ok) {
+        phase_t prev = phase_enter(PHASE_OUTPUT);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            perror(path);
+            ok = 0;
+        } else {
+            ok = object_write(m, fd);
+            close(fd);
+        }
+        phase_leave(prev);
+    }
+    module_free(&m);
+    if (!ok) {
+        fprintf(stderr, "Error: couldn't compile %s\n", p->name);
+        return 0;
+    }
+
+    char** paths = (char**)malloc((nruntime + 1) * sizeof(char*));
+    if (!paths) {
+        perror("Error with malloc");
+        return 0;
+    }
+    paths[0] = path;
+    memcpy(paths + 1, runtime, nruntime * sizeof(char*));
+
+    // The simulated pipeline is the core the code was scheduled for
+    const target_t* t = opts->target;
+    machine_t sim = machine_new(MACHINE_BASE, MACHINE_MEM_SIZE);
+    if (sim && t) {
+        sim->pipeline = (pipeline_t){t->load - 1, t->mispredict, t->jump, t->indirect};
+    }
+    ok = sim && machine_load(sim, paths, nruntime + 1, "main") && machine_run(sim);
+    free(paths);
+
+    if (ok && sim->exit_code != p->expected) {
+        fprintf(stderr, "Error: %s returned %d instead of %d\n", p->name, sim->exit_code, p->expected);
+        ok = 0;
+    }
+    if (ok) {
+        snprintf(r->name, sizeof(r->name), "%s", p->name);
+        r->instructions = sim->counters.instructions;
+        r->cycles = sim->counters.cycles;
+    }
+
+    machine_free(&sim);
+    return ok;
+}
+
+static int read_baselines(const char* path, result_t* base, int* nbase) {
+    *nbase = 0;
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        // No baselines yet, everything is new
+        return errno == ENOENT;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), fp) && *nbase < MAX_PROGRAMS) {
+        result_t* r = &base[*nbase];
+        unsigned long long ins, cyc, size;
+        if (line[0] == '#' || sscanf(line, "%31s %llu %llu %llu", r->name, &ins, &cyc, &size) != 4) {
+            continue;
+        }
+        r->instructions = ins;
+        r->cycles = cyc;
+        r->size = size;
+        (*nbase)++;
+    }
+
+    fclose(fp);
+    return 1;
+}
+
+static int write_baselines(const char* path, const result_t* results, int n) {
+    FILE* fp = fopen(path, "w");
+    if (!fp) {
+        perror(path);
+        return 0;
+    }
+
+    fprintf(fp, "# program instructions cycles code-size\n");
+    for (int i = 0; i < n; i++) {
+        fprintf(fp, "%s %llu %llu %llu\n", results[i].name, (unsigned long long)results[i].instructions,
+                (unsigned long long)results[i].cycles, (unsigned long long)results[i].size);
+    }
+
+    return fclose(fp) == 0;
+}
+
+// Prints one metric with its change from the baseline, returns 1 if it regressed
+static int compare(uint64_t now, const uint64_t* before, double tolerance) {
+    if (!before) {
+        printf(" %12llu %9s", (unsigned long long)now, "new");
+        return 0;
+    }
+
+    double delta = *before ? 100.0 * ((double)now - (double)*before) / (double)*before : 0.0;
+    printf(" %12llu %+8.2f%%", (unsigned long long)now, delta);
+    return delta > tolerance;
+}
+
+int main(int argc, char** args) {
+    enum {
+        OPT_BASELINES = 256,
+        OPT_OUT,
+        OPT_TOLERANCE,
+        OPT_UPDATE,
+        OPT_REPORT,
+        OPT_NO_DCE,
+        OPT_NO_GVN,
+        OPT_NO_LOOPS,
+        OPT_NO_SCHED,
+        OPT_TARGET,
+        OPT_INLINE,
+        OPT_INLINE_GROWTH,
+        OPT_TIME_REPORT
+    };
+    static const struct option options[] = {
+        {"baselines", required_argument, NULL, OPT_BASELINES},
+        {"out", required_argument, NULL, OPT_OUT},
+        {"tolerance", required_argument, NULL, OPT_TOLERANCE},
+        {"update", no_argument, NULL, OPT_UPDATE},
+        {"report", no_argument, NULL, OPT_REPORT},
+        {"no-dce", no_argument, NULL, OPT_NO_DCE},
+        {"no-gvn", no_argument, NULL, OPT_NO_GVN},
+        {"no-loops", no_argument, NULL, OPT_NO_LOOPS},
+        {"no-sched", no_argument, NULL, OPT_NO_SCHED},
+        {"target", required_argument, NULL, OPT_TARGET},
+        {"inline", required_argument, NULL, OPT_INLINE},
+        {"inline-growth", required_argument, NULL, OPT_INLINE_GROWTH},
+        {"time-report", optional_argument, NULL, OPT_TIME_REPORT},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    const char* baselines = "bench/baselines.txt";
+    const char* out = "obj/bench";
+    double tolerance = 0.0;
+    int update = 0;
+    int time_report = 0;
+    int json = 0;
+    codegen_options_t opts = CODEGEN_OPTIONS_DEFAULT;
+    target_t target = TARGET_DEFAULT;
+    opts.target = &target;
+
+    int opt;
+    while ((opt = getopt_long(argc, args, "", options, NULL)) != -1) {
+        switch (opt) {
+            case OPT_BASELINES:
+                baselines = optarg;
+                break;
+            case OPT_OUT:
+                out = optarg;
+                break;
+            case OPT_TOLERANCE:
+                tolerance = atof(optarg);
+                break;
+            case OPT_UPDATE:
+                update = 1;
+                break;
+            case OPT_REPORT:
+                opts.report = stderr;
+                break;
+            case OPT_NO_DCE:
+                opts.dce = 0;
+                break;
+            case OPT_NO_GVN:
+                opts.gvn = 0;
+                break;
+            case OPT_NO_LOOPS:
+                opts.loops = 0;
+                break;
+            case OPT_NO_SCHED:
+                opts.schedule = 0;
+                break;
+            case OPT_TARGET:
+                if (!target_load(optarg, &target)) {
+                    return 2;
+                }
+                break;
+            case OPT_INLINE:
+                opts.inline_threshold = atoi(optarg);
+                break;
+            case OPT_INLINE_GROWTH:
+                opts.inline_growth = atoi(optarg);
+                break;
+            case OPT_TIME_REPORT:
+                if (optarg && strcmp(optarg, "text") && strcmp(optarg, "json")) {
+                    fprintf(stderr, "Error: invalid report format '%s', expected text or json\n", optarg);
+                    return 2;
+                }
+                time_report = 1;
+                json = optarg && !strcmp(optarg, "json");
+                break;
+            case 'h':
+                usage(args[0]);
+                return 0;
+            default:
+                usage(args[0]);
+                return 2;
+        }
+    }
+
+    if (mkdir(out, 0755) < 0 && errno != EEXIST) {
+        perror(out);
+        return 2;
+    }
+
+    // The simulation runs of the programs count as other
+    if (time_report) {
+        timereport_start();
+    }
+    result_t results[MAX_PROGRAMS];
+    int n = 0;
+    for (int i = 0; i < nprograms && n < MAX_PROGRAMS; i++) {
+        if (!run_program(&programs[i], &opts, out, args + optind, argc - optind, &results[n])) {
+            return 1;
+        }
+        n++;
+    }
+    if (time_report) {
+        timereport_print(stderr, json);
+    }
+
+    if (update) {
+        if (!write_baselines(baselines, results, n)) {
+            return 2;
+        }
+        printf("Wrote %d baselines to %s\n", n, baselines);
+        return 0;
+    }
+
+    result_t base[MAX_PROGRAMS];
+    int nbase;
+    if (!read_baselines(baselines, base, &nbase)) {
+        perror(baselines);
+        return 2;
+    }
+
+    printf("%-10s %12s %9s %12s %9s %12s %9s\n", "program", "instructions", "", "cycles", "", "size", "");
+    int regressions = 0;
+    for (int i = 0; i < n; i++) {
+        const result_t* b = NULL;
+        for (int k = 0; k < nbase; k++) {
+            if (!strcmp(base[k].name, results[i].name)) {
+                b = &base[k];
+            }
+        }
+
+        printf("%-10s", results[i].name);
+        int worse = compare(results[i].instructions, b ? &b->instructions : NULL, tolerance);
+        worse |= compare(results[i].cycles, b ? &b->cycles : NULL, tolerance);
+        worse |= compare(results[i].size, b ? &b->size : NULL, tolerance);
+        printf("%s\n", worse ? "  REGRESSION" : "");
+        regressions += worse;
+    }
+
+    if (regressions) {
+        printf("%d program(s) regressed against %s\n", regressions, baselines);
+        return 1;
+    }
+
+    return 0;
+}
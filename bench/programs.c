@@ -0,0 +1,588 @@
+#include "programs.h"
+#include "codegen/abi.h"
+#include "codegen/arith.h"
+#include "codegen/cond.h"
+
+// ===================== BUILDER =====================
+
+typedef struct builder {
+    mfunc_t f;
+    int ok;
+} builder_t;
+
+static void emit(builder_t* b, inst_t i) {
+    b->ok = b->ok && mfunc_append(b->f, i);
+}
+
+static int var(builder_t* b) {
+    return b->f ? mfunc_new_vreg(b->f) : R_NONE;
+}
+
+static int op3(builder_t* b, opcode_t op, int x, int y) {
+    int v = var(b);
+    emit(b, inst_new_r(op, v, x, y));
+    return v;
+}
+
+static int opi(builder_t* b, opcode_t op, int x, int32_t imm) {
+    int v = var(b);
+    emit(b, inst_new_i(op, v, x, R_NONE, imm));
+    return v;
+}
+
+static int konst(builder_t* b, int32_t c) {
+    int v = var(b);
+    emit(b, inst_new_i(OP_LI, v, R_NONE, R_NONE, c));
+    return v;
+}
+
+static int address(builder_t* b, const char* sym) {
+    int v = var(b);
+    emit(b, inst_new_sym(OP_LA, v, sym));
+    return v;
+}
+
+static void assign(builder_t* b, int dst, int src) {
+    emit(b, inst_new_i(OP_ADDI, dst, src, R_NONE, 0));
+}
+
+static int label(builder_t* b) {
+    return b->f ? mfunc_new_label(b->f) : -1;
+}
+
+static void place(builder_t* b, int l) {
+    emit(b, inst_new_label(l));
+}
+
+static void jump(builder_t* b, int l) {
+    emit(b, inst_new_branch(OP_JAL, R_ZERO, R_NONE, R_NONE, l));
+}
+
+// Branches to l unless the condition holds, consuming it
+static void branch_if_false(builder_t* b, cond_t c, int l) {
+    b->ok = b->ok && c && cond_branch(b->f, c, 0, l);
+    cond_free(&c);
+}
+
+// x < y, x == y and friends, as conditions to branch on
+static cond_t compare(builder_t* b, token_type_t op, int x, int y) {
+    return b->ok ? cond_new_cmp(op, x, y, 0) : NULL;
+}
+
+static cond_t nonzero(builder_t* b, int x) {
+    return b->ok ? cond_new_test(x) : NULL;
+}
+
+static cond_t less(builder_t* b, int x, int y) {
+    return compare(b, RO_LT, x, y);
+}
+
+static cond_t not_equal(builder_t* b, int x, int y) {
+    return compare(b, RO_NEQ, x, y);
+}
+
+static cond_t equal(builder_t* b, int x, int y) {
+    return compare(b, RO_EQ, x, y);
+}
+
+static cond_t both(cond_t x, cond_t y) {
+    return cond_new_logic(LO_AND, x, y);
+}
+
+static cond_t either(cond_t x, cond_t y) {
+    return cond_new_logic(LO_OR, x, y);
+}
+
+// Address of the int at index i of the array at base
+static int element(builder_t* b, int base, int i) {
+    return op3(b, OP_ADD, base, opi(b, OP_SLLI, i, 2));
+}
+
+static int load(builder_t* b, opcode_t op, int addr) {
+    return opi(b, op, addr, 0);
+}
+
+static void store(builder_t* b, opcode_t op, int addr, int v) {
+    emit(b, inst_new_i(op, R_NONE, addr, v, 0));
+}
+
+static int arith(builder_t* b, token_type_t op, int x, int y) {
+    int v = var(b);
+    b->ok = b->ok && arith_lower(b->f, op, v, x, y, 0);
+    return v;
+}
+
+static int arith_const(builder_t* b, token_type_t op, int x, int32_t c) {
+    int v = var(b);
+    b->ok = b->ok && arith_lower_const(b->f, op, v, x, c, 0);
+    return v;
+}
+
+// The n word parameters of the function, in order
+static void params(builder_t* b, int* regs, int n) {
+    abi_value_t values[8];
+    b->ok = b->ok && n <= 8 && abi_params(b->f, NULL, n, values);
+    for (int k = 0; k < n; k++) {
+        regs[k] = b->ok ? values[k].lo : R_NONE;
+    }
+}
+
+static int call(builder_t* b, const char* name, const int* args, int nargs) {
+    abi_value_t values[8], r = {R_NONE, R_NONE};
+    for (int k = 0; k < nargs && k < 8; k++) {
+        values[k] = ABI_WORD(args[k]);
+    }
+    b->ok = b->ok && nargs <= 8 && abi_call(b->f, name, values, nargs, &r, 0);
+    return r.lo;
+}
+
+static void ret(builder_t* b, int v) {
+    abi_value_t r = ABI_WORD(v);
+    b->ok = b->ok && abi_return(b->f, &r);
+}
+
+static builder_t begin(const char* name) {
+    builder_t b = {mfunc_new(name), 1};
+    b.ok = b.f != NULL;
+    return b;
+}
+
+// Hands the function over to the module, 0 if anything failed
+static int end(builder_t* b, module_t m) {
+    if (!b->ok || !module_add_function(m, b->f)) {
+        mfunc_free(&b->f);
+        return 0;
+    }
+    return 1;
+}
+
+static module_t finish(module_t m, int ok) {
+    if (!ok) {
+        module_free(&m);
+    }
+    return m;
+}
+
+// ===================== PROGRAMS =====================
+
+// bench/corpus/loops.c
+static module_t build_loops() {
+    static const int zero[64];
+
+    module_t m = module_new();
+    if (!m) {
+        return NULL;
+    }
+
+    builder_t b = begin("main");
+    int i = var(&b), sum = var(&b), r = var(&b), c = var(&b);
+
+    assign(&b, i, konst(&b, 0));
+    int fill = label(&b), fill_end = label(&b);
+    place(&b, fill);
+    branch_if_false(&b, less(&b, i, konst(&b, 64)), fill_end);
+    int v = opi(&b, OP_ADDI, arith_const(&b, AO_MUL, i, 3), 1);
+    store(&b, OP_SW, element(&b, address(&b, "m"), i), v);
+    assign(&b, i, opi(&b, OP_ADDI, i, 1));
+    jump(&b, fill);
+    place(&b, fill_end);
+
+    assign(&b, sum, konst(&b, 0));
+    assign(&b, r, konst(&b, 0));
+    int rows = label(&b), rows_end = label(&b), cols = label(&b), cols_end = label(&b);
+    place(&b, rows);
+    branch_if_false(&b, less(&b, r, konst(&b, 8)), rows_end);
+    assign(&b, c, konst(&b, 0));
+    place(&b, cols);
+    branch_if_false(&b, less(&b, c, konst(&b, 8)), cols_end);
+    int index = op3(&b, OP_ADD, arith_const(&b, AO_MUL, r, 8), c);
+    assign(&b, sum, op3(&b, OP_ADD, sum, load(&b, OP_LW, element(&b, address(&b, "m"), index))));
+    assign(&b, c, opi(&b, OP_ADDI, c, 1));
+    jump(&b, cols);
+    place(&b, cols_end);
+    assign(&b, r, opi(&b, OP_ADDI, r, 1));
+    jump(&b, rows);
+    place(&b, rows_end);
+    ret(&b, op3(&b, OP_AND, sum, konst(&b, 255)));
+
+    int ok = end(&b, m) && module_add_data(m, "m", SEC_DATA, zero, sizeof(zero), 4);
+    return finish(m, ok);
+}
+
+// bench/corpus/fib.c
+static module_t build_fib() {
+    module_t m = module_new();
+    if (!m) {
+        return NULL;
+    }
+
+    builder_t b = begin("fib");
+    int n;
+    params(&b, &n, 1);
+    int recurse = label(&b);
+    branch_if_false(&b, less(&b, n, konst(&b, 2)), recurse);
+    ret(&b, n);
+    place(&b, recurse);
+    int args[1] = {op3(&b, OP_SUB, n, konst(&b, 1))};
+    int x = call(&b, "fib", args, 1);
+    args[0] = op3(&b, OP_SUB, n, konst(&b, 2));
+    int y = call(&b, "fib", args, 1);
+    ret(&b, op3(&b, OP_ADD, x, y));
+    int ok = end(&b, m);
+
+    b = begin("main");
+    args[0] = konst(&b, 20);
+    ret(&b, op3(&b, OP_AND, call(&b, "fib", args, 1), konst(&b, 255)));
+    ok = end(&b, m) && ok;
+
+    return finish(m, ok);
+}
+
+// bench/corpus/bits.c
+static module_t build_bits() {
+    module_t m = module_new();
+    if (!m) {
+        return NULL;
+    }
+
+    builder_t b = begin("popcount");
+    int x, c = var(&b);
+    params(&b, &x, 1);
+    assign(&b, c, konst(&b, 0));
+    int loop = label(&b), done = label(&b);
+    place(&b, loop);
+    branch_if_false(&b, not_equal(&b, x, konst(&b, 0)), done);
+    assign(&b, x, op3(&b, OP_AND, x, op3(&b, OP_SUB, x, konst(&b, 1))));
+    assign(&b, c, opi(&b, OP_ADDI, c, 1));
+    jump(&b, loop);
+    place(&b, done);
+    ret(&b, c);
+    int ok = end(&b, m);
+
+    b = begin("reverse");
+    params(&b, &x, 1);
+    int r = var(&b), i = var(&b);
+    assign(&b, r, konst(&b, 0));
+    assign(&b, i, konst(&b, 0));
+    loop = label(&b), done = label(&b);
+    place(&b, loop);
+    branch_if_false(&b, less(&b, i, konst(&b, 32)), done);
+    int low = op3(&b, OP_AND, x, konst(&b, 1));
+    assign(&b, r, op3(&b, OP_OR, op3(&b, OP_SLL, r, konst(&b, 1)), low));
+    assign(&b, x, op3(&b, OP_SRA, x, konst(&b, 1)));
+    assign(&b, i, opi(&b, OP_ADDI, i, 1));
+    jump(&b, loop);
+    place(&b, done);
+    ret(&b, r);
+    ok = end(&b, m) && ok;
+
+    b = begin("main");
+    int s = var(&b);
+    i = var(&b);
+    assign(&b, s, konst(&b, 0));
+    assign(&b, i, konst(&b, 0));
+    loop = label(&b), done = label(&b);
+    place(&b, loop);
+    branch_if_false(&b, less(&b, i, konst(&b, 1000)), done);
+    x = var(&b);
+    assign(&b, x, arith_const(&b, AO_MUL, i, 40503));
+    int args[1] = {x};
+    int p = call(&b, "popcount", args, 1);
+    int q = op3(&b, OP_AND, call(&b, "reverse", args, 1), konst(&b, 15));
+    assign(&b, s, op3(&b, OP_ADD, op3(&b, OP_ADD, s, p), q));
+    assign(&b, i, opi(&b, OP_ADDI, i, 1));
+    jump(&b, loop);
+    place(&b, done);
+    ret(&b, op3(&b, OP_AND, s, konst(&b, 255)));
+    ok = end(&b, m) && ok;
+
+    return finish(m, ok);
+}
+
+// bench/corpus/strscan.c
+static module_t build_strscan() {
+    static const char text[] = "the quick brown fox jumps over the lazy dog";
+
+    module_t m = module_new();
+    if (!m) {
+        return NULL;
+    }
+
+    builder_t b = begin("count");
+    int p[2], n = var(&b);
+    params(&b, p, 2);
+    int s = p[0], ch = p[1];
+    assign(&b, n, konst(&b, 0));
+    int loop = label(&b), done = label(&b), skip = label(&b);
+    place(&b, loop);
+    branch_if_false(&b, not_equal(&b, load(&b, OP_LBU, s), konst(&b, 0)), done);
+    branch_if_false(&b, equal(&b, load(&b, OP_LBU, s), ch), skip);
+    assign(&b, n, opi(&b, OP_ADDI, n, 1));
+    place(&b, skip);
+    assign(&b, s, opi(&b, OP_ADDI, s, 1));
+    jump(&b, loop);
+    place(&b, done);
+    ret(&b, n);
+    int ok = end(&b, m);
+
+    b = begin("length");
+    params(&b, &s, 1);
+    n = var(&b);
+    assign(&b, n, konst(&b, 0));
+    loop = label(&b), done = label(&b);
+    place(&b, loop);
+    branch_if_false(&b, not_equal(&b, load(&b, OP_LBU, op3(&b, OP_ADD, s, n)), konst(&b, 0)), done);
+    assign(&b, n, opi(&b, OP_ADDI, n, 1));
+    jump(&b, loop);
+    place(&b, done);
+    ret(&b, n);
+    ok = end(&b, m) && ok;
+
+    const char* str = module_add_string(m, text, sizeof(text));
+    if (!str) {
+        module_free(&m);
+        return NULL;
+    }
+    b = begin("main");
+    int t = var(&b), total = var(&b), k = var(&b);
+    assign(&b, t, address(&b, str));
+    assign(&b, total, konst(&b, 0));
+    assign(&b, k, konst(&b, 0));
+    loop = label(&b), done = label(&b);
+    place(&b, loop);
+    branch_if_false(&b, less(&b, k, konst(&b, 50)), done);
+    int args[2] = {t, konst(&b, ' ')};
+    int spaces = call(&b, "count", args, 2);
+    int len = call(&b, "length", args, 1);
+    assign(&b, total, op3(&b, OP_ADD, op3(&b, OP_ADD, total, spaces), len));
+    assign(&b, k, opi(&b, OP_ADDI, k, 1));
+    jump(&b, loop);
+    place(&b, done);
+    ret(&b, op3(&b, OP_AND, total, konst(&b, 255)));
+    ok = end(&b, m) && ok;
+
+    return finish(m, ok);
+}
+
+// bench/corpus/kernels.c
+static module_t build_kernels() {
+    static const int zero[32];
+
+    module_t m = module_new();
+    if (!m) {
+        return NULL;
+    }
+
+    builder_t b = begin("dot");
+    int n, s = var(&b), i = var(&b);
+    params(&b, &n, 1);
+    assign(&b, s, konst(&b, 0));
+    assign(&b, i, konst(&b, 0));
+    int loop = label(&b), done = label(&b);
+    place(&b, loop);
+    branch_if_false(&b, less(&b, i, n), done);
+    int x = load(&b, OP_LW, element(&b, address(&b, "a"), i));
+    int y = load(&b, OP_LW, element(&b, address(&b, "b"), i));
+    assign(&b, s, op3(&b, OP_ADD, s, arith(&b, AO_MUL, x, y)));
+    assign(&b, i, opi(&b, OP_ADDI, i, 1));
+    jump(&b, loop);
+    place(&b, done);
+    ret(&b, s);
+    int ok = end(&b, m);
+
+    b = begin("gcd");
+    int p[2];
+    params(&b, p, 2);
+    x = p[0];
+    y = p[1];
+    loop = label(&b), done = label(&b);
+    place(&b, loop);
+    branch_if_false(&b, not_equal(&b, y, konst(&b, 0)), done);
+    int t = arith(&b, AO_MOD, x, y);
+    assign(&b, x, y);
+    assign(&b, y, t);
+    jump(&b, loop);
+    place(&b, done);
+    ret(&b, x);
+    ok = end(&b, m) && ok;
+
+    b = begin("main");
+    i = var(&b);
+    assign(&b, i, konst(&b, 0));
+    loop = label(&b), done = label(&b);
+    place(&b, loop);
+    branch_if_false(&b, less(&b, i, konst(&b, 32)), done);
+    store(&b, OP_SW, element(&b, address(&b, "a"), i), opi(&b, OP_ADDI, i, 1));
+    store(&b, OP_SW, element(&b, address(&b, "b"), i), op3(&b, OP_SUB, konst(&b, 32), i));
+    assign(&b, i, opi(&b, OP_ADDI, i, 1));
+    jump(&b, loop);
+    place(&b, done);
+
+    int args[2] = {konst(&b, 32)};
+    s = call(&b, "dot", args, 1);
+    int g = var(&b), k = var(&b);
+    assign(&b, g, konst(&b, 0));
+    assign(&b, k, konst(&b, 1));
+    loop = label(&b), done = label(&b);
+    place(&b, loop);
+    branch_if_false(&b, less(&b, k, konst(&b, 200)), done);
+    args[0] = arith_const(&b, AO_MUL, k, 7);
+    args[1] = konst(&b, 84);
+    int d = call(&b, "gcd", args, 2);
+    assign(&b, g, op3(&b, OP_ADD, op3(&b, OP_ADD, g, d), arith_const(&b, AO_DIV, k, 10)));
+    assign(&b, k, opi(&b, OP_ADDI, k, 1));
+    jump(&b, loop);
+    place(&b, done);
+    ret(&b, op3(&b, OP_AND, op3(&b, OP_ADD, s, g), konst(&b, 255)));
+    ok = end(&b, m) && ok;
+
+    ok = ok && module_add_data(m, "a", SEC_DATA, zero, sizeof(zero), 4) &&
+         module_add_data(m, "b", SEC_DATA, zero, sizeof(zero), 4);
+    return finish(m, ok);
+}
+
+// bench/corpus/config.c
+static module_t build_config() {
+    module_t m = module_new();
+    if (!m) {
+        return NULL;
+    }
+
+    builder_t b = begin("checksum");
+    int x;
+    params(&b, &x, 1);
+    arith_const(&b, AO_MUL, x, 7);
+    int debug_end = label(&b);
+    branch_if_false(&b, nonzero(&b, konst(&b, 0)), debug_end);
+    assign(&b, x, opi(&b, OP_ADDI, x, 1000));
+    place(&b, debug_end);
+    int other = label(&b), scaled = label(&b);
+    branch_if_false(&b, less(&b, konst(&b, 2), konst(&b, 4)), other);
+    assign(&b, x, arith_const(&b, AO_MUL, x, 4));
+    jump(&b, scaled);
+    place(&b, other);
+    assign(&b, x, opi(&b, OP_ADDI, x, 4));
+    place(&b, scaled);
+    ret(&b, op3(&b, OP_XOR, x, op3(&b, OP_SRA, x, konst(&b, 3))));
+    int ok = end(&b, m);
+
+    b = begin("main");
+    int s = var(&b), i = var(&b);
+    assign(&b, s, konst(&b, 0));
+    assign(&b, i, konst(&b, 0));
+    int loop = label(&b), done = label(&b);
+    place(&b, loop);
+    branch_if_false(&b, less(&b, i, konst(&b, 200)), done);
+    int args[1] = {i};
+    assign(&b, s, op3(&b, OP_ADD, s, call(&b, "checksum", args, 1)));
+    assign(&b, i, opi(&b, OP_ADDI, i, 1));
+    jump(&b, loop);
+    place(&b, done);
+    ret(&b, op3(&b, OP_AND, s, konst(&b, 255)));
+    ok = end(&b, m) && ok;
+
+    return finish(m, ok);
+}
+
+// bench/corpus/args.c
+static module_t build_args() {
+    module_t m = module_new();
+    if (!m) {
+        return NULL;
+    }
+
+    builder_t b = begin("mix");
+    int wide[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+    abi_value_t p[10];
+    b.ok = b.ok && abi_params(b.f, wide, 10, p);
+    int s = b.ok ? p[0].lo : R_NONE;
+    for (int k = 1; k < 9; k++) {
+        s = op3(&b, OP_ADD, s, p[k].lo);
+    }
+    // 64-bit acc + s, s sign extended
+    abi_value_t r;
+    r.lo = op3(&b, OP_ADD, p[9].lo, s);
+    r.hi = op3(&b, OP_ADD, op3(&b, OP_ADD, p[9].hi, op3(&b, OP_SLTU, r.lo, s)), op3(&b, OP_SRA, s, konst(&b, 31)));
+    b.ok = b.ok && abi_return(b.f, &r);
+    int ok = end(&b, m);
+
+    b = begin("main");
+    abi_value_t acc = {var(&b), var(&b)};
+    assign(&b, acc.lo, konst(&b, (int32_t)0xfffff000));
+    assign(&b, acc.hi, konst(&b, 0));
+    int k = var(&b);
+    assign(&b, k, konst(&b, 0));
+    int loop = label(&b), done = label(&b);
+    place(&b, loop);
+    branch_if_false(&b, less(&b, k, konst(&b, 100)), done);
+    abi_value_t args[10];
+    for (int a = 0; a < 9; a++) {
+        args[a] = ABI_WORD(opi(&b, OP_ADDI, k, a));
+    }
+    args[9] = acc;
+    b.ok = b.ok && abi_call(b.f, "mix", args, 10, &r, 1);
+    assign(&b, acc.lo, r.lo);
+    assign(&b, acc.hi, r.hi);
+    assign(&b, k, opi(&b, OP_ADDI, k, 1));
+    jump(&b, loop);
+    place(&b, done);
+    ret(&b, op3(&b, OP_AND, op3(&b, OP_ADD, acc.hi, acc.lo), konst(&b, 255)));
+    ok = end(&b, m) && ok;
+
+    return finish(m, ok);
+}
+
+// bench/corpus/ident.c
+static module_t build_ident() {
+    module_t m = module_new();
+    if (!m) {
+        return NULL;
+    }
+    static const char text[] = "int main(void) { return foo_bar + 42 * x1 - (y2 >> 3); } // scanned 20 times";
+    const char* str = module_add_string(m, text, sizeof(text));
+    if (!str) {
+        module_free(&m);
+        return NULL;
+    }
+
+    builder_t b = begin("main");
+    int n = var(&b), k = var(&b), i = var(&b);
+    assign(&b, n, konst(&b, 0));
+    assign(&b, k, konst(&b, 0));
+    int passes = label(&b), passes_end = label(&b);
+    place(&b, passes);
+    branch_if_false(&b, less(&b, k, konst(&b, 20)), passes_end);
+    assign(&b, i, konst(&b, 0));
+    int chars = label(&b), chars_end = label(&b), next = label(&b);
+    place(&b, chars);
+    int ch = load(&b, OP_LBU, op3(&b, OP_ADD, address(&b, str), i));
+    branch_if_false(&b, not_equal(&b, ch, konst(&b, 0)), chars_end);
+    cond_t lower = both(compare(&b, RO_GE, ch, konst(&b, 'a')), compare(&b, RO_LE, ch, konst(&b, 'z')));
+    cond_t upper = both(compare(&b, RO_GE, ch, konst(&b, 'A')), compare(&b, RO_LE, ch, konst(&b, 'Z')));
+    cond_t digit = both(compare(&b, RO_GE, ch, konst(&b, '0')), compare(&b, RO_LE, ch, konst(&b, '9')));
+    branch_if_false(&b, either(either(lower, upper), either(equal(&b, ch, konst(&b, '_')), digit)), next);
+    assign(&b, n, opi(&b, OP_ADDI, n, 1));
+    place(&b, next);
+    assign(&b, i, opi(&b, OP_ADDI, i, 1));
+    jump(&b, chars);
+    place(&b, chars_end);
+    assign(&b, k, opi(&b, OP_ADDI, k, 1));
+    jump(&b, passes);
+    place(&b, passes_end);
+    ret(&b, op3(&b, OP_AND, n, konst(&b, 255)));
+    int ok = end(&b, m);
+
+    return finish(m, ok);
+}
+
+const program_t programs[] = {
+    {"loops", build_loops, 224},
+    {"fib", build_fib, 109},
+    {"bits", build_bits, 147},
+    {"strscan", build_strscan, 246},
+    {"kernels", build_kernels, 202},
+    {"config", build_config, 28},
+    {"args", build_args, 23},
+    {"ident", build_ident, 132},
+};
+const int nprograms = sizeof(programs) / sizeof(programs[0]);
@@ -0,0 +1,22 @@
+#ifndef PROGRAMS_H
+#define PROGRAMS_H
+
+#include "codegen/module.h"
+
+// The benchmark corpus. Each program of bench/corpus is built here as
+// the machine code a straightforward front end lowers it to: one virtual
+// register per variable and temporary, conditions materialized as 0/1
+// values, global addresses loaded where they are used.
+
+typedef struct program {
+    const char* name;
+    module_t (*build)();
+
+    // Value returned by main
+    int expected;
+} program_t;
+
+extern const program_t programs[];
+extern const int nprograms;
+
+#endif
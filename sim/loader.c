@@ -0,0 +1,411 @@
+#include <elf.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "machine.h"
+
+// A tiny static linker for ELF32 RISC-V relocatable objects: allocatable
+// sections are laid out back to back (code first), global symbols are
+// resolved across objects and the relocations are applied in place.
+
+typedef struct object {
+    const char* path;
+    uint8_t* bytes;
+    size_t size;
+    Elf32_Ehdr* eh;
+    Elf32_Shdr* sh;
+
+    // Load address of each section, 0 if it isn't loaded
+    uint32_t* addr;
+
+    Elf32_Sym* syms;
+    int nsyms;
+    const char* strtab;
+} object_t;
+
+typedef struct global {
+    const char* name;
+    uint32_t value;
+} global_t;
+
+typedef struct linker {
+    machine_t m;
+    object_t* objs;
+    int nobjs;
+    global_t* globals;
+    int nglobals;
+    uint32_t top;
+} linker_t;
+
+// Start stub: jal ra, <entry>; li a7, 93; ecall
+#define STUB_SIZE 12
+#define SYS_EXIT 93
+
+static int read_file(const char* path, uint8_t** bytesp, size_t* sizep) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror(path);
+        close(fd);
+        return 0;
+    }
+
+    uint8_t* bytes = (uint8_t*)malloc(st.st_size ? st.st_size : 1);
+    if (!bytes) {
+        perror("Error with malloc");
+        close(fd);
+        return 0;
+    }
+
+    size_t done = 0;
+    while (done < (size_t)st.st_size) {
+        ssize_t n = read(fd, bytes + done, st.st_size - done);
+        if (n <= 0) {
+            perror(path);
+            free(bytes);
+            close(fd);
+            return 0;
+        }
+        done += n;
+    }
+
+    close(fd);
+    *bytesp = bytes;
+    *sizep = done;
+    return 1;
+}
+
+static int parse_object(object_t* o) {
+    if (o->size < sizeof(Elf32_Ehdr)) {
+        fprintf(stderr, "Error: %s is not an ELF file\n", o->path);
+        return 0;
+    }
+
+    o->eh = (Elf32_Ehdr*)o->bytes;
+    if (memcmp(o->eh->e_ident, ELFMAG, SELFMAG) || o->eh->e_ident[EI_CLASS] != ELFCLASS32 ||
+        o->eh->e_ident[EI_DATA] != ELFDATA2LSB || o->eh->e_machine != EM_RISCV) {
+        fprintf(stderr, "Error: %s is not a little-endian RV32 ELF file\n", o->path);
+        return 0;
+    }
+    if (o->eh->e_type != ET_REL) {
+        fprintf(stderr, "Error: %s is not a relocatable object\n", o->path);
+        return 0;
+    }
+    if (o->eh->e_shoff + (size_t)o->eh->e_shnum * sizeof(Elf32_Shdr) > o->size) {
+        fprintf(stderr, "Error: %s is truncated\n", o->path);
+        return 0;
+    }
+
+    o->sh = (Elf32_Shdr*)(o->bytes + o->eh->e_shoff);
+    o->addr = (uint32_t*)calloc(o->eh->e_shnum, sizeof(uint32_t));
+    if (!o->addr) {
+        perror("Error with calloc");
+        return 0;
+    }
+
+    for (int i = 0; i < o->eh->e_shnum; i++) {
+        Elf32_Shdr* s = &o->sh[i];
+        if (s->sh_type != SHT_NOBITS && s->sh_offset + (size_t)s->sh_size > o->size) {
+            fprintf(stderr, "Error: %s is truncated\n", o->path);
+            return 0;
+        }
+        if (s->sh_type == SHT_SYMTAB) {
+            o->syms = (Elf32_Sym*)(o->bytes + s->sh_offset);
+            o->nsyms = s->sh_size / sizeof(Elf32_Sym);
+            o->strtab = (const char*)(o->bytes + o->sh[s->sh_link].sh_offset);
+        }
+    }
+
+    return 1;
+}
+
+// Places every allocatable section of the objects that is (or isn't) executable
+static int place_sections(linker_t* l, int exec) {
+    machine_t m = l->m;
+
+    for (int k = 0; k < l->nobjs; k++) {
+        object_t* o = &l->objs[k];
+        for (int i = 0; i < o->eh->e_shnum; i++) {
+            Elf32_Shdr* s = &o->sh[i];
+            if (!(s->sh_flags & SHF_ALLOC) || !!(s->sh_flags & SHF_EXECINSTR) != exec) {
+                continue;
+            }
+
+            uint32_t align = s->sh_addralign > 4 ? s->sh_addralign : 4;
+            uint32_t at = (l->top + align - 1) & ~(align - 1);
+            if (at - m->base + (uint64_t)s->sh_size > m->size) {
+                fprintf(stderr, "Error: program doesn't fit in %u bytes of memory\n", m->size);
+                return 0;
+            }
+
+            if (s->sh_type != SHT_NOBITS) {
+                memcpy(m->mem + (at - m->base), o->bytes + s->sh_offset, s->sh_size);
+            }
+            o->addr[i] = at;
+            l->top = at + s->sh_size;
+        }
+    }
+
+    return 1;
+}
+
+static global_t* find_global(linker_t* l, const char* name) {
+    for (int i = 0; i < l->nglobals; i++) {
+        if (!strcmp(l->globals[i].name, name)) {
+            return &l->globals[i];
+        }
+    }
+    return NULL;
+}
+
+static int collect_globals(linker_t* l) {
+    for (int k = 0; k < l->nobjs; k++) {
+        object_t* o = &l->objs[k];
+        for (int i = 1; i < o->nsyms; i++) {
+            Elf32_Sym* s = &o->syms[i];
+            int bind = ELF32_ST_BIND(s->st_info);
+            if ((bind != STB_GLOBAL && bind != STB_WEAK) || s->st_shndx == SHN_UNDEF) {
+                continue;
+            }
+
+            const char* name = o->strtab + s->st_name;
+            if (s->st_shndx == SHN_COMMON) {
+                fprintf(stderr, "Error: common symbol %s in %s is not supported\n", name, o->path);
+                return 0;
+            }
+
+            uint32_t value = s->st_shndx == SHN_ABS ? s->st_value : o->addr[s->st_shndx] + s->st_value;
+            global_t* g = find_global(l, name);
+            if (g) {
+                if (bind == STB_WEAK) {
+                    continue;
+                }
+                fprintf(stderr, "Error: symbol %s defined more than once\n", name);
+                return 0;
+            }
+
+            global_t* globals = (global_t*)realloc(l->globals, (l->nglobals + 1) * sizeof(global_t));
+            if (!globals) {
+                perror("Error with realloc");
+                return 0;
+            }
+            l->globals = globals;
+            l->globals[l->nglobals].name = name;
+            l->globals[l->nglobals].value = value;
+            l->nglobals++;
+        }
+    }
+
+    return 1;
+}
+
+static int symbol_value(linker_t* l, object_t* o, int index, uint32_t* valuep) {
+    if (index <= 0 || index >= o->nsyms) {
+        fprintf(stderr, "Error: bad symbol index %d in %s\n", index, o->path);
+        return 0;
+    }
+
+    Elf32_Sym* s = &o->syms[index];
+    if (s->st_shndx == SHN_UNDEF) {
+        global_t* g = find_global(l, o->strtab + s->st_name);
+        if (!g) {
+            fprintf(stderr, "Error: undefined reference to %s in %s\n", o->strtab + s->st_name, o->path);
+            return 0;
+        }
+        *valuep = g->value;
+    } else if (s->st_shndx == SHN_ABS) {
+        *valuep = s->st_value;
+    } else {
+        *valuep = o->addr[s->st_shndx] + s->st_value;
+    }
+
+    return 1;
+}
+
+static uint32_t get32(uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+    memcpy(p, &v, 4);
+}
+
+static void patch_u(uint8_t* p, uint32_t v) {
+    put32(p, (get32(p) & 0xfff) | (((v + 0x800) >> 12) << 12));
+}
+
+static void patch_i(uint8_t* p, uint32_t v) {
+    put32(p, (get32(p) & 0xfffff) | ((v & 0xfff) << 20));
+}
+
+static void patch_s(uint8_t* p, uint32_t v) {
+    put32(p, (get32(p) & 0x1fff07f) | ((v & 0x1f) << 7) | (((v >> 5) & 0x7f) << 25));
+}
+
+static void patch_b(uint8_t* p, uint32_t v) {
+    uint32_t imm = (((v >> 12) & 1) << 31) | (((v >> 5) & 0x3f) << 25) | (((v >> 1) & 0xf) << 8) |
+                   (((v >> 11) & 1) << 7);
+    put32(p, (get32(p) & 0x1fff07f) | imm);
+}
+
+static void patch_j(uint8_t* p, uint32_t v) {
+    uint32_t imm =
+        (((v >> 20) & 1) << 31) | (((v >> 1) & 0x3ff) << 21) | (((v >> 11) & 1) << 20) | (((v >> 12) & 0xff) << 12);
+    put32(p, (get32(p) & 0xfff) | imm);
+}
+
+// The low part of a pc-relative pair points to the auipc, whose
+// relocation holds the actual target
+static int pcrel_hi(linker_t* l, object_t* o, Elf32_Shdr* rs, uint32_t auipc, uint32_t* valuep) {
+    Elf32_Rela* r = (Elf32_Rela*)(o->bytes + rs->sh_offset);
+    int n = rs->sh_size / sizeof(Elf32_Rela);
+    uint32_t base = o->addr[rs->sh_info];
+
+    for (int i = 0; i < n; i++) {
+        if (base + r[i].r_offset == auipc && ELF32_R_TYPE(r[i].r_info) == R_RISCV_PCREL_HI20) {
+            uint32_t s;
+            if (!symbol_value(l, o, ELF32_R_SYM(r[i].r_info), &s)) {
+                return 0;
+            }
+            *valuep = s + r[i].r_addend - auipc;
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "Error: no R_RISCV_PCREL_HI20 at 0x%x in %s\n", auipc, o->path);
+    return 0;
+}
+
+static int relocate(linker_t* l, object_t* o, Elf32_Shdr* rs) {
+    machine_t m = l->m;
+    Elf32_Rela* r = (Elf32_Rela*)(o->bytes + rs->sh_offset);
+    int n = rs->sh_size / sizeof(Elf32_Rela);
+    uint32_t base = o->addr[rs->sh_info];
+
+    for (int i = 0; i < n; i++) {
+        int type = ELF32_R_TYPE(r[i].r_info);
+        if (type == R_RISCV_RELAX || type == R_RISCV_NONE) {
+            continue;
+        }
+
+        uint32_t pc = base + r[i].r_offset;
+        uint8_t* p = m->mem + (pc - m->base);
+        uint32_t s;
+        if (!symbol_value(l, o, ELF32_R_SYM(r[i].r_info), &s)) {
+            return 0;
+        }
+        uint32_t v = s + r[i].r_addend;
+
+        switch (type) {
+            case R_RISCV_32:
+                put32(p, v);
+                break;
+            case R_RISCV_BRANCH:
+                patch_b(p, v - pc);
+                break;
+            case R_RISCV_JAL:
+                patch_j(p, v - pc);
+                break;
+            case R_RISCV_CALL:
+            case R_RISCV_CALL_PLT:
+                patch_u(p, v - pc);
+                patch_i(p + 4, v - pc);
+                break;
+            case R_RISCV_HI20:
+                patch_u(p, v);
+                break;
+            case R_RISCV_LO12_I:
+                patch_i(p, v);
+                break;
+            case R_RISCV_LO12_S:
+                patch_s(p, v);
+                break;
+            case R_RISCV_PCREL_HI20:
+                patch_u(p, v - pc);
+                break;
+            case R_RISCV_PCREL_LO12_I:
+            case R_RISCV_PCREL_LO12_S:
+                if (!pcrel_hi(l, o, rs, s, &v)) {
+                    return 0;
+                }
+                if (type == R_RISCV_PCREL_LO12_I) {
+                    patch_i(p, v);
+                } else {
+                    patch_s(p, v);
+                }
+                break;
+            default:
+                fprintf(stderr, "Error: unsupported relocation type %d in %s\n", type, o->path);
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Links the ELF relocatable objects into memory and sets the
+// entry point to the symbol entry, called by a small start stub
+int machine_load(machine_t m, char** paths, int npaths, const char* entry) {
+    linker_t l = {m, NULL, npaths, NULL, 0, m->base + STUB_SIZE};
+    l.objs = (object_t*)calloc(npaths, sizeof(object_t));
+    if (!l.objs) {
+        perror("Error with calloc");
+        return 0;
+    }
+
+    int ok = 1;
+    for (int k = 0; ok && k < npaths; k++) {
+        l.objs[k].path = paths[k];
+        ok = read_file(paths[k], &l.objs[k].bytes, &l.objs[k].size) && parse_object(&l.objs[k]);
+    }
+
+    ok = ok && place_sections(&l, 1);
+    m->text_start = m->base;
+    m->text_end = l.top;
+    ok = ok && place_sections(&l, 0) && collect_globals(&l);
+
+    for (int k = 0; ok && k < npaths; k++) {
+        object_t* o = &l.objs[k];
+        for (int i = 0; ok && i < o->eh->e_shnum; i++) {
+            if (o->sh[i].sh_type == SHT_RELA && o->addr[o->sh[i].sh_info]) {
+                ok = relocate(&l, o, &o->sh[i]);
+            }
+        }
+    }
+
+    global_t* g = ok ? find_global(&l, entry) : NULL;
+    if (ok && !g) {
+        fprintf(stderr, "Error: entry point %s is not defined\n", entry);
+        ok = 0;
+    }
+
+    if (ok) {
+        uint8_t* stub = m->mem;
+        put32(stub, 0x000000ef);  // jal ra, 0
+        patch_j(stub, g->value - m->base);
+        put32(stub + 4, 0x00000893 | (SYS_EXIT << 20));  // li a7, 93
+        put32(stub + 8, 0x00000073);                     // ecall
+
+        m->entry = m->base;
+        m->brk = (l.top + 15) & ~15u;
+    }
+
+    for (int k = 0; k < npaths; k++) {
+        free(l.objs[k].bytes);
+        free(l.objs[k].addr);
+    }
+    free(l.objs);
+    free(l.globals);
+
+    return ok;
+}
@@ -0,0 +1,706 @@
+#include "machine.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Every instruction of the code segment is decoded once, before running,
+// into a dinst holding the address of its handler, its operands and its
+// static cost. The interpreter then jumps from handler to handler
+// (threaded dispatch, using the labels-as-values GNU extension) without
+// ever looking at the encoded word again. There is a dinst for every
+// halfword, since instructions of the C extension take 16 bits: those are
+// expanded to their 32-bit equivalent first, and the halfword in the
+// middle of a 32-bit instruction is illegal. Code that writes to the code
+// segment is not supported.
+
+typedef enum dop {
+    D_LUI,  // Also auipc, with the pc folded into imm
+    D_JAL,
+    D_JALR,
+    D_BEQ,
+    D_BNE,
+    D_BLT,
+    D_BGE,
+    D_BLTU,
+    D_BGEU,
+    D_LB,
+    D_LH,
+    D_LW,
+    D_LBU,
+    D_LHU,
+    D_SB,
+    D_SH,
+    D_SW,
+    D_ADDI,
+    D_SLTI,
+    D_SLTIU,
+    D_XORI,
+    D_ORI,
+    D_ANDI,
+    D_SLLI,
+    D_SRLI,
+    D_SRAI,
+    D_ADD,
+    D_SUB,
+    D_SLL,
+    D_SLT,
+    D_SLTU,
+    D_XOR,
+    D_SRL,
+    D_SRA,
+    D_OR,
+    D_AND,
+    D_NOP,  // fence, and writes to x0 without side effects
+    D_ECALL,
+    D_EBREAK,
+    D_ILLEGAL,
+    D_END,  // Past the end of the code segment
+    D_COUNT
+} dop_t;
+
+struct dinst {
+    const void* handler;
+
+    // Destination of branches and jal
+    dinst_t target;
+
+    int32_t imm;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t op;
+
+    // Cycles taken when the instruction isn't a jump
+    uint8_t cost;
+
+    // Static prediction: backward branches are taken
+    uint8_t taken;
+
+    // Halfwords the instruction takes, the distance to the next one
+    uint8_t step;
+};
+
+#define X0_SINK 32
+
+// Linux system call numbers
+#define SYS_CLOSE 57
+#define SYS_READ 63
+#define SYS_WRITE 64
+#define SYS_EXIT 93
+#define SYS_EXIT_GROUP 94
+#define SYS_BRK 214
+
+// Creates a machine with size bytes of zeroed memory at base
+machine_t machine_new(uint32_t base, uint32_t size) {
+    machine_t m = (machine_t)calloc(1, sizeof(_machine));
+    if (!m) {
+        perror("Error with calloc");
+        return NULL;
+    }
+
+    m->mem = (uint8_t*)calloc(size, 1);
+    if (!m->mem) {
+        perror("Error with calloc");
+        free(m);
+        return NULL;
+    }
+
+    m->base = base;
+    m->size = size;
+    m->pipeline = PIPELINE_DEFAULT;
+
+    return m;
+}
+
+static int32_t sext(uint32_t v, int bits) {
+    return (int32_t)(v << (32 - bits)) >> (32 - bits);
+}
+
+// Decodes the word at pc, without resolving targets
+static void decode(dinst_t d, uint32_t w, uint32_t pc) {
+    uint32_t opcode = w & 0x7f;
+    uint32_t funct3 = (w >> 12) & 7;
+    uint32_t funct7 = w >> 25;
+
+    d->rd = (w >> 7) & 0x1f;
+    d->rs1 = (w >> 15) & 0x1f;
+    d->rs2 = (w >> 20) & 0x1f;
+    d->imm = 0;
+    d->op = D_ILLEGAL;
+
+    switch (opcode) {
+        case 0x37:  // lui
+            d->op = D_LUI;
+            d->imm = (int32_t)(w & 0xfffff000);
+            break;
+        case 0x17:  // auipc
+            d->op = D_LUI;
+            d->imm = (int32_t)(pc + (w & 0xfffff000));
+            break;
+        case 0x6f:  // jal
+            d->op = D_JAL;
+            d->imm = sext(((w >> 31) << 20) | (((w >> 12) & 0xff) << 12) | (((w >> 20) & 1) << 11) |
+                              (((w >> 21) & 0x3ff) << 1),
+                          21);
+            break;
+        case 0x67:  // jalr
+            if (funct3 == 0) {
+                d->op = D_JALR;
+                d->imm = sext(w >> 20, 12);
+            }
+            break;
+        case 0x63:  // branches
+            if (funct3 != 2 && funct3 != 3) {
+                static const uint8_t ops[] = {D_BEQ, D_BNE, 0, 0, D_BLT, D_BGE, D_BLTU, D_BGEU};
+                d->op = ops[funct3];
+                d->imm = sext(((w >> 31) << 12) | (((w >> 7) & 1) << 11) | (((w >> 25) & 0x3f) << 5) |
+                                  (((w >> 8) & 0xf) << 1),
+                              13);
+            }
+            break;
+        case 0x03:  // loads
+            if (funct3 != 3 && funct3 < 6) {
+                static const uint8_t ops[] = {D_LB, D_LH, D_LW, 0, D_LBU, D_LHU};
+                d->op = ops[funct3];
+                d->imm = sext(w >> 20, 12);
+            }
+            break;
+        case 0x23:  // stores
+            if (funct3 < 3) {
+                static const uint8_t ops[] = {D_SB, D_SH, D_SW};
+                d->op = ops[funct3];
+                d->imm = sext(((w >> 25) << 5) | ((w >> 7) & 0x1f), 12);
+            }
+            break;
+        case 0x13:  // register-immediate
+            d->imm = sext(w >> 20, 12);
+            switch (funct3) {
+                case 0:
+                    d->op = D_ADDI;
+                    break;
+                case 2:
+                    d->op = D_SLTI;
+                    break;
+                case 3:
+                    d->op = D_SLTIU;
+                    break;
+                case 4:
+                    d->op = D_XORI;
+                    break;
+                case 6:
+                    d->op = D_ORI;
+                    break;
+                case 7:
+                    d->op = D_ANDI;
+                    break;
+                case 1:
+                    d->op = funct7 == 0 ? D_SLLI : D_ILLEGAL;
+                    d->imm &= 0x1f;
+                    break;
+                case 5:
+                    d->op = funct7 == 0 ? D_SRLI : funct7 == 0x20 ? D_SRAI : D_ILLEGAL;
+                    d->imm &= 0x1f;
+                    break;
+            }
+            break;
+        case 0x33:  // register-register
+            if (funct7 == 0) {
+                static const uint8_t ops[] = {D_ADD, D_SLL, D_SLT, D_SLTU, D_XOR, D_SRL, D_OR, D_AND};
+                d->op = ops[funct3];
+            } else if (funct7 == 0x20 && (funct3 == 0 || funct3 == 5)) {
+                d->op = funct3 == 0 ? D_SUB : D_SRA;
+            }
+            break;
+        case 0x0f:  // fence
+            d->op = D_NOP;
+            break;
+        case 0x73:
+            if (w == 0x00000073) {
+                d->op = D_ECALL;
+            } else if (w == 0x00100073) {
+                d->op = D_EBREAK;
+            }
+            break;
+    }
+
+    // Results written to x0 are thrown away
+    if (d->rd == 0) {
+        d->rd = X0_SINK;
+        if ((d->op >= D_ADDI && d->op <= D_AND) || d->op == D_LUI) {
+            d->op = D_NOP;
+        }
+    }
+}
+
+// ===================== C EXTENSION =====================
+
+static uint32_t enc_i(uint32_t opc, uint32_t f3, uint32_t rd, uint32_t rs1, int32_t imm) {
+    return ((uint32_t)imm & 0xfff) << 20 | rs1 << 15 | f3 << 12 | rd << 7 | opc;
+}
+
+static uint32_t enc_r(uint32_t f7, uint32_t f3, uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return f7 << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | rd << 7 | 0x33;
+}
+
+static uint32_t enc_s(uint32_t rs1, uint32_t rs2, int32_t imm) {
+    uint32_t u = (uint32_t)imm;
+    return ((u >> 5) & 0x7f) << 25 | rs2 << 20 | rs1 << 15 | 2u << 12 | (u & 0x1f) << 7 | 0x23;
+}
+
+static uint32_t enc_b(uint32_t f3, uint32_t rs1, int32_t imm) {
+    uint32_t u = (uint32_t)imm;
+    return ((u >> 12) & 1) << 31 | ((u >> 5) & 0x3f) << 25 | rs1 << 15 | f3 << 12 | ((u >> 1) & 0xf) << 8 |
+           ((u >> 11) & 1) << 7 | 0x63;
+}
+
+static uint32_t enc_j(uint32_t rd, int32_t imm) {
+    uint32_t u = (uint32_t)imm;
+    return ((u >> 20) & 1) << 31 | ((u >> 1) & 0x3ff) << 21 | ((u >> 11) & 1) << 20 | ((u >> 12) & 0xff) << 12 |
+           rd << 7 | 0x6f;
+}
+
+// Bits hi..lo of the halfword h, moved to bit at
+static uint32_t field(uint32_t h, int hi, int lo, int at) {
+    return ((h >> lo) & ((1u << (hi - lo + 1)) - 1)) << at;
+}
+
+// Returns the 32-bit instruction the 16-bit one h stands for, 0 (an
+// illegal instruction) if it isn't a valid RV32C one
+static uint32_t expand(uint32_t h) {
+    uint32_t f3 = h >> 13;
+    uint32_t rd = field(h, 11, 7, 0);
+    uint32_t rs2 = field(h, 6, 2, 0);
+
+    // The 3-bit fields name x8-x15
+    uint32_t rd_p = 8 + field(h, 4, 2, 0);
+    uint32_t rs1_p = 8 + field(h, 9, 7, 0);
+
+    int32_t imm6 = sext(field(h, 12, 12, 5) | field(h, 6, 2, 0), 6);
+    int32_t cj = sext(field(h, 12, 12, 11) | field(h, 11, 11, 4) | field(h, 10, 9, 8) | field(h, 8, 8, 10) |
+                          field(h, 7, 7, 6) | field(h, 6, 6, 7) | field(h, 5, 3, 1) | field(h, 2, 2, 5),
+                      12);
+
+    // The quadrant and funct3, as two octal digits
+    switch ((h & 3) << 3 | f3) {
+        case 000: {  // c.addi4spn
+            uint32_t imm = field(h, 12, 11, 4) | field(h, 10, 7, 6) | field(h, 6, 6, 2) | field(h, 5, 5, 3);
+            return imm ? enc_i(0x13, 0, rd_p, 2, (int32_t)imm) : 0;
+        }
+        case 002:  // c.lw
+            return enc_i(0x03, 2, rd_p, rs1_p, (int32_t)(field(h, 12, 10, 3) | field(h, 6, 6, 2) | field(h, 5, 5, 6)));
+        case 006:  // c.sw
+            return enc_s(rs1_p, rd_p, (int32_t)(field(h, 12, 10, 3) | field(h, 6, 6, 2) | field(h, 5, 5, 6)));
+        case 010:  // c.addi, c.nop
+            return enc_i(0x13, 0, rd, rd, imm6);
+        case 011:  // c.jal
+            return enc_j(1, cj);
+        case 012:  // c.li
+            return enc_i(0x13, 0, rd, 0, imm6);
+        case 013:
+            if (rd == 2) {  // c.addi16sp
+                int32_t imm = sext(field(h, 12, 12, 9) | field(h, 6, 6, 4) | field(h, 5, 5, 6) | field(h, 4, 3, 7) |
+                                       field(h, 2, 2, 5),
+                                   10);
+                return imm ? enc_i(0x13, 0, 2, 2, imm) : 0;
+            }
+            // c.lui
+            return imm6 ? ((uint32_t)imm6 << 12) | rd << 7 | 0x37 : 0;
+        case 014: {
+            uint32_t rd_s = rs1_p;
+            switch (field(h, 11, 10, 0)) {
+                case 0:  // c.srli
+                    return h & (1u << 12) ? 0 : enc_i(0x13, 5, rd_s, rd_s, imm6 & 0x1f);
+                case 1:  // c.srai
+                    return h & (1u << 12) ? 0 : enc_i(0x13, 5, rd_s, rd_s, 0x400 | (imm6 & 0x1f));
+                case 2:  // c.andi
+                    return enc_i(0x13, 7, rd_s, rd_s, imm6);
+                default: {
+                    // c.sub, c.xor, c.or, c.and
+                    static const uint8_t f3s[] = {0, 4, 6, 7};
+                    uint32_t k = field(h, 6, 5, 0);
+                    return h & (1u << 12) ? 0 : enc_r(k ? 0 : 0x20, f3s[k], rd_s, rd_s, rd_p);
+                }
+            }
+        }
+        case 015:  // c.j
+            return enc_j(0, cj);
+        case 016:  // c.beqz
+        case 017:  // c.bnez
+            return enc_b(f3 & 1, rs1_p,
+                         sext(field(h, 12, 12, 8) | field(h, 11, 10, 3) | field(h, 6, 5, 6) | field(h, 4, 3, 1) |
+                                  field(h, 2, 2, 5),
+                              9));
+        case 020:  // c.slli
+            return h & (1u << 12) ? 0 : enc_i(0x13, 1, rd, rd, (int32_t)rs2);
+        case 022:  // c.lwsp
+            return rd ? enc_i(0x03, 2, rd, 2, (int32_t)(field(h, 12, 12, 5) | field(h, 6, 4, 2) | field(h, 3, 2, 6)))
+                      : 0;
+        case 024:
+            if (!(h & (1u << 12))) {
+                // c.jr, c.mv
+                return rs2 ? enc_r(0, 0, rd, 0, rs2) : rd ? enc_i(0x67, 0, 0, rd, 0) : 0;
+            }
+            if (!rs2) {
+                // c.ebreak, c.jalr
+                return rd ? enc_i(0x67, 0, 1, rd, 0) : 0x00100073;
+            }
+            // c.add
+            return enc_r(0, 0, rd, rd, rs2);
+        case 026:  // c.swsp
+            return enc_s(2, rs2, (int32_t)(field(h, 12, 9, 2) | field(h, 8, 7, 6)));
+        default:
+            return 0;
+    }
+}
+
+// ===================== PREDECODING =====================
+
+static int is_load(int op) {
+    return op >= D_LB && op <= D_LHU;
+}
+
+static int reads_rs1(int op) {
+    return op == D_JALR || (op >= D_BEQ && op <= D_AND);
+}
+
+static int reads_rs2(int op) {
+    return (op >= D_BEQ && op <= D_BGEU) || (op >= D_SB && op <= D_SW) || (op >= D_ADD && op <= D_AND);
+}
+
+// Decodes the whole code segment, one slot per halfword. The extra last
+// slot catches both falling off the end and jumps outside of the code.
+static int predecode(machine_t m) {
+    uint32_t n = (m->text_end - m->text_start) / 2;
+    m->code = (dinst_t)calloc(n + 1, sizeof(_dinst));
+    if (!m->code) {
+        perror("Error with calloc");
+        return 0;
+    }
+
+    const uint8_t* text = m->mem + (m->text_start - m->base);
+    for (uint32_t i = 0; i < n;) {
+        dinst_t d = &m->code[i];
+        uint16_t h;
+        memcpy(&h, text + 2 * i, 2);
+
+        if ((h & 3) != 3) {
+            decode(d, expand(h), m->text_start + 2 * i);
+            d->step = 1;
+        } else if (i + 1 < n) {
+            uint32_t w;
+            memcpy(&w, text + 2 * i, 4);
+            decode(d, w, m->text_start + 2 * i);
+            d->step = 2;
+            m->code[i + 1].op = D_ILLEGAL;
+            m->code[i + 1].step = 1;
+        } else {
+            d->op = D_ILLEGAL;
+            d->step = 1;
+        }
+        i += d->step;
+    }
+    m->code[n].op = D_END;
+
+    for (uint32_t i = 0; i < n; i++) {
+        dinst_t d = &m->code[i];
+        d->cost = 1;
+        d->target = &m->code[n];
+
+        if (d->op == D_JAL || (d->op >= D_BEQ && d->op <= D_BGEU)) {
+            int64_t t = (int64_t)i + d->imm / 2;
+            if (d->imm % 2 == 0 && t >= 0 && t < n) {
+                d->target = &m->code[t];
+            }
+            d->taken = d->imm < 0;
+        }
+
+        // A load can't forward its result to the instruction that follows
+        dinst_t next = &m->code[i + d->step];
+        if (is_load(d->op) && d->rd != X0_SINK && i + d->step < n &&
+            ((reads_rs1(next->op) && next->rs1 == d->rd) || (reads_rs2(next->op) && next->rs2 == d->rd))) {
+            d->cost += m->pipeline.load_use;
+        }
+    }
+
+    return 1;
+}
+
+static int check_range(machine_t m, uint32_t addr, uint32_t len) {
+    return addr - m->base <= m->size && len <= m->size - (addr - m->base);
+}
+
+// Handles the system call in a7. Returns 1 if the program exited.
+static int do_syscall(machine_t m) {
+    uint32_t* x = m->regs;
+    uint32_t a0 = x[10], a1 = x[11], a2 = x[12];
+    int32_t ret = -ENOSYS;
+
+    switch (x[17]) {
+        case SYS_EXIT:
+        case SYS_EXIT_GROUP:
+            m->exit_code = (int)a0;
+            return 1;
+        case SYS_WRITE:
+        case SYS_READ:
+            if (!check_range(m, a1, a2)) {
+                ret = -EFAULT;
+                break;
+            }
+            ret = x[17] == SYS_WRITE ? write((int)a0, m->mem + (a1 - m->base), a2)
+                                     : read((int)a0, m->mem + (a1 - m->base), a2);
+            if (ret < 0) {
+                ret = -errno;
+            }
+            break;
+        case SYS_CLOSE:
+            // Don't let the program close the simulator's own files
+            ret = 0;
+            break;
+        case SYS_BRK:
+            // The heap grows from the end of the data up to 64 KiB below the stack pointer
+            if (a0 >= m->brk && check_range(m, a0, 0) && a0 + 0x10000 < x[2]) {
+                m->brk = a0;
+            }
+            ret = (int32_t)m->brk;
+            break;
+    }
+
+    x[10] = (uint32_t)ret;
+    return 0;
+}
+
+// Runs from the entry point until the program exits. Returns 1 on a
+// clean exit, with the status in exit_code, 0 on a fault.
+int machine_run(machine_t m) {
+    static const void* const handlers[D_COUNT] = {
+        [D_LUI] = &&L_LUI,     [D_JAL] = &&L_JAL,       [D_JALR] = &&L_JALR,   [D_BEQ] = &&L_BEQ,
+        [D_BNE] = &&L_BNE,     [D_BLT] = &&L_BLT,       [D_BGE] = &&L_BGE,     [D_BLTU] = &&L_BLTU,
+        [D_BGEU] = &&L_BGEU,   [D_LB] = &&L_LB,         [D_LH] = &&L_LH,       [D_LW] = &&L_LW,
+        [D_LBU] = &&L_LBU,     [D_LHU] = &&L_LHU,       [D_SB] = &&L_SB,       [D_SH] = &&L_SH,
+        [D_SW] = &&L_SW,       [D_ADDI] = &&L_ADDI,     [D_SLTI] = &&L_SLTI,   [D_SLTIU] = &&L_SLTIU,
+        [D_XORI] = &&L_XORI,   [D_ORI] = &&L_ORI,       [D_ANDI] = &&L_ANDI,   [D_SLLI] = &&L_SLLI,
+        [D_SRLI] = &&L_SRLI,   [D_SRAI] = &&L_SRAI,     [D_ADD] = &&L_ADD,     [D_SUB] = &&L_SUB,
+        [D_SLL] = &&L_SLL,     [D_SLT] = &&L_SLT,       [D_SLTU] = &&L_SLTU,   [D_XOR] = &&L_XOR,
+        [D_SRL] = &&L_SRL,     [D_SRA] = &&L_SRA,       [D_OR] = &&L_OR,       [D_AND] = &&L_AND,
+        [D_NOP] = &&L_NOP,     [D_ECALL] = &&L_ECALL,   [D_EBREAK] = &&L_EBREAK, [D_ILLEGAL] = &&L_ILLEGAL,
+        [D_END] = &&L_END,
+    };
+
+    if (!m->code && !predecode(m)) {
+        return 0;
+    }
+
+    uint32_t n = (m->text_end - m->text_start) / 2;
+    for (uint32_t i = 0; i <= n; i++) {
+        m->code[i].handler = handlers[m->code[i].op];
+    }
+
+    uint32_t* x = m->regs;
+    uint8_t* mem = m->mem;
+    uint32_t base = m->base;
+    uint32_t size = m->size;
+    dinst_t code = m->code;
+    pipeline_t pipe = m->pipeline;
+    counters_t c = m->counters;
+    int ok = 0;
+
+    x[2] = (m->base + m->size) & ~15u;
+    dinst_t d = &code[(m->entry - m->text_start) / 2];
+
+#define RD x[d->rd]
+#define RS1 x[d->rs1]
+#define RS2 x[d->rs2]
+#define PC (m->text_start + 2 * (uint32_t)(d - code))
+
+#define DISPATCH()              \
+    do {                        \
+        c.instructions++;       \
+        c.cycles += d->cost;    \
+        goto* d->handler;       \
+    } while (0)
+
+#define NEXT()       \
+    do {             \
+        d += d->step; \
+        DISPATCH();  \
+    } while (0)
+
+#define OP(label, expr) \
+    label:              \
+    RD = (expr);        \
+    NEXT()
+
+#define BRANCH(label, cond)                       \
+    label:                                        \
+    c.branches++;                                 \
+    if (cond) {                                   \
+        c.taken++;                                \
+        if (d->taken) {                           \
+            c.cycles += pipe.jump;                \
+        } else {                                  \
+            c.mispredicted++;                     \
+            c.cycles += pipe.mispredict;          \
+        }                                         \
+        d = d->target;                            \
+    } else {                                      \
+        if (d->taken) {                           \
+            c.mispredicted++;                     \
+            c.cycles += pipe.mispredict;          \
+        }                                         \
+        d += d->step;                             \
+    }                                             \
+    DISPATCH()
+
+// Offset of the accessed bytes from the start of memory
+#define ADDR(w)                           \
+    uint32_t a = RS1 + d->imm - base;     \
+    if (a > size - (w)) {                 \
+        goto fault_mem;                   \
+    }
+
+#define LOAD(label, type, w)              \
+    label : {                             \
+        ADDR(w);                          \
+        type v;                           \
+        memcpy(&v, mem + a, w);           \
+        c.loads++;                        \
+        RD = (uint32_t)(int32_t)v;        \
+        NEXT();                           \
+    }
+
+#define STORE(label, type, w)             \
+    label : {                             \
+        ADDR(w);                          \
+        type v = (type)RS2;               \
+        memcpy(mem + a, &v, w);           \
+        c.stores++;                       \
+        NEXT();                           \
+    }
+
+    DISPATCH();
+
+    OP(L_LUI, (uint32_t)d->imm);
+
+L_JAL:
+    RD = PC + 2 * d->step;
+    c.jumps++;
+    c.cycles += pipe.jump;
+    d = d->target;
+    DISPATCH();
+
+L_JALR : {
+    uint32_t t = (RS1 + d->imm) & ~1u;
+    RD = PC + 2 * d->step;
+    c.jumps++;
+    c.cycles += pipe.indirect;
+    if (t - m->text_start >= 2 * n) {
+        d = &code[n];
+        goto fault_pc;
+    }
+    d = &code[(t - m->text_start) / 2];
+    DISPATCH();
+}
+
+    BRANCH(L_BEQ, RS1 == RS2);
+    BRANCH(L_BNE, RS1 != RS2);
+    BRANCH(L_BLT, (int32_t)RS1 < (int32_t)RS2);
+    BRANCH(L_BGE, (int32_t)RS1 >= (int32_t)RS2);
+    BRANCH(L_BLTU, RS1 < RS2);
+    BRANCH(L_BGEU, RS1 >= RS2);
+
+    LOAD(L_LB, int8_t, 1);
+    LOAD(L_LH, int16_t, 2);
+    LOAD(L_LW, int32_t, 4);
+    LOAD(L_LBU, uint8_t, 1);
+    LOAD(L_LHU, uint16_t, 2);
+    STORE(L_SB, uint8_t, 1);
+    STORE(L_SH, uint16_t, 2);
+    STORE(L_SW, uint32_t, 4);
+
+    OP(L_ADDI, RS1 + d->imm);
+    OP(L_SLTI, (int32_t)RS1 < d->imm);
+    OP(L_SLTIU, RS1 < (uint32_t)d->imm);
+    OP(L_XORI, RS1 ^ d->imm);
+    OP(L_ORI, RS1 | d->imm);
+    OP(L_ANDI, RS1 & d->imm);
+    OP(L_SLLI, RS1 << d->imm);
+    OP(L_SRLI, RS1 >> d->imm);
+    OP(L_SRAI, (uint32_t)((int32_t)RS1 >> d->imm));
+    OP(L_ADD, RS1 + RS2);
+    OP(L_SUB, RS1 - RS2);
+    OP(L_SLL, RS1 << (RS2 & 31));
+    OP(L_SLT, (int32_t)RS1 < (int32_t)RS2);
+    OP(L_SLTU, RS1 < RS2);
+    OP(L_XOR, RS1 ^ RS2);
+    OP(L_SRL, RS1 >> (RS2 & 31));
+    OP(L_SRA, (uint32_t)((int32_t)RS1 >> (RS2 & 31)));
+    OP(L_OR, RS1 | RS2);
+    OP(L_AND, RS1 & RS2);
+
+L_NOP:
+    NEXT();
+
+L_ECALL:
+    c.ecalls++;
+    if (do_syscall(m)) {
+        ok = 1;
+        goto out;
+    }
+    NEXT();
+
+L_EBREAK:
+    fprintf(stderr, "Error: ebreak at 0x%x\n", PC);
+    goto out;
+
+L_ILLEGAL : {
+    uint16_t h;
+    memcpy(&h, m->mem + (PC - m->base), 2);
+    if ((h & 3) != 3) {
+        fprintf(stderr, "Error: illegal instruction 0x%04x at 0x%x\n", h, PC);
+        goto out;
+    }
+    uint32_t w;
+    memcpy(&w, m->mem + (PC - m->base), 4);
+    fprintf(stderr, "Error: illegal instruction 0x%08x at 0x%x\n", w, PC);
+    goto out;
+}
+
+L_END:
+fault_pc:
+    fprintf(stderr, "Error: execution left the code segment\n");
+    goto out;
+
+fault_mem:
+    fprintf(stderr, "Error: memory access out of bounds at 0x%x (address 0x%x)\n", PC, RS1 + d->imm);
+    goto out;
+
+#undef RD
+#undef RS1
+#undef RS2
+#undef DISPATCH
+#undef NEXT
+#undef OP
+#undef BRANCH
+#undef ADDR
+#undef LOAD
+#undef STORE
+
+out:
+    m->pc = PC;
+    m->counters = c;
+    return ok;
+#undef PC
+}
+
+void machine_free(machine_t* mp) {
+    if (!mp || !*mp) {
+        return;
+    }
+
+    free((*mp)->mem);
+    free((*mp)->code);
+    free(*mp);
+    *mp = NULL;
+}
@@ -0,0 +1,84 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <stdint.h>
+
+// The state of the simulated RV32IC hart: a flat little-endian memory,
+// the registers and the counters collected while running.
+
+// Default memory size in bytes and load address
+#define MACHINE_MEM_SIZE (16u << 20)
+#define MACHINE_BASE 0x10000u
+
+// Costs, in cycles, of a single-issue in-order pipeline. Every
+// instruction retires in one cycle, the penalties are added on top.
+typedef struct pipeline {
+    // A load followed by an instruction that reads its result
+    int load_use;
+
+    // A conditional branch that goes against the static prediction
+    int mispredict;
+
+    // A taken jump or a correctly predicted taken branch (the
+    // target is known in decode, so the fetched slot is lost)
+    int jump;
+
+    // An indirect jump, whose target is only known in execute
+    int indirect;
+} pipeline_t;
+
+// The classic five stage pipeline: branches are resolved in execute
+#define PIPELINE_DEFAULT ((pipeline_t){1, 2, 1, 2})
+
+typedef struct counters {
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t loads;
+    uint64_t stores;
+    uint64_t branches;
+    uint64_t taken;
+    uint64_t mispredicted;
+    uint64_t jumps;
+    uint64_t ecalls;
+} counters_t;
+
+typedef struct dinst _dinst, *dinst_t;
+typedef struct machine _machine, *machine_t;
+
+struct machine {
+    uint8_t* mem;
+    uint32_t base;
+    uint32_t size;
+
+    // Loaded image: [text_start, text_end) is executable and
+    // pre-decoded, data follows and the heap starts at brk
+    uint32_t text_start;
+    uint32_t text_end;
+    uint32_t brk;
+    uint32_t entry;
+
+    // x0..x31, x32 is where writes to x0 go
+    uint32_t regs[33];
+    uint32_t pc;
+
+    dinst_t code;
+    pipeline_t pipeline;
+    counters_t counters;
+
+    int exit_code;
+};
+
+// Creates a machine with size bytes of zeroed memory at base
+machine_t machine_new(uint32_t base, uint32_t size);
+
+// Links the ELF relocatable objects into memory and sets the
+// entry point to the symbol entry, called by a small start stub
+int machine_load(machine_t m, char** paths, int npaths, const char* entry);
+
+// Runs from the entry point until the program exits. Returns 1 on a
+// clean exit, with the status in exit_code, 0 on a fault.
+int machine_run(machine_t m);
+
+void machine_free(machine_t* mp);
+
+#endif
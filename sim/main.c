@@ -0,0 +1,148 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "machine.h"
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s [options] <object>...\n"
+            "Links the RV32I(C) relocatable objects, runs them from the entry point and reports\n"
+            "the instruction and cycle counts. The exit status is the program's one.\n"
+            "\n"
+            "Options:\n"
+            "  --entry=SYM        function called by the start stub (default main)\n"
+            "  --mem=MIB          memory size in MiB (default %u)\n"
+            "  --load-use=N       cycles lost when a load result is used right away (default %d)\n"
+            "  --mispredict=N     cycles lost on a mispredicted branch (default %d)\n"
+            "  --jump=N           cycles lost on a taken jump or branch (default %d)\n"
+            "  --indirect=N       cycles lost on an indirect jump (default %d)\n"
+            "  --quiet            don't print the report\n",
+            name, MACHINE_MEM_SIZE >> 20, PIPELINE_DEFAULT.load_use, PIPELINE_DEFAULT.mispredict,
+            PIPELINE_DEFAULT.jump, PIPELINE_DEFAULT.indirect);
+}
+
+static int parse_count(const char* s, int* out) {
+    char* end;
+    long v = strtol(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || v < 0 || v > 255) {
+        return 0;
+    }
+    *out = (int)v;
+    return 1;
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void report(machine_t m, double seconds) {
+    counters_t* c = &m->counters;
+    fprintf(stderr,
+            "--- rvsim ---\n"
+            "exit code        %d\n"
+            "instructions     %llu\n"
+            "cycles           %llu (CPI %.3f)\n"
+            "loads            %llu\n"
+            "stores           %llu\n"
+            "branches         %llu (%.1f%% taken)\n"
+            "mispredicted     %llu (%.1f%%)\n"
+            "jumps            %llu\n"
+            "ecalls           %llu\n"
+            "host time        %.3f s (%.1f MIPS)\n",
+            m->exit_code, (unsigned long long)c->instructions, (unsigned long long)c->cycles,
+            c->instructions ? (double)c->cycles / c->instructions : 0.0, (unsigned long long)c->loads,
+            (unsigned long long)c->stores, (unsigned long long)c->branches, percent(c->taken, c->branches),
+            (unsigned long long)c->mispredicted, percent(c->mispredicted, c->branches), (unsigned long long)c->jumps,
+            (unsigned long long)c->ecalls, seconds, seconds > 0 ? c->instructions / seconds / 1e6 : 0.0);
+}
+
+int main(int argc, char** args) {
+    enum { OPT_ENTRY = 256, OPT_MEM, OPT_LOAD_USE, OPT_MISPREDICT, OPT_JUMP, OPT_INDIRECT, OPT_QUIET };
+    static const struct option options[] = {
+        {"entry", required_argument, NULL, OPT_ENTRY},
+        {"mem", required_argument, NULL, OPT_MEM},
+        {"load-use", required_argument, NULL, OPT_LOAD_USE},
+        {"mispredict", required_argument, NULL, OPT_MISPREDICT},
+        {"jump", required_argument, NULL, OPT_JUMP},
+        {"indirect", required_argument, NULL, OPT_INDIRECT},
+        {"quiet", no_argument, NULL, OPT_QUIET},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    const char* entry = "main";
+    int mem_mib = MACHINE_MEM_SIZE >> 20;
+    pipeline_t pipeline = PIPELINE_DEFAULT;
+    int quiet = 0;
+
+    int opt;
+    while ((opt = getopt_long(argc, args, "", options, NULL)) != -1) {
+        int ok = 1;
+        switch (opt) {
+            case OPT_ENTRY:
+                entry = optarg;
+                break;
+            case OPT_MEM:
+                ok = parse_count(optarg, &mem_mib) && mem_mib > 0;
+                break;
+            case OPT_LOAD_USE:
+                ok = parse_count(optarg, &pipeline.load_use);
+                break;
+            case OPT_MISPREDICT:
+                ok = parse_count(optarg, &pipeline.mispredict);
+                break;
+            case OPT_JUMP:
+                ok = parse_count(optarg, &pipeline.jump);
+                break;
+            case OPT_INDIRECT:
+                ok = parse_count(optarg, &pipeline.indirect);
+                break;
+            case OPT_QUIET:
+                quiet = 1;
+                break;
+            case 'h':
+                usage(args[0]);
+                return 0;
+            default:
+                ok = 0;
+                break;
+        }
+
+        if (!ok) {
+            usage(args[0]);
+            return 2;
+        }
+    }
+
+    if (optind == argc) {
+        usage(args[0]);
+        return 2;
+    }
+
+    machine_t m = machine_new(MACHINE_BASE, (uint32_t)mem_mib << 20);
+    if (!m) {
+        return 2;
+    }
+    m->pipeline = pipeline;
+
+    if (!machine_load(m, args + optind, argc - optind, entry)) {
+        machine_free(&m);
+        return 2;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ok = machine_run(m);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (!quiet) {
+        fflush(stdout);
+        report(m, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    }
+
+    int status = ok ? m->exit_code & 0xff : 2;
+    machine_free(&m);
+
+    return status;
+}
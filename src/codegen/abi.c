@@ -0,0 +1,183 @@
+#include "abi.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Where each word of a list of values goes: an argument register, or
+// an offset in the stack arguments
+typedef struct abi_loc {
+    int reg;
+    int offset;
+} abi_loc_t;
+
+static int emit(mfunc_t f, inst_t i) {
+    return mfunc_append(f, i);
+}
+
+static int move(mfunc_t f, int dst, int src) {
+    return emit(f, inst_new_i(OP_ADDI, dst, src, R_NONE, 0));
+}
+
+// Assigns a location to every word of the values, 2 per value (the second
+// one unused for words), and returns the bytes passed on the stack
+static int layout(const int* wide, int n, abi_loc_t* locs) {
+    int next = 0, stack = 0;
+    for (int k = 0; k < n; k++) {
+        int words = wide && wide[k] ? 2 : 1;
+        for (int w = 0; w < 2; w++) {
+            locs[2 * k + w].reg = R_NONE;
+            locs[2 * k + w].offset = -1;
+        }
+
+        // A pair that only has a7 left gets its high word on the stack,
+        // a pair entirely on the stack is aligned
+        if (words == 2 && next >= ABI_ARG_REGS) {
+            stack = (stack + 7) & -8;
+        }
+        for (int w = 0; w < words; w++) {
+            if (next < ABI_ARG_REGS) {
+                locs[2 * k + w].reg = R_A0 + next++;
+            } else {
+                locs[2 * k + w].offset = stack;
+                stack += 4;
+            }
+        }
+    }
+    return stack;
+}
+
+static int word_of(const abi_value_t* v, int w) {
+    return w ? v->hi : v->lo;
+}
+
+// Stores the value of r in the outgoing (or loads it from the incoming)
+// stack arguments at offset
+static int stack_arg(mfunc_t f, opcode_t op, int r, int offset) {
+    inst_t i = op == OP_SW ? inst_new_i(OP_SW, R_NONE, R_SP, r, offset) : inst_new_i(OP_LW, r, R_SP, R_NONE, offset);
+    if (!i) {
+        return 0;
+    }
+    i->area = op == OP_SW ? FRAME_OUTGOING : FRAME_INCOMING;
+    return emit(f, i);
+}
+
+// Appends a call to sym with the arguments. The result, if ret isn't
+// NULL, is copied into fresh virtual registers (a pair if ret_wide is set).
+int abi_call(mfunc_t f, const char* sym, const abi_value_t* args, int nargs, abi_value_t* ret, int ret_wide) {
+    if (!f || (nargs && !args)) {
+        return 0;
+    }
+
+    abi_loc_t* locs = (abi_loc_t*)malloc((2 * nargs + 1) * sizeof(abi_loc_t));
+    int* words = (int*)malloc((3 * nargs + 1) * sizeof(int));
+    if (!locs || !words) {
+        perror("Error with malloc");
+        free(locs);
+        free(words);
+        return 0;
+    }
+
+    // The register of each word, then whether each argument is wide
+    int* wide = words + 2 * nargs;
+    for (int k = 0; k < nargs; k++) {
+        wide[k] = args[k].hi != R_NONE;
+    }
+    int stack = layout(wide, nargs, locs);
+    if (stack > f->out_size) {
+        f->out_size = stack;
+    }
+
+    // An argument already in an argument register could be overwritten by
+    // the setup of another, it's copied out of the way first. Each value
+    // is then moved to its register last, so the allocator can compute it
+    // there directly.
+    int ok = 1;
+    for (int k = 0; ok && k < 2 * nargs; k++) {
+        int r = locs[k].reg != R_NONE || locs[k].offset >= 0 ? word_of(&args[k / 2], k % 2) : R_NONE;
+        if (r >= R_A0 && r <= R_A7) {
+            int t = mfunc_new_vreg(f);
+            ok = move(f, t, r);
+            r = t;
+        }
+        words[k] = r;
+    }
+    for (int k = 0; ok && k < 2 * nargs; k++) {
+        if (locs[k].offset >= 0) {
+            ok = stack_arg(f, OP_SW, words[k], locs[k].offset);
+        }
+    }
+    for (int k = 0; ok && k < 2 * nargs; k++) {
+        if (locs[k].reg != R_NONE) {
+            ok = move(f, locs[k].reg, words[k]);
+        }
+    }
+    free(locs);
+    free(words);
+
+    if (!ok || !emit(f, inst_new_sym(OP_CALL, R_RA, sym))) {
+        return 0;
+    }
+    if (!ret) {
+        return 1;
+    }
+
+    ret->lo = mfunc_new_vreg(f);
+    ret->hi = ret_wide ? mfunc_new_vreg(f) : R_NONE;
+    return move(f, ret->lo, R_A0) && (!ret_wide || move(f, ret->hi, R_A1));
+}
+
+// Appends the copies of the n parameters of f into fresh virtual
+// registers stored in params. wide (optional) tells which are 64-bit.
+int abi_params(mfunc_t f, const int* wide, int n, abi_value_t* params) {
+    if (!f || (n && !params)) {
+        return 0;
+    }
+
+    abi_loc_t* locs = (abi_loc_t*)malloc((2 * n + 1) * sizeof(abi_loc_t));
+    if (!locs) {
+        perror("Error with malloc");
+        return 0;
+    }
+    int stack = layout(wide, n, locs);
+    if (stack > f->in_size) {
+        f->in_size = stack;
+    }
+
+    int ok = 1;
+    for (int k = 0; ok && k < n; k++) {
+        params[k].lo = mfunc_new_vreg(f);
+        params[k].hi = wide && wide[k] ? mfunc_new_vreg(f) : R_NONE;
+
+        for (int w = 0; ok && w < (params[k].hi != R_NONE ? 2 : 1); w++) {
+            const abi_loc_t* l = &locs[2 * k + w];
+            int dst = word_of(&params[k], w);
+            ok = l->reg != R_NONE ? move(f, dst, l->reg) : stack_arg(f, OP_LW, dst, l->offset);
+        }
+    }
+
+    free(locs);
+    return ok;
+}
+
+// Appends the return of v (NULL for none) to the caller
+int abi_return(mfunc_t f, const abi_value_t* v) {
+    if (!f) {
+        return 0;
+    }
+
+    if (v) {
+        // Same hazard as the arguments: the high word can't be read
+        // from a0 once the low one was moved there
+        int lo = v->lo, hi = v->hi;
+        if (hi == R_A0) {
+            hi = mfunc_new_vreg(f);
+            if (!move(f, hi, R_A0)) {
+                return 0;
+            }
+        }
+        if ((lo != R_A0 && !move(f, R_A0, lo)) || (hi != R_NONE && hi != R_A1 && !move(f, R_A1, hi))) {
+            return 0;
+        }
+    }
+
+    return emit(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+}
@@ -0,0 +1,34 @@
+#ifndef ABI_H
+#define ABI_H
+
+#include "mfunc.h"
+
+// The integer calling convention of RV32 (ILP32): arguments go in a0-a7,
+// a 64-bit value in two consecutive registers (low word first), and
+// what doesn't fit is passed on the stack from 0(sp) upward, 64-bit
+// values aligned on 8 bytes. Results come back in a0, or a0/a1.
+
+#define ABI_ARG_REGS 8
+
+// A value passed to or returned from a function: a word in lo, or a
+// 64-bit value split in two registers (hi is R_NONE for a word)
+typedef struct abi_value {
+    int lo;
+    int hi;
+} abi_value_t;
+
+#define ABI_WORD(r) ((abi_value_t){(r), R_NONE})
+#define ABI_PAIR(lo, hi) ((abi_value_t){(lo), (hi)})
+
+// Appends a call to sym with the arguments. The result, if ret isn't
+// NULL, is copied into fresh virtual registers (a pair if ret_wide is set).
+int abi_call(mfunc_t f, const char* sym, const abi_value_t* args, int nargs, abi_value_t* ret, int ret_wide);
+
+// Appends the copies of the n parameters of f into fresh virtual
+// registers stored in params. wide (optional) tells which are 64-bit.
+int abi_params(mfunc_t f, const int* wide, int n, abi_value_t* params);
+
+// Appends the return of v (NULL for none) to the caller
+int abi_return(mfunc_t f, const abi_value_t* v);
+
+#endif
@@ -0,0 +1,888 @@
+#include "arith.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Upper bound on the number of digits of a 33 bit
+// number in non-adjacent form
+#define NAF_MAX 34
+
+// ===================== HELPERS =====================
+
+static int emit(mfunc_t f, inst_t i) {
+    if (!i) {
+        return 0;
+    }
+
+    return mfunc_append(f, i);
+}
+
+static int emit_r(mfunc_t f, opcode_t op, int rd, int rs1, int rs2) {
+    return emit(f, inst_new_r(op, rd, rs1, rs2));
+}
+
+static int emit_i(mfunc_t f, opcode_t op, int rd, int rs1, int32_t imm) {
+    return emit(f, inst_new_i(op, rd, rs1, R_NONE, imm));
+}
+
+// Emits op into a fresh virtual register and returns it
+static int emit_r_tmp(mfunc_t f, opcode_t op, int rs1, int rs2) {
+    int t = mfunc_new_vreg(f);
+    return emit_r(f, op, t, rs1, rs2) ? t : R_NONE;
+}
+
+static int emit_i_tmp(mfunc_t f, opcode_t op, int rs1, int32_t imm) {
+    int t = mfunc_new_vreg(f);
+    return emit_i(f, op, t, rs1, imm) ? t : R_NONE;
+}
+
+// Makes the last emitted instruction write its result into rd,
+// or emits a move if nothing was emitted since mark.
+static int finish(mfunc_t f, inst_t mark, int rd, int result) {
+    if (f->tail == mark || f->tail->rd != result) {
+        return emit_i(f, OP_ADDI, rd, result, 0);
+    }
+
+    f->tail->rd = rd;
+    return 1;
+}
+
+// Returns k if x == 2^k, -1 otherwise
+static int log2_exact(uint32_t x) {
+    if (!x || (x & (x - 1))) {
+        return -1;
+    }
+
+    int k = 0;
+    while (x > 1) {
+        x >>= 1;
+        k++;
+    }
+    return k;
+}
+
+// Recodes x in non-adjacent form, so that x is the sum
+// of digits[i] * 2^pos[i], with digits[i] either 1 or -1.
+// Returns the number of non-zero digits.
+static int naf(int64_t x, int pos[], int digits[]) {
+    int n = 0;
+    for (int p = 0; x != 0 && n < NAF_MAX; p++) {
+        if (x & 1) {
+            // 1 if x = 1 (mod 4), -1 if x = 3 (mod 4)
+            int d = 2 - (int)(x & 3);
+            pos[n] = p;
+            digits[n] = d;
+            n++;
+            x -= d;
+        }
+        x /= 2;
+    }
+    return n;
+}
+
+// Moves the splice of instructions emitted in src to the end of dst
+static void splice(mfunc_t dst, mfunc_t src) {
+    while (src->head) {
+        inst_t i = src->head;
+        mfunc_unlink(src, i);
+        mfunc_append(dst, i);
+    }
+
+    dst->nvregs = src->nvregs;
+    dst->nlabels = src->nlabels;
+}
+
+// ===================== MAGIC NUMBERS =====================
+
+// Computes the magic number for a signed division by d (|d| >= 2)
+// (Hacker's Delight, 10-1)
+magic_t arith_magic_signed(int32_t d) {
+    const uint32_t two31 = 0x80000000u;
+    magic_t mag = {0, 0, 0};
+
+    uint32_t ad = d < 0 ? -(uint32_t)d : (uint32_t)d;
+    uint32_t t = two31 + ((uint32_t)d >> 31);
+    uint32_t anc = t - 1 - t % ad;
+    int p = 31;
+    uint32_t q1 = two31 / anc;
+    uint32_t r1 = two31 - q1 * anc;
+    uint32_t q2 = two31 / ad;
+    uint32_t r2 = two31 - q2 * ad;
+    uint32_t delta;
+
+    do {
+        p++;
+        q1 = 2 * q1;
+        r1 = 2 * r1;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+
+        q2 = 2 * q2;
+        r2 = 2 * r2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    mag.m = (int32_t)(q2 + 1);
+    if (d < 0) {
+        mag.m = (int32_t)(-(q2 + 1));
+    }
+    mag.s = p - 32;
+
+    return mag;
+}
+
+// Computes the magic number for an unsigned division by d (d >= 1)
+// (Hacker's Delight, 10-2)
+magic_t arith_magic_unsigned(uint32_t d) {
+    magic_t mag = {0, 0, 0};
+
+    uint32_t nc = -1 - (-d) % d;
+    int p = 31;
+    uint32_t q1 = 0x80000000u / nc;
+    uint32_t r1 = 0x80000000u - q1 * nc;
+    uint32_t q2 = 0x7FFFFFFFu / d;
+    uint32_t r2 = 0x7FFFFFFFu - q2 * d;
+    uint32_t delta;
+
+    do {
+        p++;
+        if (r1 >= nc - r1) {
+            q1 = 2 * q1 + 1;
+            r1 = 2 * r1 - nc;
+        } else {
+            q1 = 2 * q1;
+            r1 = 2 * r1;
+        }
+
+        if (r2 + 1 >= d - r2) {
+            if (q2 >= 0x7FFFFFFFu) {
+                mag.add = 1;
+            }
+            q2 = 2 * q2 + 1;
+            r2 = 2 * r2 + 1 - d;
+        } else {
+            if (q2 >= 0x80000000u) {
+                mag.add = 1;
+            }
+            q2 = 2 * q2;
+            r2 = 2 * r2 + 1;
+        }
+
+        delta = d - 1 - r2;
+    } while (p < 64 && (q1 < delta || (q1 == delta && r1 == 0)));
+
+    mag.m = (int32_t)(q2 + 1);
+    mag.s = p - 32;
+
+    return mag;
+}
+
+// ===================== INLINE EXPANSIONS =====================
+
+// Emits rd = rs * c as a chain of shifts and additions,
+// following the non-adjacent form of c (Horner's scheme).
+static int emit_mul(mfunc_t f, int rd, int rs, int32_t c) {
+    if (c == 0) {
+        return emit_i(f, OP_ADDI, rd, R_ZERO, 0);
+    }
+
+    int k = log2_exact((uint32_t)c);
+    if (k == 0) {
+        return emit_i(f, OP_ADDI, rd, rs, 0);
+    }
+
+    // Also covers INT32_MIN, since x * -2^31 == x << 31
+    if (k > 0) {
+        return emit_i(f, OP_SLLI, rd, rs, k);
+    }
+
+    int neg = c < 0;
+    int64_t x = neg ? -(int64_t)c : (int64_t)c;
+
+    int pos[NAF_MAX], digits[NAF_MAX];
+    int n = naf(x, pos, digits);
+
+    // The most significant digit of a positive number is always 1
+    inst_t mark = f->tail;
+    int acc = rs;
+    for (int j = n - 2; j >= 0; j--) {
+        int t = emit_i_tmp(f, OP_SLLI, acc, pos[j + 1] - pos[j]);
+        acc = emit_r_tmp(f, digits[j] > 0 ? OP_ADD : OP_SUB, t, rs);
+        if (t == R_NONE || acc == R_NONE) {
+            return 0;
+        }
+    }
+
+    if (pos[0] > 0) {
+        acc = emit_i_tmp(f, OP_SLLI, acc, pos[0]);
+    }
+
+    if (neg) {
+        acc = emit_r_tmp(f, OP_SUB, R_ZERO, acc);
+    }
+
+    return acc != R_NONE && finish(f, mark, rd, acc);
+}
+
+// Emits the high 32 bits of the 64 bit product n * m and returns
+// the register that holds them. The partial products follow the
+// non-adjacent form of m and are accumulated in a (hi, lo) pair.
+static int emit_mulh(mfunc_t f, int n, int64_t m, int is_signed) {
+    int pos[NAF_MAX], digits[NAF_MAX];
+    int ndigits = naf(m, pos, digits);
+
+    int lo = R_NONE, hi = R_NONE;
+    for (int j = 0; j < ndigits; j++) {
+        int i = pos[j];
+
+        // (n << i) as a 64 bit value
+        int tlo, thi;
+        if (i == 0) {
+            tlo = n;
+            thi = is_signed ? emit_i_tmp(f, OP_SRAI, n, 31) : R_ZERO;
+        } else if (i < 32) {
+            tlo = emit_i_tmp(f, OP_SLLI, n, i);
+            thi = emit_i_tmp(f, is_signed ? OP_SRAI : OP_SRLI, n, 32 - i);
+        } else {
+            tlo = R_ZERO;
+            thi = n;
+        }
+
+        if (lo == R_NONE) {
+            if (digits[j] > 0) {
+                lo = tlo;
+                hi = thi;
+            } else {
+                // 64 bit negation
+                int borrow = emit_r_tmp(f, OP_SLTU, R_ZERO, tlo);
+                lo = emit_r_tmp(f, OP_SUB, R_ZERO, tlo);
+                hi = emit_r_tmp(f, OP_SUB, R_ZERO, thi);
+                hi = emit_r_tmp(f, OP_SUB, hi, borrow);
+            }
+            continue;
+        }
+
+        if (digits[j] > 0) {
+            int carry = R_ZERO;
+            if (tlo != R_ZERO) {
+                lo = emit_r_tmp(f, OP_ADD, lo, tlo);
+                carry = emit_r_tmp(f, OP_SLTU, lo, tlo);
+            }
+            if (thi != R_ZERO) {
+                hi = hi == R_ZERO ? thi : emit_r_tmp(f, OP_ADD, hi, thi);
+            }
+            if (carry != R_ZERO) {
+                hi = emit_r_tmp(f, OP_ADD, hi, carry);
+            }
+        } else {
+            int borrow = R_ZERO;
+            if (tlo != R_ZERO) {
+                borrow = emit_r_tmp(f, OP_SLTU, lo, tlo);
+                lo = emit_r_tmp(f, OP_SUB, lo, tlo);
+            }
+            if (thi != R_ZERO) {
+                hi = emit_r_tmp(f, OP_SUB, hi, thi);
+            }
+            if (borrow != R_ZERO) {
+                hi = emit_r_tmp(f, OP_SUB, hi, borrow);
+            }
+        }
+    }
+
+    return hi;
+}
+
+// ===================== RECIPROCAL SERIES =====================
+
+// Without a multiplier, the high multiplication above takes some six
+// instructions per digit of the magic number. A quotient that is only
+// approximated is much cheaper: x * K / 2^T rounded down at every step
+// takes two instructions per digit, and when the binary expansion of 1/d
+// repeats with a short period P (1/3 = 0.0101..., 1/5 = 0.00110011...)
+// a period is enough, the others following from q += q >> P,
+// q += q >> 2P, ... The approximation is computed with h bits to spare
+// below the point and is never above the quotient; the few it may be
+// short of are added back by comparing the remainder with multiples of d.
+
+// How n / d is approximated: d = odd * 2^z, x = n >> (z + e) is
+// multiplied by K / 2^T (then by the series of period P, if any),
+// giving about 2^h * n / d
+typedef struct series {
+    uint32_t odd;
+    int z;
+    int e;
+    int64_t k;
+    int t;
+    int p;
+    int h;
+
+    // How much the approximation may be short of the quotient, and
+    // if it's more than two, M and S such that r * M >> S is r / d
+    // for the remainders left
+    int fix;
+    uint32_t fix_m;
+    int fix_s;
+} series_t;
+
+// Longest period of a series
+#define SERIES_PERIOD_MAX 16
+
+// Returns x * 2^k
+static double scale2(double x, int k) {
+    for (; k > 0; k--) {
+        x *= 2;
+    }
+    for (; k < 0; k++) {
+        x /= 2;
+    }
+    return x;
+}
+
+// Checks x * k / 2^t rounded down at every step for x in [0, xmax]: returns
+// 0 if an intermediate value may not fit in 32 bits (signed), otherwise
+// stores in *err how much the result may be short of the exact product
+static int frac_bounds(int64_t k, int t, double xmax, double* err) {
+    int pos[NAF_MAX], digits[NAF_MAX];
+    int n = naf(k, pos, digits);
+    if (n == 0 || pos[n - 1] - pos[0] > 31) {
+        return 0;
+    }
+
+    // The exact value is x times the partial sum s, the computed one
+    // is at most e below it
+    double s = digits[0], e = 0;
+    for (int j = 0; j <= n; j++) {
+        if (j > 0) {
+            int g = j < n ? pos[j] - pos[j - 1] : t - pos[n - 1];
+            if (g > 31) {
+                return 0;
+            }
+            s = scale2(s, -g);
+            e = g > 0 ? scale2(e, -g) + 1 : scale2(e, -g);
+            s += j < n ? digits[j] : 0;
+        }
+        if (xmax * s > 2147483647.0 || xmax * s - e < -2147483648.0 || -e < -2147483648.0) {
+            return 0;
+        }
+    }
+
+    *err = e;
+    return 1;
+}
+
+// Returns the smallest P such that d divides 2^P - 1, 0 if it's
+// larger than SERIES_PERIOD_MAX
+static int period(uint32_t d) {
+    uint64_t r = 2 % d;
+    for (int p = 1; p <= SERIES_PERIOD_MAX; p++) {
+        if (r == 1) {
+            return p;
+        }
+        r = r * 2 % d;
+    }
+    return 0;
+}
+
+// Instructions that emit_mul takes for c > 0
+static int mul_cost(int64_t c) {
+    int pos[NAF_MAX], digits[NAF_MAX];
+    int n = naf(c, pos, digits);
+    return n == 1 ? pos[0] > 0 : 2 * (n - 1) + (pos[0] > 0);
+}
+
+// Picks how to count the multiples of d left in the remainder once the
+// approximation is planned, and returns the instructions that the
+// series takes. M = 2^S / d rounded up is exact for r < R if
+// R * (M * d - 2^S) < 2^S.
+static int series_cost(series_t* plan) {
+    int pos[NAF_MAX], digits[NAF_MAX];
+    int n = naf(plan->k, pos, digits);
+    int g = plan->t - pos[n - 1];
+    int cost = (plan->e > 0) + (digits[0] < 0) + 2 * (n - 1) + mul_cost(plan->odd) + 2;
+    if (plan->p) {
+        for (int cov = plan->p; cov < 32; cov *= 2) {
+            cost += 2;
+        }
+        cost += (g != 0) + (plan->h > 0);
+    } else {
+        cost += g < 0 ? 1 + (plan->h > 0) : g + plan->h > 0;
+    }
+
+    plan->fix_m = 0;
+    uint64_t rmax = (uint64_t)(plan->fix + 1) * plan->odd;
+    for (int sh = 1; plan->fix > 2 && sh < 32; sh++) {
+        uint64_t m = ((((uint64_t)1) << sh) + plan->odd - 1) / plan->odd;
+        if (rmax * m > 0xFFFFFFFFu) {
+            break;
+        }
+        if (rmax * (m * plan->odd - (((uint64_t)1) << sh)) < (((uint64_t)1) << sh)) {
+            plan->fix_m = (uint32_t)m;
+            plan->fix_s = sh;
+            break;
+        }
+    }
+
+    return cost + (plan->fix_m ? mul_cost(plan->fix_m) + 1 : 3 * plan->fix - 1);
+}
+
+// Plans the approximation of n / d, d odd and >= 3, for n in [0, nmax].
+// Returns 0 if there is none, otherwise picks the cheapest one.
+static int series_plan_odd(uint32_t d, uint32_t nmax, series_t* best) {
+    int p = period(d);
+
+    // Without a period, K is the reciprocal to 33 bits, less the low bits
+    // that the quotient doesn't need (at least two, so that its digits
+    // span at most 31 bits)
+    int bits = 0;
+    while (bits < 32 && (d >> bits)) {
+        bits++;
+    }
+    int64_t recip = (int64_t)((((uint64_t)1) << (32 + bits)) / d);
+
+    // x must be positive as a signed number, and a bit shorter
+    // leaves room for the partial sums that go above it
+    int found = 0, best_cost = 0;
+    for (int e = nmax >= 0x80000000u, emax = e + 1; e <= emax; e++) {
+        double xmax = (double)(nmax >> e);
+        for (int h = 0; h + e < 31; h++) {
+            double scale = scale2(1.0, h + e) / d;
+            if (xmax * scale > 2147483647.0) {
+                break;
+            }
+
+            for (int cut = 2; cut < (p ? 3 : 32); cut++) {
+                series_t plan = {d, 0, e, 0, 0, p, h, 0, 0, 0};
+                double err;
+                if (p) {
+                    plan.k = (int64_t)(((((uint64_t)1) << p) - 1) / d) << (h + e);
+                    plan.t = p;
+                    if (!frac_bounds(plan.k, plan.t, xmax, &err)) {
+                        continue;
+                    }
+                    int cov = p;
+                    for (; cov < 32; cov *= 2) {
+                        err = err * (1 + scale2(1.0, -cov)) + 1;
+                    }
+                    err += xmax * scale * scale2(1.0, -cov);
+                } else {
+                    plan.k = recip & ~((((int64_t)1) << cut) - 1);
+                    plan.t = 32 + bits - h - e;
+                    if (!plan.k || !frac_bounds(plan.k, plan.t, xmax, &err)) {
+                        continue;
+                    }
+                    err += xmax * scale2((double)(recip - plan.k) + 1, -plan.t);
+                }
+
+                // The bits dropped from n
+                err += (scale2(1.0, e) - 1) * scale2(1.0, h) / d;
+
+                plan.fix = (int)scale2(err, -h) + 1;
+                if (plan.fix > 64 || (uint64_t)(plan.fix + 1) * d > 0xFFFFFFFFu) {
+                    continue;
+                }
+                int cost = series_cost(&plan);
+                if (!found || cost < best_cost) {
+                    *best = plan;
+                    best_cost = cost;
+                    found = 1;
+                }
+            }
+        }
+    }
+
+    return found;
+}
+
+// Plans the approximation of n / d for n in [0, nmax] and a constant d
+// that isn't a power of two, which is first divided by its power of two
+// factor. Returns 0 if there is none.
+static int series_plan(uint32_t d, uint32_t nmax, series_t* plan) {
+    int z = 0;
+    while (!((d >> z) & 1)) {
+        z++;
+    }
+    if ((d >> z) < 3 || !series_plan_odd(d >> z, nmax >> z, plan)) {
+        return 0;
+    }
+
+    plan->z = z;
+    return 1;
+}
+
+// Emits rs * c into a fresh virtual register and returns it
+static int emit_mul_tmp(mfunc_t f, int rs, int32_t c) {
+    int t = mfunc_new_vreg(f);
+    return rs != R_NONE && emit_mul(f, t, rs, c) ? t : R_NONE;
+}
+
+// Emits n / d as planned, or n % d if rem, and returns the register
+// of the result
+static int emit_udiv_series(mfunc_t f, int n, const series_t* plan, int rem) {
+    uint32_t odd = plan->odd;
+    int n1 = plan->z > 0 ? emit_i_tmp(f, OP_SRLI, n, plan->z) : n;
+    int x = plan->e ? emit_i_tmp(f, OP_SRLI, n, plan->z + plan->e) : n1;
+
+    // x * K / 2^T following the digits of K from the lowest one
+    int pos[NAF_MAX], digits[NAF_MAX];
+    int ndigits = naf(plan->k, pos, digits);
+    if (ndigits == 0) {
+        return R_NONE;
+    }
+    int q = digits[0] > 0 ? x : emit_r_tmp(f, OP_SUB, R_ZERO, x);
+    for (int j = 1; j < ndigits; j++) {
+        int t = emit_i_tmp(f, OP_SRAI, q, pos[j] - pos[j - 1]);
+        q = emit_r_tmp(f, digits[j] > 0 ? OP_ADD : OP_SUB, t, x);
+    }
+
+    // Without doublings in between, the two shifts right are one
+    int g = plan->t - pos[ndigits - 1];
+    int h = plan->h;
+    if (!plan->p && g > 0 && g + h <= 31) {
+        g += h;
+        h = 0;
+    }
+    if (g > 0) {
+        q = emit_i_tmp(f, OP_SRAI, q, g);
+    } else if (g < 0) {
+        q = emit_i_tmp(f, OP_SLLI, q, -g);
+    }
+
+    for (int cov = plan->p; plan->p && cov < 32; cov *= 2) {
+        q = emit_r_tmp(f, OP_ADD, q, emit_i_tmp(f, OP_SRAI, q, cov));
+    }
+    if (h > 0) {
+        q = emit_i_tmp(f, OP_SRAI, q, h);
+    }
+
+    // Each multiple of d left in the remainder adds one, counted with
+    // comparisons or r * M >> S
+    int r = emit_r_tmp(f, OP_SUB, n1, emit_mul_tmp(f, q, (int32_t)odd));
+    int more = R_NONE;
+    if (plan->fix_m) {
+        more = emit_i_tmp(f, OP_SRLI, emit_mul_tmp(f, r, (int32_t)plan->fix_m), plan->fix_s);
+    }
+    for (int k = 1; !plan->fix_m && k <= plan->fix; k++) {
+        int bound = emit_i_tmp(f, OP_LI, R_NONE, (int32_t)((uint32_t)k * odd - 1));
+        int t = emit_r_tmp(f, OP_SLTU, bound, r);
+        more = k == 1 ? t : emit_r_tmp(f, OP_ADD, more, t);
+    }
+    if (!rem) {
+        return emit_r_tmp(f, OP_ADD, q, more);
+    }
+
+    // A single comparison selects d or 0 to take away
+    if (!plan->fix_m && plan->fix == 1) {
+        more = emit_r_tmp(f, OP_AND, emit_r_tmp(f, OP_SUB, R_ZERO, more), emit_i_tmp(f, OP_LI, R_NONE, (int32_t)odd));
+    } else {
+        more = emit_mul_tmp(f, more, (int32_t)odd);
+    }
+    r = emit_r_tmp(f, OP_SUB, r, more);
+
+    // Then the bits shifted out of n go back below it
+    if (plan->z > 0) {
+        uint32_t mask = (1u << plan->z) - 1;
+        int low = mask <= 2047 ? emit_i_tmp(f, OP_ANDI, n, (int32_t)mask)
+                               : emit_i_tmp(f, OP_SRLI, emit_i_tmp(f, OP_SLLI, n, 32 - plan->z), 32 - plan->z);
+        r = emit_r_tmp(f, OP_OR, emit_i_tmp(f, OP_SLLI, r, plan->z), low);
+    }
+
+    return r;
+}
+
+// Emits rd = rs / c for signed operands
+static int emit_sdiv(mfunc_t f, int rd, int rs, int32_t c) {
+    inst_t mark = f->tail;
+
+    if (c == 1) {
+        return emit_i(f, OP_ADDI, rd, rs, 0);
+    }
+
+    if (c == -1) {
+        return emit_r(f, OP_SUB, rd, R_ZERO, rs);
+    }
+
+    uint32_t ac = c < 0 ? -(uint32_t)c : (uint32_t)c;
+    int k = log2_exact(ac);
+    int q;
+    series_t plan;
+    if (k > 0) {
+        // Round towards zero by adding 2^k - 1 to negative dividends
+        int bias = k == 1 ? emit_i_tmp(f, OP_SRLI, rs, 31)
+                          : emit_i_tmp(f, OP_SRLI, emit_i_tmp(f, OP_SRAI, rs, 31), 32 - k);
+        q = emit_i_tmp(f, OP_SRAI, emit_r_tmp(f, OP_ADD, rs, bias), k);
+        if (c < 0) {
+            q = emit_r_tmp(f, OP_SUB, R_ZERO, q);
+        }
+    } else if (series_plan(ac, 0x80000000u, &plan)) {
+        // The quotient of the magnitudes, with the sign of rs ^ c
+        int s = emit_i_tmp(f, OP_SRAI, rs, 31);
+        q = emit_udiv_series(f, emit_r_tmp(f, OP_SUB, emit_r_tmp(f, OP_XOR, rs, s), s), &plan, 0);
+        int sign = c < 0 ? emit_i_tmp(f, OP_XORI, s, -1) : s;
+        q = emit_r_tmp(f, OP_SUB, emit_r_tmp(f, OP_XOR, q, sign), sign);
+    } else {
+        magic_t mag = arith_magic_signed(c);
+        q = emit_mulh(f, rs, mag.m, 1);
+        if (c > 0 && mag.m < 0) {
+            q = emit_r_tmp(f, OP_ADD, q, rs);
+        } else if (c < 0 && mag.m > 0) {
+            q = emit_r_tmp(f, OP_SUB, q, rs);
+        }
+        if (mag.s > 0) {
+            q = emit_i_tmp(f, OP_SRAI, q, mag.s);
+        }
+
+        // Add 1 to negative quotients
+        q = emit_r_tmp(f, OP_ADD, q, emit_i_tmp(f, OP_SRLI, q, 31));
+    }
+
+    return q != R_NONE && finish(f, mark, rd, q);
+}
+
+// Emits rd = rs / c for unsigned operands
+static int emit_udiv(mfunc_t f, int rd, int rs, uint32_t c) {
+    inst_t mark = f->tail;
+
+    int k = log2_exact(c);
+    if (k == 0) {
+        return emit_i(f, OP_ADDI, rd, rs, 0);
+    }
+
+    if (k > 0) {
+        return emit_i(f, OP_SRLI, rd, rs, k);
+    }
+
+    int q;
+    series_t plan;
+    if (c >= 0x80000000u) {
+        // The quotient is either 0 or 1
+        int lt = emit_r_tmp(f, OP_SLTU, rs, emit_i_tmp(f, OP_LI, R_NONE, (int32_t)c));
+        q = emit_i_tmp(f, OP_XORI, lt, 1);
+    } else if (series_plan(c, 0xFFFFFFFFu, &plan)) {
+        q = emit_udiv_series(f, rs, &plan, 0);
+    } else {
+        magic_t mag = arith_magic_unsigned(c);
+        q = emit_mulh(f, rs, (int64_t)(uint32_t)mag.m, 0);
+        if (!mag.add) {
+            if (mag.s > 0) {
+                q = emit_i_tmp(f, OP_SRLI, q, mag.s);
+            }
+        } else {
+            int t = emit_i_tmp(f, OP_SRLI, emit_r_tmp(f, OP_SUB, rs, q), 1);
+            q = emit_i_tmp(f, OP_SRLI, emit_r_tmp(f, OP_ADD, t, q), mag.s - 1);
+        }
+    }
+
+    return q != R_NONE && finish(f, mark, rd, q);
+}
+
+// Emits rd = rs % c for power of two divisors and returns 1,
+// or returns 0 without emitting anything otherwise
+static int emit_mod_pow2(mfunc_t f, int rd, int rs, int32_t c, int is_unsigned) {
+    uint32_t ac = (is_unsigned || c > 0) ? (uint32_t)c : -(uint32_t)c;
+    int k = log2_exact(ac);
+    if (k < 0) {
+        return 0;
+    }
+
+    if (k == 0) {
+        return emit_i(f, OP_ADDI, rd, R_ZERO, 0);
+    }
+
+    inst_t mark = f->tail;
+    int r;
+    if (is_unsigned) {
+        if (ac - 1 <= 2047) {
+            return emit_i(f, OP_ANDI, rd, rs, (int32_t)(ac - 1));
+        }
+        r = emit_i_tmp(f, OP_SRLI, emit_i_tmp(f, OP_SLLI, rs, 32 - k), 32 - k);
+    } else {
+        // rs - ((rs + bias) & -2^k), where the bias rounds towards zero
+        int bias = k == 1 ? emit_i_tmp(f, OP_SRLI, rs, 31)
+                          : emit_i_tmp(f, OP_SRLI, emit_i_tmp(f, OP_SRAI, rs, 31), 32 - k);
+        int t = emit_r_tmp(f, OP_ADD, rs, bias);
+        if (k <= 11) {
+            t = emit_i_tmp(f, OP_ANDI, t, -(1 << k));
+        } else {
+            t = emit_i_tmp(f, OP_SLLI, emit_i_tmp(f, OP_SRAI, t, k), k);
+        }
+        r = emit_r_tmp(f, OP_SUB, rs, t);
+    }
+
+    return r != R_NONE && finish(f, mark, rd, r);
+}
+
+// Emits rd = rs % c with the remainder left by a reciprocal series and
+// returns 1, or returns 0 without emitting anything if there is none
+static int emit_mod_series(mfunc_t f, int rd, int rs, int32_t c, int is_unsigned) {
+    uint32_t ac = (is_unsigned || c > 0) ? (uint32_t)c : -(uint32_t)c;
+    series_t plan;
+    if (ac >= 0x80000000u || !series_plan(ac, is_unsigned ? 0xFFFFFFFFu : 0x80000000u, &plan)) {
+        return 0;
+    }
+
+    inst_t mark = f->tail;
+    int r;
+    if (is_unsigned) {
+        r = emit_udiv_series(f, rs, &plan, 1);
+    } else {
+        // The remainder of the magnitudes, with the sign of rs
+        int s = emit_i_tmp(f, OP_SRAI, rs, 31);
+        r = emit_udiv_series(f, emit_r_tmp(f, OP_SUB, emit_r_tmp(f, OP_XOR, rs, s), s), &plan, 1);
+        r = emit_r_tmp(f, OP_SUB, emit_r_tmp(f, OP_XOR, r, s), s);
+    }
+
+    return r != R_NONE && finish(f, mark, rd, r);
+}
+
+// ===================== LOWERING =====================
+
+static const char* helper_name(token_type_t op, int is_unsigned) {
+    switch (op) {
+        case AO_MUL:
+        case SO_MUL:
+            return ARITH_MUL_HELPER;
+        case AO_DIV:
+        case SO_DIV:
+            return is_unsigned ? ARITH_UDIV_HELPER : ARITH_DIV_HELPER;
+        case AO_MOD:
+        case SO_MOD:
+            return is_unsigned ? ARITH_UMOD_HELPER : ARITH_MOD_HELPER;
+        default:
+            return NULL;
+    }
+}
+
+// Returns 1 if sym is one of the runtime helpers
+int arith_is_helper(const char* sym) {
+    static const char* const helpers[] = {ARITH_MUL_HELPER, ARITH_DIV_HELPER, ARITH_UDIV_HELPER, ARITH_MOD_HELPER,
+                                          ARITH_UMOD_HELPER};
+    for (size_t k = 0; sym && k < sizeof(helpers) / sizeof(helpers[0]); k++) {
+        if (!strcmp(sym, helpers[k])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Lowers rd = rs1 op rs2, where op is one of AO_MUL, AO_DIV,
+// AO_MOD (or their SO_ assignment forms), to a runtime helper call
+int arith_lower(mfunc_t f, token_type_t op, int rd, int rs1, int rs2, int is_unsigned) {
+    const char* helper = helper_name(op, is_unsigned);
+    if (!f || !helper) {
+        return 0;
+    }
+
+    // Move the operands into a0 and a1 without
+    // overwriting one with the other
+    if (rs1 == R_A1 && rs2 == R_A0) {
+        int t = mfunc_new_vreg(f);
+        if (!emit_i(f, OP_ADDI, t, rs2, 0) || !emit_i(f, OP_ADDI, R_A0, rs1, 0) || !emit_i(f, OP_ADDI, R_A1, t, 0)) {
+            return 0;
+        }
+    } else if (rs1 == R_A1) {
+        if (!emit_i(f, OP_ADDI, R_A0, rs1, 0) || (rs2 != R_A1 && !emit_i(f, OP_ADDI, R_A1, rs2, 0))) {
+            return 0;
+        }
+    } else {
+        if ((rs2 != R_A1 && !emit_i(f, OP_ADDI, R_A1, rs2, 0)) || (rs1 != R_A0 && !emit_i(f, OP_ADDI, R_A0, rs1, 0))) {
+            return 0;
+        }
+    }
+
+    if (!emit(f, inst_new_sym(OP_CALL, R_RA, helper))) {
+        return 0;
+    }
+
+    return rd == R_A0 || emit_i(f, OP_ADDI, rd, R_A0, 0);
+}
+
+// Lowers rd = rs op c for a constant c, expanding it inline to
+// shifts and additions when it's cheap enough
+int arith_lower_const(mfunc_t f, token_type_t op, int rd, int rs, int32_t c, int is_unsigned) {
+    switch (op) {
+        case AO_MUL:
+        case SO_MUL:
+            return arith_mul_const(f, rd, rs, c);
+        case AO_DIV:
+        case SO_DIV:
+            return arith_div_const(f, rd, rs, c, is_unsigned);
+        case AO_MOD:
+        case SO_MOD:
+            return arith_mod_const(f, rd, rs, c, is_unsigned);
+        default:
+            return 0;
+    }
+}
+
+typedef int (*expand_fn)(mfunc_t f, int rd, int rs, int32_t c, int is_unsigned);
+
+// Tries the expansion in a scratch function and keeps it only if it
+// fits in max instructions, otherwise calls the runtime helper
+static int expand_or_call(mfunc_t f, token_type_t op, int rd, int rs, int32_t c, int is_unsigned, expand_fn expand,
+                          int max) {
+    if (!f) {
+        return 0;
+    }
+
+    // Division by zero is undefined: leave it to the helper
+    if (c != 0 || op == AO_MUL) {
+        mfunc_t scratch = mfunc_new(f->name);
+        if (!scratch) {
+            return 0;
+        }
+        scratch->nvregs = f->nvregs;
+        scratch->nlabels = f->nlabels;
+
+        if (expand(scratch, rd, rs, c, is_unsigned) && scratch->ninsts <= max) {
+            splice(f, scratch);
+            mfunc_free(&scratch);
+            return 1;
+        }
+        mfunc_free(&scratch);
+    }
+
+    int t = mfunc_new_vreg(f);
+    return emit_i(f, OP_LI, t, R_NONE, c) && arith_lower(f, op, rd, rs, t, is_unsigned);
+}
+
+static int expand_mul(mfunc_t f, int rd, int rs, int32_t c, int is_unsigned) {
+    (void)is_unsigned;
+    return emit_mul(f, rd, rs, c);
+}
+
+static int expand_div(mfunc_t f, int rd, int rs, int32_t c, int is_unsigned) {
+    return is_unsigned ? emit_udiv(f, rd, rs, (uint32_t)c) : emit_sdiv(f, rd, rs, c);
+}
+
+static int expand_mod(mfunc_t f, int rd, int rs, int32_t c, int is_unsigned) {
+    if (emit_mod_pow2(f, rd, rs, c, is_unsigned) || emit_mod_series(f, rd, rs, c, is_unsigned)) {
+        return 1;
+    }
+
+    // rs - (rs / c) * c
+    int q = mfunc_new_vreg(f);
+    int p = mfunc_new_vreg(f);
+    return expand_div(f, q, rs, c, is_unsigned) && emit_mul(f, p, q, c) && emit_r(f, OP_SUB, rd, rs, p);
+}
+
+// Lowers rd = rs * c
+int arith_mul_const(mfunc_t f, int rd, int rs, int32_t c) {
+    return expand_or_call(f, AO_MUL, rd, rs, c, 0, expand_mul, ARITH_MUL_INLINE_MAX);
+}
+
+// Lowers rd = rs / c
+int arith_div_const(mfunc_t f, int rd, int rs, int32_t c, int is_unsigned) {
+    return expand_or_call(f, AO_DIV, rd, rs, c, is_unsigned, expand_div, ARITH_DIV_INLINE_MAX);
+}
+
+// Lowers rd = rs % c
+int arith_mod_const(mfunc_t f, int rd, int rs, int32_t c, int is_unsigned) {
+    return expand_or_call(f, AO_MOD, rd, rs, c, is_unsigned, expand_mod, ARITH_DIV_INLINE_MAX);
+}
@@ -0,0 +1,66 @@
+#ifndef ARITH_H
+#define ARITH_H
+
+#include <stdint.h>
+#include "mfunc.h"
+#include "tokenization/token.h"
+
+// RV32I has no M extension: multiplications, divisions and
+// remainders are either expanded inline (when one operand is a
+// constant) or lowered to calls into the runtime library
+// (runtime/rv32i/muldiv.S).
+
+// Maximum number of instructions an inline expansion may take
+// before falling back to a runtime helper call
+#ifndef ARITH_MUL_INLINE_MAX
+#define ARITH_MUL_INLINE_MAX 16
+#endif
+#ifndef ARITH_DIV_INLINE_MAX
+#define ARITH_DIV_INLINE_MAX 48
+#endif
+
+// Runtime helpers
+#define ARITH_MUL_HELPER "__mulsi3"
+#define ARITH_DIV_HELPER "__divsi3"
+#define ARITH_UDIV_HELPER "__udivsi3"
+#define ARITH_MOD_HELPER "__modsi3"
+#define ARITH_UMOD_HELPER "__umodsi3"
+
+// Returns 1 if sym is one of the runtime helpers
+int arith_is_helper(const char* sym);
+
+// Magic number for the division by a constant d:
+// n / d == (mulh(n, m) [+ n]) >> s
+typedef struct magic {
+    int32_t m;
+    int s;
+
+    // Only for unsigned divisions: the magic number
+    // needs 33 bits and an add-and-shift fixup is required
+    int add;
+} magic_t;
+
+// Computes the magic number for a signed division by d (|d| >= 2)
+magic_t arith_magic_signed(int32_t d);
+
+// Computes the magic number for an unsigned division by d (d >= 1)
+magic_t arith_magic_unsigned(uint32_t d);
+
+// Lowers rd = rs1 op rs2, where op is one of AO_MUL, AO_DIV,
+// AO_MOD (or their SO_ assignment forms), to a runtime helper call
+int arith_lower(mfunc_t f, token_type_t op, int rd, int rs1, int rs2, int is_unsigned);
+
+// Lowers rd = rs op c for a constant c, expanding it inline to
+// shifts and additions when it's cheap enough
+int arith_lower_const(mfunc_t f, token_type_t op, int rd, int rs, int32_t c, int is_unsigned);
+
+// Lowers rd = rs * c
+int arith_mul_const(mfunc_t f, int rd, int rs, int32_t c);
+
+// Lowers rd = rs / c
+int arith_div_const(mfunc_t f, int rd, int rs, int32_t c, int is_unsigned);
+
+// Lowers rd = rs % c
+int arith_mod_const(mfunc_t f, int rd, int rs, int32_t c, int is_unsigned);
+
+#endif
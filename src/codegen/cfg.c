@@ -0,0 +1,347 @@
+#include "cfg.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Store in regs the registers read (or written) by the instruction,
+// including the implicit ones of calls and returns, and return how many
+int cfg_inst_uses(const inst_t i, int regs[CFG_MAX_REGS]) {
+    int n = inst_uses(i, regs);
+    return n + inst_implicit_uses(i, regs + n);
+}
+
+int cfg_inst_defs(const inst_t i, int regs[CFG_MAX_REGS]) {
+    int n = 0;
+    int r = inst_def(i);
+    if (r != R_NONE) {
+        regs[n++] = r;
+    }
+    return n + inst_implicit_defs(i, regs + n);
+}
+
+// Ends the instruction i as far as control flow is concerned
+// (unconditional jump, return or tail call)
+int cfg_ends_flow(const inst_t i) {
+    return i && (((i->op == OP_JAL || i->op == OP_JALR) && i->rd == R_ZERO) || i->op == OP_TAIL);
+}
+
+static int ends_block(const inst_t i) {
+    return inst_is_branch(i) || i->op == OP_JAL || i->op == OP_JALR || i->op == OP_TAIL;
+}
+
+static int add_pred(block_t b, int p) {
+    if (b->npreds == b->preds_cap) {
+        int cap = b->preds_cap ? b->preds_cap * 2 : 4;
+        int* preds = (int*)realloc(b->preds, cap * sizeof(int));
+        if (!preds) {
+            perror("Error with realloc");
+            return 0;
+        }
+        b->preds = preds;
+        b->preds_cap = cap;
+    }
+
+    b->preds[b->npreds++] = p;
+    return 1;
+}
+
+// Splits the function into blocks and links them
+cfg_t cfg_build(mfunc_t f) {
+    if (!f) {
+        return NULL;
+    }
+
+    cfg_t g = (cfg_t)calloc(1, sizeof(_cfg));
+    if (!g) {
+        perror("Error with calloc");
+        return NULL;
+    }
+
+    g->f = f;
+    g->nregs = R_VIRT + f->nvregs;
+    g->words = BITSET_WORDS(g->nregs);
+    g->blocks = (block_t)calloc(f->ninsts + 1, sizeof(_block));
+    g->label_block = (int*)malloc((f->nlabels + 1) * sizeof(int));
+    if (!g->blocks || !g->label_block) {
+        perror("Error with malloc");
+        cfg_free(&g);
+        return NULL;
+    }
+    for (int l = 0; l < f->nlabels; l++) {
+        g->label_block[l] = -1;
+    }
+
+    // Split: consecutive labels share a block
+    block_t cur = NULL;
+    for (inst_t i = f->head; i; i = i->next) {
+        int starts = !cur || (i->op == OP_LABEL && cur->last->op != OP_LABEL);
+        if (starts) {
+            cur = &g->blocks[g->nblocks];
+            cur->id = g->nblocks++;
+            cur->first = i;
+        }
+
+        if (starts) {
+            cur->idom = -1;
+            cur->rpo = -1;
+        }
+        cur->last = i;
+        cur->ninsts++;
+        if (i->op == OP_LABEL && i->label >= 0 && i->label < f->nlabels) {
+            g->label_block[i->label] = cur->id;
+        }
+        if (ends_block(i)) {
+            cur = NULL;
+        }
+    }
+
+    // Link
+    for (int k = 0; k < g->nblocks; k++) {
+        block_t b = &g->blocks[k];
+        inst_t last = b->last;
+        int next = k + 1 < g->nblocks ? k + 1 : -1;
+
+        if ((inst_is_branch(last) || last->op == OP_JAL) && last->label >= 0 && last->label < f->nlabels &&
+            g->label_block[last->label] >= 0) {
+            b->succ[b->nsucc++] = g->label_block[last->label];
+        }
+        if (last->op == OP_JALR && last->rd == R_ZERO && !inst_is_ret(last)) {
+            g->indirect = 1;
+        }
+        if (!cfg_ends_flow(last) && next >= 0 && (!b->nsucc || b->succ[0] != next)) {
+            b->succ[b->nsucc++] = next;
+        }
+
+        for (int s = 0; s < b->nsucc; s++) {
+            if (!add_pred(&g->blocks[b->succ[s]], k)) {
+                cfg_free(&g);
+                return NULL;
+            }
+        }
+    }
+
+    return g;
+}
+
+// Computes live_in and live_out of every block with a worklist,
+// going backwards from the exits
+int cfg_liveness(cfg_t g) {
+    if (!g) {
+        return 0;
+    }
+
+    int* work = (int*)malloc((g->nblocks + 1) * sizeof(int));
+    char* queued = (char*)calloc(g->nblocks + 1, 1);
+    if (!work || !queued) {
+        perror("Error with malloc");
+        free(work);
+        free(queued);
+        return 0;
+    }
+
+    int regs[CFG_MAX_REGS];
+    for (int k = 0; k < g->nblocks; k++) {
+        block_t b = &g->blocks[k];
+        if (!b->use) {
+            b->use = bitset_new(g->nregs);
+            b->def = bitset_new(g->nregs);
+            b->live_in = bitset_new(g->nregs);
+            b->live_out = bitset_new(g->nregs);
+            if (!b->use || !b->def || !b->live_in || !b->live_out) {
+                free(work);
+                free(queued);
+                return 0;
+            }
+        } else {
+            bitset_zero(b->use, g->words);
+            bitset_zero(b->def, g->words);
+            bitset_zero(b->live_out, g->words);
+        }
+
+        for (inst_t i = b->first;; i = i->next) {
+            int n = cfg_inst_uses(i, regs);
+            for (int r = 0; r < n; r++) {
+                if (!bitset_test(b->def, regs[r])) {
+                    bitset_set(b->use, regs[r]);
+                }
+            }
+            n = cfg_inst_defs(i, regs);
+            for (int r = 0; r < n; r++) {
+                bitset_set(b->def, regs[r]);
+            }
+            if (i == b->last) {
+                break;
+            }
+        }
+        bitset_copy(b->live_in, b->use, g->words);
+    }
+
+    // Blocks are queued last to first, so most of them see
+    // their successors' final sets on the first visit
+    int n = 0;
+    for (int k = g->nblocks - 1; k >= 0; k--) {
+        work[n++] = k;
+        queued[k] = 1;
+    }
+
+    // The worklist is a stack: a block's predecessors go on top of it
+    while (n) {
+        block_t b = &g->blocks[work[--n]];
+        queued[b->id] = 0;
+
+        for (int s = 0; s < b->nsucc; s++) {
+            bitset_union(b->live_out, g->blocks[b->succ[s]].live_in, g->words);
+        }
+
+        // live_in = use | (live_out & ~def), it can only grow
+        int changed = 0;
+        for (int w = 0; w < g->words; w++) {
+            uint64_t v = b->use[w] | (b->live_out[w] & ~b->def[w]);
+            changed |= v != b->live_in[w];
+            b->live_in[w] = v;
+        }
+
+        if (changed) {
+            for (int p = 0; p < b->npreds; p++) {
+                if (!queued[b->preds[p]]) {
+                    queued[b->preds[p]] = 1;
+                    work[n++] = b->preds[p];
+                }
+            }
+        }
+    }
+
+    free(work);
+    free(queued);
+    return 1;
+}
+
+static int intersect(cfg_t g, int a, int b) {
+    while (a != b) {
+        while (g->blocks[a].rpo > g->blocks[b].rpo) {
+            a = g->blocks[a].idom;
+        }
+        while (g->blocks[b].rpo > g->blocks[a].rpo) {
+            b = g->blocks[b].idom;
+        }
+    }
+    return a;
+}
+
+// Computes the immediate dominator of every block reachable from the
+// entry, iterating over the blocks in reverse postorder until no
+// dominator changes (Cooper, Harvey and Kennedy)
+int cfg_dominators(cfg_t g) {
+    if (!g || !g->nblocks) {
+        return g != NULL;
+    }
+
+    int* order = (int*)malloc(g->nblocks * sizeof(int));
+    int* stack = (int*)malloc(g->nblocks * sizeof(int));
+    int* next = (int*)calloc(g->nblocks, sizeof(int));
+    if (!order || !stack || !next) {
+        perror("Error with malloc");
+        free(order);
+        free(stack);
+        free(next);
+        return 0;
+    }
+
+    for (int k = 0; k < g->nblocks; k++) {
+        g->blocks[k].idom = -1;
+        g->blocks[k].rpo = -1;
+    }
+
+    // Depth first postorder, the rpo field marks the visited blocks
+    int n = 0, depth = 0;
+    stack[depth++] = 0;
+    g->blocks[0].rpo = 0;
+    while (depth) {
+        block_t b = &g->blocks[stack[depth - 1]];
+        if (next[b->id] < b->nsucc) {
+            int s = b->succ[next[b->id]++];
+            if (g->blocks[s].rpo < 0) {
+                g->blocks[s].rpo = 0;
+                stack[depth++] = s;
+            }
+            continue;
+        }
+        order[n++] = b->id;
+        depth--;
+    }
+
+    // Reverse it
+    for (int k = 0; k < n / 2; k++) {
+        int t = order[k];
+        order[k] = order[n - 1 - k];
+        order[n - 1 - k] = t;
+    }
+    for (int k = 0; k < n; k++) {
+        g->blocks[order[k]].rpo = k;
+    }
+
+    g->blocks[0].idom = 0;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int k = 1; k < n; k++) {
+            block_t b = &g->blocks[order[k]];
+            int idom = -1;
+            for (int p = 0; p < b->npreds; p++) {
+                int pred = b->preds[p];
+                if (g->blocks[pred].idom < 0) {
+                    continue;
+                }
+                idom = idom < 0 ? pred : intersect(g, pred, idom);
+            }
+            if (idom != b->idom) {
+                b->idom = idom;
+                changed = 1;
+            }
+        }
+    }
+
+    free(order);
+    free(stack);
+    free(next);
+    return 1;
+}
+
+// Returns 1 if every path from the entry to block b goes through block a
+int cfg_dominates(cfg_t g, int a, int b) {
+    if (!g || a < 0 || b < 0 || g->blocks[b].idom < 0) {
+        return 0;
+    }
+
+    while (b != a && b != 0) {
+        b = g->blocks[b].idom;
+    }
+    return b == a;
+}
+
+// Block that starts with the label, NULL if it isn't placed
+block_t cfg_label_block(cfg_t g, int label) {
+    if (!g || label < 0 || label >= g->f->nlabels || g->label_block[label] < 0) {
+        return NULL;
+    }
+    return &g->blocks[g->label_block[label]];
+}
+
+void cfg_free(cfg_t* gp) {
+    if (!gp || !*gp) {
+        return;
+    }
+
+    cfg_t g = *gp;
+    for (int k = 0; g->blocks && k < g->nblocks; k++) {
+        free(g->blocks[k].preds);
+        bitset_free(&g->blocks[k].use);
+        bitset_free(&g->blocks[k].def);
+        bitset_free(&g->blocks[k].live_in);
+        bitset_free(&g->blocks[k].live_out);
+    }
+
+    free(g->blocks);
+    free(g->label_block);
+    free(g);
+    *gp = NULL;
+}
@@ -0,0 +1,91 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include "mfunc.h"
+#include "utils/bitset.h"
+
+// The control flow graph of a machine function. Blocks are maximal runs
+// of the instruction list that start at a label (or after a branch) and
+// end at a branch, jump, return or before the next label.
+
+typedef struct block _block, *block_t;
+
+struct block {
+    int id;
+
+    // First and last instruction, both inclusive
+    inst_t first;
+    inst_t last;
+    int ninsts;
+
+    // Successors: the branch target, then the fall through block
+    int succ[2];
+    int nsucc;
+
+    int* preds;
+    int npreds;
+    int preds_cap;
+
+    // Registers read before being written in the block, registers
+    // written, and the ones live at its boundaries
+    bitset_t use;
+    bitset_t def;
+    bitset_t live_in;
+    bitset_t live_out;
+
+    // Immediate dominator and position in reverse postorder, -1 for
+    // blocks that can't be reached (filled by cfg_dominators)
+    int idom;
+    int rpo;
+};
+
+typedef struct cfg _cfg, *cfg_t;
+
+struct cfg {
+    mfunc_t f;
+
+    // Blocks in the order of the instruction list, the entry is the first
+    block_t blocks;
+    int nblocks;
+
+    // Block defined by each label, -1 if the label isn't placed
+    int* label_block;
+
+    // Registers tracked by the bit sets: physical then virtual
+    int nregs;
+    int words;
+
+    // Set if an indirect jump makes the successors unknown
+    int indirect;
+};
+
+// Splits the function into blocks and links them
+cfg_t cfg_build(mfunc_t f);
+
+// Computes live_in and live_out of every block with a worklist,
+// going backwards from the exits
+int cfg_liveness(cfg_t g);
+
+// Computes the immediate dominator of every block reachable from the entry
+int cfg_dominators(cfg_t g);
+
+// Returns 1 if every path from the entry to block b goes through block a
+int cfg_dominates(cfg_t g, int a, int b);
+
+// Block that starts with the label, NULL if it isn't placed
+block_t cfg_label_block(cfg_t g, int label);
+
+// Ends the instruction i as far as control flow is concerned
+// (unconditional jump, return or tail call)
+int cfg_ends_flow(const inst_t i);
+
+#define CFG_MAX_REGS (2 + INST_MAX_IMPLICIT)
+
+// Store in regs the registers read (or written) by the instruction,
+// including the implicit ones of calls and returns, and return how many
+int cfg_inst_uses(const inst_t i, int regs[CFG_MAX_REGS]);
+int cfg_inst_defs(const inst_t i, int regs[CFG_MAX_REGS]);
+
+void cfg_free(cfg_t* gp);
+
+#endif
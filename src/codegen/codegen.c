@@ -0,0 +1,151 @@
+#include "codegen.h"
+#include <stdlib.h>
+#include "compress.h"
+#include "dce.h"
+#include "frame.h"
+#include "gvn.h"
+#include "inline.h"
+#include "loop.h"
+#include "regalloc.h"
+#include "sched.h"
+#include "utils/timereport.h"
+
+static void report_dce(FILE* report, mfunc_t f, const dce_stats_t* stats) {
+    if (report) {
+        fprintf(report,
+                "dce: %s: removed %d instructions and %d unreachable blocks, merged %d blocks, folded %d branches, "
+                "threaded %d jumps\n",
+                f->name, stats->insts, stats->blocks, stats->merged, stats->folded, stats->threaded);
+    }
+}
+
+// The optimizations of a single function, dead code goes before value
+// numbering and after the loops are optimized
+static int optimize(mfunc_t f, const codegen_options_t* opts, dce_stats_t* stats) {
+    if (opts->dce && !dce(f, stats)) {
+        return 0;
+    }
+    if (opts->gvn) {
+        gvn_stats_t numbered = {0};
+        if (!gvn(f, &numbered)) {
+            return 0;
+        }
+        if (opts->report) {
+            fprintf(opts->report, "gvn: %s: reused %d expressions, %d loads and %d helper calls, propagated %d copies\n",
+                    f->name, numbered.exprs, numbered.loads, numbered.calls, numbered.copies);
+        }
+    }
+    if (opts->loops && (!loop_optimize(f, NULL, opts->report) || (opts->dce && !dce(f, stats)))) {
+        return 0;
+    }
+    return 1;
+}
+
+static int lower(mfunc_t f, const codegen_options_t* opts) {
+    target_t fallback = TARGET_DEFAULT;
+    const target_t* t = opts->target ? opts->target : &fallback;
+
+    if (opts->schedule) {
+        sched_stats_t stats = {0};
+        if (!schedule(f, t, &stats)) {
+            return 0;
+        }
+        if (opts->report) {
+            fprintf(opts->report, "sched: %s: %d regions, moved %d instructions, estimated stalls %d -> %d\n", f->name,
+                    stats.regions, stats.moved, stats.stalls_before, stats.stalls_after);
+        }
+    }
+
+    if (!regalloc(f, t) || !frame_lower(f)) {
+        return 0;
+    }
+
+    if (t->compressed) {
+        compress_stats_t stats = {0};
+        if (!compress(f, &stats)) {
+            return 0;
+        }
+        if (opts->report) {
+            fprintf(opts->report, "compress: %s: %d of %d instructions compressed, %d -> %d bytes\n", f->name,
+                    stats.compressed, stats.insts, stats.bytes_before, stats.bytes_after);
+        }
+    }
+    return 1;
+}
+
+// Turns a function built on virtual registers into one that can be
+// emitted or encoded: the enabled optimizations run, the blocks are
+// scheduled, registers are allocated, then the frame is laid out and,
+// for targets with the C extension, instructions are compressed.
+// opts can be NULL for the defaults.
+int codegen_function(mfunc_t f, const codegen_options_t* opts) {
+    codegen_options_t defaults = CODEGEN_OPTIONS_DEFAULT;
+    if (!opts) {
+        opts = &defaults;
+    }
+    if (!f) {
+        return 0;
+    }
+
+    dce_stats_t stats = {0};
+    phase_t prev = phase_enter(PHASE_OPTIMIZE);
+    int ok = optimize(f, opts, &stats);
+    phase_leave(prev);
+    if (!ok) {
+        return 0;
+    }
+    if (opts->dce) {
+        report_dce(opts->report, f, &stats);
+    }
+
+    prev = phase_enter(PHASE_CODEGEN);
+    ok = lower(f, opts);
+    phase_leave(prev);
+    return ok;
+}
+
+// Runs codegen_function on every function of the module, after its
+// string literals are pooled and the optimizations that work across
+// functions (inlining)
+int codegen_module(module_t m, const codegen_options_t* opts) {
+    codegen_options_t defaults = CODEGEN_OPTIONS_DEFAULT;
+    if (!opts) {
+        opts = &defaults;
+    }
+    if (!m || !module_pool_strings(m)) {
+        return 0;
+    }
+
+    dce_stats_t* stats = (dce_stats_t*)calloc(m->nfuncs + 1, sizeof(dce_stats_t));
+    if (!stats) {
+        perror("Error with calloc");
+        return 0;
+    }
+
+    // Cleaned up functions give the inliner their real size, and the
+    // inlined bodies are optimized in their new context
+    int ok = 1;
+    phase_t prev = phase_enter(PHASE_OPTIMIZE);
+    for (int i = 0; ok && opts->dce && i < m->nfuncs; i++) {
+        ok = dce(m->funcs[i], &stats[i]);
+    }
+    if (ok && opts->inline_threshold > 0) {
+        ok = inline_module(m, opts->inline_threshold, opts->inline_growth, opts->report);
+    }
+    for (int i = 0; ok && i < m->nfuncs; i++) {
+        ok = optimize(m->funcs[i], opts, &stats[i]);
+    }
+    phase_leave(prev);
+
+    prev = phase_enter(PHASE_CODEGEN);
+    for (int i = 0; ok && i < m->nfuncs; i++) {
+        if (opts->dce) {
+            report_dce(opts->report, m->funcs[i], &stats[i]);
+        }
+        ok = lower(m->funcs[i], opts);
+    }
+    phase_leave(prev);
+
+    free(stats);
+    return ok;
+}
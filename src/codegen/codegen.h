@@ -0,0 +1,46 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include <stdio.h>
+#include "mfunc.h"
+#include "module.h"
+#include "target.h"
+
+// Optimizations run on the virtual registers before allocation
+typedef struct codegen_options {
+    int dce;
+    int gvn;
+    int loops;
+
+    // Largest callee inlined, in instructions (0 disables inlining), and
+    // how much the module may grow from it, in percent of its size
+    int inline_threshold;
+    int inline_growth;
+
+    // Schedule the blocks for the target (NULL for TARGET_DEFAULT), whose
+    // extensions the code is also generated for
+    int schedule;
+    const target_t* target;
+
+    // Where the passes report what they did to each function, NULL for nowhere
+    FILE* report;
+} codegen_options_t;
+
+// Every optimization, no report
+#define CODEGEN_OPTIONS_DEFAULT                                                                    \
+    ((codegen_options_t){.dce = 1, .gvn = 1, .loops = 1, .inline_threshold = 16, .inline_growth = 50, \
+                         .schedule = 1, .target = NULL, .report = NULL})
+
+// Turns a function built on virtual registers into one that can be
+// emitted or encoded: the enabled optimizations run, the blocks are
+// scheduled, registers are allocated, then the frame is laid out and,
+// for targets with the C extension, instructions are compressed.
+// opts can be NULL for the defaults.
+int codegen_function(mfunc_t f, const codegen_options_t* opts);
+
+// Runs codegen_function on every function of the module, after its
+// string literals are pooled and the optimizations that work across
+// functions (inlining)
+int codegen_module(module_t m, const codegen_options_t* opts);
+
+#endif
@@ -0,0 +1,340 @@
+#include "compress.h"
+#include "encode.h"
+
+static const char* const cform_names[C_COUNT] = {
+    [C_NONE] = "?",              [C_ADDI4SPN] = "c.addi4spn", [C_LW] = "c.lw",             [C_SW] = "c.sw",
+    [C_NOP] = "c.nop",           [C_ADDI] = "c.addi",         [C_JAL] = "c.jal",           [C_LI] = "c.li",
+    [C_ADDI16SP] = "c.addi16sp", [C_LUI] = "c.lui",           [C_SRLI] = "c.srli",         [C_SRAI] = "c.srai",
+    [C_ANDI] = "c.andi",         [C_SUB] = "c.sub",           [C_XOR] = "c.xor",           [C_OR] = "c.or",
+    [C_AND] = "c.and",           [C_J] = "c.j",               [C_BEQZ] = "c.beqz",         [C_BNEZ] = "c.bnez",
+    [C_SLLI] = "c.slli",         [C_LWSP] = "c.lwsp",         [C_JR] = "c.jr",             [C_MV] = "c.mv",
+    [C_EBREAK] = "c.ebreak",     [C_JALR] = "c.jalr",         [C_ADD] = "c.add",           [C_SWSP] = "c.swsp",
+};
+
+const char* cform_to_str(cform_t form) {
+    return form >= 0 && form < C_COUNT ? cform_names[form] : "?";
+}
+
+// ===================== FORMS =====================
+
+// x8-x15 (s0, s1, a0-a5), the registers of the 3-bit fields
+static int is_prime(int r) {
+    return r >= R_S0 && r <= R_A5;
+}
+
+static int fits6(int32_t v) {
+    return v >= -32 && v < 32;
+}
+
+// Unsigned offset, multiple of 4, of at most max
+static int fits_word_offset(int32_t v, int32_t max) {
+    return v >= 0 && v <= max && !(v & 3);
+}
+
+static cform_t form_addi(const inst_t i) {
+    if (i->rd == R_ZERO) {
+        return i->rs1 == R_ZERO && !i->imm ? C_NOP : C_NONE;
+    }
+    if (i->rs1 == R_ZERO) {
+        return fits6(i->imm) ? C_LI : C_NONE;
+    }
+    if (!i->imm) {
+        return C_MV;
+    }
+    if (i->rd == i->rs1 && fits6(i->imm)) {
+        return C_ADDI;
+    }
+    if (i->rd == R_SP && i->rs1 == R_SP && !(i->imm & 15) && i->imm >= -512 && i->imm <= 496) {
+        return C_ADDI16SP;
+    }
+    if (i->rs1 == R_SP && is_prime(i->rd) && i->imm > 0 && fits_word_offset(i->imm, 1020)) {
+        return C_ADDI4SPN;
+    }
+    return C_NONE;
+}
+
+// lui with the upper 20 bits hi, sign extended
+static cform_t form_lui(int rd, int32_t hi) {
+    return rd != R_ZERO && rd != R_SP && hi && fits6(hi) ? C_LUI : C_NONE;
+}
+
+// Returns the 16-bit form the instruction fits in, C_NONE if it has
+// none. Branches and jumps are assumed to reach their target, the
+// operands must be in the order compression leaves them in (the
+// register written first, zero second).
+cform_t compress_form(const inst_t i) {
+    switch (i->op) {
+        case OP_ADDI:
+            return form_addi(i);
+        case OP_LI:
+            if (i->rd == R_ZERO) {
+                return C_NONE;
+            }
+            if (fits6(i->imm)) {
+                return C_LI;
+            }
+            return i->imm & 0xFFF ? C_NONE : form_lui(i->rd, i->imm >> 12);
+        case OP_LUI:
+            return form_lui(i->rd, i->imm >> 12);
+        case OP_LW:
+            if (i->rs1 == R_SP) {
+                return i->rd != R_ZERO && fits_word_offset(i->imm, 252) ? C_LWSP : C_NONE;
+            }
+            return is_prime(i->rd) && is_prime(i->rs1) && fits_word_offset(i->imm, 124) ? C_LW : C_NONE;
+        case OP_SW:
+            if (i->rs1 == R_SP) {
+                return fits_word_offset(i->imm, 252) ? C_SWSP : C_NONE;
+            }
+            return is_prime(i->rs2) && is_prime(i->rs1) && fits_word_offset(i->imm, 124) ? C_SW : C_NONE;
+        case OP_ANDI:
+            return i->rd == i->rs1 && is_prime(i->rd) && fits6(i->imm) ? C_ANDI : C_NONE;
+        case OP_SRLI:
+        case OP_SRAI:
+            if (i->rd != i->rs1 || !is_prime(i->rd) || !i->imm) {
+                return C_NONE;
+            }
+            return i->op == OP_SRLI ? C_SRLI : C_SRAI;
+        case OP_SLLI:
+            return i->rd == i->rs1 && i->rd != R_ZERO && i->imm ? C_SLLI : C_NONE;
+        case OP_ADD:
+            if (i->rd == R_ZERO || i->rs2 == R_ZERO) {
+                return C_NONE;
+            }
+            if (i->rs1 == R_ZERO) {
+                return C_MV;
+            }
+            return i->rd == i->rs1 ? C_ADD : C_NONE;
+        case OP_SUB:
+        case OP_XOR:
+        case OP_OR:
+        case OP_AND:
+            if (i->rd != i->rs1 || !is_prime(i->rd) || !is_prime(i->rs2)) {
+                return C_NONE;
+            }
+            return i->op == OP_SUB ? C_SUB : i->op == OP_XOR ? C_XOR : i->op == OP_OR ? C_OR : C_AND;
+        case OP_JAL:
+            return i->rd == R_ZERO ? C_J : i->rd == R_RA ? C_JAL : C_NONE;
+        case OP_JALR:
+            if (i->imm || i->rs1 == R_ZERO) {
+                return C_NONE;
+            }
+            return i->rd == R_ZERO ? C_JR : i->rd == R_RA ? C_JALR : C_NONE;
+        case OP_BEQ:
+        case OP_BNE:
+            if (i->rs2 != R_ZERO || !is_prime(i->rs1)) {
+                return C_NONE;
+            }
+            return i->op == OP_BEQ ? C_BEQZ : C_BNEZ;
+        case OP_EBREAK:
+            return C_EBREAK;
+        default:
+            return C_NONE;
+    }
+}
+
+// ===================== ENCODING =====================
+
+// Bits hi..lo of v, shifted down to bit 0
+static uint32_t bits(uint32_t v, int hi, int lo) {
+    return (v >> lo) & ((1u << (hi - lo + 1)) - 1);
+}
+
+// Register of a 3-bit field
+static uint32_t prime(int r) {
+    return (uint32_t)(r - R_S0);
+}
+
+// CI format: 6-bit immediate split around rd
+static uint32_t enc_ci(uint32_t f3, int rd, uint32_t imm, uint32_t quadrant) {
+    return f3 << 13 | bits(imm, 5, 5) << 12 | (uint32_t)rd << 7 | bits(imm, 4, 0) << 2 | quadrant;
+}
+
+// CJ format: c.j and c.jal
+static uint32_t enc_cj(uint32_t f3, uint32_t o) {
+    return f3 << 13 | bits(o, 11, 11) << 12 | bits(o, 4, 4) << 11 | bits(o, 9, 8) << 9 | bits(o, 10, 10) << 8 |
+           bits(o, 6, 6) << 7 | bits(o, 7, 7) << 6 | bits(o, 3, 1) << 3 | bits(o, 5, 5) << 2 | 1;
+}
+
+// CB format with a register: c.srli, c.srai, c.andi
+static uint32_t enc_cb_alu(uint32_t f2, int rd, uint32_t imm) {
+    return 4u << 13 | bits(imm, 5, 5) << 12 | f2 << 10 | prime(rd) << 7 | bits(imm, 4, 0) << 2 | 1;
+}
+
+// CL and CS formats: c.lw and c.sw
+static uint32_t enc_cl(uint32_t f3, int r, int base, uint32_t imm) {
+    return f3 << 13 | bits(imm, 5, 3) << 10 | prime(base) << 7 | bits(imm, 2, 2) << 6 | bits(imm, 6, 6) << 5 |
+           prime(r) << 2;
+}
+
+// Encodes the instruction in its 16-bit form. offset is the pc-relative
+// distance to the target of branches and jumps. Returns 0 (an illegal
+// instruction) if it has none.
+uint16_t compress_inst(const inst_t i, int32_t offset) {
+    uint32_t u = (uint32_t)i->imm;
+    uint32_t o = (uint32_t)offset;
+    uint32_t h = 0;
+
+    switch (compress_form(i)) {
+        case C_NONE:
+        case C_COUNT:
+            break;
+        case C_ADDI4SPN:
+            h = bits(u, 5, 4) << 11 | bits(u, 9, 6) << 7 | bits(u, 2, 2) << 6 | bits(u, 3, 3) << 5 | prime(i->rd) << 2;
+            break;
+        case C_LW:
+            h = enc_cl(2, i->rd, i->rs1, u);
+            break;
+        case C_SW:
+            h = enc_cl(6, i->rs2, i->rs1, u);
+            break;
+        case C_NOP:
+            h = 1;
+            break;
+        case C_ADDI:
+            h = enc_ci(0, i->rd, u, 1);
+            break;
+        case C_JAL:
+            h = enc_cj(1, o);
+            break;
+        case C_LI:
+            h = enc_ci(2, i->rd, u, 1);
+            break;
+        case C_ADDI16SP:
+            h = 3u << 13 | bits(u, 9, 9) << 12 | (uint32_t)R_SP << 7 | bits(u, 4, 4) << 6 | bits(u, 6, 6) << 5 |
+                bits(u, 8, 7) << 3 | bits(u, 5, 5) << 2 | 1;
+            break;
+        case C_LUI:
+            h = enc_ci(3, i->rd, (uint32_t)(i->imm >> 12), 1);
+            break;
+        case C_SRLI:
+            h = enc_cb_alu(0, i->rd, u);
+            break;
+        case C_SRAI:
+            h = enc_cb_alu(1, i->rd, u);
+            break;
+        case C_ANDI:
+            h = enc_cb_alu(2, i->rd, u);
+            break;
+        case C_SUB:
+        case C_XOR:
+        case C_OR:
+        case C_AND:
+            h = 4u << 13 | 3u << 10 | prime(i->rd) << 7 | (uint32_t)(compress_form(i) - C_SUB) << 5 |
+                prime(i->rs2) << 2 | 1;
+            break;
+        case C_J:
+            h = enc_cj(5, o);
+            break;
+        case C_BEQZ:
+        case C_BNEZ:
+            h = (i->op == OP_BEQ ? 6u : 7u) << 13 | bits(o, 8, 8) << 12 | bits(o, 4, 3) << 10 | prime(i->rs1) << 7 |
+                bits(o, 7, 6) << 5 | bits(o, 2, 1) << 3 | bits(o, 5, 5) << 2 | 1;
+            break;
+        case C_SLLI:
+            h = enc_ci(0, i->rd, u, 2);
+            break;
+        case C_LWSP:
+            h = 2u << 13 | bits(u, 5, 5) << 12 | (uint32_t)i->rd << 7 | bits(u, 4, 2) << 4 | bits(u, 7, 6) << 2 | 2;
+            break;
+        case C_JR:
+            h = 4u << 13 | (uint32_t)i->rs1 << 7 | 2;
+            break;
+        case C_MV:
+            h = 4u << 13 | (uint32_t)i->rd << 7 | (uint32_t)(i->op == OP_ADDI ? i->rs1 : i->rs2) << 2 | 2;
+            break;
+        case C_EBREAK:
+            h = 0x9002;
+            break;
+        case C_JALR:
+            h = 4u << 13 | 1u << 12 | (uint32_t)i->rs1 << 7 | 2;
+            break;
+        case C_ADD:
+            h = 4u << 13 | 1u << 12 | (uint32_t)i->rd << 7 | (uint32_t)i->rs2 << 2 | 2;
+            break;
+        case C_SWSP:
+            h = 6u << 13 | bits(u, 5, 2) << 9 | bits(u, 7, 6) << 7 | (uint32_t)i->rs2 << 2 | 2;
+            break;
+    }
+
+    return (uint16_t)h;
+}
+
+// ===================== PASS =====================
+
+// Turns the operands around into the order of the 16-bit forms: the
+// register written first for commutative operations, so that it can be
+// both, and zero second for copies (add rd, zero, rs) and comparisons
+static void canonicalize(inst_t i) {
+    switch (i->op) {
+        case OP_ADD:
+        case OP_AND:
+        case OP_OR:
+        case OP_XOR:
+            if (i->rs2 == R_ZERO || (i->rd == i->rs2 && i->rs1 != R_ZERO)) {
+                int r = i->rs1;
+                i->rs1 = i->rs2;
+                i->rs2 = r;
+            }
+            break;
+        case OP_BEQ:
+        case OP_BNE:
+            if (i->rs1 == R_ZERO) {
+                i->rs1 = i->rs2;
+                i->rs2 = R_ZERO;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Marks every instruction of f with a 16-bit form as compressed, after
+// turning the operands of commutative operations and comparisons with
+// zero around to match one. The code is then laid out, and branches and
+// jumps too far from their target keep their full encoding. Runs once
+// registers are allocated and the frame is laid out. The statistics of
+// stats (optional) are incremented.
+int compress(mfunc_t f, compress_stats_t* stats) {
+    if (!f) {
+        return 0;
+    }
+
+    for (inst_t i = f->head; i; i = i->next) {
+        i->compressed = 0;
+    }
+    int before = encode_size(f);
+    if (before < 0) {
+        return 0;
+    }
+
+    int insts = 0;
+    for (inst_t i = f->head; i; i = i->next) {
+        if (i->op != OP_LABEL) {
+            canonicalize(i);
+            i->compressed = compress_form(i) != C_NONE;
+            insts++;
+        }
+    }
+
+    int after = encode_size(f);
+    if (after < 0) {
+        return 0;
+    }
+
+    if (stats) {
+        stats->insts += insts;
+        stats->compressed += compress_count(f);
+        stats->bytes_before += before;
+        stats->bytes_after += after;
+    }
+    return 1;
+}
+
+// Returns the number of compressed instructions of f
+int compress_count(mfunc_t f) {
+    int n = 0;
+    for (inst_t i = f ? f->head : NULL; i; i = i->next) {
+        n += i->compressed;
+    }
+    return n;
+}
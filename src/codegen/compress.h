@@ -0,0 +1,81 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdint.h>
+#include "mfunc.h"
+
+// The 16-bit encodings of the C extension an RV32I instruction can take
+typedef enum cform {
+    C_NONE,
+
+    // Quadrant 0
+    C_ADDI4SPN,  // c.addi4spn rd', sp, imm
+    C_LW,        // c.lw rd', imm(rs1')
+    C_SW,        // c.sw rs2', imm(rs1')
+
+    // Quadrant 1
+    C_NOP,       // c.nop
+    C_ADDI,      // c.addi rd, imm
+    C_JAL,       // c.jal label
+    C_LI,        // c.li rd, imm
+    C_ADDI16SP,  // c.addi16sp sp, imm
+    C_LUI,       // c.lui rd, imm
+    C_SRLI,      // c.srli rd', imm
+    C_SRAI,      // c.srai rd', imm
+    C_ANDI,      // c.andi rd', imm
+    C_SUB,       // c.sub rd', rs2'
+    C_XOR,       // c.xor rd', rs2'
+    C_OR,        // c.or rd', rs2'
+    C_AND,       // c.and rd', rs2'
+    C_J,         // c.j label
+    C_BEQZ,      // c.beqz rs1', label
+    C_BNEZ,      // c.bnez rs1', label
+
+    // Quadrant 2
+    C_SLLI,    // c.slli rd, imm
+    C_LWSP,    // c.lwsp rd, imm(sp)
+    C_JR,      // c.jr rs1
+    C_MV,      // c.mv rd, rs2
+    C_EBREAK,  // c.ebreak
+    C_JALR,    // c.jalr rs1
+    C_ADD,     // c.add rd, rs2
+    C_SWSP,    // c.swsp rs2, imm(sp)
+
+    C_COUNT
+} cform_t;
+const char* cform_to_str(cform_t form);
+
+// What compression did to a function
+typedef struct compress_stats {
+    // Instructions (labels aside) and how many of them were compressed
+    int insts;
+    int compressed;
+
+    // Bytes of code before and after
+    int bytes_before;
+    int bytes_after;
+} compress_stats_t;
+
+// Returns the 16-bit form the instruction fits in, C_NONE if it has
+// none. Branches and jumps are assumed to reach their target, the
+// operands must be in the order compression leaves them in (the
+// register written first, zero second).
+cform_t compress_form(const inst_t i);
+
+// Encodes the instruction in its 16-bit form. offset is the pc-relative
+// distance to the target of branches and jumps. Returns 0 (an illegal
+// instruction) if it has none.
+uint16_t compress_inst(const inst_t i, int32_t offset);
+
+// Marks every instruction of f with a 16-bit form as compressed, after
+// turning the operands of commutative operations and comparisons with
+// zero around to match one. The code is then laid out, and branches and
+// jumps too far from their target keep their full encoding. Runs once
+// registers are allocated and the frame is laid out. The statistics of
+// stats (optional) are incremented.
+int compress(mfunc_t f, compress_stats_t* stats);
+
+// Returns the number of compressed instructions of f
+int compress_count(mfunc_t f);
+
+#endif
@@ -0,0 +1,271 @@
+#include "cond.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// ===================== CONDITIONS =====================
+
+static cond_t cond_alloc(token_type_t op) {
+    cond_t c = (cond_t)calloc(1, sizeof(_cond));
+    if (!c) {
+        perror("Error with calloc");
+        return NULL;
+    }
+
+    c->op = op;
+    c->lhs = R_NONE;
+    c->rhs = R_NONE;
+    return c;
+}
+
+static int is_cmp(token_type_t op) {
+    return op == RO_EQ || op == RO_NEQ || op == RO_LT || op == RO_LE || op == RO_GT || op == RO_GE;
+}
+
+// Creates the comparison lhs op rhs (op from RO_EQ to RO_GE)
+cond_t cond_new_cmp(token_type_t op, int lhs, int rhs, int is_unsigned) {
+    if (!is_cmp(op)) {
+        fprintf(stderr, "Error: %s isn't a comparison\n", token_type_to_str(op));
+        return NULL;
+    }
+
+    cond_t c = cond_alloc(op);
+    if (c) {
+        c->lhs = lhs;
+        c->rhs = rhs;
+        c->is_unsigned = is_unsigned;
+    }
+    return c;
+}
+
+// Creates the test r != 0
+cond_t cond_new_test(int r) {
+    cond_t c = cond_alloc(T_NOVALUE);
+    if (c) {
+        c->lhs = r;
+    }
+    return c;
+}
+
+// Creates a && b, a || b (op LO_AND, LO_OR, taking ownership of both)
+// or !a (op LO_NOT, b is NULL). Frees the operands if it fails.
+cond_t cond_new_logic(token_type_t op, cond_t a, cond_t b) {
+    int ok = a && (op == LO_NOT ? !b : (op == LO_AND || op == LO_OR) && b);
+    cond_t c = ok ? cond_alloc(op) : NULL;
+    if (!c) {
+        cond_free(&a);
+        cond_free(&b);
+        return NULL;
+    }
+
+    c->a = a;
+    c->b = b;
+    return c;
+}
+
+// Moves the instructions appended to f after mark (from its start if
+// mark is NULL) to the code of c
+void cond_take_code(cond_t c, mfunc_t f, inst_t mark) {
+    inst_t last = c->code;
+    while (last && last->next) {
+        last = last->next;
+    }
+
+    inst_t i = mark ? mark->next : f->head;
+    while (i) {
+        inst_t next = i->next;
+        mfunc_unlink(f, i);
+        i->prev = last;
+        if (last) {
+            last->next = i;
+        } else {
+            c->code = i;
+        }
+        last = i;
+        i = next;
+    }
+}
+
+void cond_free(cond_t* cp) {
+    if (!cp || !*cp) {
+        return;
+    }
+
+    cond_t c = *cp;
+    cond_free(&c->a);
+    cond_free(&c->b);
+    while (c->code) {
+        inst_t next = c->code->next;
+        inst_free(&c->code);
+        c->code = next;
+    }
+
+    free(c);
+    *cp = NULL;
+}
+
+// ===================== LOWERING =====================
+
+// Moves the code of the operands of c into f
+static int emit_code(mfunc_t f, cond_t c) {
+    while (c->code) {
+        inst_t i = c->code;
+        c->code = i->next;
+        i->prev = NULL;
+        i->next = NULL;
+        if (!mfunc_append(f, i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static token_type_t negate(token_type_t op) {
+    switch (op) {
+        case RO_EQ: return RO_NEQ;
+        case RO_NEQ: return RO_EQ;
+        case RO_LT: return RO_GE;
+        case RO_GE: return RO_LT;
+        case RO_GT: return RO_LE;
+        default: return RO_GT;
+    }
+}
+
+static token_type_t mirror(token_type_t op) {
+    switch (op) {
+        case RO_LT: return RO_GT;
+        case RO_GT: return RO_LT;
+        case RO_LE: return RO_GE;
+        case RO_GE: return RO_LE;
+        default: return op;
+    }
+}
+
+// Returns zero if r holds 0 where the code of f ends, because it was last
+// set by li r, 0 since the last label (branches leaving on the way don't
+// matter), r otherwise
+static int zero_or_reg(mfunc_t f, int r) {
+    for (inst_t i = f->tail; i && r != R_ZERO; i = i->prev) {
+        if (i->op == OP_LABEL || inst_is_call(i)) {
+            break;
+        }
+        if (inst_def(i) == r) {
+            int zero = (i->op == OP_LI || (i->op == OP_ADDI && i->rs1 == R_ZERO)) && i->imm == 0;
+            return zero ? R_ZERO : r;
+        }
+    }
+    return r;
+}
+
+// Appends the single branch to label taken when lhs op rhs holds.
+// Comparisons with a zero constant compare with the zero register
+// (beqz, bnez, bltz, bgez, bgtz, blez), those that are decided
+// whatever the other operand (unsigned < 0, >= 0) become nothing or
+// a jump.
+static int branch_cmp(mfunc_t f, token_type_t op, int lhs, int rhs, int is_unsigned, int label) {
+    opcode_t lt = is_unsigned ? OP_BLTU : OP_BLT;
+    opcode_t ge = is_unsigned ? OP_BGEU : OP_BGE;
+
+    lhs = zero_or_reg(f, lhs);
+    rhs = zero_or_reg(f, rhs);
+    if (lhs == R_ZERO && rhs != R_ZERO) {
+        lhs = rhs;
+        rhs = R_ZERO;
+        op = mirror(op);
+    }
+    if (rhs == R_ZERO && is_unsigned) {
+        switch (op) {
+            case RO_LT: return 1;
+            case RO_GE: return mfunc_append(f, inst_new_branch(OP_JAL, R_ZERO, R_NONE, R_NONE, label));
+            case RO_GT: op = RO_NEQ; break;
+            case RO_LE: op = RO_EQ; break;
+            default: break;
+        }
+    }
+
+    switch (op) {
+        case RO_EQ: return mfunc_append(f, inst_new_branch(OP_BEQ, R_NONE, lhs, rhs, label));
+        case RO_NEQ: return mfunc_append(f, inst_new_branch(OP_BNE, R_NONE, lhs, rhs, label));
+        case RO_LT: return mfunc_append(f, inst_new_branch(lt, R_NONE, lhs, rhs, label));
+        case RO_GE: return mfunc_append(f, inst_new_branch(ge, R_NONE, lhs, rhs, label));
+        case RO_GT: return mfunc_append(f, inst_new_branch(lt, R_NONE, rhs, lhs, label));
+        default: return mfunc_append(f, inst_new_branch(ge, R_NONE, rhs, lhs, label));
+    }
+}
+
+// Appends the branches to label taken when c is sense (1 for true, 0
+// for false), the code falls through otherwise. The code of the
+// conditions is moved into f.
+int cond_branch(mfunc_t f, cond_t c, int sense, int label) {
+    if (!f || !c || !emit_code(f, c)) {
+        return 0;
+    }
+
+    switch (c->op) {
+        case LO_NOT:
+            return cond_branch(f, c->a, !sense, label);
+        case LO_AND:
+        case LO_OR: {
+            // a && b is false as soon as a is, a || b true as soon as a
+            // is, otherwise b decides. Going the other way needs to skip b.
+            int decisive = c->op == LO_OR;
+            if (sense == decisive) {
+                return cond_branch(f, c->a, sense, label) && cond_branch(f, c->b, sense, label);
+            }
+
+            int skip = mfunc_new_label(f);
+            return cond_branch(f, c->a, decisive, skip) && cond_branch(f, c->b, sense, label) &&
+                   mfunc_append(f, inst_new_label(skip));
+        }
+        default:
+            if (!is_cmp(c->op)) {
+                return mfunc_append(f, inst_new_branch(sense ? OP_BNE : OP_BEQ, R_NONE, c->lhs, R_ZERO, label));
+            }
+            return branch_cmp(f, sense ? c->op : negate(c->op), c->lhs, c->rhs, c->is_unsigned, label);
+    }
+}
+
+// Appends rd = c ? 1 : 0, for a condition used as a value
+int cond_value(mfunc_t f, int rd, cond_t c) {
+    if (!f || !c) {
+        return 0;
+    }
+
+    // && and || keep their branches, a comparison is computed with slt
+    if (c->op == LO_AND || c->op == LO_OR) {
+        int done = mfunc_new_label(f);
+        return mfunc_append(f, inst_new_i(OP_LI, rd, R_NONE, R_NONE, 0)) && cond_branch(f, c, 0, done) &&
+               mfunc_append(f, inst_new_i(OP_LI, rd, R_NONE, R_NONE, 1)) && mfunc_append(f, inst_new_label(done));
+    }
+    if (c->op == LO_NOT) {
+        return cond_value(f, rd, c->a) && mfunc_append(f, inst_new_i(OP_XORI, rd, rd, R_NONE, 1));
+    }
+    if (!emit_code(f, c)) {
+        return 0;
+    }
+    if (!is_cmp(c->op)) {
+        return mfunc_append(f, inst_new_r(OP_SLTU, rd, R_ZERO, c->lhs));
+    }
+
+    opcode_t slt = c->is_unsigned ? OP_SLTU : OP_SLT;
+    switch (c->op) {
+        case RO_EQ:
+        case RO_NEQ: {
+            int t = mfunc_new_vreg(f);
+            if (!mfunc_append(f, inst_new_r(OP_XOR, t, c->lhs, c->rhs))) {
+                return 0;
+            }
+            return c->op == RO_EQ ? mfunc_append(f, inst_new_i(OP_SLTIU, rd, t, R_NONE, 1))
+                                  : mfunc_append(f, inst_new_r(OP_SLTU, rd, R_ZERO, t));
+        }
+        case RO_LT:
+            return mfunc_append(f, inst_new_r(slt, rd, c->lhs, c->rhs));
+        case RO_GT:
+            return mfunc_append(f, inst_new_r(slt, rd, c->rhs, c->lhs));
+        case RO_GE:
+            return mfunc_append(f, inst_new_r(slt, rd, c->lhs, c->rhs)) &&
+                   mfunc_append(f, inst_new_i(OP_XORI, rd, rd, R_NONE, 1));
+        default:
+            return mfunc_append(f, inst_new_r(slt, rd, c->rhs, c->lhs)) &&
+                   mfunc_append(f, inst_new_i(OP_XORI, rd, rd, R_NONE, 1));
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef COND_H
+#define COND_H
+
+#include "mfunc.h"
+#include "tokenization/token.h"
+
+// The conditions of if, while and for are lowered straight to branches:
+// a comparison becomes a single beq/bne/blt/bge/bltu/bgeu (operands
+// swapped for > and <=), and && and || become chains of branches that
+// stop as soon as the outcome is known, without computing a 0/1 value.
+
+typedef struct cond _cond, *cond_t;
+
+struct cond {
+    // RO_EQ to RO_GE compare lhs with rhs, LO_AND and LO_OR combine a
+    // and b, LO_NOT negates a. Anything else tests lhs != 0.
+    token_type_t op;
+    int lhs;
+    int rhs;
+    int is_unsigned;
+
+    cond_t a;
+    cond_t b;
+
+    // Instructions computing the operands (a detached chain owned by the
+    // condition), only run when the comparison is reached
+    inst_t code;
+};
+
+// Creates the comparison lhs op rhs (op from RO_EQ to RO_GE)
+cond_t cond_new_cmp(token_type_t op, int lhs, int rhs, int is_unsigned);
+
+// Creates the test r != 0
+cond_t cond_new_test(int r);
+
+// Creates a && b, a || b (op LO_AND, LO_OR, taking ownership of both)
+// or !a (op LO_NOT, b is NULL). Frees the operands if it fails.
+cond_t cond_new_logic(token_type_t op, cond_t a, cond_t b);
+
+// Moves the instructions appended to f after mark (from its start if
+// mark is NULL) to the code of c
+void cond_take_code(cond_t c, mfunc_t f, inst_t mark);
+
+// Appends the branches to label taken when c is sense (1 for true, 0
+// for false), the code falls through otherwise. The code of the
+// conditions is moved into f.
+int cond_branch(mfunc_t f, cond_t c, int sense, int label);
+
+// Appends rd = c ? 1 : 0, for a condition used as a value
+int cond_value(mfunc_t f, int rd, cond_t c);
+
+void cond_free(cond_t* cp);
+
+#endif
@@ -0,0 +1,397 @@
+#include "dce.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cfg.h"
+
+// Rounds of all the steps before giving up on reaching a fixpoint
+#define DCE_MAX_ROUNDS 16
+
+// Jumps followed when threading a jump to a jump
+#define DCE_MAX_HOPS 8
+
+static int is_jump(const inst_t i) {
+    return i->op == OP_JAL && i->rd == R_ZERO;
+}
+
+static void remove_inst(mfunc_t f, inst_t i, dce_stats_t* stats) {
+    if (i->op != OP_LABEL) {
+        stats->insts++;
+    }
+    mfunc_remove(f, i);
+}
+
+// ===================== BRANCH FOLDING =====================
+
+// Value computed by the instruction from its operands a and b, 0 if it
+// isn't a plain arithmetic instruction
+static int fold(const inst_t i, uint32_t a, uint32_t b, uint32_t* out) {
+    uint32_t imm = (uint32_t)i->imm;
+
+    switch (i->op) {
+        case OP_LI:
+        case OP_LUI: *out = imm; break;
+        case OP_ADDI: *out = a + imm; break;
+        case OP_SLTI: *out = (int32_t)a < i->imm; break;
+        case OP_SLTIU: *out = a < imm; break;
+        case OP_XORI: *out = a ^ imm; break;
+        case OP_ORI: *out = a | imm; break;
+        case OP_ANDI: *out = a & imm; break;
+        case OP_SLLI: *out = a << (imm & 31); break;
+        case OP_SRLI: *out = a >> (imm & 31); break;
+        case OP_SRAI: *out = (uint32_t)((int32_t)a >> (imm & 31)); break;
+        case OP_ADD: *out = a + b; break;
+        case OP_SUB: *out = a - b; break;
+        case OP_SLL: *out = a << (b & 31); break;
+        case OP_SLT: *out = (int32_t)a < (int32_t)b; break;
+        case OP_SLTU: *out = a < b; break;
+        case OP_XOR: *out = a ^ b; break;
+        case OP_SRL: *out = a >> (b & 31); break;
+        case OP_SRA: *out = (uint32_t)((int32_t)a >> (b & 31)); break;
+        case OP_OR: *out = a | b; break;
+        case OP_AND: *out = a & b; break;
+        default: return 0;
+    }
+
+    return 1;
+}
+
+static int taken(const inst_t i, uint32_t a, uint32_t b) {
+    switch (i->op) {
+        case OP_BEQ: return a == b;
+        case OP_BNE: return a != b;
+        case OP_BLT: return (int32_t)a < (int32_t)b;
+        case OP_BGE: return (int32_t)a >= (int32_t)b;
+        case OP_BLTU: return a < b;
+        default: return a >= b;
+    }
+}
+
+// Follows the constants within the blocks and replaces the branches
+// on them by a jump (taken) or nothing (not taken)
+static int fold_branches(mfunc_t f, int nregs, int* changed, dce_stats_t* stats) {
+    char* known = (char*)calloc(nregs, 1);
+    uint32_t* value = (uint32_t*)calloc(nregs, sizeof(uint32_t));
+    if (!known || !value) {
+        perror("Error with calloc");
+        free(known);
+        free(value);
+        return 0;
+    }
+    known[R_ZERO] = 1;
+
+    int regs[CFG_MAX_REGS];
+    for (inst_t i = f->head, next; i; i = next) {
+        next = i->next;
+
+        // Values can't be followed into a label or through a local call
+        if (i->op == OP_LABEL || ((i->op == OP_JAL || i->op == OP_JALR) && i->rd != R_ZERO)) {
+            memset(known, 0, nregs);
+            known[R_ZERO] = 1;
+            continue;
+        }
+
+        int ready = (i->rs1 < 0 || known[i->rs1]) && (i->rs2 < 0 || known[i->rs2]);
+        uint32_t a = i->rs1 >= 0 ? value[i->rs1] : 0;
+        uint32_t b = i->rs2 >= 0 ? value[i->rs2] : 0;
+
+        if (inst_is_branch(i) && ready) {
+            if (taken(i, a, b)) {
+                i->op = OP_JAL;
+                i->rd = R_ZERO;
+                i->rs1 = R_NONE;
+                i->rs2 = R_NONE;
+            } else {
+                mfunc_remove(f, i);
+            }
+            stats->folded++;
+            *changed = 1;
+            continue;
+        }
+
+        uint32_t r;
+        int folded = ready && fold(i, a, b, &r);
+        int n = cfg_inst_defs(i, regs);
+        for (int k = 0; k < n; k++) {
+            known[regs[k]] = 0;
+        }
+        if (folded && i->rd > R_ZERO) {
+            known[i->rd] = 1;
+            value[i->rd] = r;
+        }
+    }
+
+    free(known);
+    free(value);
+    return 1;
+}
+
+// ===================== UNREACHABLE BLOCKS =====================
+
+static int remove_unreachable(mfunc_t f, int* changed, dce_stats_t* stats) {
+    cfg_t g = cfg_build(f);
+    if (!g) {
+        return 0;
+    }
+    if (g->indirect || !g->nblocks) {
+        cfg_free(&g);
+        return 1;
+    }
+
+    char* reached = (char*)calloc(g->nblocks, 1);
+    int* stack = (int*)malloc(g->nblocks * sizeof(int));
+    if (!reached || !stack) {
+        perror("Error with malloc");
+        free(reached);
+        free(stack);
+        cfg_free(&g);
+        return 0;
+    }
+
+    int n = 0;
+    stack[n++] = 0;
+    reached[0] = 1;
+    while (n) {
+        block_t b = &g->blocks[stack[--n]];
+        for (int s = 0; s < b->nsucc; s++) {
+            if (!reached[b->succ[s]]) {
+                reached[b->succ[s]] = 1;
+                stack[n++] = b->succ[s];
+            }
+        }
+    }
+
+    for (int k = 0; k < g->nblocks; k++) {
+        if (reached[k]) {
+            continue;
+        }
+
+        block_t b = &g->blocks[k];
+        int code = 0;
+        for (inst_t i = b->first, next, end = b->last->next; i != end; i = next) {
+            next = i->next;
+            code |= i->op != OP_LABEL;
+            remove_inst(f, i, stats);
+        }
+        stats->blocks += code;
+        *changed = 1;
+    }
+
+    free(reached);
+    free(stack);
+    cfg_free(&g);
+    return 1;
+}
+
+// ===================== DEAD INSTRUCTIONS =====================
+
+// Sweeps every block backwards from the registers live at its end,
+// removing the instructions without side effects whose result is dead
+static int remove_dead(mfunc_t f, int* changed, dce_stats_t* stats) {
+    cfg_t g = cfg_build(f);
+    if (!g || !cfg_liveness(g)) {
+        cfg_free(&g);
+        return 0;
+    }
+
+    bitset_t live = bitset_new(g->nregs);
+    if (!live) {
+        cfg_free(&g);
+        return 0;
+    }
+
+    int regs[CFG_MAX_REGS];
+    for (int k = 0; k < g->nblocks; k++) {
+        block_t b = &g->blocks[k];
+        bitset_copy(live, b->live_out, g->words);
+
+        for (inst_t i = b->last, prev, end = b->first->prev; i != end; i = prev) {
+            prev = i->prev;
+
+            int def = inst_def(i);
+            if (!inst_has_side_effects(i) && (def == R_NONE || !bitset_test(live, def))) {
+                remove_inst(f, i, stats);
+                *changed = 1;
+                continue;
+            }
+
+            int n = cfg_inst_defs(i, regs);
+            for (int r = 0; r < n; r++) {
+                bitset_clear(live, regs[r]);
+            }
+            n = cfg_inst_uses(i, regs);
+            for (int r = 0; r < n; r++) {
+                bitset_set(live, regs[r]);
+            }
+        }
+    }
+
+    bitset_free(&live);
+    cfg_free(&g);
+    return 1;
+}
+
+// ===================== JUMPS AND CHAINS =====================
+
+// Label definitions of f, indexed by label
+static inst_t* find_labels(mfunc_t f) {
+    inst_t* labels = (inst_t*)calloc(f->nlabels + 1, sizeof(inst_t));
+    if (!labels) {
+        perror("Error with calloc");
+        return NULL;
+    }
+
+    for (inst_t i = f->head; i; i = i->next) {
+        if (i->op == OP_LABEL && i->label >= 0 && i->label < f->nlabels) {
+            labels[i->label] = i;
+        }
+    }
+    return labels;
+}
+
+static int targets_label(const inst_t i, int nlabels) {
+    return (inst_is_branch(i) || i->op == OP_JAL) && i->label >= 0 && i->label < nlabels;
+}
+
+// Sends the jumps and branches to a jump straight to its target, and
+// removes the ones that land right after themselves
+static int simplify_jumps(mfunc_t f, int* changed, dce_stats_t* stats) {
+    inst_t* labels = find_labels(f);
+    if (!labels) {
+        return 0;
+    }
+
+    for (inst_t i = f->head, next; i; i = next) {
+        next = i->next;
+        if (!targets_label(i, f->nlabels) || (i->op == OP_JAL && i->rd != R_ZERO)) {
+            continue;
+        }
+
+        for (int hop = 0; hop < DCE_MAX_HOPS && labels[i->label]; hop++) {
+            inst_t t = labels[i->label];
+            while (t && t->op == OP_LABEL) {
+                t = t->next;
+            }
+            if (!t || !is_jump(t) || t == i || t->label == i->label) {
+                break;
+            }
+            i->label = t->label;
+            stats->threaded++;
+            *changed = 1;
+        }
+
+        for (inst_t l = i->next; l && l->op == OP_LABEL; l = l->next) {
+            if (l->label == i->label) {
+                remove_inst(f, i, stats);
+                *changed = 1;
+                break;
+            }
+        }
+    }
+
+    free(labels);
+    return 1;
+}
+
+// Removes the labels nothing jumps to, merging their block into the one
+// falling through to it, and moves a block only reached by a jump in
+// place of that jump when it doesn't fall through itself
+static int merge_blocks(mfunc_t f, int* changed, dce_stats_t* stats) {
+    inst_t* labels = find_labels(f);
+    int* refs = (int*)calloc(f->nlabels + 1, sizeof(int));
+    if (!labels || !refs) {
+        perror("Error with calloc");
+        free(labels);
+        free(refs);
+        return 0;
+    }
+
+    for (inst_t i = f->head; i; i = i->next) {
+        if (targets_label(i, f->nlabels)) {
+            refs[i->label]++;
+        }
+    }
+
+    for (inst_t i = f->head, next; i; i = next) {
+        next = i->next;
+
+        if (i->op == OP_LABEL && i->label >= 0 && i->label < f->nlabels && !refs[i->label]) {
+            inst_t prev = i->prev;
+            if (prev && prev->op != OP_LABEL && !inst_is_branch(prev) && !cfg_ends_flow(prev)) {
+                stats->merged++;
+            }
+            labels[i->label] = NULL;
+            remove_inst(f, i, stats);
+            *changed = 1;
+            continue;
+        }
+
+        if (!is_jump(i) || !targets_label(i, f->nlabels) || refs[i->label] != 1 || !labels[i->label]) {
+            continue;
+        }
+
+        // The block has to start after the end of some other flow, and
+        // run without labels up to its own end of flow
+        inst_t start = labels[i->label];
+        if (!start->prev || !cfg_ends_flow(start->prev)) {
+            continue;
+        }
+        inst_t end = start->next;
+        while (end && end != i && end->op != OP_LABEL && !cfg_ends_flow(end)) {
+            end = end->next;
+        }
+        if (!end || end == i || !cfg_ends_flow(end)) {
+            continue;
+        }
+
+        inst_t stop = end->next;
+        for (inst_t m = start->next, after; m != stop; m = after) {
+            after = m->next;
+            mfunc_unlink(f, m);
+            mfunc_insert_before(f, i, m);
+        }
+
+        labels[i->label] = NULL;
+        refs[i->label] = 0;
+        if (next == start) {
+            next = start->next;
+        }
+        remove_inst(f, start, stats);
+        remove_inst(f, i, stats);
+        stats->merged++;
+        *changed = 1;
+    }
+
+    free(labels);
+    free(refs);
+    return 1;
+}
+
+// ===================== PASS =====================
+
+// Removes the unreachable blocks of f and the instructions whose results
+// are never used, folds the branches on constants and merges the blocks
+// of straight-line chains, until nothing changes. The statistics of
+// stats (optional) are incremented.
+int dce(mfunc_t f, dce_stats_t* stats) {
+    if (!f) {
+        return 0;
+    }
+
+    dce_stats_t ignored = {0};
+    if (!stats) {
+        stats = &ignored;
+    }
+
+    int changed = 1;
+    for (int round = 0; changed && round < DCE_MAX_ROUNDS; round++) {
+        changed = 0;
+        if (!fold_branches(f, R_VIRT + f->nvregs, &changed, stats) || !remove_unreachable(f, &changed, stats) ||
+            !remove_dead(f, &changed, stats) || !simplify_jumps(f, &changed, stats) ||
+            !merge_blocks(f, &changed, stats)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
@@ -0,0 +1,29 @@
+#ifndef DCE_H
+#define DCE_H
+
+#include "mfunc.h"
+
+// What dead code elimination did to a function
+typedef struct dce_stats {
+    // Instructions removed (dead, unreachable or useless jumps)
+    int insts;
+
+    // Unreachable blocks removed
+    int blocks;
+
+    // Blocks merged into the one before them
+    int merged;
+
+    // Branches whose outcome was known, and jumps sent
+    // straight to the end of a chain of jumps
+    int folded;
+    int threaded;
+} dce_stats_t;
+
+// Removes the unreachable blocks of f and the instructions whose results
+// are never used, folds the branches on constants and merges the blocks
+// of straight-line chains, until nothing changes. The statistics of
+// stats (optional) are incremented.
+int dce(mfunc_t f, dce_stats_t* stats);
+
+#endif
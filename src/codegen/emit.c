@@ -0,0 +1,674 @@
+#include "emit.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "compress.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#define CHUNK_MIN_CAP 4096
+
+// Bytes an instruction may take, besides its symbol and label names
+#define INST_MAX_LEN 64
+
+#define PUT_LIT(p, s) put_str(p, s, sizeof(s) - 1)
+
+struct emitter {
+    int fd;
+
+    // One buffer per function, written with a single writev.
+    // Buffers past nchunks are kept around to be reused.
+    buf_t* chunks;
+    int nchunks;
+    int nalloc;
+    int cap;
+};
+
+// Creates a new emitter that writes to the file descriptor fd
+emitter_t emitter_new(int fd) {
+    emitter_t e = (emitter_t)malloc(sizeof(_emitter));
+    if (!e) {
+        perror("Error with malloc");
+        return NULL;
+    }
+
+    e->fd = fd;
+    e->chunks = NULL;
+    e->nchunks = 0;
+    e->nalloc = 0;
+    e->cap = 0;
+
+    return e;
+}
+
+// Returns a new empty chunk at the end of the output
+static buf_t new_chunk(emitter_t e) {
+    if (e->nchunks == e->nalloc) {
+        if (e->nalloc == e->cap) {
+            int cap = e->cap ? e->cap * 2 : 16;
+            buf_t* chunks = (buf_t*)realloc(e->chunks, cap * sizeof(buf_t));
+            if (!chunks) {
+                perror("Error with realloc");
+                return NULL;
+            }
+            e->chunks = chunks;
+            e->cap = cap;
+        }
+
+        e->chunks[e->nalloc] = buf_new(CHUNK_MIN_CAP);
+        if (!e->chunks[e->nalloc]) {
+            return NULL;
+        }
+        e->nalloc++;
+    }
+
+    buf_t b = e->chunks[e->nchunks++];
+    buf_clear(b);
+    return b;
+}
+
+// ===================== FORMATTERS =====================
+
+static const struct {
+    char name[5];
+    unsigned char len;
+} reg_names[] = {{"zero", 4}, {"ra", 2}, {"sp", 2}, {"gp", 2},  {"tp", 2},  {"t0", 2}, {"t1", 2}, {"t2", 2},
+                 {"s0", 2},   {"s1", 2}, {"a0", 2}, {"a1", 2},  {"a2", 2},  {"a3", 2}, {"a4", 2}, {"a5", 2},
+                 {"a6", 2},   {"a7", 2}, {"s2", 2}, {"s3", 2},  {"s4", 2},  {"s5", 2}, {"s6", 2}, {"s7", 2},
+                 {"s8", 2},   {"s9", 2}, {"s10", 3}, {"s11", 3}, {"t3", 2}, {"t4", 2}, {"t5", 2}, {"t6", 2}};
+
+static char* put_str(char* p, const char* s, size_t n) {
+    memcpy(p, s, n);
+    return p + n;
+}
+
+static char* put_reg(char* p, int r) {
+    if (r >= R_VIRT) {
+        *p++ = 'v';
+        return fmt_uint(p, (uint64_t)(r - R_VIRT));
+    }
+
+    if (r < 0) {
+        return PUT_LIT(p, "?");
+    }
+
+    return put_str(p, reg_names[r].name, reg_names[r].len);
+}
+
+static char* put_label(char* p, const char* fname, size_t flen, int label) {
+    p = PUT_LIT(p, ".L");
+    p = put_str(p, fname, flen);
+    *p++ = '_';
+    return fmt_uint(p, (uint64_t)label);
+}
+
+static char* put_mnemonic(char* p, const char* m) {
+    p = PUT_LIT(p, "    ");
+    p = put_str(p, m, strlen(m));
+    *p++ = ' ';
+    return p;
+}
+
+// rd, rs1, rs2
+static char* put_rrr(char* p, const inst_t i) {
+    p = put_reg(p, i->rd);
+    p = PUT_LIT(p, ", ");
+    p = put_reg(p, i->rs1);
+    p = PUT_LIT(p, ", ");
+    return put_reg(p, i->rs2);
+}
+
+// rd, rs1, imm
+static char* put_rri(char* p, const inst_t i) {
+    p = put_reg(p, i->rd);
+    p = PUT_LIT(p, ", ");
+    p = put_reg(p, i->rs1);
+    p = PUT_LIT(p, ", ");
+    return fmt_int(p, i->imm);
+}
+
+// r, imm(rs1)
+static char* put_mem(char* p, int r, const inst_t i) {
+    p = put_reg(p, r);
+    p = PUT_LIT(p, ", ");
+    p = fmt_int(p, i->imm);
+    *p++ = '(';
+    p = put_reg(p, i->rs1);
+    *p++ = ')';
+    return p;
+}
+
+// The 16-bit form of a compressed instruction, which leaves out the
+// operands it implies (the source that is also the destination, sp)
+static char* format_compressed(char* p, const inst_t i, const char* fname, size_t flen) {
+    cform_t form = compress_form(i);
+    const char* name = cform_to_str(form);
+    if (form == C_NOP || form == C_EBREAK) {
+        p = PUT_LIT(p, "    ");
+        p = put_str(p, name, strlen(name));
+        *p++ = '\n';
+        return p;
+    }
+
+    p = put_mnemonic(p, name);
+    switch (form) {
+        case C_ADDI4SPN:
+            p = put_reg(p, i->rd);
+            p = PUT_LIT(p, ", sp, ");
+            p = fmt_int(p, i->imm);
+            break;
+        case C_LW:
+        case C_LWSP:
+            p = put_mem(p, i->rd, i);
+            break;
+        case C_SW:
+        case C_SWSP:
+            p = put_mem(p, i->rs2, i);
+            break;
+        case C_ADDI16SP:
+        case C_ADDI:
+        case C_LI:
+        case C_SRLI:
+        case C_SRAI:
+        case C_ANDI:
+        case C_SLLI:
+            p = put_reg(p, i->rd);
+            p = PUT_LIT(p, ", ");
+            p = fmt_int(p, i->imm);
+            break;
+        case C_LUI:
+            p = put_reg(p, i->rd);
+            p = PUT_LIT(p, ", ");
+            p = fmt_uint(p, (uint32_t)i->imm >> 12);
+            break;
+        case C_SUB:
+        case C_XOR:
+        case C_OR:
+        case C_AND:
+        case C_ADD:
+            p = put_reg(p, i->rd);
+            p = PUT_LIT(p, ", ");
+            p = put_reg(p, i->rs2);
+            break;
+        case C_MV:
+            p = put_reg(p, i->rd);
+            p = PUT_LIT(p, ", ");
+            p = put_reg(p, i->op == OP_ADDI ? i->rs1 : i->rs2);
+            break;
+        case C_BEQZ:
+        case C_BNEZ:
+            p = put_reg(p, i->rs1);
+            p = PUT_LIT(p, ", ");
+            p = put_label(p, fname, flen, i->label);
+            break;
+        case C_J:
+        case C_JAL:
+            p = put_label(p, fname, flen, i->label);
+            break;
+        case C_JR:
+        case C_JALR:
+            p = put_reg(p, i->rs1);
+            break;
+        default:
+            fprintf(stderr, "Error: can't emit compressed instruction with opcode %d\n", i->op);
+            break;
+    }
+
+    *p++ = '\n';
+    return p;
+}
+
+static char* format_inst(char* p, const inst_t i, const char* fname, size_t flen) {
+    if (i->compressed) {
+        return format_compressed(p, i, fname, flen);
+    }
+
+    switch (i->op) {
+        case OP_LABEL: {
+            p = put_label(p, fname, flen, i->label);
+            *p++ = ':';
+            break;
+        }
+        case OP_LUI:
+        case OP_AUIPC: {
+            p = put_mnemonic(p, opcode_to_str(i->op));
+            p = put_reg(p, i->rd);
+            p = PUT_LIT(p, ", ");
+            p = fmt_uint(p, (uint32_t)i->imm >> 12);
+            break;
+        }
+        case OP_JAL: {
+            if (i->rd == R_ZERO) {
+                p = PUT_LIT(p, "    j ");
+            } else {
+                p = put_mnemonic(p, "jal");
+                p = put_reg(p, i->rd);
+                p = PUT_LIT(p, ", ");
+            }
+            p = put_label(p, fname, flen, i->label);
+            break;
+        }
+        case OP_JALR: {
+            if (i->rd == R_ZERO && i->rs1 == R_RA && !i->imm) {
+                p = PUT_LIT(p, "    ret");
+            } else if (i->rd == R_ZERO && !i->imm) {
+                p = PUT_LIT(p, "    jr ");
+                p = put_reg(p, i->rs1);
+            } else {
+                p = put_mnemonic(p, "jalr");
+                p = put_mem(p, i->rd, i);
+            }
+            break;
+        }
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BGE:
+        case OP_BLTU:
+        case OP_BGEU: {
+            if (i->rs2 == R_ZERO && (i->op == OP_BEQ || i->op == OP_BNE || i->op == OP_BLT || i->op == OP_BGE)) {
+                p = put_mnemonic(p, i->op == OP_BEQ ? "beqz" : i->op == OP_BNE ? "bnez" : i->op == OP_BLT ? "bltz" : "bgez");
+                p = put_reg(p, i->rs1);
+            } else if (i->rs1 == R_ZERO && (i->op == OP_BLT || i->op == OP_BGE)) {
+                p = put_mnemonic(p, i->op == OP_BLT ? "bgtz" : "blez");
+                p = put_reg(p, i->rs2);
+            } else {
+                p = put_mnemonic(p, opcode_to_str(i->op));
+                p = put_reg(p, i->rs1);
+                p = PUT_LIT(p, ", ");
+                p = put_reg(p, i->rs2);
+            }
+            p = PUT_LIT(p, ", ");
+            p = put_label(p, fname, flen, i->label);
+            break;
+        }
+        case OP_LB:
+        case OP_LH:
+        case OP_LW:
+        case OP_LBU:
+        case OP_LHU: {
+            p = put_mnemonic(p, opcode_to_str(i->op));
+            p = put_mem(p, i->rd, i);
+            break;
+        }
+        case OP_SB:
+        case OP_SH:
+        case OP_SW: {
+            p = put_mnemonic(p, opcode_to_str(i->op));
+            p = put_mem(p, i->rs2, i);
+            break;
+        }
+        case OP_ADDI: {
+            if (i->rd == R_ZERO && i->rs1 == R_ZERO && !i->imm) {
+                p = PUT_LIT(p, "    nop");
+            } else if (i->rs1 == R_ZERO) {
+                p = put_mnemonic(p, "li");
+                p = put_reg(p, i->rd);
+                p = PUT_LIT(p, ", ");
+                p = fmt_int(p, i->imm);
+            } else if (!i->imm) {
+                p = put_mnemonic(p, "mv");
+                p = put_reg(p, i->rd);
+                p = PUT_LIT(p, ", ");
+                p = put_reg(p, i->rs1);
+            } else {
+                p = put_mnemonic(p, "addi");
+                p = put_rri(p, i);
+            }
+            break;
+        }
+        case OP_XORI: {
+            if (i->imm == -1) {
+                p = put_mnemonic(p, "not");
+                p = put_reg(p, i->rd);
+                p = PUT_LIT(p, ", ");
+                p = put_reg(p, i->rs1);
+            } else {
+                p = put_mnemonic(p, "xori");
+                p = put_rri(p, i);
+            }
+            break;
+        }
+        case OP_SLTIU: {
+            if (i->imm == 1) {
+                p = put_mnemonic(p, "seqz");
+                p = put_reg(p, i->rd);
+                p = PUT_LIT(p, ", ");
+                p = put_reg(p, i->rs1);
+            } else {
+                p = put_mnemonic(p, "sltiu");
+                p = put_rri(p, i);
+            }
+            break;
+        }
+        case OP_SLTI:
+        case OP_ORI:
+        case OP_ANDI:
+        case OP_SLLI:
+        case OP_SRLI:
+        case OP_SRAI: {
+            p = put_mnemonic(p, opcode_to_str(i->op));
+            p = put_rri(p, i);
+            break;
+        }
+        case OP_SUB: {
+            if (i->rs1 == R_ZERO) {
+                p = put_mnemonic(p, "neg");
+                p = put_reg(p, i->rd);
+                p = PUT_LIT(p, ", ");
+                p = put_reg(p, i->rs2);
+            } else {
+                p = put_mnemonic(p, "sub");
+                p = put_rrr(p, i);
+            }
+            break;
+        }
+        case OP_SLTU: {
+            if (i->rs1 == R_ZERO) {
+                p = put_mnemonic(p, "snez");
+                p = put_reg(p, i->rd);
+                p = PUT_LIT(p, ", ");
+                p = put_reg(p, i->rs2);
+            } else {
+                p = put_mnemonic(p, "sltu");
+                p = put_rrr(p, i);
+            }
+            break;
+        }
+        case OP_ADD:
+        case OP_SLL:
+        case OP_SLT:
+        case OP_XOR:
+        case OP_SRL:
+        case OP_SRA:
+        case OP_OR:
+        case OP_AND: {
+            p = put_mnemonic(p, opcode_to_str(i->op));
+            p = put_rrr(p, i);
+            break;
+        }
+        case OP_ECALL:
+        case OP_EBREAK: {
+            p = PUT_LIT(p, "    ");
+            p = put_str(p, opcode_to_str(i->op), strlen(opcode_to_str(i->op)));
+            break;
+        }
+        case OP_LI: {
+            p = put_mnemonic(p, "li");
+            p = put_reg(p, i->rd);
+            p = PUT_LIT(p, ", ");
+            p = fmt_int(p, i->imm);
+            break;
+        }
+        case OP_LA: {
+            p = put_mnemonic(p, "la");
+            p = put_reg(p, i->rd);
+            p = PUT_LIT(p, ", ");
+            p = put_str(p, i->sym, strlen(i->sym));
+            if (i->imm > 0) {
+                p = PUT_LIT(p, "+");
+            }
+            if (i->imm) {
+                p = fmt_int(p, i->imm);
+            }
+            break;
+        }
+        case OP_CALL:
+        case OP_TAIL: {
+            p = put_mnemonic(p, opcode_to_str(i->op));
+            p = put_str(p, i->sym, strlen(i->sym));
+            break;
+        }
+        default: {
+            fprintf(stderr, "Error: can't emit instruction with opcode %d\n", i->op);
+            break;
+        }
+    }
+
+    *p++ = '\n';
+    return p;
+}
+
+static int format_into(buf_t b, const inst_t i, const char* fname, size_t flen) {
+    size_t n = INST_MAX_LEN + 2 * flen + (i->sym ? strlen(i->sym) : 0);
+    char* p = buf_reserve(b, n);
+    if (!p) {
+        return 0;
+    }
+
+    buf_commit(b, format_inst(p, i, fname, flen));
+    return 1;
+}
+
+// Formats a single instruction into b. Labels are prefixed with
+// the name of the function they belong to, to keep them unique.
+int emit_inst(buf_t b, const inst_t i, const char* fname) {
+    if (!b || !i || !fname) {
+        return 0;
+    }
+
+    return format_into(b, i, fname, strlen(fname));
+}
+
+// ===================== EMITTER =====================
+
+// Appends raw text (e.g. section directives) to the output
+int emit_raw(emitter_t e, const char* s) {
+    if (!e || !s) {
+        return 0;
+    }
+
+    buf_t b = e->nchunks ? e->chunks[e->nchunks - 1] : new_chunk(e);
+    return b && buf_puts(b, s);
+}
+
+// Formats the whole function as assembly text
+int emit_function(emitter_t e, mfunc_t f) {
+    if (!e || !f) {
+        return 0;
+    }
+
+    buf_t b = new_chunk(e);
+    if (!b) {
+        return 0;
+    }
+
+    // Compressed code only keeps the instructions 2-byte aligned, and
+    // is assembled with the C extension for this function only
+    int compressed = compress_count(f) > 0;
+
+    size_t flen = strlen(f->name);
+    char* p = buf_reserve(b, 4 * flen + 160);
+    if (!p) {
+        return 0;
+    }
+
+    p = PUT_LIT(p, "\n    .text\n");
+    if (compressed) {
+        p = PUT_LIT(p, "    .option push\n    .option rvc\n");
+    }
+    p = PUT_LIT(p, "    .globl ");
+    p = put_str(p, f->name, flen);
+    p = PUT_LIT(p, "\n    .type ");
+    p = put_str(p, f->name, flen);
+    p = PUT_LIT(p, ", @function\n    .p2align ");
+    *p++ = compressed ? '1' : '2';
+    *p++ = '\n';
+    p = put_str(p, f->name, flen);
+    p = PUT_LIT(p, ":\n");
+    buf_commit(b, p);
+
+    for (inst_t i = f->head; i; i = i->next) {
+        if (!format_into(b, i, f->name, flen)) {
+            return 0;
+        }
+    }
+
+    p = buf_reserve(b, 2 * flen + 48);
+    if (!p) {
+        return 0;
+    }
+    p = PUT_LIT(p, "    .size ");
+    p = put_str(p, f->name, flen);
+    p = PUT_LIT(p, ", .-");
+    p = put_str(p, f->name, flen);
+    *p++ = '\n';
+    if (compressed) {
+        p = PUT_LIT(p, "    .option pop\n");
+    }
+    buf_commit(b, p);
+
+    return 1;
+}
+
+// Writes everything emitted so far
+// Formats the data object as a labelled run of .byte directives
+static int emit_data(emitter_t e, mdata_t d) {
+    buf_t b = new_chunk(e);
+    if (!b) {
+        return 0;
+    }
+
+    size_t nlen = strlen(d->name);
+    const char* sec = section_to_str(d->section);
+    char* p = buf_reserve(b, 3 * nlen + 128);
+    if (!p) {
+        return 0;
+    }
+
+    p = PUT_LIT(p, "\n    .section ");
+    p = put_str(p, sec, strlen(sec));
+    if (strcmp(d->name, MODULE_STRINGS)) {
+        // The string pool stays local, every module has its own
+        p = PUT_LIT(p, "\n    .globl ");
+        p = put_str(p, d->name, nlen);
+    }
+    p = PUT_LIT(p, "\n    .type ");
+    p = put_str(p, d->name, nlen);
+    p = PUT_LIT(p, ", @object\n    .p2align ");
+    p = fmt_int(p, __builtin_ctz((unsigned)d->align));
+    *p++ = '\n';
+    p = put_str(p, d->name, nlen);
+    p = PUT_LIT(p, ":\n");
+    buf_commit(b, p);
+
+    // 16 bytes per line, each at most "0xff, "
+    for (size_t i = 0; i < d->size; i += 16) {
+        size_t n = d->size - i < 16 ? d->size - i : 16;
+        p = buf_reserve(b, 16 + 6 * n);
+        if (!p) {
+            return 0;
+        }
+
+        p = PUT_LIT(p, "    .byte ");
+        for (size_t j = 0; j < n; j++) {
+            if (j) {
+                p = PUT_LIT(p, ", ");
+            }
+            p = fmt_uint(p, d->bytes[i + j]);
+        }
+        *p++ = '\n';
+        buf_commit(b, p);
+    }
+
+    p = buf_reserve(b, nlen + 32);
+    if (!p) {
+        return 0;
+    }
+    p = PUT_LIT(p, "    .size ");
+    p = put_str(p, d->name, nlen);
+    p = PUT_LIT(p, ", ");
+    p = fmt_uint(p, (uint32_t)d->size);
+    *p++ = '\n';
+    buf_commit(b, p);
+
+    return 1;
+}
+
+// Formats every function and then every data object of the module,
+// pooling its string literals first
+int emit_module(emitter_t e, module_t m) {
+    if (!e || !m || !module_pool_strings(m)) {
+        return 0;
+    }
+
+    for (int i = 0; i < m->nfuncs; i++) {
+        if (!emit_function(e, m->funcs[i])) {
+            return 0;
+        }
+    }
+
+    for (int i = 0; i < m->ndata; i++) {
+        if (!emit_data(e, m->data[i])) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int emitter_flush(emitter_t e) {
+    if (!e) {
+        return 0;
+    }
+
+    struct iovec iov[IOV_MAX];
+    int next = 0;
+    while (next < e->nchunks) {
+        int n = 0;
+        while (next < e->nchunks && n < IOV_MAX) {
+            buf_t b = e->chunks[next++];
+            if (b->len) {
+                iov[n].iov_base = b->data;
+                iov[n].iov_len = b->len;
+                n++;
+            }
+        }
+
+        // Retry until the whole batch is written
+        struct iovec* v = iov;
+        while (n > 0) {
+            ssize_t written = writev(e->fd, v, n);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("Error writing output");
+                return 0;
+            }
+
+            while (n > 0 && (size_t)written >= v->iov_len) {
+                written -= (ssize_t)v->iov_len;
+                v++;
+                n--;
+            }
+            if (n > 0) {
+                v->iov_base = (char*)v->iov_base + written;
+                v->iov_len -= (size_t)written;
+            }
+        }
+    }
+
+    e->nchunks = 0;
+    return 1;
+}
+
+// Flushes and frees the emitter
+void emitter_free(emitter_t* ep) {
+    if (!ep || !*ep) {
+        return;
+    }
+
+    emitter_flush(*ep);
+    for (int i = 0; i < (*ep)->nalloc; i++) {
+        buf_free(&(*ep)->chunks[i]);
+    }
+    free((*ep)->chunks);
+    free(*ep);
+    *ep = NULL;
+}
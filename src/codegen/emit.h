@@ -0,0 +1,36 @@
+#ifndef EMIT_H
+#define EMIT_H
+
+#include "mfunc.h"
+#include "module.h"
+#include "utils/buf.h"
+
+// The assembly emitter formats functions into memory, one
+// buffer per function, and hands all of them to the kernel
+// with a single writev when flushed.
+typedef struct emitter _emitter, *emitter_t;
+
+// Creates a new emitter that writes to the file descriptor fd
+emitter_t emitter_new(int fd);
+
+// Appends raw text (e.g. section directives) to the output
+int emit_raw(emitter_t e, const char* s);
+
+// Formats the whole function as assembly text
+int emit_function(emitter_t e, mfunc_t f);
+
+// Formats every function and then every data object of the module,
+// pooling its string literals first
+int emit_module(emitter_t e, module_t m);
+
+// Formats a single instruction into b. Labels are prefixed with
+// the name of the function they belong to, to keep them unique.
+int emit_inst(buf_t b, const inst_t i, const char* fname);
+
+// Writes everything emitted so far
+int emitter_flush(emitter_t e);
+
+// Flushes and frees the emitter
+void emitter_free(emitter_t* ep);
+
+#endif
@@ -0,0 +1,451 @@
+#include "encode.h"
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "compress.h"
+
+// ===================== RELOCATIONS =====================
+
+relocs_t relocs_new() {
+    relocs_t r = (relocs_t)malloc(sizeof(_relocs));
+    if (!r) {
+        perror("Error with malloc");
+        return NULL;
+    }
+
+    r->items = NULL;
+    r->n = 0;
+    r->cap = 0;
+
+    return r;
+}
+
+int relocs_add(relocs_t r, uint32_t offset, int type, const char* sym, int32_t addend) {
+    if (r->n == r->cap) {
+        int cap = r->cap ? r->cap * 2 : 16;
+        reloc_t* items = (reloc_t*)realloc(r->items, cap * sizeof(reloc_t));
+        if (!items) {
+            perror("Error with realloc");
+            return 0;
+        }
+        r->items = items;
+        r->cap = cap;
+    }
+
+    reloc_t* rel = &r->items[r->n++];
+    rel->offset = offset;
+    rel->type = type;
+    rel->sym = sym;
+    rel->addend = addend;
+
+    return 1;
+}
+
+void relocs_free(relocs_t* rp) {
+    if (!rp || !*rp) {
+        return;
+    }
+
+    free((*rp)->items);
+    free(*rp);
+    *rp = NULL;
+}
+
+// ===================== FORMATS =====================
+
+#define OPC_LUI 0x37
+#define OPC_AUIPC 0x17
+#define OPC_JAL 0x6F
+#define OPC_JALR 0x67
+#define OPC_BRANCH 0x63
+#define OPC_LOAD 0x03
+#define OPC_STORE 0x23
+#define OPC_OP_IMM 0x13
+#define OPC_OP 0x33
+#define OPC_SYSTEM 0x73
+
+static uint32_t enc_r(uint32_t opc, uint32_t f3, uint32_t f7, int rd, int rs1, int rs2) {
+    return f7 << 25 | (uint32_t)rs2 << 20 | (uint32_t)rs1 << 15 | f3 << 12 | (uint32_t)rd << 7 | opc;
+}
+
+static uint32_t enc_i(uint32_t opc, uint32_t f3, int rd, int rs1, int32_t imm) {
+    return ((uint32_t)imm & 0xFFF) << 20 | (uint32_t)rs1 << 15 | f3 << 12 | (uint32_t)rd << 7 | opc;
+}
+
+static uint32_t enc_s(uint32_t opc, uint32_t f3, int rs1, int rs2, int32_t imm) {
+    uint32_t u = (uint32_t)imm;
+    return ((u >> 5) & 0x7F) << 25 | (uint32_t)rs2 << 20 | (uint32_t)rs1 << 15 | f3 << 12 | (u & 0x1F) << 7 | opc;
+}
+
+static uint32_t enc_b(uint32_t f3, int rs1, int rs2, int32_t imm) {
+    uint32_t u = (uint32_t)imm;
+    return ((u >> 12) & 1) << 31 | ((u >> 5) & 0x3F) << 25 | (uint32_t)rs2 << 20 | (uint32_t)rs1 << 15 | f3 << 12 |
+           ((u >> 1) & 0xF) << 8 | ((u >> 11) & 1) << 7 | OPC_BRANCH;
+}
+
+static uint32_t enc_u(uint32_t opc, int rd, int32_t imm) {
+    return ((uint32_t)imm & 0xFFFFF000u) | (uint32_t)rd << 7 | opc;
+}
+
+static uint32_t enc_j(int rd, int32_t imm) {
+    uint32_t u = (uint32_t)imm;
+    return ((u >> 20) & 1) << 31 | ((u >> 1) & 0x3FF) << 21 | ((u >> 11) & 1) << 20 | ((u >> 12) & 0xFF) << 12 |
+           (uint32_t)rd << 7 | OPC_JAL;
+}
+
+static int fits_signed(int64_t v, int bits) {
+    return v >= -((int64_t)1 << (bits - 1)) && v < ((int64_t)1 << (bits - 1));
+}
+
+// Encodes a single RV32I base instruction. offset is the pc-relative
+// distance to the target of branches and jumps.
+uint32_t encode_inst(const inst_t i, int32_t offset) {
+    static const uint8_t branch_f3[] = {0, 1, 4, 5, 6, 7};
+    static const uint8_t load_f3[] = {0, 1, 2, 4, 5};
+    static const uint8_t alu_imm_f3[] = {0, 2, 3, 4, 6, 7};
+    static const uint8_t alu_f3[] = {0, 0, 1, 2, 3, 4, 5, 5, 6, 7};
+
+    switch (i->op) {
+        case OP_LUI:
+            return enc_u(OPC_LUI, i->rd, i->imm);
+        case OP_AUIPC:
+            return enc_u(OPC_AUIPC, i->rd, i->imm);
+        case OP_JAL:
+            return enc_j(i->rd, offset);
+        case OP_JALR:
+            return enc_i(OPC_JALR, 0, i->rd, i->rs1, i->imm);
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BGE:
+        case OP_BLTU:
+        case OP_BGEU:
+            return enc_b(branch_f3[i->op - OP_BEQ], i->rs1, i->rs2, offset);
+        case OP_LB:
+        case OP_LH:
+        case OP_LW:
+        case OP_LBU:
+        case OP_LHU:
+            return enc_i(OPC_LOAD, load_f3[i->op - OP_LB], i->rd, i->rs1, i->imm);
+        case OP_SB:
+        case OP_SH:
+        case OP_SW:
+            return enc_s(OPC_STORE, (uint32_t)(i->op - OP_SB), i->rs1, i->rs2, i->imm);
+        case OP_ADDI:
+        case OP_SLTI:
+        case OP_SLTIU:
+        case OP_XORI:
+        case OP_ORI:
+        case OP_ANDI:
+            return enc_i(OPC_OP_IMM, alu_imm_f3[i->op - OP_ADDI], i->rd, i->rs1, i->imm);
+        case OP_SLLI:
+            return enc_r(OPC_OP_IMM, 1, 0x00, i->rd, i->rs1, i->imm & 0x1F);
+        case OP_SRLI:
+            return enc_r(OPC_OP_IMM, 5, 0x00, i->rd, i->rs1, i->imm & 0x1F);
+        case OP_SRAI:
+            return enc_r(OPC_OP_IMM, 5, 0x20, i->rd, i->rs1, i->imm & 0x1F);
+        case OP_ADD:
+        case OP_SUB:
+        case OP_SLL:
+        case OP_SLT:
+        case OP_SLTU:
+        case OP_XOR:
+        case OP_SRL:
+        case OP_SRA:
+        case OP_OR:
+        case OP_AND:
+            return enc_r(OPC_OP, alu_f3[i->op - OP_ADD], (i->op == OP_SUB || i->op == OP_SRA) ? 0x20 : 0x00, i->rd,
+                         i->rs1, i->rs2);
+        case OP_ECALL:
+            return OPC_SYSTEM;
+        case OP_EBREAK:
+            return 1u << 20 | OPC_SYSTEM;
+        default:
+            return 0;
+    }
+}
+
+// ===================== FUNCTIONS =====================
+
+static void put_word(buf_t b, uint32_t w) {
+    char* p = buf_reserve(b, 4);
+    if (!p) {
+        return;
+    }
+
+    p[0] = (char)(w & 0xFF);
+    p[1] = (char)((w >> 8) & 0xFF);
+    p[2] = (char)((w >> 16) & 0xFF);
+    p[3] = (char)(w >> 24);
+    b->len += 4;
+}
+
+static void put_half(buf_t b, uint16_t h) {
+    char* p = buf_reserve(b, 2);
+    if (!p) {
+        return;
+    }
+
+    p[0] = (char)(h & 0xFF);
+    p[1] = (char)(h >> 8);
+    b->len += 2;
+}
+
+static opcode_t invert_branch(opcode_t op) {
+    switch (op) {
+        case OP_BEQ:
+            return OP_BNE;
+        case OP_BNE:
+            return OP_BEQ;
+        case OP_BLT:
+            return OP_BGE;
+        case OP_BGE:
+            return OP_BLT;
+        case OP_BLTU:
+            return OP_BGEU;
+        default:
+            return OP_BLTU;
+    }
+}
+
+// Number of bytes the instruction takes once pseudo instructions
+// are expanded (long_branch: the branch doesn't reach its target)
+static int inst_size(const inst_t i, int long_branch) {
+    if (i->compressed) {
+        return 2;
+    }
+
+    switch (i->op) {
+        case OP_LABEL:
+            return 0;
+        case OP_LI:
+            return fits_signed(i->imm, 12) || !(i->imm & 0xFFF) ? 4 : 8;
+        case OP_LA:
+        case OP_CALL:
+        case OP_TAIL:
+            return 8;
+        default:
+            return inst_is_branch(i) && long_branch ? 8 : 4;
+    }
+}
+
+static int check_operands(mfunc_t f, const inst_t i) {
+    int regs[] = {i->rd, i->rs1, i->rs2};
+    for (int r = 0; r < 3; r++) {
+        if (regs[r] >= R_VIRT) {
+            fprintf(stderr, "Error: virtual register v%d left in %s, registers must be allocated first\n",
+                    regs[r] - R_VIRT, f->name);
+            return 0;
+        }
+    }
+
+    if ((inst_is_branch(i) || i->op == OP_JAL || i->op == OP_LABEL) && (i->label < 0 || i->label >= f->nlabels)) {
+        fprintf(stderr, "Error: invalid label %d in %s\n", i->label, f->name);
+        return 0;
+    }
+
+    int imm_ok = 1;
+    switch (i->op) {
+        case OP_SLLI:
+        case OP_SRLI:
+        case OP_SRAI:
+            imm_ok = i->imm >= 0 && i->imm < 32;
+            break;
+        case OP_JALR:
+        case OP_ADDI:
+        case OP_SLTI:
+        case OP_SLTIU:
+        case OP_XORI:
+        case OP_ORI:
+        case OP_ANDI:
+            imm_ok = fits_signed(i->imm, 12);
+            break;
+        default:
+            imm_ok = !(inst_is_load(i) || inst_is_store(i)) || fits_signed(i->imm, 12);
+            break;
+    }
+
+    if (!imm_ok) {
+        fprintf(stderr, "Error: immediate %d out of range for %s in %s\n", i->imm, opcode_to_str(i->op), f->name);
+    }
+    return imm_ok;
+}
+
+// Checks the operands of f and lays it out until every branch reaches its
+// target: the offset of each instruction goes to offsets, the one of each
+// label to labels, branches that need a jal to reach it are marked in
+// is_long. Compressed branches and jumps that don't reach their target
+// lose their compression. Returns the size of the code, -1 on errors.
+static int layout(mfunc_t f, int* offsets, char* is_long, int* labels) {
+    for (int l = 0; l < f->nlabels; l++) {
+        labels[l] = -1;
+    }
+    for (inst_t i = f->head; i; i = i->next) {
+        if (!check_operands(f, i)) {
+            return -1;
+        }
+        if (i->op == OP_LABEL) {
+            labels[i->label] = 0;
+        }
+    }
+    for (inst_t i = f->head; i; i = i->next) {
+        if ((inst_is_branch(i) || i->op == OP_JAL) && labels[i->label] < 0) {
+            fprintf(stderr, "Error: jump to undefined label %d in %s\n", i->label, f->name);
+            return -1;
+        }
+    }
+
+    // Instructions only grow, so this terminates
+    int size = 0, changed = 1;
+    while (changed) {
+        changed = 0;
+
+        int k = 0;
+        size = 0;
+        for (inst_t i = f->head; i; i = i->next, k++) {
+            offsets[k] = size;
+            if (i->op == OP_LABEL) {
+                labels[i->label] = size;
+            }
+            size += inst_size(i, is_long[k]);
+        }
+
+        k = 0;
+        for (inst_t i = f->head; i; i = i->next, k++) {
+            if (!inst_is_branch(i) && i->op != OP_JAL) {
+                continue;
+            }
+            int32_t target = labels[i->label] - offsets[k];
+            if (i->compressed && !fits_signed(target, inst_is_branch(i) ? 9 : 12)) {
+                i->compressed = 0;
+                changed = 1;
+            } else if (inst_is_branch(i) && !i->compressed && !is_long[k] && !fits_signed(target, 13)) {
+                is_long[k] = 1;
+                changed = 1;
+            }
+        }
+    }
+
+    return size;
+}
+
+// Allocates the arrays of layout and runs it
+static int layout_new(mfunc_t f, int** offsetsp, char** is_longp, int** labelsp) {
+    *offsetsp = (int*)malloc((f->ninsts + 1) * sizeof(int));
+    *is_longp = (char*)calloc(f->ninsts + 1, 1);
+    *labelsp = (int*)malloc((f->nlabels + 1) * sizeof(int));
+    if (!*offsetsp || !*is_longp || !*labelsp) {
+        perror("Error with malloc");
+        return -1;
+    }
+
+    return layout(f, *offsetsp, *is_longp, *labelsp);
+}
+
+// Returns the number of bytes f encodes to, -1 on errors. Like encoding
+// it, this takes the compression away from the branches and jumps that
+// don't reach their target.
+int encode_size(mfunc_t f) {
+    if (!f) {
+        return -1;
+    }
+
+    int* offsets;
+    char* is_long;
+    int* labels;
+    int size = layout_new(f, &offsets, &is_long, &labels);
+
+    free(offsets);
+    free(is_long);
+    free(labels);
+    return size;
+}
+
+// Encodes the function at the end of code, expanding pseudo instructions,
+// compressed instructions in 16 bits. Branches to labels are resolved
+// here, references to symbols are added to relocs with offsets relative
+// to the start of code.
+int encode_function(mfunc_t f, buf_t code, relocs_t relocs) {
+    if (!f || !code || !relocs) {
+        return 0;
+    }
+
+    int* offsets;
+    char* is_long;
+    int* labels;
+    int ok = layout_new(f, &offsets, &is_long, &labels) >= 0;
+
+    uint32_t base = (uint32_t)code->len;
+    int k = 0;
+    for (inst_t i = f->head; ok && i; i = i->next, k++) {
+        int32_t target = i->label >= 0 && i->op != OP_LABEL ? labels[i->label] - offsets[k] : 0;
+        uint32_t at = base + (uint32_t)offsets[k];
+
+        if (i->compressed) {
+            put_half(code, compress_inst(i, target));
+            continue;
+        }
+
+        switch (i->op) {
+            case OP_LABEL: {
+                break;
+            }
+            case OP_LI: {
+                int32_t lo = (int32_t)((uint32_t)i->imm << 20) >> 20;
+                int32_t hi = (int32_t)((uint32_t)i->imm - (uint32_t)lo);
+                if (fits_signed(i->imm, 12)) {
+                    put_word(code, enc_i(OPC_OP_IMM, 0, i->rd, R_ZERO, i->imm));
+                } else {
+                    put_word(code, enc_u(OPC_LUI, i->rd, hi));
+                    if (lo) {
+                        put_word(code, enc_i(OPC_OP_IMM, 0, i->rd, i->rd, lo));
+                    }
+                }
+                break;
+            }
+            case OP_LA: {
+                ok = relocs_add(relocs, at, R_RISCV_HI20, i->sym, i->imm) &&
+                     relocs_add(relocs, at + 4, R_RISCV_LO12_I, i->sym, i->imm);
+                put_word(code, enc_u(OPC_LUI, i->rd, 0));
+                put_word(code, enc_i(OPC_OP_IMM, 0, i->rd, i->rd, 0));
+                break;
+            }
+            case OP_CALL:
+            case OP_TAIL: {
+                // auipc + jalr pair, patched by the linker
+                int link = i->op == OP_CALL ? R_RA : R_ZERO;
+                int tmp = i->op == OP_CALL ? R_RA : R_T1;
+                ok = relocs_add(relocs, at, R_RISCV_CALL, i->sym, 0);
+                put_word(code, enc_u(OPC_AUIPC, tmp, 0));
+                put_word(code, enc_i(OPC_JALR, 0, link, tmp, 0));
+                break;
+            }
+            case OP_JAL: {
+                if (!fits_signed(target, 21)) {
+                    fprintf(stderr, "Error: jump out of range in %s\n", f->name);
+                    ok = 0;
+                    break;
+                }
+                put_word(code, encode_inst(i, target));
+                break;
+            }
+            default: {
+                if (inst_is_branch(i) && is_long[k]) {
+                    // Skip over a jal to the target when the condition is false
+                    _inst inv = *i;
+                    inv.op = invert_branch(i->op);
+                    put_word(code, encode_inst(&inv, 8));
+                    put_word(code, enc_j(R_ZERO, target - 4));
+                    break;
+                }
+                put_word(code, encode_inst(i, target));
+                break;
+            }
+        }
+    }
+
+    free(offsets);
+    free(is_long);
+    free(labels);
+    return ok;
+}
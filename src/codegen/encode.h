@@ -0,0 +1,48 @@
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include <stdint.h>
+#include "mfunc.h"
+#include "utils/buf.h"
+
+// A reference to a symbol that the linker has to patch
+typedef struct reloc {
+    // Offset of the instruction from the start of the code buffer
+    uint32_t offset;
+
+    // One of the R_RISCV_* relocation types
+    int type;
+
+    // Points into the instruction that references it
+    const char* sym;
+    int32_t addend;
+} reloc_t;
+
+typedef struct relocs _relocs, *relocs_t;
+
+struct relocs {
+    reloc_t* items;
+    int n;
+    int cap;
+};
+
+relocs_t relocs_new();
+int relocs_add(relocs_t r, uint32_t offset, int type, const char* sym, int32_t addend);
+void relocs_free(relocs_t* rp);
+
+// Encodes a single RV32I base instruction. offset is the pc-relative
+// distance to the target of branches and jumps.
+uint32_t encode_inst(const inst_t i, int32_t offset);
+
+// Returns the number of bytes f encodes to, -1 on errors. Like encoding
+// it, this takes the compression away from the branches and jumps that
+// don't reach their target.
+int encode_size(mfunc_t f);
+
+// Encodes the function at the end of code, expanding pseudo instructions,
+// compressed instructions in 16 bits. Branches to labels are resolved
+// here, references to symbols are added to relocs with offsets relative
+// to the start of code.
+int encode_function(mfunc_t f, buf_t code, relocs_t relocs);
+
+#endif
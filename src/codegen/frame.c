@@ -0,0 +1,191 @@
+#include "frame.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Largest frame that a single addi can allocate
+#define FRAME_IMM_MAX 2047
+
+// Moves sp by amount before pos, through t0 if it doesn't fit an addi
+static int adjust_sp(mfunc_t f, inst_t pos, int amount) {
+    if (amount >= -FRAME_IMM_MAX - 1 && amount <= FRAME_IMM_MAX) {
+        return mfunc_insert_before(f, pos, inst_new_i(OP_ADDI, R_SP, R_SP, R_NONE, amount));
+    }
+
+    return mfunc_insert_before(f, pos, inst_new_i(OP_LI, R_T0, R_NONE, R_NONE, amount)) &&
+           mfunc_insert_before(f, pos, inst_new_r(OP_ADD, R_SP, R_SP, R_T0));
+}
+
+// Returns 1 if the address of the frame is used as a value (passed to a
+// callee or stored), sp as the base of a load or store doesn't count
+static int frame_escapes(mfunc_t f) {
+    for (inst_t i = f->head; i; i = i->next) {
+        int uses[2];
+        int n = inst_uses(i, uses);
+        for (int k = 0; k < n; k++) {
+            if (uses[k] == R_SP && !((inst_is_load(i) || inst_is_store(i)) && i->rs1 == R_SP && i->rs2 != R_SP)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Returns 1 if control goes straight from after i to a ret,
+// through labels and jumps only
+static int returns_after(const inst_t i, inst_t* labels, int nlabels) {
+    inst_t p = i->next;
+    for (int steps = 0; p && steps < 16; steps++) {
+        if (inst_is_ret(p)) {
+            return 1;
+        }
+        if (p->op == OP_LABEL) {
+            p = p->next;
+        } else if (p->op == OP_JAL && p->rd == R_ZERO && p->label >= 0 && p->label < nlabels) {
+            p = labels[p->label];
+        } else {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// Turns the calls followed by a ret into tail calls, which return
+// straight to the caller, and the recursive ones into a jump back to
+// the start of the body (*entry, a new label that has to be placed after
+// the prologue, stays -1 if there aren't any). Arguments passed on the
+// stack live in the frame, so a function that passes some keeps its calls.
+static int tail_calls(mfunc_t f, int* entry) {
+    *entry = -1;
+    if (frame_escapes(f) || f->out_size) {
+        return 1;
+    }
+
+    inst_t* labels = (inst_t*)calloc(f->nlabels + 1, sizeof(inst_t));
+    if (!labels) {
+        perror("Error with calloc");
+        return 0;
+    }
+    for (inst_t i = f->head; i; i = i->next) {
+        if (i->op == OP_LABEL && i->label >= 0 && i->label < f->nlabels) {
+            labels[i->label] = i;
+        }
+    }
+
+    for (inst_t i = f->head; i; i = i->next) {
+        if (i->op != OP_CALL || !returns_after(i, labels, f->nlabels)) {
+            continue;
+        }
+
+        if (!strcmp(i->sym, f->name)) {
+            if (*entry < 0) {
+                *entry = mfunc_new_label(f);
+            }
+            free(i->sym);
+            i->sym = NULL;
+            i->op = OP_JAL;
+            i->rd = R_ZERO;
+            i->label = *entry;
+        } else {
+            i->op = OP_TAIL;
+            i->rd = R_ZERO;
+        }
+
+        // What directly follows can't be reached anymore
+        if (i->next && (inst_is_ret(i->next) || (i->next->op == OP_JAL && i->next->rd == R_ZERO))) {
+            mfunc_remove(f, i->next);
+        }
+    }
+
+    free(labels);
+    return 1;
+}
+
+// Adds the prologue and the epilogues (before every ret and tail) of an
+// allocated function, once the calls in tail position became jumps. The
+// frame holds the outgoing stack arguments at the bottom, the stack
+// slots, then ra if the function makes calls and the callee-saved
+// registers it writes, and its size is kept a multiple of 16. A function
+// that needs none of them gets no frame.
+int frame_lower(mfunc_t f) {
+    if (!f) {
+        return 0;
+    }
+    if (f->nvregs) {
+        fprintf(stderr, "Error: %s has virtual registers left, allocate them first\n", f->name);
+        return 0;
+    }
+
+    int entry;
+    if (!tail_calls(f, &entry)) {
+        return 0;
+    }
+
+    int written[R_VIRT] = {0};
+    for (inst_t i = f->head; i; i = i->next) {
+        int r = inst_def(i);
+        if (r > R_ZERO && r < R_VIRT) {
+            written[r] = 1;
+        }
+    }
+
+    int saved[R_VIRT];
+    int nsaved = 0;
+    for (int r = 0; r < R_VIRT; r++) {
+        if (written[r] && r != R_SP && (r == R_RA || reg_is_callee_saved(r))) {
+            saved[nsaved++] = r;
+        }
+    }
+
+    // Saved registers go above the slots, so sp-relative slot offsets stay
+    // valid. A large frame is allocated in two steps to keep them in range.
+    int save_size = (4 * nsaved + 15) & -16;
+    int locals = (f->out_size + f->frame_size + 15) & -16;
+    int split = save_size + locals > FRAME_IMM_MAX;
+    int base = split ? 0 : locals;
+    int size = save_size + locals;
+
+    // The slots are above the outgoing arguments, the incoming
+    // ones above the whole frame
+    for (inst_t i = f->head; i; i = i->next) {
+        if ((inst_is_load(i) || inst_is_store(i)) && i->rs1 == R_SP) {
+            i->imm += i->area == FRAME_SLOTS ? f->out_size : i->area == FRAME_INCOMING ? size : 0;
+        }
+    }
+
+    inst_t first = f->head;
+    if (size && !adjust_sp(f, first, split ? -save_size : -size)) {
+        return 0;
+    }
+    for (int k = 0; k < nsaved; k++) {
+        if (!mfunc_insert_before(f, first, inst_new_i(OP_SW, R_NONE, R_SP, saved[k], base + save_size - 4 * (k + 1)))) {
+            return 0;
+        }
+    }
+    if (split && !adjust_sp(f, first, -locals)) {
+        return 0;
+    }
+    if (entry >= 0 && !mfunc_insert_before(f, first, inst_new_label(entry))) {
+        return 0;
+    }
+
+    for (inst_t i = first; size && i; i = i->next) {
+        if (!inst_is_ret(i) && i->op != OP_TAIL) {
+            continue;
+        }
+
+        if (split && !adjust_sp(f, i, locals)) {
+            return 0;
+        }
+        for (int k = 0; k < nsaved; k++) {
+            if (!mfunc_insert_before(f, i, inst_new_i(OP_LW, saved[k], R_SP, R_NONE, base + save_size - 4 * (k + 1)))) {
+                return 0;
+            }
+        }
+        if (!adjust_sp(f, i, split ? save_size : size)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
@@ -0,0 +1,14 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "mfunc.h"
+
+// Adds the prologue and the epilogues (before every ret and tail) of an
+// allocated function, once the calls in tail position became jumps. The
+// frame holds the outgoing stack arguments at the bottom, the stack
+// slots, then ra if the function makes calls and the callee-saved
+// registers it writes, and its size is kept a multiple of 16. A function
+// that needs none of them gets no frame.
+int frame_lower(mfunc_t f);
+
+#endif
@@ -0,0 +1,621 @@
+#include "gvn.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arith.h"
+#include "cfg.h"
+
+// No value number, or a register whose value is unknown
+#define NO_VN -1
+
+// The value number of zero
+#define VN_ZERO 0
+
+// What an instruction computes: an opcode applied to value numbers
+typedef struct expr {
+    opcode_t op;
+    int a;
+    int b;
+    int32_t imm;
+    const char* sym;
+    frame_area_t area;
+} expr_t;
+
+typedef struct entry {
+    expr_t expr;
+    int vn;
+
+    // Memory state a load read, -1 for the values that don't depend on memory
+    int epoch;
+
+    // Bucket of the entry, and the entry it hides there
+    int bucket;
+    int next;
+} entry_t;
+
+// A change of the register holding a value number, undone with its scope
+typedef struct undo {
+    int vn;
+    int reg;
+} undo_t;
+
+// The previous state of a register written in a block
+typedef struct saved {
+    int reg;
+    int vn;
+    int stamp;
+    int span;
+} saved_t;
+
+typedef struct gvn {
+    mfunc_t f;
+    cfg_t g;
+    gvn_stats_t* stats;
+
+    // Registers written once, by an instruction that dominates their uses
+    char* stable;
+
+    // Value number of each register. Those of the other registers are only
+    // valid in the run of blocks they were set in: a block continues the
+    // run of its immediate dominator when it's its only predecessor. The
+    // visits are numbered in order, a run starts at chain.
+    int* vn;
+    int* stamp;
+    int visit;
+    int chain;
+    saved_t* saved;
+    int nsaved;
+
+    // Register holding each value number, R_NONE if none is known
+    int* holder;
+    int nvns;
+    int cap;
+
+    // Expressions of the dominating blocks, newest first in each bucket
+    entry_t* entries;
+    int nentries;
+    int* buckets;
+    unsigned mask;
+
+    undo_t* undo;
+    int nundo;
+
+    // Memory state: changed by every store and call, and at the start of
+    // the blocks that can be entered from somewhere else than their
+    // immediate dominator
+    int epoch;
+    int epochs;
+    int* end_epoch;
+
+    // Stretch of code without calls, numbered the same way, and the one
+    // each register was written in: a value cheap to compute isn't kept
+    // alive across a call, that would take a callee-saved register
+    int span;
+    int spans;
+    int* end_span;
+    int* def_span;
+
+    // Dominator tree: first child and next sibling of each block
+    int* child;
+    int* sibling;
+
+    // Register the uses of each stable register are redirected to
+    int* rename;
+} gvn_t;
+
+// ===================== VALUE NUMBERS =====================
+
+static int fresh(gvn_t* s) {
+    // The capacity covers every number the instructions can make
+    s->holder[s->nvns] = R_NONE;
+    return s->nvns++;
+}
+
+// Value number of r at this point, without making one up
+static int current(const gvn_t* s, int r) {
+    if (r == R_ZERO) {
+        return VN_ZERO;
+    }
+    if (s->stable[r] || s->stamp[r] >= s->chain) {
+        return s->vn[r];
+    }
+    return NO_VN;
+}
+
+// Sets the value number of r, the previous one comes back with the scope
+static void set(gvn_t* s, int r, int vn) {
+    s->saved[s->nsaved++] = (saved_t){r, s->vn[r], s->stamp[r], s->def_span[r]};
+    s->vn[r] = vn;
+    s->stamp[r] = s->visit;
+    s->def_span[r] = s->span;
+}
+
+// Value number of r read at this point, a new one if it's unknown
+static int value(gvn_t* s, int r) {
+    int vn = current(s, r);
+    if (vn == NO_VN) {
+        vn = fresh(s);
+        set(s, r, vn);
+    }
+    return vn;
+}
+
+// The register that still holds vn, R_NONE if none does
+static int holder(const gvn_t* s, int vn) {
+    int h = s->holder[vn];
+    return h != R_NONE && h != R_ZERO && current(s, h) == vn ? h : R_NONE;
+}
+
+// r now holds vn. It becomes the holder of vn if there is none, or if
+// the holder is only valid within its block and r isn't.
+static void define(gvn_t* s, int r, int vn) {
+    if (r == R_NONE || r == R_ZERO) {
+        return;
+    }
+    set(s, r, vn);
+
+    int h = holder(s, vn);
+    if (r != R_SP && (h == R_NONE || (!s->stable[h] && s->stable[r]))) {
+        s->undo[s->nundo++] = (undo_t){vn, s->holder[vn]};
+        s->holder[vn] = r;
+    }
+}
+
+// The value of r is unknown from now on
+static void kill(gvn_t* s, int r) {
+    if (r != R_ZERO) {
+        set(s, r, NO_VN);
+    }
+}
+
+// ===================== EXPRESSIONS =====================
+
+static unsigned hash(const expr_t* e) {
+    unsigned h = (unsigned)e->op;
+    h = h * 31u + (unsigned)e->a;
+    h = h * 31u + (unsigned)e->b;
+    h = h * 31u + (unsigned)e->imm;
+    h = h * 31u + (unsigned)e->area;
+    for (const char* c = e->sym; c && *c; c++) {
+        h = h * 31u + (unsigned char)*c;
+    }
+    return h ^ (h >> 16);
+}
+
+static int same(const expr_t* x, const expr_t* y) {
+    return x->op == y->op && x->a == y->a && x->b == y->b && x->imm == y->imm && x->area == y->area &&
+           (x->sym == y->sym || (x->sym && y->sym && !strcmp(x->sym, y->sym)));
+}
+
+static entry_t* lookup(gvn_t* s, const expr_t* e) {
+    for (int k = s->buckets[hash(e) & s->mask]; k >= 0; k = s->entries[k].next) {
+        if (same(&s->entries[k].expr, e)) {
+            return &s->entries[k];
+        }
+    }
+    return NULL;
+}
+
+static void insert(gvn_t* s, const expr_t* e, int vn, int epoch) {
+    int bucket = hash(e) & s->mask;
+    s->entries[s->nentries] = (entry_t){*e, vn, epoch, bucket, s->buckets[bucket]};
+    s->buckets[bucket] = s->nentries++;
+}
+
+// Operands of a commutative operation are ordered by value number
+static void order(expr_t* e) {
+    if (e->a > e->b) {
+        int t = e->a;
+        e->a = e->b;
+        e->b = t;
+    }
+}
+
+// Describes the value i computes. Returns 0 if it isn't a function of
+// its operands (and of memory for loads) only.
+static int expression(gvn_t* s, const inst_t i, expr_t* e) {
+    memset(e, 0, sizeof(*e));
+    e->op = i->op;
+    e->a = e->b = NO_VN;
+    e->area = FRAME_SLOTS;
+
+    if (i->op == OP_CALL) {
+        if (!arith_is_helper(i->sym)) {
+            return 0;
+        }
+        e->sym = i->sym;
+        e->a = value(s, R_A0);
+        e->b = value(s, R_A1);
+        if (!strcmp(i->sym, ARITH_MUL_HELPER)) {
+            order(e);
+        }
+        return 1;
+    }
+
+    if (i->rd == R_NONE || i->rd == R_ZERO || i->rd == R_SP) {
+        return 0;
+    }
+
+    switch (i->op) {
+        case OP_ADDI:
+            if (i->rs1 == R_ZERO) {
+                e->op = OP_LI;
+                e->imm = i->imm;
+                return 1;
+            }
+            // fall through
+        case OP_SLTI:
+        case OP_SLTIU:
+        case OP_XORI:
+        case OP_ORI:
+        case OP_ANDI:
+        case OP_SLLI:
+        case OP_SRLI:
+        case OP_SRAI:
+            e->a = value(s, i->rs1);
+            e->imm = i->imm;
+            return 1;
+        case OP_ADD:
+        case OP_AND:
+        case OP_OR:
+        case OP_XOR:
+            e->a = value(s, i->rs1);
+            e->b = value(s, i->rs2);
+            order(e);
+            return 1;
+        case OP_SUB:
+        case OP_SLL:
+        case OP_SLT:
+        case OP_SLTU:
+        case OP_SRL:
+        case OP_SRA:
+            e->a = value(s, i->rs1);
+            e->b = value(s, i->rs2);
+            return 1;
+        case OP_LB:
+        case OP_LH:
+        case OP_LW:
+        case OP_LBU:
+        case OP_LHU:
+            e->a = value(s, i->rs1);
+            e->imm = i->imm;
+            e->area = i->area;
+            return 1;
+        case OP_LI:
+        case OP_LUI:
+            e->imm = i->imm;
+            return 1;
+        case OP_LA:
+            e->sym = i->sym;
+            e->imm = i->imm;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Loading a constant that fits an addi is as cheap as copying it
+static int rematerialized(const expr_t* e) {
+    return (e->op == OP_LI || e->op == OP_LUI) && (e->op == OP_LUI || (e->imm >= -2048 && e->imm < 2048));
+}
+
+// ===================== NUMBERING =====================
+
+// Turns i into rd = h
+static void make_copy(inst_t i, int rd, int h) {
+    free(i->sym);
+    i->sym = NULL;
+    i->op = OP_ADDI;
+    i->rd = rd;
+    i->rs1 = h;
+    i->rs2 = R_NONE;
+    i->imm = 0;
+    i->area = FRAME_SLOTS;
+}
+
+// A copy of a register written once into another one: its uses can
+// read the source (or any stable register holding the same value)
+static void propagate(gvn_t* s, int rd, int vn) {
+    int h = holder(s, vn);
+    if (reg_is_virtual(rd) && s->stable[rd] && h != R_NONE && h != rd && s->stable[h]) {
+        s->rename[rd] = h;
+        s->stats->copies++;
+    }
+}
+
+static void number(gvn_t* s, inst_t i) {
+    if (i->op == OP_LABEL) {
+        return;
+    }
+
+    // Copies carry the value of their source
+    if (i->op == OP_ADDI && i->imm == 0 && i->rs1 != R_ZERO && i->rd != R_NONE && i->rd != R_ZERO && i->rd != R_SP) {
+        int vn = value(s, i->rs1);
+        propagate(s, i->rd, vn);
+        define(s, i->rd, vn);
+        return;
+    }
+
+    expr_t e;
+    if (expression(s, i, &e)) {
+        int load = inst_is_load(i), call = i->op == OP_CALL;
+        int rd = call ? R_A0 : i->rd;
+        entry_t* hit = lookup(s, &e);
+        if (hit && load && hit->epoch != s->epoch) {
+            hit = NULL;
+        }
+
+        int vn = hit ? hit->vn : fresh(s);
+        int h = hit ? holder(s, vn) : R_NONE;
+        if (!hit) {
+            insert(s, &e, vn, load ? s->epoch : -1);
+        }
+
+        int across_call = h != R_NONE && !load && !call && s->def_span[h] != s->span;
+        if (h != R_NONE && (h == rd || (!rematerialized(&e) && !across_call))) {
+            if (h == rd) {
+                // Recomputes what its destination already holds
+                mfunc_remove(s->f, i);
+            } else {
+                make_copy(i, rd, h);
+                propagate(s, rd, vn);
+            }
+            if (call) {
+                s->stats->calls++;
+            } else if (load) {
+                s->stats->loads++;
+            } else {
+                s->stats->exprs++;
+            }
+            define(s, rd, vn);
+            return;
+        }
+
+        if (call) {
+            int regs[CFG_MAX_REGS];
+            int n = cfg_inst_defs(i, regs);
+            for (int r = 0; r < n; r++) {
+                kill(s, regs[r]);
+            }
+        }
+        define(s, rd, vn);
+        return;
+    }
+
+    // Anything else may change memory or writes a value of its own
+    if (inst_is_store(i) || inst_is_call(i) || i->op == OP_ECALL) {
+        s->epoch = ++s->epochs;
+    }
+    if (inst_is_call(i)) {
+        s->span = ++s->spans;
+    }
+    int regs[CFG_MAX_REGS];
+    int n = cfg_inst_defs(i, regs);
+    for (int r = 0; r < n; r++) {
+        kill(s, regs[r]);
+    }
+}
+
+// Numbers the block and the ones it dominates, the expressions of the
+// block are forgotten once they're done
+static void visit(gvn_t* s, int k) {
+    block_t b = &s->g->blocks[k];
+    int nentries = s->nentries, nundo = s->nundo, nsaved = s->nsaved, chain = s->chain;
+
+    int entered = k && b->npreds == 1 && b->preds[0] == b->idom;
+    s->visit++;
+    if (!entered) {
+        s->chain = s->visit;
+    }
+    s->epoch = entered ? s->end_epoch[b->idom] : ++s->epochs;
+    s->span = entered ? s->end_span[b->idom] : ++s->spans;
+
+    for (inst_t i = b->first, next, end = b->last->next; i != end; i = next) {
+        next = i->next;
+        number(s, i);
+    }
+    s->end_epoch[k] = s->epoch;
+    s->end_span[k] = s->span;
+
+    for (int c = s->child[k]; c >= 0; c = s->sibling[c]) {
+        visit(s, c);
+    }
+
+    while (s->nentries > nentries) {
+        entry_t* e = &s->entries[--s->nentries];
+        s->buckets[e->bucket] = e->next;
+    }
+    while (s->nundo > nundo) {
+        undo_t u = s->undo[--s->nundo];
+        s->holder[u.vn] = u.reg;
+    }
+    while (s->nsaved > nsaved) {
+        saved_t r = s->saved[--s->nsaved];
+        s->vn[r.reg] = r.vn;
+        s->stamp[r.reg] = r.stamp;
+        s->def_span[r.reg] = r.span;
+    }
+    s->chain = chain;
+}
+
+// ===================== SETUP =====================
+
+// Marks the virtual registers written once by an instruction that
+// dominates all their uses
+static int find_stable(gvn_t* s) {
+    cfg_t g = s->g;
+    int* defs = (int*)calloc(g->nregs, sizeof(int));
+    int* def_block = (int*)malloc(g->nregs * sizeof(int));
+    int* def_pos = (int*)malloc(g->nregs * sizeof(int));
+    if (!defs || !def_block || !def_pos) {
+        perror("Error with malloc");
+        free(defs);
+        free(def_block);
+        free(def_pos);
+        return 0;
+    }
+
+    int regs[CFG_MAX_REGS];
+    int pos = 0;
+    for (int k = 0; k < g->nblocks; k++) {
+        block_t b = &g->blocks[k];
+        for (inst_t i = b->first;; i = i->next, pos++) {
+            int n = cfg_inst_defs(i, regs);
+            for (int r = 0; r < n; r++) {
+                defs[regs[r]]++;
+                def_block[regs[r]] = k;
+                def_pos[regs[r]] = pos;
+            }
+            if (i == b->last) {
+                break;
+            }
+        }
+    }
+    for (int r = R_VIRT; r < g->nregs; r++) {
+        s->stable[r] = defs[r] == 1;
+    }
+
+    pos = 0;
+    for (int k = 0; k < g->nblocks; k++) {
+        block_t b = &g->blocks[k];
+        for (inst_t i = b->first;; i = i->next, pos++) {
+            int n = cfg_inst_uses(i, regs);
+            for (int r = 0; r < n; r++) {
+                int u = regs[r];
+                if (s->stable[u] && (def_block[u] == k ? def_pos[u] >= pos : !cfg_dominates(g, def_block[u], k))) {
+                    s->stable[u] = 0;
+                }
+            }
+            if (i == b->last) {
+                break;
+            }
+        }
+    }
+
+    free(defs);
+    free(def_block);
+    free(def_pos);
+    return 1;
+}
+
+static void gvn_free(gvn_t* s) {
+    cfg_free(&s->g);
+    free(s->stable);
+    free(s->vn);
+    free(s->stamp);
+    free(s->holder);
+    free(s->entries);
+    free(s->buckets);
+    free(s->undo);
+    free(s->saved);
+    free(s->end_epoch);
+    free(s->end_span);
+    free(s->def_span);
+    free(s->child);
+    free(s->sibling);
+    free(s->rename);
+}
+
+static int gvn_init(gvn_t* s, mfunc_t f, gvn_stats_t* stats) {
+    memset(s, 0, sizeof(*s));
+    s->f = f;
+    s->stats = stats;
+    s->g = cfg_build(f);
+    if (!s->g || !cfg_dominators(s->g)) {
+        return 0;
+    }
+
+    cfg_t g = s->g;
+    int n = f->ninsts + 1;
+    unsigned size = 16;
+    while (size < 2u * (unsigned)n) {
+        size *= 2;
+    }
+    s->mask = size - 1;
+    s->cap = n * (CFG_MAX_REGS + 1) + 1;
+
+    s->stable = (char*)calloc(g->nregs, 1);
+    s->vn = (int*)malloc(g->nregs * sizeof(int));
+    s->stamp = (int*)calloc(g->nregs, sizeof(int));
+    s->holder = (int*)malloc(s->cap * sizeof(int));
+    s->entries = (entry_t*)malloc(n * sizeof(entry_t));
+    s->buckets = (int*)malloc(size * sizeof(int));
+    s->undo = (undo_t*)malloc(n * sizeof(undo_t));
+    s->saved = (saved_t*)malloc(n * (CFG_MAX_REGS + 3) * sizeof(saved_t));
+    s->end_epoch = (int*)calloc(g->nblocks + 1, sizeof(int));
+    s->end_span = (int*)calloc(g->nblocks + 1, sizeof(int));
+    s->def_span = (int*)calloc(g->nregs, sizeof(int));
+    s->child = (int*)malloc((g->nblocks + 1) * sizeof(int));
+    s->sibling = (int*)malloc((g->nblocks + 1) * sizeof(int));
+    s->rename = (int*)malloc(g->nregs * sizeof(int));
+    if (!s->stable || !s->vn || !s->stamp || !s->holder || !s->entries || !s->buckets || !s->undo || !s->saved || !s->end_epoch ||
+        !s->end_span || !s->def_span || !s->child || !s->sibling || !s->rename) {
+        perror("Error with malloc");
+        return 0;
+    }
+
+    for (int r = 0; r < g->nregs; r++) {
+        s->vn[r] = NO_VN;
+        s->rename[r] = r;
+    }
+    memset(s->buckets, -1, size * sizeof(int));
+
+    // Children in layout order
+    for (int k = 0; k <= g->nblocks; k++) {
+        s->child[k] = s->sibling[k] = -1;
+    }
+    for (int k = g->nblocks - 1; k > 0; k--) {
+        int idom = g->blocks[k].idom;
+        if (idom >= 0 && g->blocks[k].rpo >= 0) {
+            s->sibling[k] = s->child[idom];
+            s->child[idom] = k;
+        }
+    }
+
+    s->visit = 0;
+    s->nvns = VN_ZERO;
+    fresh(s);
+    return find_stable(s);
+}
+
+// Global value numbering over the dominator tree of f: an instruction
+// computing a value that a dominating one already computed (same opcode
+// on the same value numbers, operands of commutative ones in a canonical
+// order) becomes a copy of it. Loads are reused until a store or a call
+// may have changed memory, pure runtime helper calls (multiplications,
+// divisions) like arithmetic. Registers written more than once are only
+// numbered within their block. The copies left behind are dead once
+// their uses are redirected and go with dead code elimination. The
+// statistics of stats (optional) are incremented.
+int gvn(mfunc_t f, gvn_stats_t* stats) {
+    if (!f) {
+        return 0;
+    }
+    if (!f->head) {
+        return 1;
+    }
+
+    gvn_stats_t local = {0};
+    gvn_t s;
+    if (!gvn_init(&s, f, stats ? stats : &local)) {
+        gvn_free(&s);
+        return 0;
+    }
+
+    // Dominators mean nothing when an indirect jump can go anywhere
+    if (!s.g->indirect) {
+        visit(&s, 0);
+
+        for (inst_t i = f->head; i; i = i->next) {
+            int* ops[] = {&i->rs1, &i->rs2};
+            for (int k = 0; k < 2; k++) {
+                while (*ops[k] >= R_VIRT && *ops[k] < s.g->nregs && s.rename[*ops[k]] != *ops[k]) {
+                    *ops[k] = s.rename[*ops[k]];
+                }
+            }
+        }
+    }
+
+    gvn_free(&s);
+    return 1;
+}
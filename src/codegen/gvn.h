@@ -0,0 +1,30 @@
+#ifndef GVN_H
+#define GVN_H
+
+#include "mfunc.h"
+
+// What value numbering did to a function
+typedef struct gvn_stats {
+    // Arithmetic instructions, loads and runtime helper calls whose value
+    // was already in a register, replaced by a copy of it
+    int exprs;
+    int loads;
+    int calls;
+
+    // Copies between registers written once whose uses now read the
+    // source directly
+    int copies;
+} gvn_stats_t;
+
+// Global value numbering over the dominator tree of f: an instruction
+// computing a value that a dominating one already computed (same opcode
+// on the same value numbers, operands of commutative ones in a canonical
+// order) becomes a copy of it. Loads are reused until a store or a call
+// may have changed memory, pure runtime helper calls (multiplications,
+// divisions) like arithmetic. Registers written more than once are only
+// numbered within their block. The copies left behind are dead once
+// their uses are redirected and go with dead code elimination. The
+// statistics of stats (optional) are incremented.
+int gvn(mfunc_t f, gvn_stats_t* stats);
+
+#endif
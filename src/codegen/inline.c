@@ -0,0 +1,321 @@
+#include "inline.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ===================== CALL GRAPH =====================
+
+typedef struct callgraph {
+    module_t m;
+
+    // Functions of the module called by each function
+    int** callees;
+    int* ncallees;
+
+    // Strongly connected component of each function, and whether
+    // the function is part of a cycle (including calling itself)
+    int* scc;
+    char* recursive;
+
+    // Functions in the order their component was closed: callees first
+    int* order;
+    int norder;
+
+    // Tarjan's state
+    int* index;
+    int* lowlink;
+    char* onstack;
+    int* stack;
+    int nstack;
+    int counter;
+    int nscc;
+} callgraph_t;
+
+static int func_index(module_t m, const char* name) {
+    for (int k = 0; name && k < m->nfuncs; k++) {
+        if (!strcmp(m->funcs[k]->name, name)) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+static void callgraph_free(callgraph_t* g) {
+    for (int k = 0; g->callees && k < g->m->nfuncs; k++) {
+        free(g->callees[k]);
+    }
+    free(g->callees);
+    free(g->ncallees);
+    free(g->scc);
+    free(g->recursive);
+    free(g->order);
+    free(g->index);
+    free(g->lowlink);
+    free(g->onstack);
+    free(g->stack);
+}
+
+static void strongconnect(callgraph_t* g, int v) {
+    g->index[v] = g->lowlink[v] = g->counter++;
+    g->stack[g->nstack++] = v;
+    g->onstack[v] = 1;
+
+    for (int k = 0; k < g->ncallees[v]; k++) {
+        int w = g->callees[v][k];
+        if (w == v) {
+            g->recursive[v] = 1;
+        }
+        if (g->index[w] < 0) {
+            strongconnect(g, w);
+            if (g->lowlink[w] < g->lowlink[v]) {
+                g->lowlink[v] = g->lowlink[w];
+            }
+        } else if (g->onstack[w] && g->index[w] < g->lowlink[v]) {
+            g->lowlink[v] = g->index[w];
+        }
+    }
+
+    if (g->lowlink[v] != g->index[v]) {
+        return;
+    }
+
+    // v is the root of a component, pop it
+    int first = g->norder, w;
+    do {
+        w = g->stack[--g->nstack];
+        g->onstack[w] = 0;
+        g->scc[w] = g->nscc;
+        g->order[g->norder++] = w;
+    } while (w != v);
+
+    if (g->norder - first > 1) {
+        for (int k = first; k < g->norder; k++) {
+            g->recursive[g->order[k]] = 1;
+        }
+    }
+    g->nscc++;
+}
+
+static int callgraph_build(callgraph_t* g, module_t m) {
+    memset(g, 0, sizeof(*g));
+    g->m = m;
+
+    int n = m->nfuncs;
+    g->callees = (int**)calloc(n + 1, sizeof(int*));
+    g->ncallees = (int*)calloc(n + 1, sizeof(int));
+    g->scc = (int*)calloc(n + 1, sizeof(int));
+    g->recursive = (char*)calloc(n + 1, 1);
+    g->order = (int*)calloc(n + 1, sizeof(int));
+    g->index = (int*)calloc(n + 1, sizeof(int));
+    g->lowlink = (int*)calloc(n + 1, sizeof(int));
+    g->onstack = (char*)calloc(n + 1, 1);
+    g->stack = (int*)calloc(n + 1, sizeof(int));
+    if (!g->callees || !g->ncallees || !g->scc || !g->recursive || !g->order || !g->index || !g->lowlink ||
+        !g->onstack || !g->stack) {
+        perror("Error with calloc");
+        return 0;
+    }
+
+    for (int k = 0; k < n; k++) {
+        mfunc_t f = m->funcs[k];
+        g->callees[k] = (int*)malloc((f->ninsts + 1) * sizeof(int));
+        if (!g->callees[k]) {
+            perror("Error with malloc");
+            return 0;
+        }
+
+        for (inst_t i = f->head; i; i = i->next) {
+            int callee = (i->op == OP_CALL || i->op == OP_TAIL) ? func_index(m, i->sym) : -1;
+            if (callee >= 0) {
+                g->callees[k][g->ncallees[k]++] = callee;
+            }
+        }
+        g->index[k] = -1;
+    }
+
+    for (int k = 0; k < n; k++) {
+        if (g->index[k] < 0) {
+            strongconnect(g, k);
+        }
+    }
+    return 1;
+}
+
+// ===================== INLINING =====================
+
+// Instructions of the function, without its labels
+static int func_size(mfunc_t f) {
+    int n = 0;
+    for (inst_t i = f->head; i; i = i->next) {
+        n += i->op != OP_LABEL;
+    }
+    return n;
+}
+
+// A body can be copied into another function if it only returns through
+// ret, has no stack slots and doesn't otherwise touch ra or sp
+static int can_inline(mfunc_t f) {
+    if (f->frame_size) {
+        return 0;
+    }
+
+    for (inst_t i = f->head; i; i = i->next) {
+        if (inst_is_ret(i) || i->op == OP_CALL || i->op == OP_TAIL) {
+            continue;
+        }
+        if (i->op == OP_JALR || (i->op == OP_JAL && i->rd != R_ZERO)) {
+            return 0;
+        }
+
+        int uses[2];
+        int n = inst_uses(i, uses);
+        for (int k = 0; k < n; k++) {
+            if (uses[k] == R_RA || uses[k] == R_SP) {
+                return 0;
+            }
+        }
+        if (i->rd == R_RA || i->rd == R_SP) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Callee register or label renamed into the caller, allocated on first use
+static int renamed(int* map, int k, int (*fresh)(mfunc_t), mfunc_t caller) {
+    if (map[k] < 0) {
+        map[k] = fresh(caller);
+    }
+    return map[k];
+}
+
+static int insert(mfunc_t f, inst_t pos, inst_t i) {
+    if (!i || !mfunc_insert_before(f, pos, i)) {
+        inst_free(&i);
+        return 0;
+    }
+    return 1;
+}
+
+// Replaces the call site by a copy of the callee's body: its virtual
+// registers and labels are renamed, and for a call its returns jump past
+// the call site (a tail call site keeps them as returns of the caller)
+static int inline_call(mfunc_t caller, inst_t site, mfunc_t callee) {
+    int* vregs = (int*)malloc((callee->nvregs + 1) * sizeof(int));
+    int* labels = (int*)malloc((callee->nlabels + 1) * sizeof(int));
+    if (!vregs || !labels) {
+        perror("Error with malloc");
+        free(vregs);
+        free(labels);
+        return 0;
+    }
+    memset(vregs, -1, (callee->nvregs + 1) * sizeof(int));
+    memset(labels, -1, (callee->nlabels + 1) * sizeof(int));
+
+    int tail = site->op == OP_TAIL;
+    int after = tail ? -1 : mfunc_new_label(caller);
+    int ok = 1;
+
+    for (inst_t i = callee->head; ok && i; i = i->next) {
+        if (!tail && (inst_is_ret(i) || i->op == OP_TAIL)) {
+            if (i->op == OP_TAIL) {
+                ok = insert(caller, site, inst_new_sym(OP_CALL, R_RA, i->sym));
+            }
+            ok = ok && insert(caller, site, inst_new_branch(OP_JAL, R_ZERO, R_NONE, R_NONE, after));
+            continue;
+        }
+
+        inst_t c = inst_copy(i);
+        if (!c) {
+            ok = 0;
+            break;
+        }
+
+        int* fields[] = {&c->rd, &c->rs1, &c->rs2};
+        for (int k = 0; k < 3; k++) {
+            if (reg_is_virtual(*fields[k])) {
+                *fields[k] = renamed(vregs, *fields[k] - R_VIRT, mfunc_new_vreg, caller);
+            }
+        }
+        if (c->label >= 0 && c->label < callee->nlabels) {
+            c->label = renamed(labels, c->label, mfunc_new_label, caller);
+        }
+        ok = insert(caller, site, c);
+    }
+
+    if (ok && !tail) {
+        ok = insert(caller, site, inst_new_label(after));
+    }
+    if (ok) {
+        mfunc_remove(caller, site);
+    }
+
+    free(vregs);
+    free(labels);
+    return ok;
+}
+
+// Replaces the calls to the functions of the module that have at most
+// threshold instructions by a copy of their body. Functions are handled
+// callees first, so a callee is measured with its own calls inlined, and
+// nothing is inlined along a recursive cycle. The instructions added stay
+// within growth percent of the size of the module. Every inlined call
+// site is written to report (optional).
+int inline_module(module_t m, int threshold, int growth, FILE* report) {
+    if (!m) {
+        return 0;
+    }
+
+    callgraph_t g;
+    if (!callgraph_build(&g, m)) {
+        callgraph_free(&g);
+        return 0;
+    }
+
+    int total = 0;
+    for (int k = 0; k < m->nfuncs; k++) {
+        total += func_size(m->funcs[k]);
+    }
+    int budget = (int)((long long)total * growth / 100);
+    int grown = 0, sites = 0, ok = 1;
+
+    for (int o = 0; ok && o < g.norder; o++) {
+        int k = g.order[o];
+        mfunc_t caller = m->funcs[k];
+
+        for (inst_t i = caller->head, next; ok && i; i = next) {
+            next = i->next;
+            int c = (i->op == OP_CALL || i->op == OP_TAIL) ? func_index(m, i->sym) : -1;
+            if (c < 0 || g.scc[c] == g.scc[k] || g.recursive[c]) {
+                continue;
+            }
+
+            mfunc_t callee = m->funcs[c];
+            int size = func_size(callee);
+
+            // The call goes away, the body comes in
+            int cost = size - 1;
+            if (size > threshold || grown + cost > budget || !can_inline(callee)) {
+                continue;
+            }
+
+            ok = inline_call(caller, i, callee);
+            if (ok) {
+                grown += cost;
+                sites++;
+                if (report) {
+                    fprintf(report, "inline: %s: inlined %s (%d instructions), ~%d cycles saved per call\n",
+                            caller->name, callee->name, size, INLINE_CALL_CYCLES);
+                }
+            }
+        }
+    }
+
+    if (ok && report) {
+        fprintf(report, "inline: %d call sites inlined, %d of %d instructions of growth budget used\n", sites, grown,
+                budget);
+    }
+
+    callgraph_free(&g);
+    return ok;
+}
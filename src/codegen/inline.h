@@ -0,0 +1,20 @@
+#ifndef INLINE_H
+#define INLINE_H
+
+#include <stdio.h>
+#include "module.h"
+
+// Cycles a call costs on top of the callee's body: call (auipc, jalr and
+// the indirect jump penalty), ret (jalr and the penalty), and saving and
+// restoring ra with the sp adjustments around it
+#define INLINE_CALL_CYCLES 11
+
+// Replaces the calls to the functions of the module that have at most
+// threshold instructions by a copy of their body. Functions are handled
+// callees first, so a callee is measured with its own calls inlined, and
+// nothing is inlined along a recursive cycle. The instructions added stay
+// within growth percent of the size of the module. Every inlined call
+// site is written to report (optional).
+int inline_module(module_t m, int threshold, int growth, FILE* report);
+
+#endif
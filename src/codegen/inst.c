@@ -0,0 +1,484 @@
+#include "inst.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ===================== REGISTERS =====================
+
+static const char* const reg_names[] = {"zero", "ra", "sp", "gp", "tp",  "t0",  "t1", "t2", "s0", "s1", "a0",
+                                        "a1",   "a2", "a3", "a4", "a5",  "a6",  "a7", "s2", "s3", "s4", "s5",
+                                        "s6",   "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+
+const char* reg_to_str(int r) {
+    if (r < 0) {
+        return "R_NONE";
+    }
+
+    if (r < R_VIRT) {
+        return reg_names[r];
+    }
+
+    // Virtual registers don't have a fixed name
+    return "virt";
+}
+
+int reg_is_virtual(int r) {
+    return r >= R_VIRT;
+}
+
+// Registers that a function has to preserve for its caller (sp, s0-s11)
+int reg_is_callee_saved(int r) {
+    return r == R_SP || r == R_S0 || r == R_S1 || (r >= R_S2 && r <= R_S11);
+}
+
+// ===================== OPCODES =====================
+
+static const char* const opcode_names[] = {
+    "lui",  "auipc", "jal",  "jalr", "beq",  "bne",  "blt",  "bge",  "bltu", "bgeu",  "lb",     "lh",
+    "lw",   "lbu",   "lhu",  "sb",   "sh",   "sw",   "addi", "slti", "sltiu", "xori", "ori",   "andi",
+    "slli", "srli",  "srai", "add",  "sub",  "sll",  "slt",  "sltu", "xor",  "srl",   "sra",  "or",
+    "and",  "ecall", "ebreak", "li", "la",   "call", "tail", "label"};
+
+const char* opcode_to_str(opcode_t op) {
+    if (op < 0 || op >= OP_NOVALUE) {
+        return "UNKNOWN";
+    }
+
+    return opcode_names[op];
+}
+
+// ===================== INSTRUCTIONS =====================
+
+static inst_t inst_alloc(opcode_t op) {
+    inst_t i = (inst_t)malloc(sizeof(_inst));
+    if (!i) {
+        return NULL;
+    }
+
+    i->op = op;
+    i->rd = R_NONE;
+    i->rs1 = R_NONE;
+    i->rs2 = R_NONE;
+    i->imm = 0;
+    i->label = -1;
+    i->sym = NULL;
+    i->area = FRAME_SLOTS;
+    i->compressed = 0;
+    i->prev = NULL;
+    i->next = NULL;
+
+    return i;
+}
+
+// Create a new register-register instruction (e.g. add rd, rs1, rs2)
+inst_t inst_new_r(opcode_t op, int rd, int rs1, int rs2) {
+    inst_t i = inst_alloc(op);
+    if (!i) {
+        return NULL;
+    }
+
+    i->rd = rd;
+    i->rs1 = rs1;
+    i->rs2 = rs2;
+
+    return i;
+}
+
+// Create a new instruction with an immediate (e.g. addi rd, rs1, imm,
+// lw rd, imm(rs1), sw rs2, imm(rs1), li rd, imm)
+inst_t inst_new_i(opcode_t op, int rd, int rs1, int rs2, int32_t imm) {
+    inst_t i = inst_new_r(op, rd, rs1, rs2);
+    if (!i) {
+        return NULL;
+    }
+
+    i->imm = imm;
+
+    return i;
+}
+
+// Create a new branch or jump to a label (e.g. beq rs1, rs2, .L<label>,
+// jal rd, .L<label>)
+inst_t inst_new_branch(opcode_t op, int rd, int rs1, int rs2, int label) {
+    inst_t i = inst_new_r(op, rd, rs1, rs2);
+    if (!i) {
+        return NULL;
+    }
+
+    i->label = label;
+
+    return i;
+}
+
+// Create a new instruction that references a symbol (la, call, tail)
+inst_t inst_new_sym(opcode_t op, int rd, const char* sym) {
+    inst_t i = inst_alloc(op);
+    if (!i) {
+        return NULL;
+    }
+
+    i->rd = rd;
+    i->sym = strdup(sym);
+    if (!i->sym) {
+        free(i);
+        return NULL;
+    }
+
+    return i;
+}
+
+// Create a new label definition
+inst_t inst_new_label(int label) {
+    inst_t i = inst_alloc(OP_LABEL);
+    if (!i) {
+        return NULL;
+    }
+
+    i->label = label;
+
+    return i;
+}
+
+// Create an unlinked copy of the instruction
+inst_t inst_copy(const inst_t src) {
+    inst_t i = src->sym ? inst_new_sym(src->op, src->rd, src->sym) : inst_alloc(src->op);
+    if (!i) {
+        return NULL;
+    }
+
+    i->rd = src->rd;
+    i->rs1 = src->rs1;
+    i->rs2 = src->rs2;
+    i->imm = src->imm;
+    i->label = src->label;
+    i->area = src->area;
+    i->compressed = src->compressed;
+
+    return i;
+}
+
+int inst_is_branch(const inst_t i) {
+    return i && i->op >= OP_BEQ && i->op <= OP_BGEU;
+}
+
+int inst_is_load(const inst_t i) {
+    return i && i->op >= OP_LB && i->op <= OP_LHU;
+}
+
+int inst_is_store(const inst_t i) {
+    return i && i->op >= OP_SB && i->op <= OP_SW;
+}
+
+int inst_is_call(const inst_t i) {
+    return i && (i->op == OP_CALL || i->op == OP_TAIL);
+}
+
+// Returns 1 for the return from a function (jalr zero, 0(ra))
+int inst_is_ret(const inst_t i) {
+    return i && i->op == OP_JALR && i->rd == R_ZERO && i->rs1 == R_RA && i->imm == 0;
+}
+
+// Returns the register written by the instruction, R_NONE if it
+// doesn't write one (writes to zero are ignored). Calls write ra.
+int inst_def(const inst_t i) {
+    if (!i) {
+        return R_NONE;
+    }
+
+    switch (i->op) {
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BGE:
+        case OP_BLTU:
+        case OP_BGEU:
+        case OP_SB:
+        case OP_SH:
+        case OP_SW:
+        case OP_ECALL:
+        case OP_EBREAK:
+        case OP_TAIL:
+        case OP_LABEL:
+        case OP_NOVALUE:
+            return R_NONE;
+        case OP_CALL:
+            return R_RA;
+        default:
+            return i->rd == R_ZERO ? R_NONE : i->rd;
+    }
+}
+
+// Stores the registers read by the instruction in uses and returns how
+// many there are (at most 2). zero is never reported as a use.
+int inst_uses(const inst_t i, int uses[2]) {
+    if (!i) {
+        return 0;
+    }
+
+    int rs1 = R_NONE, rs2 = R_NONE;
+    switch (i->op) {
+        case OP_LUI:
+        case OP_AUIPC:
+        case OP_JAL:
+        case OP_ECALL:
+        case OP_EBREAK:
+        case OP_LI:
+        case OP_LA:
+        case OP_CALL:
+        case OP_TAIL:
+        case OP_LABEL:
+        case OP_NOVALUE:
+            break;
+        case OP_JALR:
+        case OP_LB:
+        case OP_LH:
+        case OP_LW:
+        case OP_LBU:
+        case OP_LHU:
+        case OP_ADDI:
+        case OP_SLTI:
+        case OP_SLTIU:
+        case OP_XORI:
+        case OP_ORI:
+        case OP_ANDI:
+        case OP_SLLI:
+        case OP_SRLI:
+        case OP_SRAI:
+            rs1 = i->rs1;
+            break;
+        default:
+            rs1 = i->rs1;
+            rs2 = i->rs2;
+            break;
+    }
+
+    int n = 0;
+    if (rs1 > R_ZERO) {
+        uses[n++] = rs1;
+    }
+    if (rs2 > R_ZERO) {
+        uses[n++] = rs2;
+    }
+    return n;
+}
+
+static int put_range(int* regs, int n, int from, int to) {
+    for (int r = from; r <= to; r++) {
+        regs[n++] = r;
+    }
+    return n;
+}
+
+// Registers read or written by the instruction besides its operands,
+// following the calling convention: calls read the argument registers
+// and clobber the caller-saved ones, returns read the results and the
+// registers preserved for the caller. Both return how many were stored.
+int inst_implicit_uses(const inst_t i, int regs[INST_MAX_IMPLICIT]) {
+    int n = 0;
+    if (!i) {
+        return 0;
+    }
+
+    if (i->op == OP_CALL || i->op == OP_TAIL || i->op == OP_ECALL) {
+        n = put_range(regs, n, R_A0, R_A7);
+        regs[n++] = R_SP;
+    }
+
+    // The callee of a tail call returns straight to our caller
+    if (i->op == OP_TAIL || inst_is_ret(i)) {
+        regs[n++] = R_RA;
+        regs[n++] = R_S0;
+        regs[n++] = R_S1;
+        n = put_range(regs, n, R_S2, R_S11);
+        if (inst_is_ret(i)) {
+            regs[n++] = R_A0;
+            regs[n++] = R_A1;
+            regs[n++] = R_SP;
+        }
+    }
+
+    return n;
+}
+
+int inst_implicit_defs(const inst_t i, int regs[INST_MAX_IMPLICIT]) {
+    int n = 0;
+    if (!i) {
+        return 0;
+    }
+
+    if (i->op == OP_CALL) {
+        regs[n++] = R_RA;
+        n = put_range(regs, n, R_T0, R_T2);
+        n = put_range(regs, n, R_A0, R_A7);
+        n = put_range(regs, n, R_T3, R_T6);
+    } else if (i->op == OP_ECALL) {
+        regs[n++] = R_A0;
+    }
+
+    return n;
+}
+
+// Returns 1 if the instruction does more than computing its result
+// (memory writes, control flow, calls, system calls, moving sp)
+int inst_has_side_effects(const inst_t i) {
+    if (!i) {
+        return 0;
+    }
+
+    switch (i->op) {
+        case OP_JAL:
+        case OP_JALR:
+        case OP_SB:
+        case OP_SH:
+        case OP_SW:
+        case OP_ECALL:
+        case OP_EBREAK:
+        case OP_CALL:
+        case OP_TAIL:
+        case OP_LABEL:
+            return 1;
+        default:
+            return inst_is_branch(i) || i->rd == R_SP;
+    }
+}
+
+static void print_reg(int r) {
+    if (r >= R_VIRT) {
+        printf("v%d", r - R_VIRT);
+        return;
+    }
+
+    printf("%s", reg_to_str(r));
+}
+
+void inst_print(const inst_t i) {
+    if (!i) {
+        printf("OP_NOVALUE");
+        return;
+    }
+
+    if (i->op == OP_LABEL) {
+        printf(".L%d:", i->label);
+        return;
+    }
+
+    printf("    %s", opcode_to_str(i->op));
+    switch (i->op) {
+        case OP_LUI:
+        case OP_AUIPC: {
+            printf(" ");
+            print_reg(i->rd);
+            printf(", %d", (int)((uint32_t)i->imm >> 12));
+            break;
+        }
+        case OP_JAL: {
+            printf(" ");
+            print_reg(i->rd);
+            printf(", .L%d", i->label);
+            break;
+        }
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BGE:
+        case OP_BLTU:
+        case OP_BGEU: {
+            printf(" ");
+            print_reg(i->rs1);
+            printf(", ");
+            print_reg(i->rs2);
+            printf(", .L%d", i->label);
+            break;
+        }
+        case OP_JALR:
+        case OP_LB:
+        case OP_LH:
+        case OP_LW:
+        case OP_LBU:
+        case OP_LHU: {
+            printf(" ");
+            print_reg(i->rd);
+            printf(", %d(", i->imm);
+            print_reg(i->rs1);
+            printf(")");
+            break;
+        }
+        case OP_SB:
+        case OP_SH:
+        case OP_SW: {
+            printf(" ");
+            print_reg(i->rs2);
+            printf(", %d(", i->imm);
+            print_reg(i->rs1);
+            printf(")");
+            break;
+        }
+        case OP_ADDI:
+        case OP_SLTI:
+        case OP_SLTIU:
+        case OP_XORI:
+        case OP_ORI:
+        case OP_ANDI:
+        case OP_SLLI:
+        case OP_SRLI:
+        case OP_SRAI: {
+            printf(" ");
+            print_reg(i->rd);
+            printf(", ");
+            print_reg(i->rs1);
+            printf(", %d", i->imm);
+            break;
+        }
+        case OP_ADD:
+        case OP_SUB:
+        case OP_SLL:
+        case OP_SLT:
+        case OP_SLTU:
+        case OP_XOR:
+        case OP_SRL:
+        case OP_SRA:
+        case OP_OR:
+        case OP_AND: {
+            printf(" ");
+            print_reg(i->rd);
+            printf(", ");
+            print_reg(i->rs1);
+            printf(", ");
+            print_reg(i->rs2);
+            break;
+        }
+        case OP_LI: {
+            printf(" ");
+            print_reg(i->rd);
+            printf(", %d", i->imm);
+            break;
+        }
+        case OP_LA: {
+            printf(" ");
+            print_reg(i->rd);
+            printf(", %s", i->sym);
+            if (i->imm) {
+                printf("%+d", i->imm);
+            }
+            break;
+        }
+        case OP_CALL:
+        case OP_TAIL: {
+            printf(" %s", i->sym);
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+}
+
+void inst_free(inst_t* ip) {
+    if (!ip || !*ip) {
+        return;
+    }
+
+    free((*ip)->sym);
+    free(*ip);
+    *ip = NULL;
+}
@@ -0,0 +1,208 @@
+#ifndef INST_H
+#define INST_H
+
+#include <stdint.h>
+
+// ===================== REGISTERS =====================
+
+typedef enum reg {
+    R_NONE = -1,
+
+    R_ZERO,  // x0
+    R_RA,    // x1
+    R_SP,    // x2
+    R_GP,    // x3
+    R_TP,    // x4
+    R_T0,    // x5
+    R_T1,    // x6
+    R_T2,    // x7
+    R_S0,    // x8
+    R_S1,    // x9
+    R_A0,    // x10
+    R_A1,    // x11
+    R_A2,    // x12
+    R_A3,    // x13
+    R_A4,    // x14
+    R_A5,    // x15
+    R_A6,    // x16
+    R_A7,    // x17
+    R_S2,    // x18
+    R_S3,    // x19
+    R_S4,    // x20
+    R_S5,    // x21
+    R_S6,    // x22
+    R_S7,    // x23
+    R_S8,    // x24
+    R_S9,    // x25
+    R_S10,   // x26
+    R_S11,   // x27
+    R_T3,    // x28
+    R_T4,    // x29
+    R_T5,    // x30
+    R_T6,    // x31
+
+    // Virtual registers are numbered from here on
+    R_VIRT
+} reg_t;
+const char* reg_to_str(int r);
+
+int reg_is_virtual(int r);
+
+// Registers that a function has to preserve for its caller (sp, s0-s11)
+int reg_is_callee_saved(int r);
+
+// ===================== OPCODES =====================
+
+typedef enum opcode {
+    // RV32I base instructions
+    OP_LUI,
+    OP_AUIPC,
+    OP_JAL,
+    OP_JALR,
+    OP_BEQ,
+    OP_BNE,
+    OP_BLT,
+    OP_BGE,
+    OP_BLTU,
+    OP_BGEU,
+    OP_LB,
+    OP_LH,
+    OP_LW,
+    OP_LBU,
+    OP_LHU,
+    OP_SB,
+    OP_SH,
+    OP_SW,
+    OP_ADDI,
+    OP_SLTI,
+    OP_SLTIU,
+    OP_XORI,
+    OP_ORI,
+    OP_ANDI,
+    OP_SLLI,
+    OP_SRLI,
+    OP_SRAI,
+    OP_ADD,
+    OP_SUB,
+    OP_SLL,
+    OP_SLT,
+    OP_SLTU,
+    OP_XOR,
+    OP_SRL,
+    OP_SRA,
+    OP_OR,
+    OP_AND,
+    OP_ECALL,
+    OP_EBREAK,
+
+    // Pseudo instructions
+    OP_LI,     // li rd, imm
+    OP_LA,     // la rd, sym+imm
+    OP_CALL,   // call sym
+    OP_TAIL,   // tail sym
+    OP_LABEL,  // .L<label>:
+
+    OP_NOVALUE
+} opcode_t;
+const char* opcode_to_str(opcode_t op);
+
+// ===================== INSTRUCTIONS =====================
+
+// Part of the frame a sp-relative load or store refers to, its offset
+// is relative to that area until the frame is laid out
+typedef enum frame_area {
+    // Stack slots (locals, spills)
+    FRAME_SLOTS,
+
+    // Arguments passed on the stack to a callee, at the bottom of the frame
+    FRAME_OUTGOING,
+
+    // Arguments received on the stack, above the frame of the caller
+    FRAME_INCOMING
+} frame_area_t;
+
+typedef struct inst _inst, *inst_t;
+
+struct inst {
+    opcode_t op;
+    int rd;
+    int rs1;
+    int rs2;
+
+    // For OP_LUI and OP_AUIPC this is the full value
+    // with the low 12 bits cleared, for OP_LA the offset
+    // from the symbol
+    int32_t imm;
+
+    // Target label of branches and jumps, or the
+    // label defined by an OP_LABEL
+    int label;
+
+    // Symbol referenced by OP_LA, OP_CALL and OP_TAIL
+    char* sym;
+
+    // Frame area of a load or store based on sp
+    frame_area_t area;
+
+    // Encoded in 16 bits with the C extension, decided by compression
+    // once the code doesn't change anymore
+    int compressed;
+
+    inst_t prev;
+    inst_t next;
+};
+
+// Create a new register-register instruction (e.g. add rd, rs1, rs2)
+inst_t inst_new_r(opcode_t op, int rd, int rs1, int rs2);
+
+// Create a new instruction with an immediate (e.g. addi rd, rs1, imm,
+// lw rd, imm(rs1), sw rs2, imm(rs1), li rd, imm)
+inst_t inst_new_i(opcode_t op, int rd, int rs1, int rs2, int32_t imm);
+
+// Create a new branch or jump to a label (e.g. beq rs1, rs2, .L<label>,
+// jal rd, .L<label>)
+inst_t inst_new_branch(opcode_t op, int rd, int rs1, int rs2, int label);
+
+// Create a new instruction that references a symbol (la, call, tail)
+inst_t inst_new_sym(opcode_t op, int rd, const char* sym);
+
+// Create a new label definition
+inst_t inst_new_label(int label);
+
+// Create an unlinked copy of the instruction
+inst_t inst_copy(const inst_t src);
+
+int inst_is_branch(const inst_t i);
+int inst_is_load(const inst_t i);
+int inst_is_store(const inst_t i);
+int inst_is_call(const inst_t i);
+
+// Returns 1 for the return from a function (jalr zero, 0(ra))
+int inst_is_ret(const inst_t i);
+
+// Returns the register written by the instruction, R_NONE if it
+// doesn't write one (writes to zero are ignored). Calls write ra.
+int inst_def(const inst_t i);
+
+// Stores the registers read by the instruction in uses and returns how
+// many there are (at most 2). zero is never reported as a use.
+int inst_uses(const inst_t i, int uses[2]);
+
+#define INST_MAX_IMPLICIT 24
+
+// Registers read or written by the instruction besides its operands,
+// following the calling convention: calls read the argument registers
+// and clobber the caller-saved ones, returns read the results and the
+// registers preserved for the caller. Both return how many were stored.
+int inst_implicit_uses(const inst_t i, int regs[INST_MAX_IMPLICIT]);
+int inst_implicit_defs(const inst_t i, int regs[INST_MAX_IMPLICIT]);
+
+// Returns 1 if the instruction does more than computing its result
+// (memory writes, control flow, calls, system calls, moving sp)
+int inst_has_side_effects(const inst_t i);
+
+void inst_print(const inst_t i);
+
+void inst_free(inst_t* ip);
+
+#endif
@@ -0,0 +1,932 @@
+#include "loop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arith.h"
+#include "cfg.h"
+#include "dce.h"
+
+// Strength reductions tried per loop
+#define LOOP_MAX_REDUCTIONS 16
+
+// Instructions followed back from a value to an induction variable
+#define LOOP_MAX_DEPTH 8
+
+// Instructions computing a reduced value from its induction variable
+#define LOOP_MAX_NODES 16
+
+// Largest multiple of an induction variable followed
+#define LOOP_MAX_COEF (1 << 16)
+
+// ===================== LOOPS =====================
+
+typedef struct loop {
+    mfunc_t f;
+    cfg_t g;
+    block_t header;
+
+    // The first label of the header, the preheader ends right before it
+    inst_t start;
+
+    // Blocks of the loop
+    char* in;
+
+    // Instructions of the loop in layout order, and their block
+    inst_t* insts;
+    int* block;
+    int ninsts;
+
+    // Definitions of each register in the loop (implicit ones included),
+    // the definition of the ones defined once there, and the explicit
+    // definitions and uses of each register in the whole function
+    int* loopdefs;
+    inst_t* def;
+    int* funcdefs;
+    int* uses;
+} loop_t;
+
+// Marks in the blocks of the natural loop of h: h and the blocks that
+// reach one of its back edges without going through h. Returns how many
+// there are, 0 if nothing jumps back to h.
+static int natural_loop(cfg_t g, block_t h, char* in, int* stack) {
+    memset(in, 0, g->nblocks);
+    in[h->id] = 1;
+
+    int n = 0, count = 1, back = 0;
+    for (int p = 0; p < h->npreds; p++) {
+        int pred = h->preds[p];
+        if (!cfg_dominates(g, h->id, pred)) {
+            continue;
+        }
+        back = 1;
+        if (!in[pred]) {
+            in[pred] = 1;
+            stack[n++] = pred;
+            count++;
+        }
+    }
+    if (!back) {
+        return 0;
+    }
+
+    while (n) {
+        block_t b = &g->blocks[stack[--n]];
+        for (int p = 0; p < b->npreds; p++) {
+            int pred = b->preds[p];
+            if (!in[pred] && g->blocks[pred].rpo >= 0) {
+                in[pred] = 1;
+                stack[n++] = pred;
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+static void loop_free(loop_t* lp) {
+    cfg_free(&lp->g);
+    free(lp->in);
+    free(lp->insts);
+    free(lp->block);
+    free(lp->loopdefs);
+    free(lp->def);
+    free(lp->funcdefs);
+    free(lp->uses);
+    memset(lp, 0, sizeof(*lp));
+}
+
+// Analyses the loop whose header starts with the label. Returns 0 on
+// error, header is left NULL if the label doesn't start a loop anymore.
+static int loop_find(loop_t* lp, mfunc_t f, int label) {
+    memset(lp, 0, sizeof(*lp));
+    lp->f = f;
+    lp->g = cfg_build(f);
+    if (!lp->g || !cfg_dominators(lp->g) || !cfg_liveness(lp->g)) {
+        loop_free(lp);
+        return 0;
+    }
+
+    cfg_t g = lp->g;
+    int* stack = (int*)malloc((g->nblocks + 1) * sizeof(int));
+    lp->in = (char*)calloc(g->nblocks + 1, 1);
+    lp->insts = (inst_t*)malloc((f->ninsts + 1) * sizeof(inst_t));
+    lp->block = (int*)malloc((f->ninsts + 1) * sizeof(int));
+    lp->loopdefs = (int*)calloc(g->nregs, sizeof(int));
+    lp->def = (inst_t*)calloc(g->nregs, sizeof(inst_t));
+    lp->funcdefs = (int*)calloc(g->nregs, sizeof(int));
+    lp->uses = (int*)calloc(g->nregs, sizeof(int));
+    if (!stack || !lp->in || !lp->insts || !lp->block || !lp->loopdefs || !lp->def || !lp->funcdefs || !lp->uses) {
+        perror("Error with malloc");
+        free(stack);
+        loop_free(lp);
+        return 0;
+    }
+
+    block_t h = cfg_label_block(g, label);
+    int size = h && h->rpo >= 0 ? natural_loop(g, h, lp->in, stack) : 0;
+    free(stack);
+    if (!size) {
+        return 1;
+    }
+    lp->header = h;
+    lp->start = h->first;
+
+    int regs[CFG_MAX_REGS];
+    for (int k = 0; k < g->nblocks; k++) {
+        block_t b = &g->blocks[k];
+        for (inst_t i = b->first;; i = i->next) {
+            int n = inst_uses(i, regs);
+            for (int r = 0; r < n; r++) {
+                lp->uses[regs[r]]++;
+            }
+            if (inst_def(i) != R_NONE) {
+                lp->funcdefs[inst_def(i)]++;
+            }
+
+            if (lp->in[k]) {
+                lp->insts[lp->ninsts] = i;
+                lp->block[lp->ninsts++] = k;
+                n = cfg_inst_defs(i, regs);
+                for (int r = 0; r < n; r++) {
+                    lp->loopdefs[regs[r]]++;
+                    lp->def[regs[r]] = i;
+                }
+            }
+
+            if (i == b->last) {
+                break;
+            }
+        }
+    }
+
+    return 1;
+}
+
+// Position of the instruction among the ones of the loop, -1 if it's outside
+static int index_of(const loop_t* lp, const inst_t i) {
+    for (int k = 0; k < lp->ninsts; k++) {
+        if (lp->insts[k] == i) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+static int insert(mfunc_t f, inst_t pos, inst_t i) {
+    if (!i || !mfunc_insert_before(f, pos, i)) {
+        inst_free(&i);
+        return 0;
+    }
+    return 1;
+}
+
+// ===================== PREHEADER =====================
+
+// Makes every entry into the loop go through the code right before its
+// header: the block falling into it, and a new label for the branches
+// from outside. Returns 0 when it can't (a block of the loop falls into
+// the header, or the loop can't be entered), -1 on error.
+static int preheader(loop_t* lp) {
+    cfg_t g = lp->g;
+    block_t h = lp->header;
+
+    if (h->id > 0 && lp->in[h->id - 1] && !cfg_ends_flow(g->blocks[h->id - 1].last)) {
+        return 0;
+    }
+
+    int entries = 0, label = -1;
+    for (int p = 0; p < h->npreds; p++) {
+        block_t pred = &g->blocks[h->preds[p]];
+        if (lp->in[pred->id]) {
+            continue;
+        }
+        entries++;
+
+        inst_t last = pred->last;
+        if ((inst_is_branch(last) || last->op == OP_JAL) && cfg_label_block(g, last->label) == h) {
+            if (label < 0) {
+                label = mfunc_new_label(lp->f);
+                if (!insert(lp->f, lp->start, inst_new_label(label))) {
+                    return -1;
+                }
+            }
+            last->label = label;
+        }
+    }
+
+    return entries ? 1 : 0;
+}
+
+// ===================== INVARIANT CODE MOTION =====================
+
+// A computation whose only definition is in the loop and whose operands
+// aren't written in the loop. Loads stay, a store in the loop could change
+// what they read, and auipc depends on where it is.
+static int invariant(const loop_t* lp, const inst_t i) {
+    if (!i || i->op == OP_LABEL || i->op == OP_AUIPC || inst_is_load(i) || inst_has_side_effects(i) ||
+        !reg_is_virtual(i->rd) || lp->funcdefs[i->rd] != 1) {
+        return 0;
+    }
+
+    int uses[2];
+    int n = inst_uses(i, uses);
+    for (int k = 0; k < n; k++) {
+        if (lp->loopdefs[uses[k]]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Moves the invariant instructions to the end of the preheader, in their
+// order, until none is left. Returns how many moved.
+static int hoist(loop_t* lp) {
+    int hoisted = 0, moved = 1;
+    while (moved) {
+        moved = 0;
+        for (int k = 0; k < lp->ninsts; k++) {
+            inst_t i = lp->insts[k];
+            if (!invariant(lp, i)) {
+                continue;
+            }
+
+            mfunc_unlink(lp->f, i);
+            mfunc_insert_before(lp->f, lp->start, i);
+            lp->loopdefs[i->rd]--;
+            lp->insts[k] = NULL;
+            moved++;
+        }
+        hoisted += moved;
+    }
+    return hoisted;
+}
+
+// ===================== INDUCTION VARIABLES =====================
+
+// A register live into the loop and stepped by a constant once
+// in it, through a chain of additions (i = t, t = i + 1)
+typedef struct iv {
+    int reg;
+    int32_t step;
+
+    // The first instruction defines reg, the last one reads it
+    inst_t chain[LOOP_MAX_DEPTH];
+    int nchain;
+} iv_t;
+
+static int find_iv(const loop_t* lp, int r, iv_t* iv) {
+    // It has to come into the loop with a value
+    if (!reg_is_virtual(r) || lp->loopdefs[r] != 1 || !bitset_test(lp->header->live_in, r)) {
+        return 0;
+    }
+
+    inst_t d = lp->def[r];
+    int32_t step = 0;
+    iv->nchain = 0;
+    for (int depth = 0; depth < LOOP_MAX_DEPTH; depth++) {
+        if (d->op != OP_ADDI || d->imm < -2048 || d->imm > 2047) {
+            return 0;
+        }
+        step += d->imm;
+        iv->chain[iv->nchain++] = d;
+
+        if (d->rs1 == r) {
+            iv->reg = r;
+            iv->step = step;
+            return step != 0;
+        }
+        if (!reg_is_virtual(d->rs1) || lp->loopdefs[d->rs1] != 1) {
+            return 0;
+        }
+        d = lp->def[d->rs1];
+    }
+    return 0;
+}
+
+static int in_chain(const iv_t* iv, const inst_t i) {
+    for (int k = 0; k < iv->nchain; k++) {
+        if (iv->chain[k] == i) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// ===================== STRENGTH REDUCTION =====================
+
+// A value c * i + x, or c * reg * i + x with reg invariant,
+// where i is an induction variable and x is invariant
+typedef struct linear {
+    int ok;
+    int32_t c;
+    int reg;
+} linear_t;
+
+static const linear_t NONLINEAR = {0, 0, R_NONE};
+
+// The instructions computing a linear value
+typedef struct nodes {
+    inst_t at[LOOP_MAX_NODES];
+    int n;
+} nodes_t;
+
+// The move of a register argument (addi reg, x, 0) in the
+// instructions leading to the call, NULL if there isn't one
+static inst_t arg_move(const inst_t call, int reg) {
+    for (inst_t i = call->prev; i && i->op != OP_LABEL && !inst_is_branch(i) && !inst_is_call(i) &&
+                                i->op != OP_JAL && i->op != OP_JALR;
+         i = i->prev) {
+        if (inst_def(i) == reg) {
+            return i->op == OP_ADDI && i->imm == 0 && i->rs1 >= 0 ? i : NULL;
+        }
+    }
+    return NULL;
+}
+
+// The call of the multiplication helper whose result d copies out of a0,
+// when a0 isn't read by anything else before being written again
+static inst_t mul_call(const loop_t* lp, const inst_t d) {
+    inst_t call = d->prev;
+    if (d->op != OP_ADDI || d->rs1 != R_A0 || d->imm != 0 || !call || call->op != OP_CALL ||
+        strcmp(call->sym, ARITH_MUL_HELPER) || !arg_move(call, R_A0) || !arg_move(call, R_A1)) {
+        return NULL;
+    }
+
+    int k = index_of(lp, d);
+    if (k < 0) {
+        return NULL;
+    }
+
+    int regs[CFG_MAX_REGS];
+    for (int j = k + 1; j < lp->ninsts && lp->block[j] == lp->block[k]; j++) {
+        if (!lp->insts[j]) {
+            continue;
+        }
+        int n = cfg_inst_uses(lp->insts[j], regs);
+        for (int r = 0; r < n; r++) {
+            if (regs[r] == R_A0) {
+                return NULL;
+            }
+        }
+        n = cfg_inst_defs(lp->insts[j], regs);
+        for (int r = 0; r < n; r++) {
+            if (regs[r] == R_A0) {
+                return call;
+            }
+        }
+    }
+
+    return bitset_test(lp->g->blocks[lp->block[k]].live_out, R_A0) ? NULL : call;
+}
+
+static int add_node(nodes_t* nodes, inst_t i) {
+    for (int k = 0; k < nodes->n; k++) {
+        if (nodes->at[k] == i) {
+            return 1;
+        }
+    }
+    if (nodes->n == LOOP_MAX_NODES) {
+        return 0;
+    }
+    nodes->at[nodes->n++] = i;
+    return 1;
+}
+
+static int small(int64_t c) {
+    return c > -LOOP_MAX_COEF && c < LOOP_MAX_COEF;
+}
+
+// Expresses v as a linear function of the induction variable, collecting
+// the instructions that compute it. Only registers not written in the
+// loop count as invariant, so the computation can be redone before it.
+static linear_t linear(const loop_t* lp, const iv_t* iv, int v, nodes_t* nodes, int depth) {
+    if (v == iv->reg) {
+        return (linear_t){1, 1, R_NONE};
+    }
+    if (v < 0 || v == R_ZERO || lp->loopdefs[v] == 0) {
+        return (linear_t){1, 0, R_NONE};
+    }
+    if (!reg_is_virtual(v) || lp->loopdefs[v] != 1 || depth > LOOP_MAX_DEPTH) {
+        return NONLINEAR;
+    }
+
+    inst_t d = lp->def[v];
+    linear_t r = NONLINEAR;
+    inst_t call = mul_call(lp, d);
+
+    if (call) {
+        // i * reg through the helper, one factor has to be invariant
+        inst_t x = arg_move(call, R_A0), y = arg_move(call, R_A1);
+        linear_t a = linear(lp, iv, x->rs1, nodes, depth + 1);
+        linear_t b = linear(lp, iv, y->rs1, nodes, depth + 1);
+        if (a.ok && b.ok && a.c && !b.c && a.reg == R_NONE && y->rs1 != R_ZERO) {
+            r = (linear_t){1, a.c, y->rs1};
+        } else if (a.ok && b.ok && b.c && !a.c && b.reg == R_NONE && x->rs1 != R_ZERO) {
+            r = (linear_t){1, b.c, x->rs1};
+        }
+    } else {
+        linear_t a, b;
+        switch (d->op) {
+            case OP_ADDI:
+                r = linear(lp, iv, d->rs1, nodes, depth + 1);
+                break;
+            case OP_SLLI:
+                a = linear(lp, iv, d->rs1, nodes, depth + 1);
+                if (a.ok && d->imm >= 0 && d->imm < 16 && small((int64_t)a.c << d->imm)) {
+                    r = (linear_t){1, a.c * (1 << d->imm), a.reg};
+                }
+                break;
+            case OP_ADD:
+            case OP_SUB:
+                a = linear(lp, iv, d->rs1, nodes, depth + 1);
+                b = linear(lp, iv, d->rs2, nodes, depth + 1);
+                if (d->op == OP_SUB) {
+                    b.c = -b.c;
+                }
+                if (a.ok && b.ok && (!a.c || !b.c || a.reg == b.reg) && small((int64_t)a.c + b.c)) {
+                    r = (linear_t){1, a.c + b.c, a.c ? a.reg : b.reg};
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (!r.ok || !r.c || !add_node(nodes, d)) {
+        return NONLINEAR;
+    }
+    return r;
+}
+
+// Returns 1 if something else than another linear computation reads v
+static int consumed(const loop_t* lp, const iv_t* iv, int v) {
+    for (int k = 0; k < lp->ninsts; k++) {
+        inst_t i = lp->insts[k];
+        int uses[2];
+        int n = i ? inst_uses(i, uses) : 0;
+        int reads = 0;
+        for (int u = 0; u < n; u++) {
+            reads |= uses[u] == v;
+        }
+        if (!reads) {
+            continue;
+        }
+
+        nodes_t nodes = {0};
+        if (!reg_is_virtual(i->rd) || !linear(lp, iv, i->rd, &nodes, 0).ok) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// The nodes have to sit in the block of the value, with the induction
+// variable keeping the same value from the first of them to the last
+static int contiguous(const loop_t* lp, const iv_t* iv, const nodes_t* nodes, int last) {
+    int first = last;
+    for (int k = 0; k < nodes->n; k++) {
+        int pos = index_of(lp, nodes->at[k]);
+        if (pos < 0 || lp->block[pos] != lp->block[last]) {
+            return 0;
+        }
+        if (pos < first) {
+            first = pos;
+        }
+    }
+
+    for (int k = first + 1; k <= last; k++) {
+        if (lp->insts[k] == iv->chain[0]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Returns 1 if all the reads of v follow its definition at position k in
+// the same block, before the induction variable steps
+static int read_before_step(const loop_t* lp, const iv_t* iv, int k, int v) {
+    int reads = 0;
+    for (int j = k + 1; j < lp->ninsts && lp->block[j] == lp->block[k] && lp->insts[j] != iv->chain[0]; j++) {
+        int uses[2];
+        int n = lp->insts[j] ? inst_uses(lp->insts[j], uses) : 0;
+        for (int u = 0; u < n; u++) {
+            reads += uses[u] == v;
+        }
+    }
+    return reads == lp->uses[v];
+}
+
+static int log2_exact(int64_t x) {
+    int k = 0;
+    if (x <= 0 || (x & (x - 1))) {
+        return -1;
+    }
+    while (x > 1) {
+        x >>= 1;
+        k++;
+    }
+    return k;
+}
+
+static int mapped(const nodes_t* from, const int* to, int r) {
+    for (int k = 0; k < from->n; k++) {
+        if (from->at[k]->rd == r) {
+            return to[k];
+        }
+    }
+    return r;
+}
+
+static int by_position(const loop_t* lp, nodes_t* nodes) {
+    for (int a = 1; a < nodes->n; a++) {
+        for (int b = a; b > 0 && index_of(lp, nodes->at[b - 1]) > index_of(lp, nodes->at[b]); b--) {
+            inst_t t = nodes->at[b];
+            nodes->at[b] = nodes->at[b - 1];
+            nodes->at[b - 1] = t;
+        }
+    }
+    return 1;
+}
+
+// Replaces the value defined by p, c * i + x, by a register q set to its
+// value before the loop and stepped by c * step right after i
+static int reduce_value(loop_t* lp, const iv_t* iv, int k, nodes_t* nodes, linear_t l, int64_t step) {
+    mfunc_t f = lp->f;
+    inst_t p = lp->insts[k];
+    int q = mfunc_new_vreg(f);
+    int to[LOOP_MAX_NODES];
+    int ok = by_position(lp, nodes);
+
+    // The initial value: the same computation before the loop
+    for (int n = 0; ok && n < nodes->n; n++) {
+        inst_t node = nodes->at[n];
+        to[n] = node == p ? q : mfunc_new_vreg(f);
+
+        inst_t call = mul_call(lp, node);
+        if (call) {
+            int x = mapped(nodes, to, arg_move(call, R_A0)->rs1);
+            int y = mapped(nodes, to, arg_move(call, R_A1)->rs1);
+            ok = insert(f, lp->start, inst_new_i(OP_ADDI, R_A0, x, R_NONE, 0)) &&
+                 insert(f, lp->start, inst_new_i(OP_ADDI, R_A1, y, R_NONE, 0)) &&
+                 insert(f, lp->start, inst_new_sym(OP_CALL, R_RA, ARITH_MUL_HELPER)) &&
+                 insert(f, lp->start, inst_new_i(OP_ADDI, to[n], R_A0, R_NONE, 0));
+            continue;
+        }
+
+        inst_t c = inst_copy(node);
+        if (c) {
+            c->rd = to[n];
+            c->rs1 = mapped(nodes, to, c->rs1);
+            c->rs2 = mapped(nodes, to, c->rs2);
+        }
+        ok = insert(f, lp->start, c);
+    }
+
+    // The step, times the invariant factor
+    inst_t update;
+    if (l.reg == R_NONE) {
+        update = inst_new_i(OP_ADDI, q, q, R_NONE, (int32_t)step);
+    } else {
+        int s = l.reg, shift = log2_exact(step < 0 ? -step : step);
+        if (shift > 0) {
+            s = mfunc_new_vreg(f);
+            ok = ok && insert(f, lp->start, inst_new_i(OP_SLLI, s, l.reg, R_NONE, shift));
+        }
+        update = inst_new_r(step < 0 ? OP_SUB : OP_ADD, q, q, s);
+    }
+    ok = ok && insert(f, iv->chain[0]->next, update);
+    if (!ok) {
+        return 0;
+    }
+
+    // Then p's readers use q directly if it can't have stepped in
+    // between, otherwise p copies it
+    inst_t call = mul_call(lp, p);
+    if (read_before_step(lp, iv, k, p->rd)) {
+        for (int j = k + 1; j < lp->ninsts && lp->block[j] == lp->block[k]; j++) {
+            inst_t i = lp->insts[j];
+            if (i && i->rs1 == p->rd) {
+                i->rs1 = q;
+            }
+            if (i && i->rs2 == p->rd) {
+                i->rs2 = q;
+            }
+        }
+    } else {
+        p->op = OP_ADDI;
+        p->rs1 = q;
+        p->rs2 = R_NONE;
+        p->imm = 0;
+    }
+    if (call) {
+        mfunc_remove(f, call);
+    }
+    return 1;
+}
+
+// Strength reduces one value derived from an induction variable, the
+// first one read by something else than another derived value and worth
+// it: at least two instructions or a multiplication. Returns 1 if one
+// was, 0 if none, -1 on error.
+static int reduce(loop_t* lp) {
+    for (int r = R_VIRT; r < lp->g->nregs; r++) {
+        iv_t iv;
+        if (!find_iv(lp, r, &iv)) {
+            continue;
+        }
+
+        for (int k = 0; k < lp->ninsts; k++) {
+            inst_t p = lp->insts[k];
+            if (!reg_is_virtual(p->rd) || p->rd == iv.reg || lp->loopdefs[p->rd] != 1 || in_chain(&iv, p)) {
+                continue;
+            }
+
+            nodes_t nodes = {0};
+            linear_t l = linear(lp, &iv, p->rd, &nodes, 0);
+            int heavy = nodes.n >= 2;
+            for (int n = 0; n < nodes.n; n++) {
+                heavy |= mul_call(lp, nodes.at[n]) != NULL;
+            }
+            if (!l.ok || !heavy || !consumed(lp, &iv, p->rd) || !contiguous(lp, &iv, &nodes, k)) {
+                continue;
+            }
+
+            int64_t step = (int64_t)l.c * iv.step;
+            if (l.reg == R_NONE ? (step < -2048 || step > 2047) : log2_exact(step < 0 ? -step : step) < 0) {
+                continue;
+            }
+
+            return reduce_value(lp, &iv, k, &nodes, l, step) ? 1 : -1;
+        }
+    }
+    return 0;
+}
+
+// ===================== COUNTING DOWN =====================
+
+// Returns 1 if i is only read by the exit test and its own step:
+// twice in the loop and never after it
+static int unread(const loop_t* lp, int i) {
+    int reads = 0;
+    for (int k = 0; k < lp->ninsts; k++) {
+        int uses[2];
+        int n = inst_uses(lp->insts[k], uses);
+        for (int u = 0; u < n; u++) {
+            reads += uses[u] == i;
+        }
+    }
+
+    for (int k = 0; k < lp->g->nblocks; k++) {
+        block_t b = &lp->g->blocks[k];
+        for (int s = 0; lp->in[k] && s < b->nsucc; s++) {
+            if (!lp->in[b->succ[s]] && bitset_test(lp->g->blocks[b->succ[s]].live_in, i)) {
+                return 0;
+            }
+        }
+    }
+    return reads == 2;
+}
+
+// Turns a loop testing i < n at the top and stepping i once per iteration
+// into one counting down what's left of n - i: the test at the top only
+// runs on entry, the latch steps the counter and branches back while
+// something is left. Past the entry test n - i is positive but may not fit
+// in 32 signed bits, so the counter is compared unsigned: with a step of 1
+// it's n - i down to zero, otherwise n - i - 1 stepped down while it
+// doesn't wrap below zero, that is while it's below -step unsigned. Only
+// done when nothing else reads i. Sets body to the label of the new first
+// block of the loop. Returns 1 if it was done, 0 if not, -1 on error.
+static int count_down(loop_t* lp, int* body) {
+    mfunc_t f = lp->f;
+    cfg_t g = lp->g;
+    block_t h = lp->header;
+    inst_t br = h->last;
+
+    int ninsts = 0;
+    for (inst_t i = h->first;; i = i->next) {
+        ninsts += i->op != OP_LABEL;
+        if (i == h->last) {
+            break;
+        }
+    }
+
+    block_t exit = inst_is_branch(br) ? cfg_label_block(g, br->label) : NULL;
+    if (!exit || lp->in[exit->id] || h->nsucc != 2 || !lp->in[h->succ[1]]) {
+        return 0;
+    }
+
+    int i, n;
+    if (br->op == OP_BEQ && br->rs2 == R_ZERO && ninsts == 2 && br->prev->op == OP_SLT && br->prev->rd == br->rs1 &&
+        lp->uses[br->rs1] == 1) {
+        i = br->prev->rs1;
+        n = br->prev->rs2;
+    } else if (br->op == OP_BGE && ninsts == 1) {
+        i = br->rs1;
+        n = br->rs2;
+    } else {
+        return 0;
+    }
+
+    iv_t iv;
+    if (!find_iv(lp, i, &iv) || iv.step <= 0 || n < 0 || lp->loopdefs[n] || !unread(lp, i)) {
+        return 0;
+    }
+
+    // A single latch, jumping back to the header, stepping i
+    int latch = -1;
+    for (int p = 0; p < h->npreds; p++) {
+        if (lp->in[h->preds[p]]) {
+            if (latch >= 0) {
+                return 0;
+            }
+            latch = h->preds[p];
+        }
+    }
+    block_t t = latch >= 0 ? &g->blocks[latch] : NULL;
+    if (!t || t == h || t->last->op != OP_JAL || t->last->rd != R_ZERO || cfg_label_block(g, t->last->label) != h) {
+        return 0;
+    }
+    for (int k = 0; k < iv.nchain; k++) {
+        int pos = index_of(lp, iv.chain[k]);
+        if (pos < 0 || lp->block[pos] != latch || (k > 0 && lp->uses[iv.chain[k]->rd] != 1)) {
+            return 0;
+        }
+    }
+
+    int left = mfunc_new_vreg(f);
+    int label = mfunc_new_label(f);
+    int limit = iv.step == 1 ? R_ZERO : mfunc_new_vreg(f);
+    inst_t jump = t->last;
+    if (!insert(f, lp->start, inst_new_r(OP_SUB, left, n, i)) ||
+        (iv.step > 1 && (!insert(f, lp->start, inst_new_i(OP_ADDI, left, left, R_NONE, -1)) ||
+                         !insert(f, lp->start, inst_new_i(OP_LI, limit, R_NONE, R_NONE, -iv.step)))) ||
+        !insert(f, br->next, inst_new_label(label)) ||
+        !insert(f, jump, inst_new_i(OP_ADDI, left, left, R_NONE, -iv.step)) ||
+        !insert(f, jump->next, inst_new_branch(OP_JAL, R_ZERO, R_NONE, R_NONE, br->label))) {
+        return -1;
+    }
+
+    // In the latch: back to the body while something is left, the test
+    // on entry stays as it was
+    jump->op = iv.step == 1 ? OP_BNE : OP_BLTU;
+    jump->rd = R_NONE;
+    jump->rs1 = left;
+    jump->rs2 = limit;
+    jump->label = label;
+
+    for (int k = 0; k < iv.nchain; k++) {
+        mfunc_remove(f, iv.chain[k]);
+    }
+
+    *body = label;
+    return 1;
+}
+
+// ===================== PASS =====================
+
+// Runs every step on the loop of the header label, analysing the loop
+// again after each change. Sets body when the loop got a new header.
+static int optimize_loop(mfunc_t f, int header, loop_stats_t* stats, FILE* report, int* body) {
+    loop_t lp;
+    int hoisted = 0, reduced = 0, counted = 0, r;
+
+    if (!loop_find(&lp, f, header)) {
+        return 0;
+    }
+    r = lp.header ? preheader(&lp) : 0;
+    loop_free(&lp);
+    if (r <= 0) {
+        return r == 0;
+    }
+
+    if (!loop_find(&lp, f, header)) {
+        return 0;
+    }
+    hoisted = lp.header ? hoist(&lp) : 0;
+    loop_free(&lp);
+
+    for (r = 1; r > 0 && reduced < LOOP_MAX_REDUCTIONS; reduced += r) {
+        if (!loop_find(&lp, f, header)) {
+            return 0;
+        }
+        r = lp.header ? reduce(&lp) : 0;
+        loop_free(&lp);
+        if (r < 0) {
+            return 0;
+        }
+    }
+
+    // The computations the reduced values replaced go away first,
+    // so that the induction variable may be left unread
+    if (reduced && !dce(f, NULL)) {
+        return 0;
+    }
+    if (!loop_find(&lp, f, header)) {
+        return 0;
+    }
+    r = lp.header ? count_down(&lp, body) : 0;
+    loop_free(&lp);
+    if (r < 0) {
+        return 0;
+    }
+    counted = r;
+
+    stats->loops++;
+    stats->hoisted += hoisted;
+    stats->reduced += reduced;
+    stats->counted += counted;
+    if (report) {
+        fprintf(report, "loops: %s: loop at .L%d: hoisted %d instructions, reduced %d induction variables%s\n",
+                f->name, header, hoisted, reduced, counted ? ", counts down" : "");
+    }
+    return 1;
+}
+
+static int seen(const int* labels, int n, int label) {
+    for (int k = 0; k < n; k++) {
+        if (labels[k] == label) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Optimizes the natural loops of f, innermost first: each one gets a
+// preheader, its invariant instructions are hoisted there, the values
+// derived from its induction variables are strength reduced, and a loop
+// running an induction variable up to a bound is turned into one counting
+// down to zero, tested at the bottom. The statistics of stats (optional)
+// are incremented and every loop is written to report (optional).
+int loop_optimize(mfunc_t f, loop_stats_t* stats, FILE* report) {
+    if (!f) {
+        return 0;
+    }
+
+    loop_stats_t ignored = {0};
+    if (!stats) {
+        stats = &ignored;
+    }
+
+    // Headers already handled, each loop is optimized once
+    int* done = (int*)malloc((f->nlabels + 1) * 2 * sizeof(int));
+    if (!done) {
+        perror("Error with malloc");
+        return 0;
+    }
+    int ndone = 0, cap = (f->nlabels + 1) * 2;
+
+    int ok = 1;
+    while (ok) {
+        cfg_t g = cfg_build(f);
+        char* in = g ? (char*)malloc(g->nblocks + 1) : NULL;
+        int* stack = g ? (int*)malloc((g->nblocks + 1) * sizeof(int)) : NULL;
+        if (!g || !in || !stack || !cfg_dominators(g)) {
+            free(in);
+            free(stack);
+            cfg_free(&g);
+            ok = 0;
+            break;
+        }
+
+        // The smallest loop left, which has no loop left inside
+        int header = -1, best = 0;
+        for (int k = 0; k < g->nblocks; k++) {
+            block_t h = &g->blocks[k];
+            if (h->first->op != OP_LABEL || h->rpo < 0 || seen(done, ndone, h->first->label)) {
+                continue;
+            }
+            int size = natural_loop(g, h, in, stack);
+            if (size && (header < 0 || size < best)) {
+                header = h->first->label;
+                best = size;
+            }
+        }
+        free(in);
+        free(stack);
+        cfg_free(&g);
+        if (header < 0) {
+            break;
+        }
+
+        if (ndone + 2 > cap) {
+            int* grown = (int*)realloc(done, cap * 2 * sizeof(int));
+            if (!grown) {
+                perror("Error with realloc");
+                ok = 0;
+                break;
+            }
+            done = grown;
+            cap *= 2;
+        }
+
+        int body = -1;
+        done[ndone++] = header;
+        ok = optimize_loop(f, header, stats, report, &body);
+        if (body >= 0) {
+            done[ndone++] = body;
+        }
+    }
+
+    free(done);
+    return ok;
+}
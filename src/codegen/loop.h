@@ -0,0 +1,30 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdio.h>
+#include "mfunc.h"
+
+// What the loop optimizations did to a function
+typedef struct loop_stats {
+    int loops;
+
+    // Invariant instructions moved to a preheader
+    int hoisted;
+
+    // Values derived from an induction variable (i * stride, base + i * 4)
+    // replaced by one stepped along with it
+    int reduced;
+
+    // Loops whose exit test became a counter decremented down to zero
+    int counted;
+} loop_stats_t;
+
+// Optimizes the natural loops of f, innermost first: each one gets a
+// preheader, its invariant instructions are hoisted there, the values
+// derived from its induction variables are strength reduced, and a loop
+// running an induction variable up to a bound is turned into one counting
+// down to zero, tested at the bottom. The statistics of stats (optional)
+// are incremented and every loop is written to report (optional).
+int loop_optimize(mfunc_t f, loop_stats_t* stats, FILE* report);
+
+#endif
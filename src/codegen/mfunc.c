@@ -0,0 +1,142 @@
+#include "mfunc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Creates a new empty function
+mfunc_t mfunc_new(const char* name) {
+    mfunc_t f = (mfunc_t)malloc(sizeof(_mfunc));
+    if (!f) {
+        perror("Error with malloc");
+        return NULL;
+    }
+
+    f->name = strdup(name);
+    if (!f->name) {
+        free(f);
+        return NULL;
+    }
+
+    f->head = NULL;
+    f->tail = NULL;
+    f->ninsts = 0;
+    f->nlabels = 0;
+    f->nvregs = 0;
+    f->frame_size = 0;
+    f->out_size = 0;
+    f->in_size = 0;
+
+    return f;
+}
+
+// Returns a label that isn't used yet in the function
+int mfunc_new_label(mfunc_t f) {
+    return f->nlabels++;
+}
+
+// Returns a virtual register that isn't used yet in the function
+int mfunc_new_vreg(mfunc_t f) {
+    return R_VIRT + f->nvregs++;
+}
+
+// Reserves a stack slot and returns its offset in the slot area
+// (FRAME_SLOTS), which starts above the outgoing arguments
+int mfunc_new_slot(mfunc_t f, int size, int align) {
+    int offset = (f->frame_size + align - 1) & -align;
+    f->frame_size = offset + size;
+    return offset;
+}
+
+// Appends the instruction at the end of the function,
+// which takes ownership of it.
+int mfunc_append(mfunc_t f, inst_t i) {
+    return mfunc_insert_before(f, NULL, i);
+}
+
+// Inserts the instruction before pos (at the end if pos is NULL).
+int mfunc_insert_before(mfunc_t f, inst_t pos, inst_t i) {
+    if (!f || !i) {
+        return 0;
+    }
+
+    if (!pos) {
+        i->prev = f->tail;
+        i->next = NULL;
+        if (f->tail) {
+            f->tail->next = i;
+        } else {
+            f->head = i;
+        }
+        f->tail = i;
+    } else {
+        i->prev = pos->prev;
+        i->next = pos;
+        if (pos->prev) {
+            pos->prev->next = i;
+        } else {
+            f->head = i;
+        }
+        pos->prev = i;
+    }
+
+    f->ninsts++;
+    return 1;
+}
+
+// Unlinks the instruction from the function without freeing it
+void mfunc_unlink(mfunc_t f, inst_t i) {
+    if (!f || !i) {
+        return;
+    }
+
+    if (i->prev) {
+        i->prev->next = i->next;
+    } else {
+        f->head = i->next;
+    }
+
+    if (i->next) {
+        i->next->prev = i->prev;
+    } else {
+        f->tail = i->prev;
+    }
+
+    i->prev = NULL;
+    i->next = NULL;
+    f->ninsts--;
+}
+
+// Unlinks and frees the instruction
+void mfunc_remove(mfunc_t f, inst_t i) {
+    mfunc_unlink(f, i);
+    inst_free(&i);
+}
+
+void mfunc_print(mfunc_t f) {
+    if (!f) {
+        return;
+    }
+
+    printf("%s:\n", f->name);
+    for (inst_t i = f->head; i; i = i->next) {
+        inst_print(i);
+        printf("\n");
+    }
+}
+
+void mfunc_free(mfunc_t* fp) {
+    if (!fp || !*fp) {
+        return;
+    }
+
+    inst_t i = (*fp)->head;
+    while (i) {
+        inst_t next = i->next;
+        inst_free(&i);
+        i = next;
+    }
+
+    free((*fp)->name);
+    free(*fp);
+    *fp = NULL;
+}
@@ -0,0 +1,61 @@
+#ifndef MFUNC_H
+#define MFUNC_H
+
+#include "inst.h"
+
+// A machine function: a named, doubly linked
+// list of RV32I instructions
+typedef struct mfunc _mfunc, *mfunc_t;
+
+struct mfunc {
+    char* name;
+
+    inst_t head;
+    inst_t tail;
+    int ninsts;
+
+    // Counters used to hand out fresh labels
+    // and virtual registers
+    int nlabels;
+    int nvregs;
+
+    // Bytes of stack slots (locals, spills) in the frame
+    int frame_size;
+
+    // Bytes of the arguments passed on the stack, to the largest callee
+    // (at the bottom of the frame) and received from the caller
+    int out_size;
+    int in_size;
+};
+
+// Creates a new empty function
+mfunc_t mfunc_new(const char* name);
+
+// Returns a label that isn't used yet in the function
+int mfunc_new_label(mfunc_t f);
+
+// Returns a virtual register that isn't used yet in the function
+int mfunc_new_vreg(mfunc_t f);
+
+// Reserves a stack slot and returns its offset in the slot area
+// (FRAME_SLOTS), which starts above the outgoing arguments
+int mfunc_new_slot(mfunc_t f, int size, int align);
+
+// Appends the instruction at the end of the function,
+// which takes ownership of it.
+int mfunc_append(mfunc_t f, inst_t i);
+
+// Inserts the instruction before pos (at the end if pos is NULL).
+int mfunc_insert_before(mfunc_t f, inst_t pos, inst_t i);
+
+// Unlinks the instruction from the function without freeing it
+void mfunc_unlink(mfunc_t f, inst_t i);
+
+// Unlinks and frees the instruction
+void mfunc_remove(mfunc_t f, inst_t i);
+
+void mfunc_print(mfunc_t f);
+
+void mfunc_free(mfunc_t* fp);
+
+#endif
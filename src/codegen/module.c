@@ -0,0 +1,324 @@
+#include "module.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char* section_to_str(section_t s) {
+    switch (s) {
+        case SEC_TEXT:
+            return ".text";
+        case SEC_DATA:
+            return ".data";
+        case SEC_RODATA:
+            return ".rodata";
+        default:
+            return "UNKNOWN";
+    }
+}
+
+// Creates a new empty module
+module_t module_new() {
+    module_t m = (module_t)malloc(sizeof(_module));
+    if (!m) {
+        perror("Error with malloc");
+        return NULL;
+    }
+
+    m->funcs = NULL;
+    m->nfuncs = 0;
+    m->funcs_cap = 0;
+    m->data = NULL;
+    m->ndata = 0;
+    m->data_cap = 0;
+    m->strings = NULL;
+    m->nstrings = 0;
+    m->strings_cap = 0;
+    m->string_slots = NULL;
+    m->nslots = 0;
+    m->pooled = 0;
+
+    return m;
+}
+
+// Makes room for one more pointer in the array *ap
+static int grow(void** ap, int n, int* capp) {
+    if (n < *capp) {
+        return 1;
+    }
+
+    int cap = *capp ? *capp * 2 : 8;
+    void* a = realloc(*ap, cap * sizeof(void*));
+    if (!a) {
+        perror("Error with realloc");
+        return 0;
+    }
+
+    *ap = a;
+    *capp = cap;
+    return 1;
+}
+
+// Adds the function to the module, which takes ownership of it
+int module_add_function(module_t m, mfunc_t f) {
+    if (!m || !f || !grow((void**)&m->funcs, m->nfuncs, &m->funcs_cap)) {
+        return 0;
+    }
+
+    m->funcs[m->nfuncs++] = f;
+    return 1;
+}
+
+// Adds a copy of size bytes as a data object in the given section
+mdata_t module_add_data(module_t m, const char* name, section_t section, const void* bytes, size_t size, int align) {
+    if (!m || !name || !grow((void**)&m->data, m->ndata, &m->data_cap)) {
+        return NULL;
+    }
+
+    mdata_t d = (mdata_t)malloc(sizeof(_mdata));
+    if (!d) {
+        perror("Error with malloc");
+        return NULL;
+    }
+
+    d->name = strdup(name);
+    d->bytes = (uint8_t*)malloc(size ? size : 1);
+    if (!d->name || !d->bytes) {
+        free(d->name);
+        free(d->bytes);
+        free(d);
+        return NULL;
+    }
+
+    if (size) {
+        memcpy(d->bytes, bytes, size);
+    }
+    d->section = section;
+    d->size = size;
+    d->align = align > 0 ? align : 1;
+
+    m->data[m->ndata++] = d;
+    return d;
+}
+
+// FNV-1a
+static uint32_t hash_bytes(const uint8_t* bytes, size_t size) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ bytes[i]) * 16777619u;
+    }
+    return h;
+}
+
+// Doubles the slots of the index of the string literals
+static int rehash(module_t m) {
+    int nslots = m->nslots ? m->nslots * 2 : 64;
+    int* slots = (int*)malloc(nslots * sizeof(int));
+    if (!slots) {
+        perror("Error with malloc");
+        return 0;
+    }
+
+    memset(slots, -1, nslots * sizeof(int));
+    for (int k = 0; k < m->nstrings; k++) {
+        int slot = (int)(m->strings[k]->hash & (uint32_t)(nslots - 1));
+        while (slots[slot] >= 0) {
+            slot = (slot + 1) & (nslots - 1);
+        }
+        slots[slot] = k;
+    }
+
+    free(m->string_slots);
+    m->string_slots = slots;
+    m->nslots = nslots;
+    return 1;
+}
+
+// Returns the symbol to load the address of the string literal of size
+// bytes (its terminating NUL included) with, la rd, sym. Identical
+// literals of the module share one symbol. NULL on error.
+const char* module_add_string(module_t m, const void* bytes, size_t size) {
+    if (!m || (!bytes && size) || m->pooled) {
+        return NULL;
+    }
+    if (2 * (m->nstrings + 1) > m->nslots && !rehash(m)) {
+        return NULL;
+    }
+
+    uint32_t h = hash_bytes((const uint8_t*)bytes, size);
+    int slot = (int)(h & (uint32_t)(m->nslots - 1));
+    for (; m->string_slots[slot] >= 0; slot = (slot + 1) & (m->nslots - 1)) {
+        mstring_t s = m->strings[m->string_slots[slot]];
+        if (s->hash == h && s->size == size && !memcmp(s->bytes, bytes, size)) {
+            return s->name;
+        }
+    }
+
+    if (!grow((void**)&m->strings, m->nstrings, &m->strings_cap)) {
+        return NULL;
+    }
+    mstring_t s = (mstring_t)calloc(1, sizeof(_mstring));
+    char name[32];
+    snprintf(name, sizeof(name), ".str%d", m->nstrings);
+    if (s) {
+        s->name = strdup(name);
+        s->bytes = (uint8_t*)malloc(size ? size : 1);
+    }
+    if (!s || !s->name || !s->bytes) {
+        perror("Error with malloc");
+        if (s) {
+            free(s->name);
+            free(s->bytes);
+        }
+        free(s);
+        return NULL;
+    }
+
+    if (size) {
+        memcpy(s->bytes, bytes, size);
+    }
+    s->size = size;
+    s->hash = h;
+
+    m->string_slots[slot] = m->nstrings;
+    m->strings[m->nstrings++] = s;
+    return s->name;
+}
+
+// Orders the literals by their bytes read backwards, so that a literal
+// comes right before the ones it ends
+static int compare_tails(const void* a, const void* b) {
+    mstring_t x = *(const mstring_t*)a, y = *(const mstring_t*)b;
+    size_t i = x->size, j = y->size;
+    while (i && j) {
+        uint8_t cx = x->bytes[--i], cy = y->bytes[--j];
+        if (cx != cy) {
+            return cx < cy ? -1 : 1;
+        }
+    }
+    return (i > 0) - (j > 0);
+}
+
+// Returns 1 if the bytes of s end t
+static int ends(mstring_t t, mstring_t s) {
+    return s->size <= t->size && !memcmp(t->bytes + t->size - s->size, s->bytes, s->size);
+}
+
+// The literal called sym, NULL if it isn't one
+static mstring_t find_string(module_t m, const char* sym) {
+    if (strncmp(sym, ".str", 4) || sym[4] < '0' || sym[4] > '9') {
+        return NULL;
+    }
+    int k = atoi(sym + 4);
+    return k < m->nstrings && !strcmp(m->strings[k]->name, sym) ? m->strings[k] : NULL;
+}
+
+// Lays the string literals out once, as a single MODULE_STRINGS object
+// in .rodata: a literal that ends another one (e.g. "dog" in "lazy dog")
+// shares its bytes. Every la of a literal symbol is redirected into the
+// pool. Does nothing once done, the literals can't be added to anymore.
+int module_pool_strings(module_t m) {
+    if (!m) {
+        return 0;
+    }
+    if (m->pooled || !m->nstrings) {
+        m->pooled = 1;
+        return 1;
+    }
+
+    mstring_t* sorted = (mstring_t*)malloc(m->nstrings * sizeof(mstring_t));
+    if (!sorted) {
+        perror("Error with malloc");
+        return 0;
+    }
+    memcpy(sorted, m->strings, m->nstrings * sizeof(mstring_t));
+    qsort(sorted, m->nstrings, sizeof(mstring_t), compare_tails);
+    for (int k = m->nstrings - 1; k >= 0; k--) {
+        int shared = k + 1 < m->nstrings && ends(sorted[k + 1], sorted[k]);
+        sorted[k]->owner = shared ? sorted[k + 1]->owner : sorted[k];
+    }
+    free(sorted);
+
+    // The literals that own their bytes in the order they were added,
+    // the others point into their owner
+    size_t size = 0;
+    for (int k = 0; k < m->nstrings; k++) {
+        mstring_t s = m->strings[k];
+        if (s->owner == s) {
+            s->offset = size;
+            size += s->size;
+        }
+    }
+    uint8_t* pool = (uint8_t*)malloc(size ? size : 1);
+    if (!pool) {
+        perror("Error with malloc");
+        return 0;
+    }
+    for (int k = 0; k < m->nstrings; k++) {
+        mstring_t s = m->strings[k];
+        if (s->owner == s) {
+            memcpy(pool + s->offset, s->bytes, s->size);
+        } else {
+            s->offset = s->owner->offset + s->owner->size - s->size;
+        }
+    }
+    int ok = module_add_data(m, MODULE_STRINGS, SEC_RODATA, pool, size, MODULE_STRINGS_ALIGN) != NULL;
+    free(pool);
+
+    for (int k = 0; ok && k < m->nfuncs; k++) {
+        for (inst_t i = m->funcs[k]->head; ok && i; i = i->next) {
+            mstring_t s = i->op == OP_LA ? find_string(m, i->sym) : NULL;
+            if (!s) {
+                continue;
+            }
+            char* sym = strdup(MODULE_STRINGS);
+            ok = sym != NULL;
+            if (ok) {
+                free(i->sym);
+                i->sym = sym;
+                i->imm += (int32_t)s->offset;
+            }
+        }
+    }
+
+    m->pooled = ok;
+    return ok;
+}
+
+// Returns the function with the given name, NULL if the module doesn't define it
+mfunc_t module_find_function(module_t m, const char* name) {
+    for (int i = 0; m && name && i < m->nfuncs; i++) {
+        if (!strcmp(m->funcs[i]->name, name)) {
+            return m->funcs[i];
+        }
+    }
+    return NULL;
+}
+
+void module_free(module_t* mp) {
+    if (!mp || !*mp) {
+        return;
+    }
+
+    for (int i = 0; i < (*mp)->nfuncs; i++) {
+        mfunc_free(&(*mp)->funcs[i]);
+    }
+
+    for (int i = 0; i < (*mp)->ndata; i++) {
+        free((*mp)->data[i]->name);
+        free((*mp)->data[i]->bytes);
+        free((*mp)->data[i]);
+    }
+
+    for (int i = 0; i < (*mp)->nstrings; i++) {
+        free((*mp)->strings[i]->name);
+        free((*mp)->strings[i]->bytes);
+        free((*mp)->strings[i]);
+    }
+
+    free((*mp)->funcs);
+    free((*mp)->data);
+    free((*mp)->strings);
+    free((*mp)->string_slots);
+    free(*mp);
+    *mp = NULL;
+}
@@ -0,0 +1,89 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mfunc.h"
+
+// A translation unit ready for output: its
+// functions and its data objects
+
+typedef enum section { SEC_TEXT, SEC_DATA, SEC_RODATA } section_t;
+const char* section_to_str(section_t s);
+
+typedef struct mdata _mdata, *mdata_t;
+
+struct mdata {
+    char* name;
+    section_t section;
+    uint8_t* bytes;
+    size_t size;
+    int align;
+};
+
+// A string literal of the module, until the literals are pooled
+typedef struct mstring _mstring, *mstring_t;
+
+struct mstring {
+    char* name;
+    uint8_t* bytes;
+    size_t size;
+    uint32_t hash;
+
+    // Once pooled: the literal whose bytes it shares (itself if none),
+    // and where it starts in the pool
+    mstring_t owner;
+    size_t offset;
+};
+
+// The data object the string literals are pooled into
+#define MODULE_STRINGS ".strings"
+#define MODULE_STRINGS_ALIGN 4
+
+typedef struct module _module, *module_t;
+
+struct module {
+    mfunc_t* funcs;
+    int nfuncs;
+    int funcs_cap;
+
+    mdata_t* data;
+    int ndata;
+    int data_cap;
+
+    // Distinct string literals, with an open addressing index of them
+    // by content, and whether they were pooled already
+    mstring_t* strings;
+    int nstrings;
+    int strings_cap;
+    int* string_slots;
+    int nslots;
+    int pooled;
+};
+
+// Creates a new empty module
+module_t module_new();
+
+// Adds the function to the module, which takes ownership of it
+int module_add_function(module_t m, mfunc_t f);
+
+// Adds a copy of size bytes as a data object in the given section
+mdata_t module_add_data(module_t m, const char* name, section_t section, const void* bytes, size_t size, int align);
+
+// Returns the symbol to load the address of the string literal of size
+// bytes (its terminating NUL included) with, la rd, sym. Identical
+// literals of the module share one symbol. NULL on error.
+const char* module_add_string(module_t m, const void* bytes, size_t size);
+
+// Lays the string literals out once, as a single MODULE_STRINGS object
+// in .rodata: a literal that ends another one (e.g. "dog" in "lazy dog")
+// shares its bytes. Every la of a literal symbol is redirected into the
+// pool. Does nothing once done, the literals can't be added to anymore.
+int module_pool_strings(module_t m);
+
+// Returns the function with the given name, NULL if the module doesn't define it
+mfunc_t module_find_function(module_t m, const char* name);
+
+void module_free(module_t* mp);
+
+#endif
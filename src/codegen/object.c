@@ -0,0 +1,283 @@
+#include "object.h"
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compress.h"
+#include "encode.h"
+#include "utils/buf.h"
+
+// Section header indices
+enum {
+    SH_NULL,
+    SH_TEXT,
+    SH_RELA_TEXT,
+    SH_DATA,
+    SH_RODATA,
+    SH_SYMTAB,
+    SH_STRTAB,
+    SH_SHSTRTAB,
+    SH_COUNT
+};
+
+static const char shstrtab[] = "\0.text\0.rela.text\0.data\0.rodata\0.symtab\0.strtab\0.shstrtab";
+static const int shstrtab_names[SH_COUNT] = {0, 1, 7, 18, 24, 32, 40, 48};
+
+typedef struct symbols {
+    Elf32_Sym* items;
+    int n;
+    int cap;
+} symbols_t;
+
+static int add_symbol(symbols_t* s, buf_t strtab, const char* name, Elf32_Addr value, Elf32_Word size,
+                      unsigned char info, Elf32_Half shndx) {
+    if (s->n == s->cap) {
+        int cap = s->cap ? s->cap * 2 : 16;
+        Elf32_Sym* items = (Elf32_Sym*)realloc(s->items, cap * sizeof(Elf32_Sym));
+        if (!items) {
+            perror("Error with realloc");
+            return -1;
+        }
+        s->items = items;
+        s->cap = cap;
+    }
+
+    Elf32_Sym* sym = &s->items[s->n];
+    memset(sym, 0, sizeof(*sym));
+    sym->st_name = name ? (Elf32_Word)strtab->len : 0;
+    sym->st_value = value;
+    sym->st_size = size;
+    sym->st_info = info;
+    sym->st_shndx = shndx;
+
+    if (name && !buf_put(strtab, name, strlen(name) + 1)) {
+        return -1;
+    }
+
+    return s->n++;
+}
+
+// Returns the index of the symbol called name, adding it
+// as undefined if the module doesn't define it
+static int find_symbol(symbols_t* s, buf_t strtab, const char* name) {
+    for (int i = 1; i < s->n; i++) {
+        if (s->items[i].st_name && !strcmp(strtab->data + s->items[i].st_name, name)) {
+            return i;
+        }
+    }
+
+    return add_symbol(s, strtab, name, 0, 0, ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE), SHN_UNDEF);
+}
+
+static int pad(buf_t b, size_t align) {
+    while (b->len % align) {
+        if (!buf_putc(b, 0)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Places the data objects of the given section in b, defining a symbol
+// for each of them. The string pool is local to the module, every
+// module has its own.
+static int layout_data(module_t m, section_t section, Elf32_Half shndx, buf_t b, symbols_t* syms, buf_t strtab,
+                       Elf32_Word* align) {
+    for (int i = 0; i < m->ndata; i++) {
+        mdata_t d = m->data[i];
+        if (d->section != section) {
+            continue;
+        }
+
+        if (!pad(b, (size_t)d->align)) {
+            return 0;
+        }
+        if ((Elf32_Word)d->align > *align) {
+            *align = (Elf32_Word)d->align;
+        }
+
+        int bind = strcmp(d->name, MODULE_STRINGS) ? STB_GLOBAL : STB_LOCAL;
+        if (add_symbol(syms, strtab, d->name, (Elf32_Addr)b->len, (Elf32_Word)d->size,
+                       ELF32_ST_INFO(bind, STT_OBJECT), shndx) < 0 ||
+            !buf_put(b, (const char*)d->bytes, d->size)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Moves the local symbols before the global ones, keeping their order,
+// and returns the index of the first global one
+static Elf32_Word locals_first(symbols_t* s) {
+    int first = 0;
+    for (int i = 0; i < s->n; i++) {
+        if (ELF32_ST_BIND(s->items[i].st_info) == STB_LOCAL) {
+            Elf32_Sym sym = s->items[i];
+            memmove(&s->items[first + 1], &s->items[first], (i - first) * sizeof(Elf32_Sym));
+            s->items[first++] = sym;
+        }
+    }
+    return (Elf32_Word)first;
+}
+
+static void section_header(Elf32_Shdr* sh, int name, Elf32_Word type, Elf32_Word flags, Elf32_Off offset,
+                           Elf32_Word size, Elf32_Word link, Elf32_Word info, Elf32_Word align, Elf32_Word entsize) {
+    sh->sh_name = (Elf32_Word)name;
+    sh->sh_type = type;
+    sh->sh_flags = flags;
+    sh->sh_addr = 0;
+    sh->sh_offset = offset;
+    sh->sh_size = size;
+    sh->sh_link = link;
+    sh->sh_info = info;
+    sh->sh_addralign = align;
+    sh->sh_entsize = entsize;
+}
+
+// Encodes the module straight to machine code and writes it to fd as
+// an ELF32 RISC-V relocatable object (.text, .data, .rodata, .symtab
+// and the .rela.text relocations for calls and address pairs). The
+// string literals are pooled first.
+int object_write(module_t m, int fd) {
+    if (!m || !module_pool_strings(m)) {
+        return 0;
+    }
+
+    buf_t text = buf_new(4096);
+    buf_t data = buf_new(256);
+    buf_t rodata = buf_new(256);
+    buf_t strtab = buf_new(256);
+    buf_t out = buf_new(8192);
+    relocs_t relocs = relocs_new();
+    symbols_t syms = {NULL, 0, 0};
+    Elf32_Rela* rela = NULL;
+
+    int ok = text && data && rodata && strtab && out && relocs && buf_putc(strtab, 0);
+
+    // Symbol 0 is reserved
+    ok = ok && add_symbol(&syms, strtab, NULL, 0, 0, 0, SHN_UNDEF) >= 0;
+    Elf32_Half sections[] = {SH_TEXT, SH_DATA, SH_RODATA};
+    for (int i = 0; ok && i < 3; i++) {
+        ok = add_symbol(&syms, strtab, NULL, 0, 0, ELF32_ST_INFO(STB_LOCAL, STT_SECTION), sections[i]) >= 0;
+    }
+
+    // Code, flagged as needing the C extension if any of it is compressed
+    Elf32_Word flags = 0;
+    for (int i = 0; ok && i < m->nfuncs; i++) {
+        mfunc_t f = m->funcs[i];
+        Elf32_Addr start = (Elf32_Addr)text->len;
+        if (compress_count(f)) {
+            flags |= EF_RISCV_RVC;
+        }
+        ok = encode_function(f, text, relocs) &&
+             add_symbol(&syms, strtab, f->name, start, (Elf32_Word)(text->len - start),
+                        ELF32_ST_INFO(STB_GLOBAL, STT_FUNC), SH_TEXT) >= 0;
+    }
+
+    // Data
+    Elf32_Word data_align = 1, rodata_align = 1;
+    ok = ok && layout_data(m, SEC_DATA, SH_DATA, data, &syms, strtab, &data_align) &&
+         layout_data(m, SEC_RODATA, SH_RODATA, rodata, &syms, strtab, &rodata_align);
+
+    // Local symbols must come before the global ones, the undefined
+    // symbols the relocations add are all global
+    Elf32_Word first_global = locals_first(&syms);
+
+    // Relocations, now that every defined symbol is known
+    if (ok && relocs->n) {
+        rela = (Elf32_Rela*)malloc(relocs->n * sizeof(Elf32_Rela));
+        ok = rela != NULL;
+    }
+    for (int i = 0; ok && i < relocs->n; i++) {
+        int sym = find_symbol(&syms, strtab, relocs->items[i].sym);
+        ok = sym >= 0;
+        rela[i].r_offset = relocs->items[i].offset;
+        rela[i].r_info = ELF32_R_INFO((Elf32_Word)sym, (Elf32_Word)relocs->items[i].type);
+        rela[i].r_addend = relocs->items[i].addend;
+    }
+
+    // File layout: header, section contents, section headers
+    Elf32_Shdr sh[SH_COUNT];
+    memset(sh, 0, sizeof(sh));
+    if (ok) {
+        Elf32_Ehdr eh;
+        memset(&eh, 0, sizeof(eh));
+        ok = buf_put(out, (const char*)&eh, sizeof(eh));
+    }
+
+    struct {
+        int index;
+        const void* bytes;
+        size_t size;
+        Elf32_Word align;
+    } contents[] = {
+        {SH_TEXT, text ? text->data : NULL, text ? text->len : 0, 4},
+        {SH_RELA_TEXT, rela, relocs ? relocs->n * sizeof(Elf32_Rela) : 0, 4},
+        {SH_DATA, data ? data->data : NULL, data ? data->len : 0, data_align},
+        {SH_RODATA, rodata ? rodata->data : NULL, rodata ? rodata->len : 0, rodata_align},
+        {SH_SYMTAB, syms.items, syms.n * sizeof(Elf32_Sym), 4},
+        {SH_STRTAB, strtab ? strtab->data : NULL, strtab ? strtab->len : 0, 1},
+        {SH_SHSTRTAB, shstrtab, sizeof(shstrtab), 1},
+    };
+
+    Elf32_Off offsets[SH_COUNT] = {0};
+    for (size_t i = 0; ok && i < sizeof(contents) / sizeof(contents[0]); i++) {
+        ok = pad(out, contents[i].align);
+        offsets[contents[i].index] = (Elf32_Off)out->len;
+        if (ok && contents[i].size) {
+            ok = buf_put(out, (const char*)contents[i].bytes, contents[i].size);
+        }
+    }
+
+    if (ok) {
+        section_header(&sh[SH_TEXT], shstrtab_names[SH_TEXT], SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
+                       offsets[SH_TEXT], (Elf32_Word)text->len, 0, 0, 4, 0);
+        section_header(&sh[SH_RELA_TEXT], shstrtab_names[SH_RELA_TEXT], SHT_RELA, SHF_INFO_LINK,
+                       offsets[SH_RELA_TEXT], (Elf32_Word)(relocs->n * sizeof(Elf32_Rela)), SH_SYMTAB, SH_TEXT, 4,
+                       sizeof(Elf32_Rela));
+        section_header(&sh[SH_DATA], shstrtab_names[SH_DATA], SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, offsets[SH_DATA],
+                       (Elf32_Word)data->len, 0, 0, data_align, 0);
+        section_header(&sh[SH_RODATA], shstrtab_names[SH_RODATA], SHT_PROGBITS, SHF_ALLOC, offsets[SH_RODATA],
+                       (Elf32_Word)rodata->len, 0, 0, rodata_align, 0);
+        section_header(&sh[SH_SYMTAB], shstrtab_names[SH_SYMTAB], SHT_SYMTAB, 0, offsets[SH_SYMTAB],
+                       (Elf32_Word)(syms.n * sizeof(Elf32_Sym)), SH_STRTAB, first_global, 4, sizeof(Elf32_Sym));
+        section_header(&sh[SH_STRTAB], shstrtab_names[SH_STRTAB], SHT_STRTAB, 0, offsets[SH_STRTAB],
+                       (Elf32_Word)strtab->len, 0, 0, 1, 0);
+        section_header(&sh[SH_SHSTRTAB], shstrtab_names[SH_SHSTRTAB], SHT_STRTAB, 0, offsets[SH_SHSTRTAB],
+                       sizeof(shstrtab), 0, 0, 1, 0);
+
+        ok = pad(out, 4);
+    }
+
+    if (ok) {
+        Elf32_Ehdr* eh = (Elf32_Ehdr*)out->data;
+        memcpy(eh->e_ident, ELFMAG, SELFMAG);
+        eh->e_ident[EI_CLASS] = ELFCLASS32;
+        eh->e_ident[EI_DATA] = ELFDATA2LSB;
+        eh->e_ident[EI_VERSION] = EV_CURRENT;
+        eh->e_ident[EI_OSABI] = ELFOSABI_SYSV;
+        eh->e_type = ET_REL;
+        eh->e_machine = EM_RISCV;
+        eh->e_version = EV_CURRENT;
+        eh->e_flags = flags;
+        eh->e_shoff = (Elf32_Off)out->len;
+        eh->e_ehsize = sizeof(Elf32_Ehdr);
+        eh->e_shentsize = sizeof(Elf32_Shdr);
+        eh->e_shnum = SH_COUNT;
+        eh->e_shstrndx = SH_SHSTRTAB;
+
+        ok = buf_put(out, (const char*)sh, sizeof(sh)) && buf_write(out, fd);
+    }
+
+    free(syms.items);
+    free(rela);
+    relocs_free(&relocs);
+    buf_free(&text);
+    buf_free(&data);
+    buf_free(&rodata);
+    buf_free(&strtab);
+    buf_free(&out);
+
+    return ok;
+}
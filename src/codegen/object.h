@@ -0,0 +1,12 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include "module.h"
+
+// Encodes the module straight to machine code and writes it to fd as
+// an ELF32 RISC-V relocatable object (.text, .data, .rodata, .symtab
+// and the .rela.text relocations for calls and address pairs). The
+// string literals are pooled first.
+int object_write(module_t m, int fd);
+
+#endif
@@ -0,0 +1,473 @@
+#include "regalloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cfg.h"
+
+// The live interval of a virtual register, as positions in the
+// instruction list: from its first to its last occurrence, stretched
+// over the loops it is live around.
+typedef struct interval {
+    int vreg;
+    int start;
+    int end;
+    int crosses_call;
+
+    // Argument registers the value is copied from (parameter, call
+    // result) and to (argument, return value), R_NONE if there is none
+    int hints[2];
+
+    // Virtual registers the instruction computing the value reads and
+    // could overwrite in its 16-bit form (add rd, rd, rs2), R_NONE if none
+    int tied[2];
+
+    // Assigned physical register, or R_NONE if spilled to slot
+    int reg;
+    int slot;
+} interval_t;
+
+// A jump from the position from back to the label at position to
+typedef struct back_edge {
+    int to;
+    int from;
+} back_edge_t;
+
+static const int caller_saved[] = {R_T0, R_T1, R_T2, R_T3, R_T4};
+static const int callee_saved[] = {R_S0, R_S1, R_S2, R_S3, R_S4, R_S5, R_S6, R_S7, R_S8, R_S9, R_S10, R_S11};
+
+// The argument registers that most 16-bit forms can name, the ones
+// least likely to be wanted for arguments first
+static const int compressible_args[] = {R_A5, R_A4, R_A3, R_A2, R_A1, R_A0};
+
+#define NCALLER (int)(sizeof(caller_saved) / sizeof(caller_saved[0]))
+#define NCALLEE (int)(sizeof(callee_saved) / sizeof(callee_saved[0]))
+#define NCOMPRESSIBLE_ARGS (int)(sizeof(compressible_args) / sizeof(compressible_args[0]))
+
+static void touch(interval_t* iv, int r, int pos) {
+    if (!reg_is_virtual(r)) {
+        return;
+    }
+
+    interval_t* v = &iv[r - R_VIRT];
+    if (v->start < 0) {
+        v->start = pos;
+    }
+    v->end = pos;
+}
+
+static int is_move(const inst_t i) {
+    return i->op == OP_ADDI && i->imm == 0;
+}
+
+static int is_arg(int r) {
+    return r >= R_A0 && r <= R_A7;
+}
+
+// Returns 1 if the 16-bit form of the operation can write its result
+// over its first operand (and its second one, for commutative ones)
+static int has_two_address_form(const inst_t i, int* commutative) {
+    switch (i->op) {
+        case OP_ADD:
+        case OP_AND:
+        case OP_OR:
+        case OP_XOR:
+            *commutative = 1;
+            return 1;
+        case OP_SUB:
+        case OP_ADDI:
+        case OP_ANDI:
+        case OP_SLLI:
+        case OP_SRLI:
+        case OP_SRAI:
+            *commutative = 0;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int arg_bits(const int* regs, int n) {
+    int bits = 0;
+    for (int k = 0; k < n; k++) {
+        if (is_arg(regs[k])) {
+            bits |= 1 << (regs[k] - R_A0);
+        }
+    }
+    return bits;
+}
+
+// Stores in busy, for every position, the argument registers (bit k for
+// a<k>) that are written by the instruction or hold a value still needed
+// after it
+static int arg_occupancy(mfunc_t f, unsigned char* busy) {
+    cfg_t g = cfg_build(f);
+    if (!g || !cfg_liveness(g)) {
+        cfg_free(&g);
+        return 0;
+    }
+
+    int start = 0;
+    for (int b = 0; b < g->nblocks; b++) {
+        block_t blk = &g->blocks[b];
+        int live = 0;
+        for (int r = R_A0; r <= R_A7; r++) {
+            live |= bitset_test(blk->live_out, r) << (r - R_A0);
+        }
+
+        int pos = start + blk->ninsts - 1;
+        for (inst_t i = blk->last;; i = i->prev, pos--) {
+            int regs[CFG_MAX_REGS];
+            int defs = arg_bits(regs, cfg_inst_defs(i, regs));
+            busy[pos] = (unsigned char)(live | defs);
+            live = (live & ~defs) | arg_bits(regs, cfg_inst_uses(i, regs));
+            if (i == blk->first) {
+                break;
+            }
+        }
+        start += blk->ninsts;
+    }
+
+    cfg_free(&g);
+    return 1;
+}
+
+// Returns 1 if the value can live in the argument register r, which
+// nothing else needs from where the value is set to its last use
+static int fits_arg(const interval_t* v, int r, const unsigned char* busy, interval_t** owner) {
+    if (r == R_NONE || owner[r] || v->crosses_call) {
+        return 0;
+    }
+    for (int pos = v->start; pos < v->end; pos++) {
+        if (busy[pos] & (1 << (r - R_A0))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int by_start(const void* a, const void* b) {
+    const interval_t* x = *(const interval_t* const*)a;
+    const interval_t* y = *(const interval_t* const*)b;
+    return x->start != y->start ? x->start - y->start : x->vreg - y->vreg;
+}
+
+// Computes the intervals of all the virtual registers of f
+static int build_intervals(mfunc_t f, interval_t* iv) {
+    int* label_pos = (int*)malloc((f->nlabels + 1) * sizeof(int));
+    back_edge_t* edges = (back_edge_t*)malloc((f->ninsts + 1) * sizeof(back_edge_t));
+    int* calls = (int*)malloc((f->ninsts + 1) * sizeof(int));
+    if (!label_pos || !edges || !calls) {
+        perror("Error with malloc");
+        free(label_pos);
+        free(edges);
+        free(calls);
+        return 0;
+    }
+
+    for (int v = 0; v < f->nvregs; v++) {
+        iv[v].vreg = R_VIRT + v;
+        iv[v].start = -1;
+        iv[v].end = -1;
+        iv[v].crosses_call = 0;
+        iv[v].hints[0] = R_NONE;
+        iv[v].hints[1] = R_NONE;
+        iv[v].tied[0] = R_NONE;
+        iv[v].tied[1] = R_NONE;
+        iv[v].reg = R_NONE;
+        iv[v].slot = -1;
+    }
+
+    int pos = 0, nedges = 0, ncalls = 0;
+    for (inst_t i = f->head; i; i = i->next, pos++) {
+        if (i->op == OP_LABEL && i->label >= 0 && i->label < f->nlabels) {
+            label_pos[i->label] = pos;
+        }
+    }
+
+    pos = 0;
+    for (inst_t i = f->head; i; i = i->next, pos++) {
+        int uses[2];
+        int n = inst_uses(i, uses);
+        for (int k = 0; k < n; k++) {
+            touch(iv, uses[k], pos);
+        }
+        touch(iv, inst_def(i), pos);
+
+        if (is_move(i) && is_arg(i->rs1) && reg_is_virtual(i->rd)) {
+            iv[i->rd - R_VIRT].hints[0] = i->rs1;
+        } else if (is_move(i) && is_arg(i->rd) && reg_is_virtual(i->rs1)) {
+            iv[i->rs1 - R_VIRT].hints[1] = i->rd;
+        }
+
+        int commutative;
+        if (reg_is_virtual(i->rd) && has_two_address_form(i, &commutative) && iv[i->rd - R_VIRT].start == pos) {
+            iv[i->rd - R_VIRT].tied[0] = reg_is_virtual(i->rs1) ? i->rs1 : R_NONE;
+            iv[i->rd - R_VIRT].tied[1] = commutative && reg_is_virtual(i->rs2) ? i->rs2 : R_NONE;
+        }
+
+        if ((inst_is_branch(i) || i->op == OP_JAL) && i->label >= 0 && i->label < f->nlabels &&
+            label_pos[i->label] <= pos) {
+            edges[nedges].to = label_pos[i->label];
+            edges[nedges].from = pos;
+            nedges++;
+        }
+        if (i->op == OP_CALL) {
+            calls[ncalls++] = pos;
+        }
+    }
+
+    // A value that is live when a loop starts is live through all of it
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int e = 0; e < nedges; e++) {
+            for (int v = 0; v < f->nvregs; v++) {
+                if (iv[v].start >= 0 && iv[v].start < edges[e].to && iv[v].end >= edges[e].to &&
+                    iv[v].end < edges[e].from) {
+                    iv[v].end = edges[e].from;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    for (int v = 0; v < f->nvregs; v++) {
+        for (int c = 0; c < ncalls && calls[c] < iv[v].end; c++) {
+            if (calls[c] > iv[v].start) {
+                iv[v].crosses_call = 1;
+                break;
+            }
+        }
+    }
+
+    free(label_pos);
+    free(edges);
+    free(calls);
+    return 1;
+}
+
+static int take_free(const int* pool, int n, interval_t** owner) {
+    for (int k = 0; k < n; k++) {
+        if (!owner[pool[k]]) {
+            return pool[k];
+        }
+    }
+    return R_NONE;
+}
+
+static void spill(mfunc_t f, interval_t* v) {
+    v->reg = R_NONE;
+    v->slot = mfunc_new_slot(f, 4, 4);
+}
+
+// Returns 1 if a value that is set while the one of order[k] is live
+// would like to be computed in the argument register r
+static int wanted(interval_t** order, int k, int n, int r) {
+    for (int j = k + 1; j < n && order[j]->start < order[k]->end; j++) {
+        if (order[j]->hints[0] == r || order[j]->hints[1] == r) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Register of a value that the one of order[k] is computed from, if it
+// can take it over there so the instruction has a 16-bit form, R_NONE
+// if not
+static int take_tied(const interval_t* iv, interval_t** order, int k, int n, const unsigned char* busy,
+                     interval_t** owner) {
+    const interval_t* cur = order[k];
+    for (int h = 0; h < 2; h++) {
+        if (cur->tied[h] == R_NONE) {
+            continue;
+        }
+
+        int r = iv[cur->tied[h] - R_VIRT].reg;
+        if (r == R_NONE || owner[r] || (cur->crosses_call && !reg_is_callee_saved(r))) {
+            continue;
+        }
+        if (!is_arg(r) || (fits_arg(cur, r, busy, owner) && !wanted(order, k, n, r))) {
+            return r;
+        }
+    }
+    return R_NONE;
+}
+
+// Assigns registers in order of interval start, values moved from or to
+// an argument register get it when it's free, so they are computed there.
+// For compressed code, values then go to the register of the operand they
+// are computed from when it's free, or to x8-x15, as long as no other
+// value wants the argument register meanwhile.
+static int assign(mfunc_t f, interval_t* iv, const unsigned char* busy, int compressed) {
+    interval_t** order = (interval_t**)malloc((f->nvregs + 1) * sizeof(interval_t*));
+    if (!order) {
+        perror("Error with malloc");
+        return 0;
+    }
+
+    int n = 0;
+    for (int v = 0; v < f->nvregs; v++) {
+        if (iv[v].start >= 0) {
+            order[n++] = &iv[v];
+        }
+    }
+    qsort(order, n, sizeof(interval_t*), by_start);
+
+    // Interval currently holding each physical register
+    interval_t* owner[R_VIRT] = {0};
+
+    for (int k = 0; k < n; k++) {
+        interval_t* cur = order[k];
+
+        // Expire the intervals that ended, a register read by an instruction
+        // can be written by the same one
+        for (int r = 0; r < R_VIRT; r++) {
+            if (owner[r] && owner[r]->end <= cur->start) {
+                owner[r] = NULL;
+            }
+        }
+
+        int reg = R_NONE;
+        for (int h = 0; reg == R_NONE && h < 2; h++) {
+            if (fits_arg(cur, cur->hints[h], busy, owner)) {
+                reg = cur->hints[h];
+            }
+        }
+        if (reg == R_NONE && compressed) {
+            reg = take_tied(iv, order, k, n, busy, owner);
+        }
+        for (int a = 0; reg == R_NONE && compressed && a < NCOMPRESSIBLE_ARGS; a++) {
+            if (fits_arg(cur, compressible_args[a], busy, owner) && !wanted(order, k, n, compressible_args[a])) {
+                reg = compressible_args[a];
+            }
+        }
+        if (reg == R_NONE && !cur->crosses_call) {
+            reg = take_free(caller_saved, NCALLER, owner);
+        }
+        if (reg == R_NONE) {
+            reg = take_free(callee_saved, NCALLEE, owner);
+        }
+
+        if (reg == R_NONE) {
+            // Steal the register of the interval that ends last, if it
+            // ends after this one and the register suits this interval
+            interval_t* victim = NULL;
+            for (int r = 0; r < R_VIRT; r++) {
+                if (owner[r] && !is_arg(r) && (!cur->crosses_call || reg_is_callee_saved(r)) &&
+                    (!victim || owner[r]->end > victim->end)) {
+                    victim = owner[r];
+                }
+            }
+
+            if (victim && victim->end > cur->end) {
+                reg = victim->reg;
+                spill(f, victim);
+            } else {
+                spill(f, cur);
+                continue;
+            }
+        }
+
+        cur->reg = reg;
+        owner[reg] = cur;
+    }
+
+    free(order);
+    return 1;
+}
+
+// Replaces the virtual registers with their physical ones,
+// reloading and storing spilled values around each instruction
+static int rewrite(mfunc_t f, interval_t* iv) {
+    for (inst_t i = f->head; i; i = i->next) {
+        int* fields[] = {&i->rs1, &i->rs2};
+        int reloaded = R_NONE;
+
+        for (int k = 0; k < 2; k++) {
+            int r = *fields[k];
+            if (!reg_is_virtual(r)) {
+                continue;
+            }
+
+            interval_t* v = &iv[r - R_VIRT];
+            if (v->reg != R_NONE) {
+                *fields[k] = v->reg;
+                continue;
+            }
+
+            // Both operands may be the same spilled value
+            if (k == 1 && reloaded == r) {
+                *fields[k] = REGALLOC_SCRATCH1;
+                continue;
+            }
+
+            int scratch = k == 0 ? REGALLOC_SCRATCH1 : REGALLOC_SCRATCH2;
+            if (!mfunc_insert_before(f, i, inst_new_i(OP_LW, scratch, R_SP, R_NONE, v->slot))) {
+                return 0;
+            }
+            *fields[k] = scratch;
+            if (k == 0) {
+                reloaded = r;
+            }
+        }
+
+        if (reg_is_virtual(i->rd)) {
+            interval_t* v = &iv[i->rd - R_VIRT];
+            if (v->reg != R_NONE) {
+                i->rd = v->reg;
+            } else {
+                i->rd = REGALLOC_SCRATCH1;
+                inst_t store = inst_new_i(OP_SW, R_NONE, R_SP, REGALLOC_SCRATCH1, v->slot);
+                if (!mfunc_insert_before(f, i->next, store)) {
+                    return 0;
+                }
+                i = store;
+            }
+        }
+    }
+
+    // Values computed in the register they were moved to
+    // leave moves to themselves behind
+    for (inst_t i = f->head, next; i; i = next) {
+        next = i->next;
+        if (is_move(i) && i->rd == i->rs1) {
+            mfunc_remove(f, i);
+        }
+    }
+
+    return 1;
+}
+
+// Linear scan register allocation: replaces the virtual registers of f
+// with physical ones, spilling whole intervals to stack slots when they
+// run out. Values live across a call only get callee-saved registers,
+// values moved to or from an argument register get that register when
+// nothing else needs it meanwhile, which makes the move go away. When the
+// target (NULL for TARGET_DEFAULT) compresses instructions, registers are
+// picked to give them 16-bit forms.
+int regalloc(mfunc_t f, const target_t* t) {
+    if (!f) {
+        return 0;
+    }
+    if (!f->nvregs) {
+        return 1;
+    }
+
+    interval_t* iv = (interval_t*)malloc(f->nvregs * sizeof(interval_t));
+    unsigned char* busy = (unsigned char*)malloc(f->ninsts + 1);
+    if (!iv || !busy) {
+        perror("Error with malloc");
+        free(iv);
+        free(busy);
+        return 0;
+    }
+
+    int ok = build_intervals(f, iv) && arg_occupancy(f, busy) && assign(f, iv, busy, t && t->compressed) && rewrite(f, iv);
+    if (ok) {
+        f->nvregs = 0;
+    }
+
+    free(iv);
+    free(busy);
+    return ok;
+}
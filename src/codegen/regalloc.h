@@ -0,0 +1,21 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include "mfunc.h"
+#include "target.h"
+
+// Scratch registers kept out of allocation, used to reload
+// spilled values around the instructions that need them
+#define REGALLOC_SCRATCH1 R_T5
+#define REGALLOC_SCRATCH2 R_T6
+
+// Linear scan register allocation: replaces the virtual registers of f
+// with physical ones, spilling whole intervals to stack slots when they
+// run out. Values live across a call only get callee-saved registers,
+// values moved to or from an argument register get that register when
+// nothing else needs it meanwhile, which makes the move go away. When the
+// target (NULL for TARGET_DEFAULT) compresses instructions, registers are
+// picked to give them 16-bit forms.
+int regalloc(mfunc_t f, const target_t* t);
+
+#endif
@@ -0,0 +1,477 @@
+#include "sched.h"
+#include <stdlib.h>
+#include <string.h>
+#include "arith.h"
+#include "cfg.h"
+
+// Longest region scheduled at once, longer runs are cut
+#define SCHED_MAX_REGION 128
+
+// No dependency between two instructions
+#define NO_DEP -1
+
+typedef struct node {
+    inst_t inst;
+    int latency;
+
+    // Longest path of latencies to the end of the region
+    int height;
+
+    // Predecessors not scheduled yet, and the first cycle the
+    // instruction can issue without stalling
+    int waiting;
+    int earliest;
+    int done;
+} node_t;
+
+// A straight-line region being scheduled, the last instruction may be a
+// branch or call that stays last
+typedef struct sched {
+    const target_t* t;
+    int nregs;
+    int words;
+
+    node_t nodes[SCHED_MAX_REGION];
+    int n;
+
+    // Cycles node j waits for node i (i < j), NO_DEP if it doesn't
+    short dep[SCHED_MAX_REGION][SCHED_MAX_REGION];
+
+    // Registers read or written in the region, with the reads left and
+    // whether they hold a value that is still needed
+    int* regs;
+    int nused;
+    int* remaining;
+    unsigned char* live;
+    unsigned char* seen;
+
+    // Registers live after the region
+    bitset_t live_out;
+} sched_t;
+
+// ===================== DEPENDENCIES =====================
+
+static int latency(const target_t* t, const inst_t i) {
+    if (inst_is_load(i)) {
+        return t->load;
+    }
+    if (i->op == OP_CALL) {
+        return arith_is_helper(i->sym) ? t->mul : t->call;
+    }
+    return t->alu;
+}
+
+// Ends a region: nothing moves across it
+static int is_barrier(const inst_t i) {
+    return inst_is_branch(i) || i->op == OP_JAL || i->op == OP_JALR || inst_is_call(i) || i->op == OP_ECALL ||
+           i->op == OP_EBREAK || i->op == OP_LABEL;
+}
+
+static int contains(const int* regs, int n, int r) {
+    for (int k = 0; k < n; k++) {
+        if (regs[k] == r) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int width(const inst_t i) {
+    switch (i->op) {
+        case OP_LB:
+        case OP_LBU:
+        case OP_SB:
+            return 1;
+        case OP_LH:
+        case OP_LHU:
+        case OP_SH:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+// Returns 1 unless the accesses of nodes a and b (a < b) are known not to
+// overlap: different areas of the frame, or disjoint offsets from a base
+// that doesn't change in between
+static int may_alias(const sched_t* s, int a, int b) {
+    const inst_t x = s->nodes[a].inst, y = s->nodes[b].inst;
+    if (x->rs1 != y->rs1) {
+        return 1;
+    }
+    if (x->rs1 == R_SP && x->area != y->area) {
+        return 0;
+    }
+    for (int k = a; k < b; k++) {
+        if (inst_def(s->nodes[k].inst) == x->rs1) {
+            return 1;
+        }
+    }
+    return x->imm < y->imm + width(y) && y->imm < x->imm + width(x);
+}
+
+static void build_deps(sched_t* s) {
+    for (int j = 0; j < s->n; j++) {
+        inst_t b = s->nodes[j].inst;
+        int uses_b[CFG_MAX_REGS], defs_b[CFG_MAX_REGS];
+        int nuses_b = cfg_inst_uses(b, uses_b), ndefs_b = cfg_inst_defs(b, defs_b);
+
+        for (int i = 0; i < j; i++) {
+            inst_t a = s->nodes[i].inst;
+            int uses_a[CFG_MAX_REGS], defs_a[CFG_MAX_REGS];
+            int nuses_a = cfg_inst_uses(a, uses_a), ndefs_a = cfg_inst_defs(a, defs_a);
+
+            int d = NO_DEP;
+            for (int k = 0; k < ndefs_a; k++) {
+                if (contains(uses_b, nuses_b, defs_a[k])) {
+                    d = s->nodes[i].latency;
+                } else if (d == NO_DEP && contains(defs_b, ndefs_b, defs_a[k])) {
+                    d = 0;
+                }
+            }
+            for (int k = 0; d == NO_DEP && k < nuses_a; k++) {
+                if (contains(defs_b, ndefs_b, uses_a[k])) {
+                    d = 0;
+                }
+            }
+            if (d == NO_DEP && ((inst_is_store(a) && (inst_is_load(b) || inst_is_store(b))) ||
+                                (inst_is_load(a) && inst_is_store(b))) &&
+                may_alias(s, i, j)) {
+                d = 0;
+            }
+            s->dep[i][j] = (short)d;
+        }
+    }
+
+    for (int i = s->n - 1; i >= 0; i--) {
+        node_t* x = &s->nodes[i];
+        x->height = 0;
+        x->waiting = 0;
+        x->earliest = 0;
+        x->done = 0;
+        for (int j = i + 1; j < s->n; j++) {
+            if (s->dep[i][j] != NO_DEP && s->dep[i][j] + s->nodes[j].height > x->height) {
+                x->height = s->dep[i][j] + s->nodes[j].height;
+            }
+        }
+        for (int p = 0; p < i; p++) {
+            x->waiting += s->dep[p][i] != NO_DEP;
+        }
+    }
+}
+
+// Stall cycles of the region issued in the order given
+static int stalls(const sched_t* s, const int* order) {
+    int issue[SCHED_MAX_REGION];
+    int cycle = 0, total = 0;
+    for (int k = 0; k < s->n; k++) {
+        int j = order[k], at = cycle;
+        for (int p = 0; p < k; p++) {
+            int i = order[p];
+            int d = i < j ? s->dep[i][j] : NO_DEP;
+            if (d != NO_DEP && issue[p] + d > at) {
+                at = issue[p] + d;
+            }
+        }
+        issue[k] = at;
+        total += at - cycle;
+        cycle = at + 1;
+    }
+    return total;
+}
+
+// ===================== REGISTER PRESSURE =====================
+
+// Collects the registers of the region with their reads, and the ones
+// holding a value when it starts
+static void pressure_init(sched_t* s) {
+    s->nused = 0;
+    for (int k = 0; k < s->n; k++) {
+        int regs[2 * CFG_MAX_REGS];
+        int n = cfg_inst_uses(s->nodes[k].inst, regs);
+        int nuses = n;
+        n += cfg_inst_defs(s->nodes[k].inst, regs + n);
+
+        for (int r = 0; r < n; r++) {
+            int reg = regs[r];
+            if (!s->seen[reg]) {
+                s->seen[reg] = 1;
+                s->regs[s->nused++] = reg;
+                // Read before being written: it comes from before the region
+                s->live[reg] = r < nuses;
+            }
+            if (r < nuses && !contains(regs, r, reg)) {
+                s->remaining[reg]++;
+            }
+        }
+    }
+}
+
+static void pressure_clear(sched_t* s) {
+    for (int k = 0; k < s->nused; k++) {
+        s->seen[s->regs[k]] = 0;
+        s->live[s->regs[k]] = 0;
+        s->remaining[s->regs[k]] = 0;
+    }
+}
+
+static int pressure(const sched_t* s) {
+    int n = 0;
+    for (int k = 0; k < s->nused; k++) {
+        n += s->live[s->regs[k]];
+    }
+    return n;
+}
+
+// Updates the live values once the instruction issued, or only
+// returns by how much their number changes if apply isn't set
+static int pressure_issue(sched_t* s, const inst_t i, int apply) {
+    int uses[CFG_MAX_REGS], defs[CFG_MAX_REGS], dies[CFG_MAX_REGS], needed[CFG_MAX_REGS];
+    int nuses = cfg_inst_uses(i, uses), ndefs = cfg_inst_defs(i, defs);
+    int delta = 0;
+
+    // Last read of a value, and values written that will be read
+    for (int k = 0; k < nuses; k++) {
+        int r = uses[k];
+        dies[k] = !contains(uses, k, r) && s->remaining[r] == 1 && !bitset_test(s->live_out, r) &&
+                  !contains(defs, ndefs, r);
+        delta -= dies[k] && s->live[r];
+    }
+    for (int k = 0; k < ndefs; k++) {
+        int r = defs[k];
+        int reads_left = s->remaining[r] - contains(uses, nuses, r);
+        needed[k] = reads_left > 0 || bitset_test(s->live_out, r);
+        delta += needed[k] - s->live[r];
+    }
+
+    for (int k = 0; apply && k < nuses; k++) {
+        if (!contains(uses, k, uses[k])) {
+            s->remaining[uses[k]]--;
+            s->live[uses[k]] = s->live[uses[k]] && !dies[k];
+        }
+    }
+    for (int k = 0; apply && k < ndefs; k++) {
+        s->live[defs[k]] = (unsigned char)needed[k];
+    }
+    return delta;
+}
+
+// ===================== SCHEDULING =====================
+
+// Returns 1 if node a is a better pick than node b at the cycle
+static int better(const sched_t* s, int a, int b, int cycle, int fits_a, int fits_b) {
+    if (b < 0) {
+        return 1;
+    }
+    if (fits_a != fits_b) {
+        return fits_a;
+    }
+
+    const node_t* x = &s->nodes[a];
+    const node_t* y = &s->nodes[b];
+    int ready_a = x->earliest <= cycle, ready_b = y->earliest <= cycle;
+    if (ready_a != ready_b) {
+        return ready_a;
+    }
+    if (!ready_a && x->earliest != y->earliest) {
+        return x->earliest < y->earliest;
+    }
+    if (x->height != y->height) {
+        return x->height > y->height;
+    }
+    return a < b;
+}
+
+// Orders the nodes of the region in order, the last one staying last
+// if it is a barrier
+static void list_schedule(sched_t* s, int* order) {
+    int pinned = is_barrier(s->nodes[s->n - 1].inst) ? s->n - 1 : -1;
+
+    // The original order is the bound on the number of live values
+    pressure_init(s);
+    int limit = pressure(s);
+    for (int k = 0; k < s->n; k++) {
+        pressure_issue(s, s->nodes[k].inst, 1);
+        int p = pressure(s);
+        limit = p > limit ? p : limit;
+    }
+    pressure_clear(s);
+    pressure_init(s);
+
+    int cycle = 0, live = pressure(s);
+    for (int k = 0; k < s->n; k++) {
+        int best = -1, best_fits = 0;
+        for (int j = 0; j < s->n; j++) {
+            node_t* x = &s->nodes[j];
+            if (x->done || x->waiting || (j == pinned && k < s->n - 1)) {
+                continue;
+            }
+            int fits = live + pressure_issue(s, x->inst, 0) <= limit;
+            if (better(s, j, best, cycle, fits, best_fits)) {
+                best = j;
+                best_fits = fits;
+            }
+        }
+
+        node_t* x = &s->nodes[best];
+        int issue = x->earliest > cycle ? x->earliest : cycle;
+        x->done = 1;
+        live += pressure_issue(s, x->inst, 1);
+        for (int j = best + 1; j < s->n; j++) {
+            if (s->dep[best][j] != NO_DEP) {
+                s->nodes[j].waiting--;
+                if (issue + s->dep[best][j] > s->nodes[j].earliest) {
+                    s->nodes[j].earliest = issue + s->dep[best][j];
+                }
+            }
+        }
+        order[k] = best;
+        cycle = issue + 1;
+    }
+}
+
+// Schedules the region made of the instructions insts[0..n), and relinks
+// them in their new order if it has fewer stalls
+static int schedule_region(sched_t* s, mfunc_t f, inst_t* insts, int n, sched_stats_t* stats) {
+    s->n = n;
+    for (int k = 0; k < n; k++) {
+        s->nodes[k].inst = insts[k];
+        s->nodes[k].latency = latency(s->t, insts[k]);
+    }
+
+    int identity[SCHED_MAX_REGION], order[SCHED_MAX_REGION];
+    for (int k = 0; k < n; k++) {
+        identity[k] = k;
+    }
+
+    build_deps(s);
+    list_schedule(s, order);
+    pressure_clear(s);
+
+    int before = stalls(s, identity), after = stalls(s, order);
+    stats->regions++;
+    stats->stalls_before += before;
+    if (after >= before) {
+        stats->stalls_after += before;
+        return 1;
+    }
+    stats->stalls_after += after;
+
+    inst_t next = insts[n - 1]->next;
+    for (int k = 0; k < n; k++) {
+        mfunc_unlink(f, insts[k]);
+    }
+    for (int k = 0; k < n; k++) {
+        stats->moved += order[k] != k;
+        if (!mfunc_insert_before(f, next, s->nodes[order[k]].inst)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Registers live before the instructions, from the ones live after them
+static void live_before(const inst_t* insts, int n, bitset_t live) {
+    for (int k = n - 1; k >= 0; k--) {
+        int regs[CFG_MAX_REGS];
+        int nr = cfg_inst_defs(insts[k], regs);
+        for (int r = 0; r < nr; r++) {
+            bitset_clear(live, regs[r]);
+        }
+        nr = cfg_inst_uses(insts[k], regs);
+        for (int r = 0; r < nr; r++) {
+            bitset_set(live, regs[r]);
+        }
+    }
+}
+
+// Schedules the regions of the block, from the last one up
+static int schedule_block(sched_t* s, mfunc_t f, block_t b, inst_t* insts, bitset_t live, sched_stats_t* stats) {
+    int n = 0;
+    for (inst_t i = b->first;; i = i->next) {
+        if (i->op != OP_LABEL) {
+            insts[n++] = i;
+        }
+        if (i == b->last) {
+            break;
+        }
+    }
+
+    bitset_copy(live, b->live_out, s->words);
+    int end = n;
+    while (end > 0) {
+        // The region ends with the barrier before end, if any, and starts
+        // after the previous one
+        int start = end - 1;
+        while (start > 0 && !is_barrier(insts[start - 1]) && end - start < SCHED_MAX_REGION) {
+            start--;
+        }
+
+        bitset_copy(s->live_out, live, s->words);
+        if (end - start > 1 && !schedule_region(s, f, insts + start, end - start, stats)) {
+            return 0;
+        }
+        live_before(insts + start, end - start, live);
+        end = start;
+    }
+    return 1;
+}
+
+// List scheduling of every basic block of f for an in-order core: the
+// instructions between two labels, branches or calls are reordered along
+// their dependencies so that a result isn't used before its latency
+// (given by the target) has elapsed, loads first. An instruction that
+// would make more values live at once than the original order did waits.
+// The statistics of stats (optional) are incremented.
+int schedule(mfunc_t f, const target_t* t, sched_stats_t* stats) {
+    if (!f || !t) {
+        return 0;
+    }
+
+    sched_stats_t local = {0};
+    if (!stats) {
+        stats = &local;
+    }
+
+    cfg_t g = cfg_build(f);
+    if (!g || !cfg_liveness(g)) {
+        cfg_free(&g);
+        return 0;
+    }
+
+    sched_t* s = (sched_t*)calloc(1, sizeof(sched_t));
+    inst_t* insts = (inst_t*)malloc((f->ninsts + 1) * sizeof(inst_t));
+    bitset_t live = bitset_new(g->nregs);
+    int ok = s && insts && live;
+    if (ok) {
+        s->t = t;
+        s->nregs = g->nregs;
+        s->words = g->words;
+        s->regs = (int*)malloc(g->nregs * sizeof(int));
+        s->remaining = (int*)calloc(g->nregs, sizeof(int));
+        s->live = (unsigned char*)calloc(g->nregs, 1);
+        s->seen = (unsigned char*)calloc(g->nregs, 1);
+        s->live_out = bitset_new(g->nregs);
+        ok = s->regs && s->remaining && s->live && s->seen && s->live_out;
+    }
+    if (!ok) {
+        perror("Error with malloc");
+    }
+
+    for (int b = 0; ok && b < g->nblocks; b++) {
+        ok = schedule_block(s, f, &g->blocks[b], insts, live, stats);
+    }
+
+    if (s) {
+        free(s->regs);
+        free(s->remaining);
+        free(s->live);
+        free(s->seen);
+        bitset_free(&s->live_out);
+        free(s);
+    }
+    bitset_free(&live);
+    free(insts);
+    cfg_free(&g);
+    return ok;
+}
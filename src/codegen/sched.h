@@ -0,0 +1,28 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdio.h>
+#include "mfunc.h"
+#include "target.h"
+
+// What the scheduler did to a function
+typedef struct sched_stats {
+    // Straight-line regions scheduled, and instructions that moved
+    int regions;
+    int moved;
+
+    // Stall cycles of the regions estimated from the latencies of the
+    // target, before and after scheduling
+    int stalls_before;
+    int stalls_after;
+} sched_stats_t;
+
+// List scheduling of every basic block of f for an in-order core: the
+// instructions between two labels, branches or calls are reordered along
+// their dependencies so that a result isn't used before its latency
+// (given by the target) has elapsed, loads first. An instruction that
+// would make more values live at once than the original order did waits.
+// The statistics of stats (optional) are incremented.
+int schedule(mfunc_t f, const target_t* t, sched_stats_t* stats);
+
+#endif
@@ -0,0 +1,70 @@
+#include "target.h"
+#include <stdio.h>
+#include <string.h>
+
+// Sets the key of t, 0 if there is no such key
+static int set(target_t* t, const char* key, const char* value) {
+    if (!strcmp(key, "name")) {
+        size_t len = strlen(value);
+        if (len >= sizeof(t->name)) {
+            return 0;
+        }
+        memcpy(t->name, value, len + 1);
+        return 1;
+    }
+
+    struct {
+        const char* key;
+        int* field;
+    } fields[] = {
+        {"alu", &t->alu},   {"load", &t->load},     {"mul", &t->mul},           {"call", &t->call},
+        {"jump", &t->jump}, {"mispredict", &t->mispredict}, {"indirect", &t->indirect},
+        {"compressed", &t->compressed},
+    };
+
+    for (size_t k = 0; k < sizeof(fields) / sizeof(fields[0]); k++) {
+        int n, end = 0;
+        if (!strcmp(key, fields[k].key)) {
+            if (sscanf(value, "%d%n", &n, &end) != 1 || value[end] != '\0' || n < 0 || n > 255) {
+                return 0;
+            }
+            *fields[k].field = n;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Reads the target description file at path into t, the keys it doesn't
+// set keep their value. Returns 0 and reports the line on errors.
+int target_load(const char* path, target_t* t) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return 0;
+    }
+
+    char line[256];
+    int lineno = 0, ok = 1;
+    while (ok && fgets(line, sizeof(line), fp)) {
+        lineno++;
+        char* comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        char key[32], value[64];
+        int n = sscanf(line, " %31[a-z_] = %63s", key, value);
+        if (n == EOF) {
+            // Blank line
+            continue;
+        }
+        if (n != 2 || !set(t, key, value)) {
+            fprintf(stderr, "Error: %s:%d: invalid line %s", path, lineno, line);
+            ok = 0;
+        }
+    }
+
+    fclose(fp);
+    return ok;
+}
@@ -0,0 +1,40 @@
+#ifndef TARGET_H
+#define TARGET_H
+
+// The model of the core the code is generated for, as read from a target
+// description file (targets/*.target): "key = value" lines, # comments.
+typedef struct target {
+    char name[32];
+
+    // Cycles from the issue of an instruction to the first one that can
+    // use its result without stalling
+    int alu;
+    int load;
+
+    // Calls to the software multiplication and division helpers (from the
+    // call to their result) and to other functions
+    int mul;
+    int call;
+
+    // Cycles lost on a taken jump or correctly predicted taken branch, on
+    // a mispredicted branch and on an indirect jump
+    int jump;
+    int mispredict;
+    int indirect;
+
+    // The core implements the C extension: instructions with a 16-bit
+    // form are compressed, and registers allocated to allow it
+    int compressed;
+} target_t;
+
+// The classic five stage pipeline (targets/rv32i-5stage.target)
+#define TARGET_DEFAULT                                                                                                \
+    ((target_t){                                                                                                      \
+        .name = "rv32i-5stage", .alu = 1, .load = 2, .mul = 40, .call = 4, .jump = 1, .mispredict = 2,                \
+        .indirect = 2, .compressed = 0})
+
+// Reads the target description file at path into t, the keys it doesn't
+// set keep their value. Returns 0 and reports the line on errors.
+int target_load(const char* path, target_t* t);
+
+#endif
@@ -0,0 +1,1537 @@
+#include "preprocessor.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "tokenizer.h"
+#include "utils/str.h"
+
+#define PP_BUCKETS 1024
+
+// Nesting of #include past which a file is assumed to include itself
+#define PP_MAX_DEPTH 200
+
+// ===================== TOKEN VECTORS =====================
+
+// An array of tokens. Unless said otherwise they're borrowed from the
+// files and macros of the session, which live as long as it.
+typedef struct tvec {
+    token_t* items;
+    int n;
+    int cap;
+} tvec_t;
+
+static int tvec_push(tvec_t* v, token_t t) {
+    if (!t) {
+        return 0;
+    }
+
+    if (v->n == v->cap) {
+        int ncap = v->cap ? 2 * v->cap : 16;
+        token_t* grown = (token_t*)realloc(v->items, ncap * sizeof(token_t));
+        if (!grown) {
+            perror("Error with realloc");
+            return 0;
+        }
+        v->items = grown;
+        v->cap = ncap;
+    }
+
+    v->items[v->n++] = t;
+    return 1;
+}
+
+// Frees the vector and the tokens, when it owns them
+static void tvec_free(tvec_t* v, int owned) {
+    for (int i = 0; owned && i < v->n; i++) {
+        token_free(&v->items[i]);
+    }
+    free(v->items);
+    *v = (tvec_t){NULL, 0, 0};
+}
+
+// Lexes the len bytes at text into v, which owns the tokens
+static int lex(const char* text, size_t len, tvec_t* v) {
+    tokenizer_t t = tokenizer_new();
+    int ok = t && tokenize_string(t, text, len);
+
+    tlist_t tokens = get_tokens(t);
+    for (tlist_t l = tokens; ok && l; l = tlist_next(l)) {
+        ok = tvec_push(v, token_clone(tlist_token(l)));
+    }
+    tlist_free(&tokens);
+    tokenizer_free(&t);
+
+    return ok;
+}
+
+static int is_id(token_t t, const char* name) {
+    return token_get_type(t) == ID && !strcmp(token_get_string(t), name);
+}
+
+// ===================== FILES =====================
+
+typedef struct macro {
+    char* name;
+
+    // Function-like, and the names of its parameters
+    int function;
+    int nparams;
+    char** params;
+
+    // The replacement list, lexed from text the first time the
+    // definition is run
+    const char* text;
+    size_t len;
+    int lexed;
+    tvec_t body;
+
+    // Set while its replacement is being rescanned, when the name isn't
+    // expanded again
+    int disabled;
+} macro_t;
+
+typedef enum item_kind {
+    IT_TEXT,     // Lines of code
+    IT_INCLUDE,  // #include "arg" or <arg>
+    IT_DEFINE,   // #define, the macro
+    IT_UNDEF,    // #undef arg
+    IT_IFDEF,    // #ifdef arg
+    IT_IFNDEF,   // #ifndef arg
+    IT_IF,       // #if text
+    IT_ELIF,     // #elif text
+    IT_ELSE,     // #else
+    IT_ENDIF,    // #endif
+    IT_ERROR,    // #error, or a directive that can't be run, arg is the message
+    IT_NONE      // A directive without effect (#, #pragma, #line)
+} item_kind_t;
+
+// A directive of a file, or the lines of code between two of them
+typedef struct item {
+    item_kind_t kind;
+    int line;
+
+    // The code, in the content of the file, or the condition of #if
+    const char* text;
+    size_t len;
+
+    // Their tokens, lexed the first time they're needed
+    int lexed;
+    tvec_t tokens;
+
+    char* arg;
+    int angled;
+    macro_t* macro;
+
+    // The logical line of a directive, continuations removed
+    char* own;
+} item_t;
+
+typedef struct file {
+    char* path;
+
+    // Directory searched first for its #include "..."
+    char* dir;
+
+    char* data;
+    size_t len;
+    hash128_t hash;
+
+    // What it was when read, to tell whether it changed since
+    struct stat st;
+
+    item_t* items;
+    int nitems;
+    int cap;
+
+    // The macro guarding the whole file, #pragma once
+    const char* guard;
+    int once;
+
+    int entered;
+    int used;
+} file_t;
+
+// An #include already resolved, by the directory it was searched from
+// and its path as written
+typedef struct resolved {
+    char* key;
+    file_t* f;
+    struct resolved* next;
+} resolved_t;
+
+typedef struct mdef {
+    macro_t* m;
+    struct mdef* next;
+} mdef_t;
+
+struct pp {
+    char** dirs;
+    int ndirs;
+
+    mdef_t* macros[PP_BUCKETS];
+    resolved_t* resolved[PP_BUCKETS];
+
+    file_t** files;
+    int nfiles;
+    int cap;
+
+    // The files the translation unit since the last reset is made of
+    file_t** used;
+    int nused;
+    int ucap;
+
+    // The definitions of pp_define not run yet, as #define lines, and the
+    // files they were run from
+    buf_t predefs;
+    file_t** cmdlines;
+    int ncmdlines;
+
+    // What "defined X" turns into
+    token_t one;
+    token_t zero;
+
+    int depth;
+    pp_stats_t stats;
+};
+
+static unsigned bucket(const char* s) {
+    uint32_t h = 2166136261u;
+    for (; *s; s++) {
+        h = (h ^ (uint8_t)*s) * 16777619u;
+    }
+    return h & (PP_BUCKETS - 1);
+}
+
+static char* dup_range(const char* s, size_t len) {
+    char* d = (char*)malloc(len + 1);
+    if (!d) {
+        perror("Error with malloc");
+        return NULL;
+    }
+    memcpy(d, s, len);
+    d[len] = '\0';
+    return d;
+}
+
+static item_t* add_item(file_t* f, item_kind_t kind, int line) {
+    if (f->nitems == f->cap) {
+        int ncap = f->cap ? 2 * f->cap : 16;
+        item_t* grown = (item_t*)realloc(f->items, ncap * sizeof(item_t));
+        if (!grown) {
+            perror("Error with realloc");
+            return NULL;
+        }
+        f->items = grown;
+        f->cap = ncap;
+    }
+
+    item_t* it = &f->items[f->nitems++];
+    memset(it, 0, sizeof(item_t));
+    it->kind = kind;
+    it->line = line;
+    return it;
+}
+
+static const char* skip_blanks(const char* p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\f' || *p == '\v') {
+        p++;
+    }
+    return p;
+}
+
+// Returns the end of the identifier at p, p if there is none
+static const char* skip_ident(const char* p) {
+    if (!isalpha((unsigned char)*p) && *p != '_') {
+        return p;
+    }
+    while (isalnum((unsigned char)*p) || *p == '_') {
+        p++;
+    }
+    return p;
+}
+
+// Turns it into an #error item with the message
+static int fail_item(item_t* it, const char* msg, const char* name) {
+    char text[256];
+    snprintf(text, sizeof(text), msg, name);
+    free(it->arg);
+    it->kind = IT_ERROR;
+    it->arg = dup_range(text, strlen(text));
+    return it->arg != NULL;
+}
+
+static int parse_define(item_t* it, const char* p) {
+    const char* end = skip_ident(p);
+    if (end == p) {
+        return fail_item(it, "macro names must be identifiers", NULL);
+    }
+
+    macro_t* m = (macro_t*)calloc(1, sizeof(macro_t));
+    if (!m || !(m->name = dup_range(p, end - p))) {
+        perror("Error with malloc");
+        free(m);
+        return 0;
+    }
+    it->macro = m;
+
+    // Only a parenthesis right after the name makes it function-like
+    p = end;
+    if (*p == '(') {
+        m->function = 1;
+        p = skip_blanks(p + 1);
+        while (*p != ')') {
+            end = skip_ident(p);
+            if (end == p) {
+                return fail_item(it, "invalid parameter list of macro \"%s\"", m->name);
+            }
+            char** grown = (char**)realloc(m->params, (m->nparams + 1) * sizeof(char*));
+            if (!grown) {
+                perror("Error with realloc");
+                return 0;
+            }
+            m->params = grown;
+            if (!(m->params[m->nparams] = dup_range(p, end - p))) {
+                return 0;
+            }
+            m->nparams++;
+
+            p = skip_blanks(end);
+            if (*p == ',') {
+                p = skip_blanks(p + 1);
+            } else if (*p != ')') {
+                return fail_item(it, "invalid parameter list of macro \"%s\"", m->name);
+            }
+        }
+        p++;
+    }
+
+    p = skip_blanks(p);
+    m->text = p;
+    m->len = strlen(p);
+    return 1;
+}
+
+// Returns the end of the string or character literal at p, past its
+// closing quote. An unterminated one runs to the end of the line.
+static const char* skip_literal(const char* p, const char* end) {
+    char quote = *p;
+    for (p++; p < end && *p != quote && *p != '\n'; p++) {
+        p += *p == '\\' && p + 1 < end;
+    }
+    return p < end && *p == quote ? p + 1 : p;
+}
+
+// Returns the end of the logical line at p, at its newline: past its
+// continuations and the block comments that start on it, wherever they
+// end. The newlines passed are added to *lines.
+static const char* line_end(const char* p, const char* end, int* lines) {
+    while (p < end && *p != '\n') {
+        const char* q = p;
+        if (*p == '\\' && p + 1 < end && p[1] == '\n') {
+            q = p + 2;
+        } else if (*p == '"' || *p == '\'') {
+            q = skip_literal(p, end);
+        } else if (*p == '/' && p + 1 < end && p[1] == '/') {
+            // Line comments end with the line, continued or not
+            q = p + 2;
+            while (q < end && *q != '\n') {
+                q += *q == '\\' && q + 1 < end && q[1] == '\n' ? 2 : 1;
+            }
+        } else if (*p == '/' && p + 1 < end && p[1] == '*') {
+            q = block_comment_end(p + 2, end);
+            q = q ? q : end;
+        } else {
+            p++;
+            continue;
+        }
+
+        for (; p < q; p++) {
+            *lines += *p == '\n';
+        }
+    }
+    return p;
+}
+
+// Parses the directive of the logical line [s, e), past its '#'
+static int directive(file_t* f, const char* s, const char* e, int line) {
+    item_t* it = add_item(f, IT_NONE, line);
+    if (!it) {
+        return 0;
+    }
+
+    // Continuations and comments go, each a space, the rest is kept for
+    // the whole session
+    it->own = (char*)malloc(e - s + 1);
+    if (!it->own) {
+        perror("Error with malloc");
+        return 0;
+    }
+    char* d = it->own;
+    for (const char* p = s; p < e; p++) {
+        if (*p == '\\' && p + 1 < e && p[1] == '\n') {
+            p++;
+            *d++ = ' ';
+        } else if (*p == '/' && p + 1 < e && p[1] == '/') {
+            break;
+        } else if (*p == '/' && p + 1 < e && p[1] == '*') {
+            const char* c = block_comment_end(p + 2, e);
+            p = c ? c - 1 : e;
+            *d++ = ' ';
+        } else if (*p == '"' || *p == '\'') {
+            const char* q = skip_literal(p, e);
+            memcpy(d, p, q - p);
+            d += q - p;
+            p = q - 1;
+        } else {
+            *d++ = *p;
+        }
+    }
+    *d = '\0';
+
+    const char* name = skip_blanks(it->own);
+    const char* end = skip_ident(name);
+    size_t n = end - name;
+    const char* rest = skip_blanks(end);
+
+#define IS(s) (n == sizeof(s) - 1 && !strncmp(name, s, n))
+    if (!n) {
+        return *rest ? fail_item(it, "invalid preprocessing directive", NULL) : 1;
+    } else if (IS("include")) {
+        char close = *rest == '"' ? '"' : *rest == '<' ? '>' : '\0';
+        const char* stop = close ? strchr(rest + 1, close) : NULL;
+        if (!stop || stop == rest + 1) {
+            return fail_item(it, "#include expects \"FILENAME\" or <FILENAME>", NULL);
+        }
+        it->kind = IT_INCLUDE;
+        it->angled = close == '>';
+        it->arg = dup_range(rest + 1, stop - rest - 1);
+        return it->arg != NULL;
+    } else if (IS("define")) {
+        it->kind = IT_DEFINE;
+        return parse_define(it, rest);
+    } else if (IS("undef") || IS("ifdef") || IS("ifndef")) {
+        it->kind = IS("undef") ? IT_UNDEF : IS("ifdef") ? IT_IFDEF : IT_IFNDEF;
+        end = skip_ident(rest);
+        it->arg = end > rest ? dup_range(rest, end - rest) : NULL;
+        return end == rest || it->arg;
+    } else if (IS("if") || IS("elif")) {
+        it->kind = IS("if") ? IT_IF : IT_ELIF;
+        it->text = rest;
+        it->len = strlen(rest);
+        return 1;
+    } else if (IS("else") || IS("endif")) {
+        it->kind = IS("else") ? IT_ELSE : IT_ENDIF;
+        return 1;
+    } else if (IS("error")) {
+        return fail_item(it, "#error %s", rest);
+    } else if (IS("pragma")) {
+        f->once |= !strncmp(rest, "once", 4) && !*skip_blanks(rest + 4);
+        return 1;
+    } else if (IS("line") || IS("warning") || IS("ident")) {
+        return 1;
+    }
+#undef IS
+
+    char text[64];
+    snprintf(text, sizeof(text), "%.*s", (int)(n < 32 ? n : 32), name);
+    return fail_item(it, "invalid preprocessing directive #%s", text);
+}
+
+// Finds the include guard of f: its first directive is #ifndef X, the
+// second #define X, and the #endif closing the first the last, with no
+// #else or #elif of its own
+static void find_guard(file_t* f) {
+    if (f->nitems < 3 || f->items[0].kind != IT_IFNDEF || !f->items[0].arg || f->items[1].kind != IT_DEFINE ||
+        strcmp(f->items[1].macro->name, f->items[0].arg)) {
+        return;
+    }
+
+    int depth = 0;
+    for (int i = 0; i < f->nitems; i++) {
+        item_kind_t k = f->items[i].kind;
+        depth += k == IT_IF || k == IT_IFDEF || k == IT_IFNDEF;
+        if (depth == 1 && (k == IT_ELSE || k == IT_ELIF)) {
+            return;
+        }
+        if (k == IT_ENDIF && !--depth) {
+            if (i == f->nitems - 1) {
+                f->guard = f->items[0].arg;
+            }
+            return;
+        }
+    }
+}
+
+// Splits the content of f in directives and the code between them
+static int scan(file_t* f) {
+    const char* p = f->data;
+    const char* end = p + f->len;
+    const char* text = NULL;
+    int text_line = 0, blank = 1, line = 1;
+
+    while (p < end) {
+        const char* start = p;
+        const char* q = p;
+        while (q < end && (*q == ' ' || *q == '\t')) {
+            q++;
+        }
+
+        if (q < end && *q == '#') {
+            if (text && !blank) {
+                item_t* it = add_item(f, IT_TEXT, text_line);
+                if (!it) {
+                    return 0;
+                }
+                it->text = text;
+                it->len = start - text;
+            }
+            text = NULL;
+            blank = 1;
+
+            // The logical line, with its continuations and comments
+            int lines = 1;
+            const char* e = line_end(q + 1, end, &lines);
+            if (!directive(f, q + 1, e, line)) {
+                return 0;
+            }
+            p = e < end ? e + 1 : e;
+            line += lines;
+        } else {
+            if (!text) {
+                text = start;
+                text_line = line;
+            }
+            // A comment it opens hides the directives up to its end
+            int lines = 1;
+            const char* e = line_end(q, end, &lines);
+            for (const char* c = q; blank && c < e; c++) {
+                blank = isspace((unsigned char)*c);
+            }
+            p = e < end ? e + 1 : e;
+            line += lines;
+        }
+    }
+
+    if (text && !blank) {
+        item_t* it = add_item(f, IT_TEXT, text_line);
+        if (!it) {
+            return 0;
+        }
+        it->text = text;
+        it->len = end - text;
+    }
+
+    find_guard(f);
+    return 1;
+}
+
+static void file_free(file_t** fp) {
+    file_t* f = *fp;
+    if (!f) {
+        return;
+    }
+
+    for (int i = 0; i < f->nitems; i++) {
+        item_t* it = &f->items[i];
+        tvec_free(&it->tokens, 1);
+        free(it->arg);
+        free(it->own);
+        if (it->macro) {
+            for (int k = 0; k < it->macro->nparams; k++) {
+                free(it->macro->params[k]);
+            }
+            free(it->macro->params);
+            tvec_free(&it->macro->body, 1);
+            free(it->macro->name);
+            free(it->macro);
+        }
+    }
+    free(f->items);
+    free(f->data);
+    free(f->path);
+    free(f->dir);
+    free(f);
+
+    *fp = NULL;
+}
+
+// Creates a file of the len bytes at data, which it takes
+static file_t* file_new(const char* path, char* data, size_t len) {
+    file_t* f = (file_t*)calloc(1, sizeof(file_t));
+    if (!f) {
+        perror("Error with malloc");
+        free(data);
+        return NULL;
+    }
+
+    f->data = data;
+    f->len = len;
+    f->hash = hash128(data, len, 0);
+    const char* slash = strrchr(path, '/');
+    f->path = dup_range(path, strlen(path));
+    f->dir = slash ? dup_range(path, slash - path + 1) : dup_range("", 0);
+
+    if (!f->path || !f->dir || !scan(f)) {
+        file_free(&f);
+    }
+    return f;
+}
+
+// Returns the file at path, read and scanned the first time
+static file_t* load(pp_t pp, const char* path) {
+    char real[PATH_MAX];
+    if (!realpath(path, real)) {
+        return NULL;
+    }
+
+    for (int i = 0; i < pp->nfiles; i++) {
+        if (!strcmp(pp->files[i]->path, real)) {
+            pp->stats.reused++;
+            return pp->files[i];
+        }
+    }
+
+    int fd = open(real, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    char* data = (char*)malloc(st.st_size + 1);
+    size_t len = 0;
+    while (data && len < (size_t)st.st_size) {
+        ssize_t n = read(fd, data + len, st.st_size - len);
+        if (n <= 0 && !(n < 0 && errno == EINTR)) {
+            break;
+        }
+        len += n > 0 ? n : 0;
+    }
+    close(fd);
+    if (!data) {
+        perror("Error with malloc");
+        return NULL;
+    }
+
+    if (pp->nfiles == pp->cap) {
+        int ncap = pp->cap ? 2 * pp->cap : 16;
+        file_t** grown = (file_t**)realloc(pp->files, ncap * sizeof(file_t*));
+        if (!grown) {
+            perror("Error with realloc");
+            free(data);
+            return NULL;
+        }
+        pp->files = grown;
+        pp->cap = ncap;
+    }
+
+    file_t* f = file_new(real, data, len);
+    if (f) {
+        f->st = st;
+        pp->files[pp->nfiles++] = f;
+        pp->stats.files++;
+    }
+    return f;
+}
+
+// Records that the translation unit is made of f too
+static int use(pp_t pp, file_t* f) {
+    if (f->used) {
+        return 1;
+    }
+    if (pp->nused == pp->ucap) {
+        int ncap = pp->ucap ? 2 * pp->ucap : 16;
+        file_t** grown = (file_t**)realloc(pp->used, ncap * sizeof(file_t*));
+        if (!grown) {
+            perror("Error with realloc");
+            return 0;
+        }
+        pp->used = grown;
+        pp->ucap = ncap;
+    }
+    f->used = 1;
+    pp->used[pp->nused++] = f;
+    return 1;
+}
+
+// Returns the file an #include of path from the file from names
+static file_t* resolve(pp_t pp, const file_t* from, const char* path, int angled) {
+    const char* dir = angled || path[0] == '/' ? "" : from->dir;
+    size_t n = strlen(dir) + strlen(path) + 3;
+    char* key = (char*)malloc(n);
+    if (!key) {
+        perror("Error with malloc");
+        return NULL;
+    }
+    snprintf(key, n, "%s\n%c%s", dir, angled ? '<' : '"', path);
+
+    unsigned b = bucket(key);
+    for (resolved_t* r = pp->resolved[b]; r; r = r->next) {
+        if (!strcmp(r->key, key)) {
+            free(key);
+            pp->stats.reused++;
+            return r->f;
+        }
+    }
+
+    // The directory of the includer first, then the include directories
+    file_t* f = NULL;
+    char candidate[PATH_MAX];
+    if (path[0] == '/') {
+        f = load(pp, path);
+    } else if (!angled && snprintf(candidate, sizeof(candidate), "%s%s", dir, path) < PATH_MAX) {
+        f = load(pp, candidate);
+    }
+    for (int i = 0; !f && path[0] != '/' && i < pp->ndirs; i++) {
+        if (snprintf(candidate, sizeof(candidate), "%s/%s", pp->dirs[i], path) < PATH_MAX) {
+            f = load(pp, candidate);
+        }
+    }
+
+    resolved_t* r = f ? (resolved_t*)malloc(sizeof(resolved_t)) : NULL;
+    if (r) {
+        *r = (resolved_t){key, f, pp->resolved[b]};
+        pp->resolved[b] = r;
+    } else {
+        free(key);
+    }
+    return f;
+}
+
+// ===================== MACROS =====================
+
+static macro_t* lookup(pp_t pp, const char* name) {
+    for (mdef_t* d = pp->macros[bucket(name)]; d; d = d->next) {
+        if (!strcmp(d->m->name, name)) {
+            return d->m;
+        }
+    }
+    return NULL;
+}
+
+static int undefine(pp_t pp, const char* name) {
+    for (mdef_t** dp = &pp->macros[bucket(name)]; *dp; dp = &(*dp)->next) {
+        if (!strcmp((*dp)->m->name, name)) {
+            mdef_t* d = *dp;
+            *dp = d->next;
+            free(d);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int define(pp_t pp, macro_t* m) {
+    if (!m->lexed) {
+        m->lexed = 1;
+        if (!lex(m->text, m->len, &m->body)) {
+            return 0;
+        }
+    }
+
+    undefine(pp, m->name);
+    mdef_t* d = (mdef_t*)malloc(sizeof(mdef_t));
+    if (!d) {
+        perror("Error with malloc");
+        return 0;
+    }
+
+    unsigned b = bucket(m->name);
+    *d = (mdef_t){m, pp->macros[b]};
+    pp->macros[b] = d;
+    return 1;
+}
+
+// The tokens left to expand, a stack of the input and the replacement
+// lists being rescanned
+typedef struct frame {
+    token_t* toks;
+    int n;
+    int pos;
+
+    // The macro it's the replacement of, NULL for the input, and whether
+    // toks was allocated for it
+    macro_t* m;
+    int owned;
+} frame_t;
+
+typedef struct expander {
+    pp_t pp;
+
+    // Where the expanded code is, for errors
+    const file_t* f;
+    int line;
+
+    frame_t* frames;
+    int n;
+    int cap;
+} expander_t;
+
+static int push_frame(expander_t* ex, token_t* toks, int n, macro_t* m, int owned) {
+    if (ex->n == ex->cap) {
+        int ncap = ex->cap ? 2 * ex->cap : 8;
+        frame_t* grown = (frame_t*)realloc(ex->frames, ncap * sizeof(frame_t));
+        if (!grown) {
+            perror("Error with realloc");
+            if (owned) {
+                free(toks);
+            }
+            return 0;
+        }
+        ex->frames = grown;
+        ex->cap = ncap;
+    }
+
+    ex->frames[ex->n++] = (frame_t){toks, n, 0, m, owned};
+    if (m) {
+        m->disabled++;
+    }
+    return 1;
+}
+
+static void pop_frame(expander_t* ex) {
+    frame_t* fr = &ex->frames[--ex->n];
+    if (fr->m) {
+        fr->m->disabled--;
+    }
+    if (fr->owned) {
+        free(fr->toks);
+    }
+}
+
+static void expander_free(expander_t* ex) {
+    while (ex->n) {
+        pop_frame(ex);
+    }
+    free(ex->frames);
+}
+
+static token_t next_token(expander_t* ex) {
+    while (ex->n && ex->frames[ex->n - 1].pos == ex->frames[ex->n - 1].n) {
+        pop_frame(ex);
+    }
+    return ex->n ? ex->frames[ex->n - 1].toks[ex->frames[ex->n - 1].pos++] : NULL;
+}
+
+// Returns the token next_token would, without leaving any replacement
+static token_t peek_token(expander_t* ex) {
+    for (int i = ex->n - 1; i >= 0; i--) {
+        if (ex->frames[i].pos < ex->frames[i].n) {
+            return ex->frames[i].toks[ex->frames[i].pos];
+        }
+    }
+    return NULL;
+}
+
+static int expand(expander_t* ex, tvec_t* out);
+
+// Reads the arguments of an invocation of m, from its '('
+static int collect_args(expander_t* ex, macro_t* m, tvec_t** argsp, int* nargsp) {
+    next_token(ex);
+
+    tvec_t* args = (tvec_t*)calloc(1, sizeof(tvec_t));
+    int nargs = 1, depth = 1, ok = args != NULL;
+    while (ok) {
+        token_t t = next_token(ex);
+        if (!t) {
+            fprintf(stderr, "Error: %s:%d: unterminated argument list invoking macro \"%s\"\n", ex->f->path, ex->line,
+                    m->name);
+            ok = 0;
+            break;
+        }
+
+        token_type_t type = token_get_type(t);
+        depth += (type == S_OP) - (type == S_CP);
+        if (!depth) {
+            break;
+        }
+        if (type == S_COM && depth == 1) {
+            tvec_t* grown = (tvec_t*)realloc(args, (nargs + 1) * sizeof(tvec_t));
+            ok = grown != NULL;
+            if (grown) {
+                args = grown;
+                args[nargs++] = (tvec_t){NULL, 0, 0};
+            }
+        } else {
+            ok = tvec_push(&args[nargs - 1], t);
+        }
+    }
+
+    // f() passes no argument to a macro without parameters, one empty to
+    // a macro with one
+    int expected = m->nparams ? m->nparams : 1;
+    if (ok && (nargs != expected || (!m->nparams && args[0].n))) {
+        fprintf(stderr, "Error: %s:%d: macro \"%s\" passed %d arguments, but takes %d\n", ex->f->path, ex->line,
+                m->name, !m->nparams && !args[0].n ? 0 : nargs, m->nparams);
+        ok = 0;
+    }
+
+    if (!args) {
+        perror("Error with malloc");
+        nargs = 0;
+    }
+    *argsp = args;
+    *nargsp = nargs;
+    return ok;
+}
+
+// Replaces the invocation of the function-like macro m, its arguments
+// expanded on their own first
+static int invoke(expander_t* ex, macro_t* m) {
+    tvec_t* args;
+    int nargs;
+    int ok = collect_args(ex, m, &args, &nargs);
+
+    tvec_t rep = {NULL, 0, 0};
+    for (int i = 0; ok && i < m->body.n; i++) {
+        token_t t = m->body.items[i];
+        int p = -1;
+        for (int k = 0; token_get_type(t) == ID && p < 0 && k < m->nparams; k++) {
+            p = is_id(t, m->params[k]) ? k : -1;
+        }
+
+        if (p < 0) {
+            ok = tvec_push(&rep, t);
+            continue;
+        }
+        expander_t sub = {ex->pp, ex->f, ex->line, NULL, 0, 0};
+        ok = push_frame(&sub, args[p].items, args[p].n, NULL, 0) && expand(&sub, &rep);
+        expander_free(&sub);
+    }
+
+    for (int i = 0; i < nargs; i++) {
+        tvec_free(&args[i], 0);
+    }
+    free(args);
+
+    if (!ok) {
+        tvec_free(&rep, 0);
+        return 0;
+    }
+    ex->pp->stats.expansions++;
+    return push_frame(ex, rep.items, rep.n, m, 1);
+}
+
+// Expands the tokens of ex into out
+static int expand(expander_t* ex, tvec_t* out) {
+    token_t t;
+    while ((t = next_token(ex))) {
+        macro_t* m = token_get_type(t) == ID ? lookup(ex->pp, token_get_string(t)) : NULL;
+        if (!m || m->disabled || (m->function && token_get_type(peek_token(ex)) != S_OP)) {
+            if (!tvec_push(out, t)) {
+                return 0;
+            }
+        } else if (!m->function) {
+            ex->pp->stats.expansions++;
+            if (!push_frame(ex, m->body.items, m->body.n, m, 0)) {
+                return 0;
+            }
+        } else if (!invoke(ex, m)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int expand_tokens(pp_t pp, const file_t* f, int line, const tvec_t* in, tvec_t* out) {
+    expander_t ex = {pp, f, line, NULL, 0, 0};
+    int ok = push_frame(&ex, in->items, in->n, NULL, 0) && expand(&ex, out);
+    expander_free(&ex);
+    return ok;
+}
+
+// ===================== CONDITIONS =====================
+
+typedef struct eval {
+    const tvec_t* v;
+    int pos;
+    const char* error;
+
+    // Inside an operand that isn't evaluated, the right of 0 && x or
+    // 1 || x, or the unused branch of ?:, where dividing by zero is fine
+    int dead;
+} eval_t;
+
+static token_type_t peek_type(eval_t* e) {
+    return e->pos < e->v->n ? token_get_type(e->v->items[e->pos]) : T_NOVALUE;
+}
+
+// A value of an #if expression: every signed type acts as intmax_t and
+// every unsigned one as uintmax_t
+typedef struct num {
+    int64_t v;
+    int is_unsigned;
+} num_t;
+
+// The value of an integer literal. A u suffix makes it unsigned, and so
+// does not fitting intmax_t. Hexadecimal and octal ones past INT32_MAX
+// take an unsigned type on the target even without a suffix, but fit
+// intmax_t: those are signed. The suffix isn't kept in the type, so
+// 0x80000000u is read as signed too.
+static num_t literal(token_t t) {
+    uint64_t v = (uint64_t)token_get_int(t);
+    int_type_t it = token_get_int_type(t);
+    int is_unsigned = it == LT_ULLONG || ((it == LT_UINT || it == LT_ULONG) && v <= INT32_MAX);
+    return (num_t){(int64_t)v, is_unsigned};
+}
+
+static num_t eval_ternary(eval_t* e);
+
+static num_t eval_unary(eval_t* e) {
+    if (e->pos >= e->v->n) {
+        e->error = e->error ? e->error : "#if with no expression";
+        return (num_t){0, 0};
+    }
+
+    token_t t = e->v->items[e->pos++];
+    num_t n;
+    switch (token_get_type(t)) {
+        case L_I:
+            return literal(t);
+        case L_C:
+            return (num_t){token_get_char(t), 0};
+        case ID:
+            // Identifiers left after expansion are 0
+            return (num_t){0, 0};
+        case LO_NOT:
+            return (num_t){!eval_unary(e).v, 0};
+        case BW_NOT:
+            n = eval_unary(e);
+            return (num_t){~n.v, n.is_unsigned};
+        case AO_SUB:
+            n = eval_unary(e);
+            return (num_t){(int64_t)(0 - (uint64_t)n.v), n.is_unsigned};
+        case AO_SUM:
+            return eval_unary(e);
+        case S_OP: {
+            n = eval_ternary(e);
+            if (peek_type(e) != S_CP) {
+                e->error = e->error ? e->error : "missing ')' in expression";
+            }
+            e->pos++;
+            return n;
+        }
+        default:
+            e->error = e->error ? e->error : "invalid token in #if expression";
+            return (num_t){0, 0};
+    }
+}
+
+// Binary operators by decreasing precedence level
+static const token_type_t levels[][4] = {
+    {LO_OR, T_NOVALUE},
+    {LO_AND, T_NOVALUE},
+    {BW_OR, T_NOVALUE},
+    {BW_XOR, T_NOVALUE},
+    {BW_AND, T_NOVALUE},
+    {RO_EQ, RO_NEQ, T_NOVALUE},
+    {RO_LT, RO_LE, RO_GT, RO_GE},
+    {BW_LSFHIT, BW_RSHIFT, T_NOVALUE},
+    {AO_SUM, AO_SUB, T_NOVALUE},
+    {AO_MUL, AO_DIV, AO_MOD, T_NOVALUE},
+};
+static const int nlevels = sizeof(levels) / sizeof(*levels);
+
+// Applies op as C does: both operands are unsigned if either is, but for
+// shifts, whose result has the type of the left one. Comparisons and
+// logical operators give a signed 0 or 1.
+static num_t apply(eval_t* e, token_type_t op, num_t l, num_t r) {
+    int64_t a = l.v, b = r.v;
+    uint64_t x = (uint64_t)a, y = (uint64_t)b;
+    int u = l.is_unsigned || r.is_unsigned;
+    switch (op) {
+        case LO_OR:
+            return (num_t){a || b, 0};
+        case LO_AND:
+            return (num_t){a && b, 0};
+        case BW_OR:
+            return (num_t){a | b, u};
+        case BW_XOR:
+            return (num_t){a ^ b, u};
+        case BW_AND:
+            return (num_t){a & b, u};
+        case RO_EQ:
+            return (num_t){a == b, 0};
+        case RO_NEQ:
+            return (num_t){a != b, 0};
+        case RO_LT:
+            return (num_t){u ? x < y : a < b, 0};
+        case RO_LE:
+            return (num_t){u ? x <= y : a <= b, 0};
+        case RO_GT:
+            return (num_t){u ? x > y : a > b, 0};
+        case RO_GE:
+            return (num_t){u ? x >= y : a >= b, 0};
+        case BW_LSFHIT:
+            return (num_t){(int64_t)(x << (y & 63)), l.is_unsigned};
+        case BW_RSHIFT:
+            return (num_t){l.is_unsigned ? (int64_t)(x >> (y & 63)) : a >> (y & 63), l.is_unsigned};
+        case AO_SUM:
+            return (num_t){(int64_t)(x + y), u};
+        case AO_SUB:
+            return (num_t){(int64_t)(x - y), u};
+        case AO_MUL:
+            return (num_t){(int64_t)(x * y), u};
+        default:
+            if (!b || (!u && a == INT64_MIN && b == -1)) {
+                e->error = e->error || e->dead ? e->error : "division by zero in #if";
+                return (num_t){0, u};
+            }
+            if (u) {
+                return (num_t){(int64_t)(op == AO_DIV ? x / y : x % y), 1};
+            }
+            return (num_t){op == AO_DIV ? a / b : a % b, 0};
+    }
+}
+
+static num_t eval_binary(eval_t* e, int level) {
+    if (level == nlevels) {
+        return eval_unary(e);
+    }
+
+    num_t n = eval_binary(e, level + 1);
+    for (;;) {
+        token_type_t type = peek_type(e), op = T_NOVALUE;
+        for (int k = 0; k < 4 && levels[level][k] != T_NOVALUE; k++) {
+            op = levels[level][k] == type ? type : op;
+        }
+        if (op == T_NOVALUE) {
+            return n;
+        }
+        e->pos++;
+        int dead = (op == LO_AND && !n.v) || (op == LO_OR && n.v);
+        e->dead += dead;
+        num_t rhs = eval_binary(e, level + 1);
+        e->dead -= dead;
+        n = apply(e, op, n, rhs);
+    }
+}
+
+static num_t eval_ternary(eval_t* e) {
+    num_t c = eval_binary(e, 0);
+    if (peek_type(e) != S_QM) {
+        return c;
+    }
+
+    e->pos++;
+    e->dead += !c.v;
+    num_t a = eval_ternary(e);
+    e->dead -= !c.v;
+    if (peek_type(e) != S_COL) {
+        e->error = e->error ? e->error : "expected ':' in #if expression";
+    }
+    e->pos++;
+    e->dead += !!c.v;
+    num_t b = eval_ternary(e);
+    e->dead -= !!c.v;
+
+    // Either way the result has the type both branches convert to
+    return (num_t){c.v ? a.v : b.v, a.is_unsigned || b.is_unsigned};
+}
+
+// Evaluates the condition of an #if, #ifdef, #ifndef or #elif
+static int condition(pp_t pp, const file_t* f, item_t* it, int* v) {
+    if (it->kind == IT_IFDEF || it->kind == IT_IFNDEF) {
+        if (!it->arg) {
+            fprintf(stderr, "Error: %s:%d: no macro name given in #if%sdef\n", f->path, it->line,
+                    it->kind == IT_IFNDEF ? "n" : "");
+            return 0;
+        }
+        *v = (lookup(pp, it->arg) != NULL) == (it->kind == IT_IFDEF);
+        return 1;
+    }
+
+    if (!it->lexed) {
+        it->lexed = 1;
+        if (!lex(it->text, it->len, &it->tokens)) {
+            return 0;
+        }
+    }
+
+    // defined X and defined(X) are answered before expansion
+    tvec_t in = {NULL, 0, 0}, out = {NULL, 0, 0};
+    const tvec_t* c = &it->tokens;
+    int ok = 1;
+    for (int i = 0; ok && i < c->n; i++) {
+        if (!is_id(c->items[i], "defined")) {
+            ok = tvec_push(&in, c->items[i]);
+            continue;
+        }
+
+        int paren = i + 1 < c->n && token_get_type(c->items[i + 1]) == S_OP;
+        int k = i + 1 + paren;
+        if (k >= c->n || token_get_type(c->items[k]) != ID ||
+            (paren && (k + 1 >= c->n || token_get_type(c->items[k + 1]) != S_CP))) {
+            fprintf(stderr, "Error: %s:%d: operator \"defined\" requires an identifier\n", f->path, it->line);
+            ok = 0;
+            break;
+        }
+        ok = tvec_push(&in, lookup(pp, token_get_string(c->items[k])) ? pp->one : pp->zero);
+        i = k + paren;
+    }
+
+    ok = ok && expand_tokens(pp, f, it->line, &in, &out);
+    if (ok) {
+        eval_t e = {&out, 0, NULL, 0};
+        *v = eval_ternary(&e).v != 0;
+        if (!e.error && e.pos < out.n) {
+            e.error = "missing binary operator in #if expression";
+        }
+        if (e.error) {
+            fprintf(stderr, "Error: %s:%d: %s\n", f->path, it->line, e.error);
+            ok = 0;
+        }
+    }
+
+    tvec_free(&in, 0);
+    tvec_free(&out, 0);
+    return ok;
+}
+
+// ===================== RUNNING =====================
+
+typedef struct cond {
+    // The group is being kept, one of the chain was, #else was seen
+    int active;
+    int taken;
+    int in_else;
+    int line;
+} cond_t;
+
+static int run_file(pp_t pp, file_t* f, tvec_t* out);
+
+static int include(pp_t pp, const file_t* from, const item_t* it, tvec_t* out) {
+    pp->stats.includes++;
+    if (pp->depth >= PP_MAX_DEPTH) {
+        fprintf(stderr, "Error: %s:%d: #include nested too deeply\n", from->path, it->line);
+        return 0;
+    }
+
+    file_t* f = resolve(pp, from, it->arg, it->angled);
+    if (!f) {
+        fprintf(stderr, "Error: %s:%d: %s: No such file\n", from->path, it->line, it->arg);
+        return 0;
+    }
+    return use(pp, f) && run_file(pp, f, out);
+}
+
+// Runs the directives of f and expands its code into out
+static int run_file(pp_t pp, file_t* f, tvec_t* out) {
+    if (f->entered && (f->once || (f->guard && lookup(pp, f->guard)))) {
+        pp->stats.skipped++;
+        return 1;
+    }
+    f->entered++;
+    pp->depth++;
+
+    cond_t* conds = NULL;
+    int n = 0, cap = 0, ok = 1;
+    for (int i = 0; ok && i < f->nitems; i++) {
+        item_t* it = &f->items[i];
+        int active = !n || conds[n - 1].active;
+        int outer = n < 2 || conds[n - 2].active;
+
+        switch (it->kind) {
+            case IT_IF:
+            case IT_IFDEF:
+            case IT_IFNDEF: {
+                if (n == cap) {
+                    cap = cap ? 2 * cap : 8;
+                    cond_t* grown = (cond_t*)realloc(conds, cap * sizeof(cond_t));
+                    if (!grown) {
+                        perror("Error with realloc");
+                        ok = 0;
+                        break;
+                    }
+                    conds = grown;
+                }
+
+                // Groups inside a skipped one are never kept
+                int v = 0;
+                ok = !active || condition(pp, f, it, &v);
+                conds[n++] = (cond_t){v, v || !active, 0, it->line};
+                break;
+            }
+            case IT_ELIF:
+            case IT_ELSE: {
+                const char* name = it->kind == IT_ELIF ? "#elif" : "#else";
+                if (!n || conds[n - 1].in_else) {
+                    fprintf(stderr, "Error: %s:%d: %s %s\n", f->path, it->line, name, n ? "after #else" : "without #if");
+                    ok = 0;
+                    break;
+                }
+
+                cond_t* c = &conds[n - 1];
+                int v = !c->taken && outer;
+                if (v && it->kind == IT_ELIF) {
+                    ok = condition(pp, f, it, &v);
+                }
+                c->active = v;
+                c->taken |= v;
+                c->in_else = it->kind == IT_ELSE;
+                break;
+            }
+            case IT_ENDIF:
+                if (!n) {
+                    fprintf(stderr, "Error: %s:%d: #endif without #if\n", f->path, it->line);
+                    ok = 0;
+                }
+                n -= n > 0;
+                break;
+            default:
+                if (!active) {
+                    break;
+                }
+
+                if (it->kind == IT_TEXT) {
+                    if (!it->lexed) {
+                        it->lexed = 1;
+                        ok = lex(it->text, it->len, &it->tokens);
+                    }
+                    ok = ok && expand_tokens(pp, f, it->line, &it->tokens, out);
+                } else if (it->kind == IT_INCLUDE) {
+                    ok = include(pp, f, it, out);
+                } else if (it->kind == IT_DEFINE) {
+                    ok = define(pp, it->macro);
+                } else if (it->kind == IT_UNDEF) {
+                    if (!it->arg) {
+                        fprintf(stderr, "Error: %s:%d: no macro name given in #undef\n", f->path, it->line);
+                        ok = 0;
+                    } else {
+                        undefine(pp, it->arg);
+                    }
+                } else if (it->kind == IT_ERROR) {
+                    fprintf(stderr, "Error: %s:%d: %s\n", f->path, it->line, it->arg);
+                    ok = 0;
+                }
+                break;
+        }
+    }
+
+    if (ok && n) {
+        fprintf(stderr, "Error: %s:%d: unterminated conditional directive\n", f->path, conds[n - 1].line);
+        ok = 0;
+    }
+
+    free(conds);
+    pp->depth--;
+    return ok;
+}
+
+// ===================== PREPROCESSOR =====================
+
+// Creates a new preprocessor session
+pp_t pp_new() {
+    pp_t pp = (pp_t)calloc(1, sizeof(_pp));
+    if (!pp) {
+        perror("Error with malloc");
+        return NULL;
+    }
+
+    pp->predefs = buf_new(256);
+    pp->one = token_new_int(1);
+    pp->zero = token_new_int(0);
+    if (!pp->predefs || !pp->one || !pp->zero) {
+        pp_free(&pp);
+    }
+    return pp;
+}
+
+// Adds a directory to search for included files, after those added before
+int pp_add_include_dir(pp_t pp, const char* dir) {
+    char** grown = (char**)realloc(pp->dirs, (pp->ndirs + 1) * sizeof(char*));
+    if (!grown) {
+        perror("Error with realloc");
+        return 0;
+    }
+    pp->dirs = grown;
+
+    pp->dirs[pp->ndirs] = dup_range(dir, strlen(dir));
+    return pp->dirs[pp->ndirs++] != NULL;
+}
+
+// Defines a macro as -D does: "NAME" defines it as 1, "NAME=value" as
+// the tokens of value
+int pp_define(pp_t pp, const char* def) {
+    const char* eq = strchr(def, '=');
+    size_t n = eq ? (size_t)(eq - def) : strlen(def);
+    if (!n || skip_ident(def) != def + n) {
+        fprintf(stderr, "Error: invalid macro definition '%s'\n", def);
+        return 0;
+    }
+
+    return buf_puts(pp->predefs, "#define ") && buf_put(pp->predefs, def, n) && buf_putc(pp->predefs, ' ') &&
+           buf_puts(pp->predefs, eq ? eq + 1 : "1") && buf_putc(pp->predefs, '\n');
+}
+
+// Preprocesses the file and appends its tokens to *lp. Returns 0 on
+// error, reported on stderr.
+int preprocess(pp_t pp, const char* filename, tlist_t* lp) {
+    tvec_t out = {NULL, 0, 0};
+    int ok = 1;
+
+    // The definitions of pp_define since the last file
+    if (pp->predefs->len) {
+        // Their macros stay defined, the files stay with them
+        file_t** grown = (file_t**)realloc(pp->cmdlines, (pp->ncmdlines + 1) * sizeof(file_t*));
+        if (!grown) {
+            perror("Error with realloc");
+            return 0;
+        }
+        pp->cmdlines = grown;
+
+        char* data = dup_range(pp->predefs->data, pp->predefs->len);
+        file_t* cmdline = data ? file_new("<command line>", data, pp->predefs->len) : NULL;
+        if (cmdline) {
+            pp->cmdlines[pp->ncmdlines++] = cmdline;
+        }
+        ok = cmdline && run_file(pp, cmdline, &out);
+        buf_clear(pp->predefs);
+    }
+
+    file_t* f = ok ? load(pp, filename) : NULL;
+    if (ok && !f) {
+        fprintf(stderr, "Error: %s: %s\n", filename, strerror(errno ? errno : ENOENT));
+        ok = 0;
+    }
+    ok = ok && use(pp, f) && run_file(pp, f, &out);
+
+    // Built backwards, inserting at the head is what doesn't walk it
+    tlist_t l = NULL;
+    for (int i = out.n - 1; ok && i >= 0; i--) {
+        token_t t = token_clone(out.items[i]);
+        ok = t && tlist_insert_token(&l, t);
+    }
+    if (ok && l) {
+        tlist_append_node(lp, l);
+    } else {
+        tlist_free(&l);
+    }
+
+    tvec_free(&out, 0);
+    return ok;
+}
+
+// The files the translation unit since the last reset is made of, with
+// the hashes of their contents
+int pp_nfiles(pp_t pp) {
+    return pp->nused;
+}
+
+const char* pp_file_path(pp_t pp, int i) {
+    return pp->used[i]->path;
+}
+
+hash128_t pp_file_hash(pp_t pp, int i) {
+    return pp->used[i]->hash;
+}
+
+// Returns the statistics of the session
+pp_stats_t pp_get_stats(pp_t pp) {
+    return pp->stats;
+}
+
+// Whether the file at f->path is still the one read
+static int unchanged(const file_t* f) {
+    struct stat st;
+    return !stat(f->path, &st) && st.st_dev == f->st.st_dev && st.st_ino == f->st.st_ino &&
+           st.st_size == f->st.st_size && st.st_mtim.tv_sec == f->st.st_mtim.tv_sec &&
+           st.st_mtim.tv_nsec == f->st.st_mtim.tv_nsec && st.st_ctim.tv_sec == f->st.st_ctim.tv_sec &&
+           st.st_ctim.tv_nsec == f->st.st_ctim.tv_nsec;
+}
+
+// Forgets the macros, the includes resolved, the include directories and
+// the definitions of pp_define
+static void forget(pp_t pp) {
+    for (int b = 0; b < PP_BUCKETS; b++) {
+        while (pp->macros[b]) {
+            mdef_t* d = pp->macros[b];
+            pp->macros[b] = d->next;
+            free(d);
+        }
+        while (pp->resolved[b]) {
+            resolved_t* r = pp->resolved[b];
+            pp->resolved[b] = r->next;
+            free(r->key);
+            free(r);
+        }
+    }
+
+    for (int i = 0; i < pp->ncmdlines; i++) {
+        file_free(&pp->cmdlines[i]);
+    }
+    pp->ncmdlines = 0;
+
+    for (int i = 0; i < pp->ndirs; i++) {
+        free(pp->dirs[i]);
+    }
+    pp->ndirs = 0;
+    buf_clear(pp->predefs);
+}
+
+// Makes the session ready for another translation unit, with other
+// options. The files read stay read and lexed, but for those changed on
+// disk since.
+void pp_reset(pp_t pp) {
+    forget(pp);
+
+    int n = 0;
+    for (int i = 0; i < pp->nfiles; i++) {
+        file_t* f = pp->files[i];
+        if (unchanged(f)) {
+            f->entered = 0;
+            f->used = 0;
+            pp->files[n++] = f;
+        } else {
+            file_free(&f);
+        }
+    }
+    pp->nfiles = n;
+    pp->nused = 0;
+    pp->depth = 0;
+    memset(&pp->stats, 0, sizeof(pp->stats));
+}
+
+// Returns the bytes of source the session keeps
+size_t pp_size(pp_t pp) {
+    size_t size = 0;
+    for (int i = 0; i < pp->nfiles; i++) {
+        size += pp->files[i]->len;
+    }
+    return size;
+}
+
+void pp_free(pp_t* ppp) {
+    if (!ppp || !*ppp) {
+        return;
+    }
+    pp_t pp = *ppp;
+
+    forget(pp);
+    for (int i = 0; i < pp->nfiles; i++) {
+        file_free(&pp->files[i]);
+    }
+    free(pp->files);
+    free(pp->used);
+    free(pp->cmdlines);
+    free(pp->dirs);
+
+    buf_free(&pp->predefs);
+    if (pp->one) {
+        token_free(&pp->one);
+    }
+    if (pp->zero) {
+        token_free(&pp->zero);
+    }
+    free(pp);
+
+    *ppp = NULL;
+}
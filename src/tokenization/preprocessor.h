@@ -0,0 +1,69 @@
+#ifndef PREPROCESSOR_H
+#define PREPROCESSOR_H
+
+#include "tlist.h"
+#include "utils/hash.h"
+
+// The C preprocessor, between reading the files and the consumers of
+// their tokens. Lines starting with '#' are directives: #include,
+// #define (object-like and function-like macros), #undef, #ifdef,
+// #ifndef, #if, #elif, #else, #endif, #error and #pragma once. The text
+// between them is tokenized and its macros expanded at token level.
+//
+// A preprocessor is a session: every file it reads is kept, split in
+// directives and text whose tokens are lexed the first time they're
+// needed, so including it again costs no I/O and no lexing. A file whose
+// content is all inside #ifndef X / #define X ... #endif, or that has
+// #pragma once, is skipped without a look when included again with X
+// defined. pp_reset keeps the files for the next translation unit.
+typedef struct pp _pp, *pp_t;
+
+// What a preprocessor did
+typedef struct pp_stats {
+    // Files read and lexed, #include directives run
+    int files;
+    int includes;
+
+    // Includes served from the files of the session, and skipped by their
+    // include guard or #pragma once
+    int reused;
+    int skipped;
+
+    // Macro invocations replaced
+    int expansions;
+} pp_stats_t;
+
+// Creates a new preprocessor session
+pp_t pp_new();
+
+// Adds a directory to search for included files, after those added before
+int pp_add_include_dir(pp_t pp, const char* dir);
+
+// Defines a macro as -D does: "NAME" defines it as 1, "NAME=value" as
+// the tokens of value
+int pp_define(pp_t pp, const char* def);
+
+// Preprocesses the file and appends its tokens to *lp. Returns 0 on
+// error, reported on stderr.
+int preprocess(pp_t pp, const char* filename, tlist_t* lp);
+
+// The files the translation unit since the last reset is made of, with
+// the hashes of their contents
+int pp_nfiles(pp_t pp);
+const char* pp_file_path(pp_t pp, int i);
+hash128_t pp_file_hash(pp_t pp, int i);
+
+// Returns the statistics of the session
+pp_stats_t pp_get_stats(pp_t pp);
+
+// Makes the session ready for another translation unit, with other
+// options. The files read stay read and lexed, but for those changed on
+// disk since.
+void pp_reset(pp_t pp);
+
+// Returns the bytes of source the session keeps
+size_t pp_size(pp_t pp);
+
+void pp_free(pp_t* pp);
+
+#endif
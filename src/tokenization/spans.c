@@ -0,0 +1,144 @@
+#include "spans.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tokenizer.h"
+#include "utils/str.h"
+
+static int add_span(span_t** spansp, int* n, int* cap, span_t s) {
+    if (*n == *cap) {
+        int ncap = *cap ? 2 * *cap : 16;
+        span_t* grown = (span_t*)realloc(*spansp, ncap * sizeof(span_t));
+        if (!grown) {
+            perror("Error with realloc");
+            return 0;
+        }
+        *spansp = grown;
+        *cap = ncap;
+    }
+
+    (*spansp)[(*n)++] = s;
+    return 1;
+}
+
+// Splits the len bytes at src into top-level spans, each ending after
+// the ';' or the '}' that closes it at file scope, so that no token
+// crosses two of them. String and character literals and comments are
+// skipped.
+// Returns the number of spans, stored in a new array at *spansp, or -1.
+int split_spans(const char* src, size_t len, span_t** spansp) {
+    *spansp = NULL;
+    int n = 0, cap = 0;
+
+    span_t cur = {0, 0, 0};
+    int depth = 0;
+    char last = '\0';  // Last character outside spaces and literals
+    for (size_t i = 0; i < len; i++) {
+        char c = src[i];
+        if (c == '"' || c == '\'') {
+            // An unterminated literal runs to the end of the line, as far
+            // as the tokenizer can go with it
+            for (i++; i < len && src[i] != c && src[i] != '\n'; i++) {
+                i += src[i] == '\\';
+            }
+            last = c;
+            continue;
+        }
+        if (c == '/' && i + 1 < len && (src[i + 1] == '/' || src[i + 1] == '*')) {
+            // To the newline, or past the "*/" (to the end if unterminated)
+            const char* e = src[i + 1] == '/' ? (const char*)memchr(src + i, '\n', len - i)
+                                               : block_comment_end(src + i + 2, src + len);
+            i = e ? (size_t)(e - src) - 1 : len;
+            continue;
+        }
+        if (isspace((unsigned char)c)) {
+            continue;
+        }
+
+        int end = 0;
+        if (c == '{') {
+            cur.function |= !depth && last == ')';
+            depth++;
+        } else if (c == '}' && depth) {
+            end = !--depth;
+        } else if (c == ';') {
+            end = !depth;
+        }
+        last = c;
+
+        if (end) {
+            cur.end = i + 1;
+            if (!add_span(spansp, &n, &cap, cur)) {
+                free(*spansp);
+                *spansp = NULL;
+                return -1;
+            }
+            cur = (span_t){i + 1, 0, 0};
+        }
+    }
+
+    // Whatever follows the last declaration
+    if (cur.start < len) {
+        cur.end = len;
+        if (!add_span(spansp, &n, &cap, cur)) {
+            free(*spansp);
+            *spansp = NULL;
+            return -1;
+        }
+    }
+
+    return n;
+}
+
+// Appends the tokens of the len bytes at src to out as tokenizing it
+// whole formats them, one span at a time: the spans found in before (by
+// their hash, in the data it was loaded from) are copied, the others
+// tokenized. Each span is added to now, at its bytes of out. A lex error
+// ends the list after the tokens before it, as it does whole. Returns 1
+// if all of src was tokenized and written, and counts the spans in
+// *stats.
+int tokenize_spans(const char* src, size_t len, fragdb_t before, fragdb_t now, buf_t out,
+                   incremental_stats_t* stats) {
+    span_t* spans = NULL;
+    int n = split_spans(src, len, &spans);
+    int written = n >= 0 && buf_puts(out, "tlist[");
+    int lexed = 1;
+    size_t first = out->len;
+
+    for (int i = 0; written && lexed && i < n; i++) {
+        const char* s = src + spans[i].start;
+        size_t slen = spans[i].end - spans[i].start;
+        hash128_t h = hash128(s, slen, 0);
+
+        size_t mark = out->len;
+        written = mark == first || buf_put(out, ", ", 2);
+        size_t off = out->len;
+
+        const fragment_t* f = fragdb_find(before, h);
+        if (written && f) {
+            written = buf_put(out, before->base + f->off, f->len);
+        } else if (written) {
+            tokenizer_t t = tokenizer_new();
+            lexed = t && tokenize_string(t, s, slen);
+
+            tlist_t tokens = get_tokens(t);
+            written = tlist_format_tokens(out, tokens);
+            tlist_free(&tokens);
+            tokenizer_free(&t);
+            stats->regenerated++;
+        }
+
+        // Spans without tokens take no separator
+        if (out->len == off) {
+            buf_commit(out, out->data + mark);
+            off = mark;
+        }
+        written = written && fragdb_add(now, h, off, out->len - off);
+    }
+    stats->spans += n > 0 ? n : 0;
+    written = written && buf_putc(out, ']');
+
+    free(spans);
+    return written && lexed;
+}
@@ -0,0 +1,42 @@
+#ifndef SPANS_H
+#define SPANS_H
+
+#include <stddef.h>
+#include "utils/buf.h"
+#include "utils/fragdb.h"
+
+// A top-level piece of a source file: a function definition, a
+// declaration, or what's left after the last one
+typedef struct span {
+    // Bytes [start, end) of the source
+    size_t start;
+    size_t end;
+
+    // Whether it's a function definition, a body after a ')'
+    int function;
+} span_t;
+
+// Splits the len bytes at src into top-level spans, each ending after
+// the ';' or the '}' that closes it at file scope, so that no token
+// crosses two of them. String and character literals and comments are
+// skipped.
+// Returns the number of spans, stored in a new array at *spansp, or -1.
+int split_spans(const char* src, size_t len, span_t** spansp);
+
+// What incremental compilation reused
+typedef struct incremental_stats {
+    int spans;
+    int regenerated;
+} incremental_stats_t;
+
+// Appends the tokens of the len bytes at src to out as tokenizing it
+// whole formats them, one span at a time: the spans found in before (by
+// their hash, in the data it was loaded from) are copied, the others
+// tokenized. Each span is added to now, at its bytes of out. A lex error
+// ends the list after the tokens before it, as it does whole. Returns 1
+// if all of src was tokenized and written, and counts the spans in
+// *stats.
+int tokenize_spans(const char* src, size_t len, fragdb_t before, fragdb_t now, buf_t out,
+                   incremental_stats_t* stats);
+
+#endif
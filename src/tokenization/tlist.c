@@ -1,6 +1,7 @@
 #include "tlist.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 struct tnode {
     token_t data;
@@ -74,16 +75,60 @@ int tlist_append_token(tlist_t* restrict lp, const token_t restrict t) {
     return tlist_append_node(lp, n);
 }
 
-void tlist_print(tlist_t l) {
-    printf("tlist[");
+// Returns the token of the node
+token_t tlist_token(tlist_t l) {
+    return l ? l->data : NULL;
+}
+
+// Returns the node after l
+tlist_t tlist_next(tlist_t l) {
+    return l ? l->next : NULL;
+}
+
+// Reverses the list in place
+void tlist_reverse(tlist_t* lp) {
+    tlist_t prev = NULL, l = *lp;
     while (l) {
-        token_print(l->data);
-        if (l->next) {
-            printf(", ");
+        tlist_t next = l->next;
+        l->next = prev;
+        prev = l;
+        l = next;
+    }
+    *lp = prev;
+}
+
+// Appends the tokens of the list to b, separated by ", "
+int tlist_format_tokens(buf_t b, tlist_t l) {
+    int ok = 1;
+    while (ok && l) {
+        ok = token_format(b, l->data);
+        if (ok && l->next) {
+            ok = buf_put(b, ", ", 2);
         }
         l = l->next;
     }
-    printf("]");
+
+    return ok;
+}
+
+// Appends the tokens of the list to b, as tlist[token, ...]
+int tlist_format(buf_t b, tlist_t l) {
+    return buf_puts(b, "tlist[") && tlist_format_tokens(b, l) && buf_putc(b, ']');
+}
+
+// Formats the whole list in memory and
+// writes it to stdout at once
+void tlist_print(tlist_t l) {
+    buf_t b = buf_new(4096);
+    if (!b) {
+        return;
+    }
+
+    if (tlist_format(b, l)) {
+        fflush(stdout);
+        buf_write(b, STDOUT_FILENO);
+    }
+    buf_free(&b);
 }
 
 void tlist_free(tlist_t* lp) {
@@ -22,6 +22,21 @@ int tlist_append_node(tlist_t* lp, tlist_t n);
 // in the tail of the list.
 int tlist_append_token(tlist_t* restrict lp, const token_t restrict t);
 
+// Returns the token of the node
+token_t tlist_token(tlist_t l);
+
+// Returns the node after l
+tlist_t tlist_next(tlist_t l);
+
+// Reverses the list in place
+void tlist_reverse(tlist_t* lp);
+
+// Appends the tokens of the list to b, separated by ", "
+int tlist_format_tokens(buf_t b, tlist_t l);
+
+// Appends the tokens of the list to b, as tlist[token, ...]
+int tlist_format(buf_t b, tlist_t l);
+
 void tlist_print(tlist_t l);
 
 void tlist_free(tlist_t* lp);
@@ -3,7 +3,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include "utils/str.h"
-#include <inttypes.h>
 
 const char* token_type_to_str(token_type_t tt) {
     switch (tt) {
@@ -145,7 +144,12 @@ const char* token_type_to_str(token_type_t tt) {
     }
 }
 
-// TODO: update ivalue type to "long long"
+// The suffix that gives an integer literal its type (e.g. "UL")
+const char* int_type_suffix(int_type_t it) {
+    static const char* const suffixes[] = {"", "U", "L", "UL", "LL", "ULL"};
+    return it >= LT_INT && it <= LT_ULLONG ? suffixes[it] : "";
+}
+
 union token_value {
     char cvalue;
     int64_t ivalue;
@@ -157,6 +161,9 @@ struct token {
     token_value_t value;
     int has_value;
     int needs_free;
+
+    // The type of an integer literal
+    int_type_t itype;
 };
 
 // Create a new token that doesn't carry additional data.
@@ -194,15 +201,22 @@ token_t token_new_char(char value) {
 
 // Create a new token for an integer literal.
 token_t token_new_int(int64_t value) {
+    return token_new_typed_int((uint64_t)value, LT_INT);
+}
+
+// Create a new token for an integer literal of the given type. Values of
+// unsigned types past INT64_MAX are kept in their two's complement.
+token_t token_new_typed_int(uint64_t value, int_type_t it) {
     token_t t = (token_t)malloc(sizeof(_token));
     if (!t) {
         return NULL;
     }
 
     t->type = L_I;
-    t->value.ivalue = value;
+    t->value.ivalue = (int64_t)value;
     t->has_value = 1;
     t->needs_free = 0;
+    t->itype = it;
 
     return t;
 }
@@ -296,45 +310,84 @@ int token_needs_free(token_t t) {
     return t->needs_free;
 }
 
-void token_print(const token_t t) {
+// The value of a token, for each kind of value it can carry
+char token_get_char(token_t t) {
+    return t && t->type == L_C ? t->value.cvalue : 0;
+}
+
+int64_t token_get_int(token_t t) {
+    return t && t->type == L_I ? t->value.ivalue : 0;
+}
+
+int_type_t token_get_int_type(token_t t) {
+    return t && t->type == L_I ? t->itype : LT_INT;
+}
+
+const char* token_get_string(token_t t) {
+    return t && (t->type == L_S || t->type == ID) && t->has_value ? t->value.svalue : NULL;
+}
+
+// Formats the token into the buffer (e.g. "L_I(5)", "L_I(5UL)")
+int token_format(buf_t b, const token_t t) {
     if (!t) {
-        printf("T_NOVALUE");
-        return;
+        return buf_puts(b, "T_NOVALUE");
     }
 
-    if (t->has_value) {
-        switch (t->type) {
-            case L_C: {
-                printf("%s(%c)", token_type_to_str(t->type), t->value.cvalue);
-                break;
-            }
-            case L_I: {
-                // To correctly format int64_t
-                printf("%s(%" PRId64 ")", token_type_to_str(t->type), t->value.ivalue);
-                break;
-            }
-            case L_S:
-            case ID: {
-                printf("%s(%s)", token_type_to_str(t->type), t->value.svalue);
-                break;
-            }
-            default: {
-                fprintf(stderr,
-                        "Error: t->has_value is true but t->type is a type of token that doesn't carry a value\n");
+    if (!buf_puts(b, token_type_to_str(t->type))) {
+        return 0;
+    }
+
+    if (!t->has_value) {
+        return 1;
+    }
+
+    switch (t->type) {
+        case L_C: {
+            char s[3] = {'(', t->value.cvalue, ')'};
+            return buf_put(b, s, sizeof(s));
+        }
+        case L_I: {
+            // Values of unsigned types are printed as such, with their
+            // suffix, those of int as they always were
+            int is_unsigned = t->itype == LT_UINT || t->itype == LT_ULONG || t->itype == LT_ULLONG;
+            char* p = buf_putc(b, '(') ? buf_reserve(b, 21) : NULL;
+            if (!p) {
+                return 0;
             }
+            buf_commit(b, is_unsigned ? fmt_uint(p, (uint64_t)t->value.ivalue) : fmt_int(p, t->value.ivalue));
+            return buf_puts(b, int_type_suffix(t->itype)) && buf_putc(b, ')');
+        }
+        case L_S:
+        case ID: {
+            return buf_putc(b, '(') && buf_puts(b, t->value.svalue) && buf_putc(b, ')');
+        }
+        default: {
+            fprintf(stderr, "Error: t->has_value is true but t->type is a type of token that doesn't carry a value\n");
+            return 0;
         }
+    }
+}
+
+void token_print(const token_t t) {
+    buf_t b = buf_new(64);
+    if (!b) {
         return;
     }
 
-    printf("%s", token_type_to_str(t->type));
+    if (token_format(b, t)) {
+        fwrite(b->data, 1, b->len, stdout);
+    }
+    buf_free(&b);
 }
 
 void token_free(token_t* tp) {
-    if (!tp || !(*tp)->needs_free || !(*tp)->has_value || !(*tp)->value.svalue) {
+    if (!tp || !*tp) {
         return;
     }
 
-    free((*tp)->value.svalue);
+    if ((*tp)->needs_free && (*tp)->has_value) {
+        free((*tp)->value.svalue);
+    }
     free(*tp);
     *tp = NULL;
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define TOKEN_H
 
 #include <stdint.h>
+#include "utils/buf.h"
 
 typedef enum token_type {
     // Keywords
@@ -87,6 +88,20 @@ typedef enum token_type {
 } token_type_t;
 const char* token_type_to_str(token_type_t tt);
 
+// The type of an integer literal, from its suffix and the first of the
+// types its suffix allows that holds its value (C11 6.4.4.1)
+typedef enum int_type {
+    LT_INT,     // e.g. 5
+    LT_UINT,    // e.g. 5u
+    LT_LONG,    // e.g. 5l
+    LT_ULONG,   // e.g. 5ul
+    LT_LLONG,   // e.g. 5ll
+    LT_ULLONG,  // e.g. 5ull
+} int_type_t;
+
+// The suffix that gives an integer literal its type (e.g. "UL")
+const char* int_type_suffix(int_type_t it);
+
 typedef union token_value token_value_t;
 typedef struct token _token, *token_t;
 
@@ -99,6 +114,10 @@ token_t token_new_char(char value);
 // Create a new token for an integer literal
 token_t token_new_int(int64_t value);
 
+// Create a new token for an integer literal of the given type. Values of
+// unsigned types past INT64_MAX are kept in their two's complement.
+token_t token_new_typed_int(uint64_t value, int_type_t it);
+
 // Create a new token for a string literal
 token_t token_new_string(const char* value);
 
@@ -112,6 +131,15 @@ token_value_t token_get_value(token_t t);
 int token_has_value(token_t t);
 int token_needs_free(token_t t);
 
+// The value of a token, for each kind of value it can carry
+char token_get_char(token_t t);
+int64_t token_get_int(token_t t);
+int_type_t token_get_int_type(token_t t);
+const char* token_get_string(token_t t);
+
+// Formats the token into the buffer (e.g. "L_I(5)", "L_I(5UL)")
+int token_format(buf_t b, const token_t t);
+
 void token_print(const token_t t);
 
 void token_free(token_t* tp);
@@ -2,13 +2,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include "utils/reader.h"
 #include "utils/str.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
 
-#define PARTIAL_SIZE 256
-#define CHUNK_SIZE 4096
+// Initial size of the carry-over, that grows with the longest token
+#define CARRY_SIZE 256
 #define ID_MAX 256
 
 // ===================== MATCH_NODATA =====================
@@ -49,7 +53,7 @@ static match_t match_from_data(char** strp, token_t* tp, const match_data_t* dat
     for (int i = 0; i < data->nsymbols; i++) {
         const char* symbol = data->symbols[i];
         size_t token_len = strlen(symbol);
-        size_t input_len = strlen(str);
+        size_t input_len = strnlen(str, token_len);
 
         if (input_len < token_len) {
             if (!strncmp(str, symbol, input_len)) {
@@ -83,6 +87,11 @@ match_t match_keyword(char** strp, token_t* tp) {
 }
 
 static match_t assignment_action(char** strp, token_t* tp, int i, size_t token_len) {
+    // A = that is actually the == relational operator
+    if (assignment_operators[i][0] == '=' && (*strp)[token_len] == '=') {
+        return MATCH_NONE;
+    }
+
     *tp = token_new((token_type_t)(i + SO_SIMPLE));
     str_advance(strp, token_len);
     skip_spaces(strp);
@@ -97,6 +106,12 @@ match_t match_assignment_operator(char** strp, token_t* tp) {
 }
 
 static match_t relational_action(char** strp, token_t* tp, int i, size_t token_len) {
+    // A < or > that is actually the << or >> bitwise operator
+    if ((relational_operators[i][0] == '<' || relational_operators[i][0] == '>') &&
+        (*strp)[token_len] == relational_operators[i][0]) {
+        return MATCH_NONE;
+    }
+
     // If a > or < is actually a >= or <=
     if ((relational_operators[i][0] == '<' || relational_operators[i][0] == '>') && (*strp)[token_len] == '=') {
         *tp = token_new(relational_operators[i][0] == '<' ? RO_LE : RO_GE);
@@ -278,6 +293,126 @@ match_t match_char_literal(char** strp, token_t* tp) {
     return MATCH_FULL;
 }
 
+// The largest value of each integer type on the target, RV32 being ILP32
+static const uint64_t int_type_max[] = {INT32_MAX, UINT32_MAX, INT32_MAX, UINT32_MAX, INT64_MAX, UINT64_MAX};
+
+// Returns the type of an integer literal of value v: the first its
+// suffix allows that holds it, in the order int, unsigned, long,
+// unsigned long, long long, unsigned long long. Decimal literals without
+// 'u' only take signed types. -1 if none holds it.
+static int literal_type(uint64_t v, int decimal, int is_unsigned, int_type_t min) {
+    for (int it = min; it <= LT_ULLONG; it++) {
+        int type_unsigned = it == LT_UINT || it == LT_ULONG || it == LT_ULLONG;
+        if (is_unsigned && !type_unsigned) {
+            continue;
+        }
+        if (decimal && !is_unsigned && type_unsigned) {
+            continue;
+        }
+        if (v <= int_type_max[it]) {
+            return it;
+        }
+    }
+    return -1;
+}
+
+// Loads 8 characters as a word, the first in its low byte
+static uint64_t load8(const char* s) {
+    uint64_t v;
+    memcpy(&v, s, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+// Whether the 8 characters of v are all decimal digits: adding 6 to one
+// carries into its high nibble only past '9'
+static int is_8digits(uint64_t v) {
+    return ((v & 0xf0f0f0f0f0f0f0f0) | (((v + 0x0606060606060606) & 0xf0f0f0f0f0f0f0f0) >> 4)) == 0x3333333333333333;
+}
+
+// The value of 8 decimal digits, combining pairs, then pairs of pairs,
+// then the two halves, with three multiplications in all
+static uint32_t parse_8digits(uint64_t v) {
+    v -= 0x3030303030303030;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000ff000000ff) * 0x000f424000000064) + (((v >> 16) & 0x000000ff000000ff) * 0x0000271000000001)) >>
+        32;
+    return (uint32_t)v;
+}
+
+// The value of a digit in base 16, 16 if it isn't one
+static int digit_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : 16;
+}
+
+// Lexes the digits of an integer literal in base 10 at *strp into *vp.
+// Returns 0 if the value doesn't fit 64 bits.
+static int decimal_digits(char** strp, uint64_t* vp) {
+    char* str = *strp;
+    uint64_t v = 0;
+    int fits = 1;
+
+    // 8 digits at a time while they fit, the largest 64-bit value having
+    // 20. Only the bytes before the terminator are loaded.
+    size_t avail = strnlen(str, 24);
+    while (avail >= 8 && v < 100000000000ull && is_8digits(load8(str))) {
+        v = v * 100000000 + parse_8digits(load8(str));
+        str += 8;
+        avail -= 8;
+    }
+
+    for (; isdigit(*str); str++) {
+        uint64_t d = *str - '0';
+        fits &= v <= (UINT64_MAX - d) / 10;
+        v = v * 10 + d;
+    }
+
+    *strp = str;
+    *vp = v;
+    return fits;
+}
+
+// Lexes the digits of an integer literal in base 2, 8 or 16 at *strp
+// into *vp. Returns 0 if the value doesn't fit 64 bits.
+static int power_of_two_digits(char** strp, int base, uint64_t* vp) {
+    int shift = base == 16 ? 4 : base == 8 ? 3 : 1;
+    char* str = *strp;
+    uint64_t v = 0;
+    int fits = 1;
+
+    for (int d; (d = digit_value(*str)) < base; str++) {
+        fits &= !(v >> (64 - shift));
+        v = v << shift | d;
+    }
+
+    *strp = str;
+    *vp = v;
+    return fits;
+}
+
+// Reads the u, l and ll suffixes of an integer literal, in either order
+static void int_suffix(char** strp, int* is_unsigned, int_type_t* min) {
+    char* str = *strp;
+    for (int i = 0; i < 2; i++) {
+        if (!*is_unsigned && (*str == 'u' || *str == 'U')) {
+            *is_unsigned = 1;
+            str++;
+        } else if (*min == LT_INT && (*str == 'l' || *str == 'L')) {
+            // "ll" or "LL", not mixed
+            int ll = str[1] == str[0];
+            *min = ll ? LT_LLONG : LT_LONG;
+            str += ll ? 2 : 1;
+        }
+    }
+    *strp = str;
+}
+
 match_t match_integer_literal(char** strp, token_t* tp) {
     if (!strp || !*strp || !tp) {
         return MATCH_ERR;
@@ -289,31 +424,65 @@ match_t match_integer_literal(char** strp, token_t* tp) {
     if (!isdigit(*str)) {
         return MATCH_NONE;
     }
-    str++;
 
-    // Skip over all the digits
-    while (*str && isdigit(*str)) {
-        str++;
+    // 0x and 0b prefixes, a leading 0 makes it octal
+    int base = 10;
+    if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X' || str[1] == 'b' || str[1] == 'B')) {
+        base = (str[1] | 0x20) == 'x' ? 16 : 2;
+        str += 2;
+        if (!*str) {
+            return MATCH_PARTIAL;
+        }
+        if (digit_value(*str) >= base) {
+            fprintf(stderr, "Error: integer literal \"%.2s\" has no digits\n", *strp);
+            return MATCH_ERR;
+        }
+    } else if (str[0] == '0') {
+        base = 8;
     }
 
-    if (isalpha(*str)) {
-        return MATCH_NONE;
-    }
+    // The value is built as the digits are read, once
+    uint64_t v;
+    int fits = base == 10 ? decimal_digits(&str, &v) : power_of_two_digits(&str, base, &v);
+
+    int is_unsigned = 0;
+    int_type_t min = LT_INT;
+    char* suffix = str;
+    int_suffix(&str, &is_unsigned, &min);
 
+    // The literal could go on in the next buffer
     if (!*str) {
         return MATCH_PARTIAL;
     }
 
-    char* end;
-    errno = 0;
-    long long res = strtoll(*strp, &end, 10);
+    char* end = str;
+    while (isalnum(*end) || *end == '_') {
+        end++;
+    }
+    int len = (int)(end - *strp);
+    if (end > str) {
+        if (base == 8 && isdigit(*suffix)) {
+            fprintf(stderr, "Error: invalid digit '%c' in octal literal \"%.*s\"\n", *suffix, len, *strp);
+        } else {
+            fprintf(stderr, "Error: invalid suffix \"%.*s\" on integer literal \"%.*s\"\n", (int)(end - suffix),
+                    suffix, len, *strp);
+        }
+        return MATCH_ERR;
+    }
 
-    if (errno == ERANGE) {
-        perror("strtoll");
-        return MATCH_NONE;
+    int it = fits ? literal_type(v, base == 10, is_unsigned, min) : -1;
+    if (it < 0 && fits && base == 10) {
+        // As C compilers do, too large for long long but not for 64 bits
+        fprintf(stderr, "Warning: integer literal \"%.*s\" is too large for long long, it's unsigned\n", len,
+                *strp);
+        it = LT_ULLONG;
+    }
+    if (it < 0) {
+        fprintf(stderr, "Error: integer literal \"%.*s\" is too large for any integer type\n", len, *strp);
+        return MATCH_ERR;
     }
 
-    *tp = token_new_int((int64_t)res);
+    *tp = token_new_typed_int(v, (int_type_t)it);
     *strp = str;
     skip_spaces(strp);
 
@@ -399,9 +568,18 @@ struct tokenizer {
     // The list of tokens
     tlist_t tokens;
 
-    //  A character buffer to accumulate
-    // partial tokens across read operations
-    char partial[PARTIAL_SIZE];
+    // What the input read so far ends in that the rest continues: a
+    // partial token of any length, or the '*' that may start the "*/" of
+    // a comment. New input is appended to it, and the whole lexed.
+    buf_t carry;
+
+    // The length of the carry-over left by the last lexing, which is
+    // only lexed again once the input appended at least doubles it
+    size_t stalled;
+
+    // The comment the last buffer ended in, '/' for a line comment and
+    // '*' for a block comment, '\0' if none. Its body isn't kept.
+    char comment;
 };
 
 // Creates a new tokenizer
@@ -413,7 +591,13 @@ tokenizer_t tokenizer_new() {
     }
 
     t->tokens = NULL;
-    memset(t->partial, 0, PARTIAL_SIZE);
+    t->carry = buf_new(CARRY_SIZE);
+    if (!t->carry) {
+        free(t);
+        return NULL;
+    }
+    t->stalled = 0;
+    t->comment = '\0';
 
     return t;
 }
@@ -431,27 +615,69 @@ static match_t (*const matchers[])(char**, token_t*) = {match_keyword,
                                                         match_separator};
 static const int num_matchers = sizeof(matchers) / sizeof(*matchers);
 
-static int process_buffer(char* buf, tokenizer_t t) {
+// Skips the rest of the comment the last buffer ended in. Returns where
+// the code starts again, NULL if the comment goes on past the buffer, in
+// which case *restp is set to what the next buffer continues.
+static char* end_comment(char* buf, tokenizer_t t, char** restp) {
+    size_t len = strlen(buf);
+    const char* end = t->comment == '/' ? (const char*)memchr(buf, '\n', len) : block_comment_end(buf, buf + len);
+    if (!end) {
+        *restp = buf + len - (t->comment == '*' && len && buf[len - 1] == '*');
+        return NULL;
+    }
+
+    t->comment = '\0';
+    return (char*)end;
+}
+
+// Keeps the comment starting at str, that the buffer ends in, for the
+// next one. Returns what the next buffer continues.
+static char* begin_comment(char* str, tokenizer_t t) {
+    t->comment = str[1];
+    size_t len = strlen(str);
+    return str + len - (t->comment == '*' && len > 2 && str[len - 1] == '*');
+}
+
+// Lexes the tokens of buf. *restp is set to the end of what was lexed:
+// the start of a token the end of the buffer cuts, or its terminator.
+static int process_buffer(char* buf, tokenizer_t t, char** restp) {
     char* str = buf;
+    if (t->comment && !(str = end_comment(buf, t, restp))) {
+        return 1;
+    }
+
     while (*str) {
+        // The matchers skip whole comments along with spaces, one cut by
+        // the end of the buffer (or a '/' that may start it) is left for
+        // the next
+        skip_spaces(&str);
+        if (!*str) {
+            break;
+        }
+        if (str[0] == '/' && (str[1] == '/' || str[1] == '*')) {
+            *restp = begin_comment(str, t);
+            return 1;
+        }
+        if (str[0] == '/' && !str[1]) {
+            *restp = str;
+            return 1;
+        }
+
         int matched = 0;
         token_t tk = NULL;
         for (int i = 0; !matched && i < num_matchers; i++) {
             switch (matchers[i](&str, &tk)) {
                 case MATCH_ERR: {
-                    fprintf(stderr, "Tokenizer error at \"%s\"\n", str);
+                    fprintf(stderr, "Tokenizer error at \"%.*s\"\n", (int)strcspn(str, "\n"), str);
                     return 0;
                 }
                 case MATCH_NONE: {
                     break;
                 }
                 case MATCH_PARTIAL: {
-                    matched = 1;
-
-                    // Store the rest of the buffer for next chunk
-                    snprintf(t->partial, PARTIAL_SIZE, "%s", str);
-                    *str = '\0';
-                    break;
+                    // The rest of the buffer goes with the next
+                    *restp = str;
+                    return 1;
                 }
                 case MATCH_FULL:
                 case MATCH_FULL_DIFF: {
@@ -467,9 +693,53 @@ static int process_buffer(char* buf, tokenizer_t t) {
             str++;
         }
     }
+    *restp = str;
+    return 1;
+}
+
+// Appends the len bytes at data to the input and lexes what can be.
+// While a token is longer than the input appended after it, lexing it
+// waits for more, so that however long it grows it's lexed a bounded
+// number of times. last lexes all there is.
+static int feed(tokenizer_t t, const char* data, size_t len, int last) {
+    if (!buf_put(t->carry, data, len) || !buf_reserve(t->carry, 1)) {
+        return 0;
+    }
+    if (!last && t->carry->len < 2 * t->stalled) {
+        return 1;
+    }
+
+    // The matchers need a terminator
+    t->carry->data[t->carry->len] = '\0';
+    char* rest = NULL;
+    if (!process_buffer(t->carry->data, t, &rest)) {
+        return 0;
+    }
+
+    size_t left = t->carry->len - (size_t)(rest - t->carry->data);
+    memmove(t->carry->data, rest, left);
+    buf_commit(t->carry, t->carry->data + left);
+    t->stalled = left;
     return 1;
 }
 
+// Lexes what's left of the input if ok, which ends its last token as a
+// newline would, and warns about what can't be. Then forgets the input,
+// returns whether it was all lexed.
+static int finish(tokenizer_t t, int ok) {
+    ok = ok && feed(t, "\n", 1, 1);
+    if (ok && t->comment) {
+        fprintf(stderr, "Warning: unterminated comment\n");
+    } else if (ok && t->carry->len) {
+        fprintf(stderr, "Warning: leftover \"%.*s\"\n", (int)strcspn(t->carry->data, "\n"), t->carry->data);
+    }
+
+    t->comment = '\0';
+    t->stalled = 0;
+    buf_clear(t->carry);
+    return ok;
+}
+
 // Tokenizes the file (if found) with the tokenizer t
 int tokenize(tokenizer_t t, const char* filename) {
     struct stat path_stat;
@@ -483,36 +753,53 @@ int tokenize(tokenizer_t t, const char* filename) {
         return 0;
     }
 
-    FILE* f = fopen(filename, "r");
-    if (!f) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
         perror("Error opening file");
         return 0;
     }
 
-    char chunk[CHUNK_SIZE + 1] = {0};
-    char buf[PARTIAL_SIZE + CHUNK_SIZE + 1] = {0};
-
-    size_t nread;
-    while ((nread = fread(chunk, 1, CHUNK_SIZE, f)) > 0) {
-        chunk[nread] = '\0';
-
-        // Prepend partial data from last reading
-        snprintf(buf, sizeof(buf), "%s%s", t->partial, chunk);
-        t->partial[0] = '\0';
+    int ok = tokenize_fd(t, fd);
+    close(fd);
+    return ok;
+}
 
-        if (!process_buffer(buf, t)) {
-            fclose(f);
-            return 0;
-        }
+// Tokenizes what can be read from fd (a file, a pipe, stdin) until its
+// end with the tokenizer t. A thread reads the next block while the last
+// is lexed.
+int tokenize_fd(tokenizer_t t, int fd) {
+    reader_t r = reader_new(fd, READER_BLOCK_SIZE);
+    if (!r) {
+        return 0;
     }
 
-    // Check if there's something left in partial
-    if (t->partial[0]) {
-        fprintf(stderr, "Warning: leftover \"%s\"\n", t->partial);
+    const char* data;
+    size_t len;
+    int ok = 1;
+    while (ok && (data = reader_next(r, &len))) {
+        ok = tokenize_part(t, data, len);
     }
 
-    fclose(f);
-    return 1;
+    // A read error is reported by the reader, what came before is lexed
+    ok = finish(t, ok) && !len;
+    reader_free(&r);
+    return ok;
+}
+
+// Tokenizes the len bytes at src with the tokenizer t
+int tokenize_string(tokenizer_t t, const char* src, size_t len) {
+    return finish(t, feed(t, src, len, 0));
+}
+
+// Tokenizes the len bytes at src with the tokenizer t, the next part of
+// an input whose tokens and comments may cross parts
+int tokenize_part(tokenizer_t t, const char* src, size_t len) {
+    return feed(t, src, len, 0);
+}
+
+// Tokenizes what's left of the input given in parts, which ends there
+int tokenize_end(tokenizer_t t) {
+    return finish(t, 1);
 }
 
 // Gets a list of tokens from a tokenizer,
@@ -529,6 +816,7 @@ void tokenizer_free(tokenizer_t* tp) {
     }
 
     tlist_free(&(*tp)->tokens);
+    buf_free(&(*tp)->carry);
     free(*tp);
 
     *tp = NULL;
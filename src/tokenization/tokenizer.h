@@ -1,6 +1,7 @@
 #ifndef TOKENIZER_H
 #define TOKENIZER_H
 
+#include <stddef.h>
 #include "tlist.h"
 
 // ===================== TOKEN STRINGS =====================
@@ -58,6 +59,21 @@ tokenizer_t tokenizer_new();
 // Tokenizes the file (if found) with the tokenizer t
 int tokenize(tokenizer_t t, const char* filename);
 
+// Tokenizes what can be read from fd (a file, a pipe, stdin) until its
+// end with the tokenizer t. A thread reads the next block while the last
+// is lexed.
+int tokenize_fd(tokenizer_t t, int fd);
+
+// Tokenizes the len bytes at src with the tokenizer t
+int tokenize_string(tokenizer_t t, const char* src, size_t len);
+
+// Tokenizes the len bytes at src with the tokenizer t, the next part of
+// an input whose tokens and comments may cross parts
+int tokenize_part(tokenizer_t t, const char* src, size_t len);
+
+// Tokenizes what's left of the input given in parts, which ends there
+int tokenize_end(tokenizer_t t);
+
 // Gets a list of tokens from a tokenizer,
 // which will be left with no tokens.
 tlist_t get_tokens(tokenizer_t t);
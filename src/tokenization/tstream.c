@@ -0,0 +1,310 @@
+#include "tstream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils/hash.h"
+
+// ===================== VARINTS =====================
+
+static int put_varint(buf_t b, uint64_t v) {
+    char* p = buf_reserve(b, 10);
+    if (!p) {
+        return 0;
+    }
+
+    while (v >= 0x80) {
+        *p++ = (char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (char)v;
+
+    buf_commit(b, p);
+    return 1;
+}
+
+// Reads a varint at *pp, not past end, returns 0 if it's cut or too long
+static int get_varint(const uint8_t** pp, const uint8_t* end, uint64_t* v) {
+    *v = 0;
+    for (int shift = 0; *pp < end && shift < 64; shift += 7) {
+        uint8_t byte = *(*pp)++;
+        *v |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t get_u32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static int put_u32(buf_t b, uint32_t v) {
+    return buf_put(b, (const char*)&v, 4);
+}
+
+// ===================== STRING TABLE =====================
+
+// The distinct strings of a list, in the order they first appear, with
+// an open addressing table of their indices
+typedef struct strtab {
+    buf_t offsets;
+    buf_t strings;
+    uint32_t n;
+
+    // Index + 1 of the string in each slot, 0 if empty
+    uint32_t* slots;
+    uint32_t cap;
+} strtab_t;
+
+static int strtab_grow(strtab_t* st) {
+    uint32_t cap = st->cap ? 2 * st->cap : 256;
+    uint32_t* slots = (uint32_t*)calloc(cap, sizeof(uint32_t));
+    if (!slots) {
+        perror("Error with calloc");
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < st->cap; i++) {
+        if (st->slots[i]) {
+            const char* s = st->strings->data + get_u32(st->offsets->data + 4 * (st->slots[i] - 1));
+            uint32_t h = (uint32_t)hash128(s, strlen(s), 0).lo & (cap - 1);
+            while (slots[h]) {
+                h = (h + 1) & (cap - 1);
+            }
+            slots[h] = st->slots[i];
+        }
+    }
+
+    free(st->slots);
+    st->slots = slots;
+    st->cap = cap;
+    return 1;
+}
+
+// Returns the index of s in the table, adding it if it's new, or -1
+static int64_t strtab_index(strtab_t* st, const char* s) {
+    if (2 * (st->n + 1) > st->cap && !strtab_grow(st)) {
+        return -1;
+    }
+
+    size_t len = strlen(s);
+    uint32_t h = (uint32_t)hash128(s, len, 0).lo & (st->cap - 1);
+    for (; st->slots[h]; h = (h + 1) & (st->cap - 1)) {
+        const char* other = st->strings->data + get_u32(st->offsets->data + 4 * (st->slots[h] - 1));
+        if (!strcmp(other, s)) {
+            return st->slots[h] - 1;
+        }
+    }
+
+    if (st->strings->len > UINT32_MAX - len - 1 || !put_u32(st->offsets, (uint32_t)st->strings->len) ||
+        !buf_put(st->strings, s, len + 1)) {
+        return -1;
+    }
+    st->slots[h] = ++st->n;
+    return st->n - 1;
+}
+
+// ===================== WRITING =====================
+
+static int put_token(buf_t stream, strtab_t* st, token_t t) {
+    token_type_t type = token_get_type(t);
+    int has_value = token_has_value(t) == 1;
+    if (!put_varint(stream, (uint64_t)type << 1 | has_value)) {
+        return 0;
+    }
+    if (!has_value) {
+        return 1;
+    }
+
+    switch (type) {
+        case L_C:
+            return put_varint(stream, (uint8_t)token_get_char(t));
+        case L_I: {
+            int64_t v = token_get_int(t);
+            return put_varint(stream, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63)) &&
+                   put_varint(stream, token_get_int_type(t));
+        }
+        case L_S:
+        case ID: {
+            int64_t i = strtab_index(st, token_get_string(t));
+            return i >= 0 && put_varint(stream, (uint64_t)i);
+        }
+        default:
+            fprintf(stderr, "Error: token of type %s can't carry a value\n", token_type_to_str(type));
+            return 0;
+    }
+}
+
+// Appends the tokens of the list to b, serialized
+int tstream_write(buf_t b, tlist_t l) {
+    strtab_t st = {buf_new(256), buf_new(1024), 0, NULL, 0};
+    buf_t stream = buf_new(4096);
+    int ok = st.offsets && st.strings && stream;
+
+    uint32_t ntokens = 0;
+    for (; ok && l; l = tlist_next(l)) {
+        ok = put_token(stream, &st, tlist_token(l));
+        ntokens++;
+    }
+
+    // Everything has to be addressable with 32-bit offsets
+    uint64_t strings_off = 0, stream_off = 0;
+    if (ok) {
+        strings_off = TSTREAM_HEADER_SIZE + (uint64_t)st.offsets->len;
+        stream_off = strings_off + st.strings->len;
+    }
+    if (ok && stream_off + stream->len > UINT32_MAX) {
+        fprintf(stderr, "Error: token stream too big\n");
+        ok = 0;
+    }
+
+    ok = ok && buf_put(b, TSTREAM_MAGIC, 4) && buf_put(b, (const char*)&(uint16_t){TSTREAM_VERSION}, 2) &&
+         buf_put(b, (const char*)&(uint16_t){0}, 2) && put_u32(b, ntokens) && put_u32(b, st.n) &&
+         put_u32(b, (uint32_t)strings_off) && put_u32(b, (uint32_t)st.strings->len) &&
+         put_u32(b, (uint32_t)stream_off) && put_u32(b, (uint32_t)stream->len) &&
+         buf_put(b, st.offsets->data, st.offsets->len) && buf_put(b, st.strings->data, st.strings->len) &&
+         buf_put(b, stream->data, stream->len);
+
+    free(st.slots);
+    buf_free(&st.offsets);
+    buf_free(&st.strings);
+    buf_free(&stream);
+    return ok;
+}
+
+// ===================== READING =====================
+
+// Checks the len bytes at data hold a token list of this version and
+// sets up s to read them, without copying them. Returns 0 if they
+// don't.
+int tstream_open(tstream_t* s, const void* data, size_t len) {
+    const char* p = (const char*)data;
+    if (len < TSTREAM_HEADER_SIZE || memcmp(p, TSTREAM_MAGIC, 4)) {
+        return 0;
+    }
+
+    uint16_t version;
+    memcpy(&version, p + 4, 2);
+    uint32_t ntokens = get_u32(p + 8), nstrings = get_u32(p + 12);
+    uint64_t strings_off = get_u32(p + 16), strings_size = get_u32(p + 20);
+    uint64_t stream_off = get_u32(p + 24), stream_size = get_u32(p + 28);
+    if (version != TSTREAM_VERSION || TSTREAM_HEADER_SIZE + 4 * (uint64_t)nstrings > strings_off ||
+        strings_off + strings_size > stream_off || stream_off + stream_size > len) {
+        return 0;
+    }
+
+    // Every string starts in the table and ends in it
+    const char* offsets = p + TSTREAM_HEADER_SIZE;
+    if (nstrings && (!strings_size || p[strings_off + strings_size - 1])) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < nstrings; i++) {
+        if (get_u32(offsets + 4 * i) >= strings_size) {
+            return 0;
+        }
+    }
+
+    *s = (tstream_t){p,
+                     len,
+                     ntokens,
+                     nstrings,
+                     offsets,
+                     p + strings_off,
+                     (const uint8_t*)p + stream_off,
+                     (const uint8_t*)p + stream_off + stream_size};
+    return 1;
+}
+
+tstream_cursor_t tstream_begin(const tstream_t* s) {
+    return (tstream_cursor_t){s, s->stream, s->ntokens};
+}
+
+// Reads the next token at c into t. Returns 1 if there was one, 0 at
+// the end of the stream, -1 if it's corrupt.
+int tstream_next(tstream_cursor_t* c, tstream_token_t* t) {
+    if (!c->left) {
+        return 0;
+    }
+
+    uint64_t v;
+    if (!get_varint(&c->p, c->s->end, &v) || (v >> 1) >= T_NOVALUE) {
+        return -1;
+    }
+    *t = (tstream_token_t){(token_type_t)(v >> 1), (int)(v & 1), 0, 0, LT_INT, NULL};
+    c->left--;
+    if (!t->has_value) {
+        return 1;
+    }
+
+    if (!get_varint(&c->p, c->s->end, &v)) {
+        return -1;
+    }
+    switch (t->type) {
+        case L_C:
+            t->cvalue = (char)v;
+            return v <= 0xff ? 1 : -1;
+        case L_I:
+            t->ivalue = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+            if (!get_varint(&c->p, c->s->end, &v) || v > LT_ULLONG) {
+                return -1;
+            }
+            t->itype = (int_type_t)v;
+            return 1;
+        case L_S:
+        case ID:
+            if (v >= c->s->nstrings) {
+                return -1;
+            }
+            t->svalue = c->s->strings + get_u32(c->s->offsets + 4 * v);
+            return 1;
+        default:
+            return -1;
+    }
+}
+
+static token_t make_token(const tstream_token_t* t) {
+    if (!t->has_value) {
+        return token_new(t->type);
+    }
+
+    switch (t->type) {
+        case L_C:
+            return token_new_char(t->cvalue);
+        case L_I:
+            return token_new_typed_int((uint64_t)t->ivalue, t->itype);
+        case L_S:
+            return token_new_string(t->svalue);
+        default:
+            return token_new_id(t->svalue);
+    }
+}
+
+// Rebuilds the token list of s, returns 0 on error
+int tstream_to_tlist(const tstream_t* s, tlist_t* lp) {
+    *lp = NULL;
+
+    // Built backwards, inserting at the head is what doesn't walk it
+    tstream_cursor_t c = tstream_begin(s);
+    tstream_token_t t;
+    int r;
+    while ((r = tstream_next(&c, &t)) == 1) {
+        token_t tk = make_token(&t);
+        if (!tk || !tlist_insert_token(lp, tk)) {
+            perror("Error with malloc");
+            if (tk) {
+                token_free(&tk);
+            }
+            r = -2;
+            break;
+        }
+    }
+    tlist_reverse(lp);
+
+    if (r == -1) {
+        fprintf(stderr, "Error: corrupt token stream\n");
+    }
+    return r == 0;
+}
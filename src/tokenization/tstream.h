@@ -0,0 +1,78 @@
+#ifndef TSTREAM_H
+#define TSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "tlist.h"
+#include "utils/buf.h"
+
+// A token list serialized, to be mapped back in memory and read in place
+// rather than lexed again. Little-endian, laid out as:
+//
+//   header      TSTREAM_HEADER_SIZE bytes, see below
+//   offsets     nstrings 32-bit offsets into the string table
+//   strings     the distinct strings of identifiers and string literals,
+//               each with its terminator
+//   stream      each token as a varint of its type shifted left once,
+//               the low bit set if a value follows: the character of a
+//               character literal, the zigzag encoded integer of an
+//               integer literal and then its int_type_t, or the index
+//               of the string of an identifier or a string literal
+//
+// The header holds the magic, the version, then the number of tokens,
+// the number of strings, and the offset and size of the strings and of
+// the stream, all 32-bit.
+
+#define TSTREAM_MAGIC "DTOK"
+#define TSTREAM_VERSION 2
+#define TSTREAM_HEADER_SIZE 32
+
+// Appends the tokens of the list to b, serialized
+int tstream_write(buf_t b, tlist_t l);
+
+// A serialized token list, read where it lies
+typedef struct tstream {
+    const char* data;
+    size_t len;
+
+    uint32_t ntokens;
+    uint32_t nstrings;
+
+    const char* offsets;
+    const char* strings;
+    const uint8_t* stream;
+    const uint8_t* end;
+} tstream_t;
+
+// Checks the len bytes at data hold a token list of this version and
+// sets up s to read them, without copying them. Returns 0 if they
+// don't.
+int tstream_open(tstream_t* s, const void* data, size_t len);
+
+// A token as read from a stream, its string pointing into it
+typedef struct tstream_token {
+    token_type_t type;
+    int has_value;
+    char cvalue;
+    int64_t ivalue;
+    int_type_t itype;
+    const char* svalue;
+} tstream_token_t;
+
+// Position in a stream, starting at its first token
+typedef struct tstream_cursor {
+    const tstream_t* s;
+    const uint8_t* p;
+    uint32_t left;
+} tstream_cursor_t;
+
+tstream_cursor_t tstream_begin(const tstream_t* s);
+
+// Reads the next token at c into t. Returns 1 if there was one, 0 at
+// the end of the stream, -1 if it's corrupt.
+int tstream_next(tstream_cursor_t* c, tstream_token_t* t);
+
+// Rebuilds the token list of s, returns 0 on error
+int tstream_to_tlist(const tstream_t* s, tlist_t* lp);
+
+#endif
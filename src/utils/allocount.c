@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+#include "allocount.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Sanitizers bring their own allocator, which may allocate before
+// anything can be looked up: under them nothing is replaced
+#if !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+
+static int64_t allocs;
+static int64_t alloc_bytes;
+static int counting;
+
+// The allocator of the C library, that the functions below count the
+// calls to
+static void* (*real_malloc)(size_t);
+static void* (*real_calloc)(size_t, size_t);
+static void* (*real_realloc)(void*, size_t);
+static void (*real_free)(void*);
+static int (*real_posix_memalign)(void**, size_t, size_t);
+static void* (*real_aligned_alloc)(size_t, size_t);
+
+// What's allocated while the functions above are looked up, dlsym may
+// allocate itself
+static char bootstrap[4096];
+static size_t bootstrap_used;
+
+static void* bootstrap_alloc(size_t n) {
+    n = (n + 15) & ~(size_t)15;
+    if (bootstrap_used + n > sizeof(bootstrap)) {
+        return NULL;
+    }
+    void* p = bootstrap + bootstrap_used;
+    bootstrap_used += n;
+    return p;
+}
+
+static int in_bootstrap(const void* p) {
+    return (const char*)p >= bootstrap && (const char*)p < bootstrap + sizeof(bootstrap);
+}
+
+static int resolve() {
+    static int resolving;
+    if (real_free) {
+        return 1;
+    }
+    if (resolving) {
+        return 0;
+    }
+
+    resolving = 1;
+    real_malloc = (void* (*)(size_t))dlsym(RTLD_NEXT, "malloc");
+    real_calloc = (void* (*)(size_t, size_t))dlsym(RTLD_NEXT, "calloc");
+    real_realloc = (void* (*)(void*, size_t))dlsym(RTLD_NEXT, "realloc");
+    real_posix_memalign = (int (*)(void**, size_t, size_t))dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = (void* (*)(size_t, size_t))dlsym(RTLD_NEXT, "aligned_alloc");
+    real_free = (void (*)(void*))dlsym(RTLD_NEXT, "free");
+    resolving = 0;
+    return real_malloc && real_calloc && real_realloc && real_posix_memalign && real_aligned_alloc && real_free;
+}
+
+static void count(size_t n) {
+    if (counting) {
+        __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&alloc_bytes, (int64_t)n, __ATOMIC_RELAXED);
+    }
+}
+
+// Starts or stops counting, nothing is counted until started
+void allocount_enable(int on) {
+    counting = on;
+}
+
+// Returns the allocations counted so far, and their bytes in *bytes
+int64_t allocount_get(int64_t* bytes) {
+    *bytes = __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED);
+    return __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+}
+
+void* malloc(size_t n) {
+    if (!resolve()) {
+        return bootstrap_alloc(n);
+    }
+    count(n);
+    return real_malloc(n);
+}
+
+void* calloc(size_t n, size_t size) {
+    if (!resolve()) {
+        // The bootstrap buffer is zeroed, and never reused
+        return size && n > sizeof(bootstrap) / size ? NULL : bootstrap_alloc(n * size);
+    }
+    count(n * size);
+    return real_calloc(n, size);
+}
+
+void* realloc(void* p, size_t n) {
+    if (in_bootstrap(p) || !resolve()) {
+        void* q = resolve() ? real_malloc(n) : bootstrap_alloc(n);
+        if (q && p) {
+            size_t left = bootstrap + sizeof(bootstrap) - (char*)p;
+            memcpy(q, p, n < left ? n : left);
+        }
+        count(n);
+        return q;
+    }
+    count(n);
+    return real_realloc(p, n);
+}
+
+// The C library's would call its own realloc, which isn't counted
+void* reallocarray(void* p, size_t n, size_t size) {
+    if (size && n > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(p, n * size);
+}
+
+int posix_memalign(void** pp, size_t align, size_t n) {
+    if (!resolve()) {
+        return ENOMEM;
+    }
+    count(n);
+    return real_posix_memalign(pp, align, n);
+}
+
+void* aligned_alloc(size_t align, size_t n) {
+    if (!resolve()) {
+        return NULL;
+    }
+    count(n);
+    return real_aligned_alloc(align, n);
+}
+
+void free(void* p) {
+    if (p && !in_bootstrap(p) && resolve()) {
+        real_free(p);
+    }
+}
+
+#endif
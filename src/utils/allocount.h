@@ -0,0 +1,19 @@
+#ifndef ALLOCOUNT_H
+#define ALLOCOUNT_H
+
+#include <stdint.h>
+
+// Counts the calls to malloc and its family (calloc, realloc,
+// reallocarray, posix_memalign, aligned_alloc) and the bytes they ask
+// for, for the time report. It replaces the allocator functions of the
+// whole process, so it's only linked in by a build made with
+// make COUNT_ALLOCS=1, and not under the sanitizers. Elsewhere the
+// functions below are NULL.
+
+// Starts or stops counting, nothing is counted until started
+void allocount_enable(int on) __attribute__((weak));
+
+// Returns the allocations counted so far, and their bytes in *bytes
+int64_t allocount_get(int64_t* bytes) __attribute__((weak));
+
+#endif
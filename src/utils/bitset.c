@@ -0,0 +1,21 @@
+#include "bitset.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Creates an empty set able to hold 0..n-1
+bitset_t bitset_new(int n) {
+    bitset_t s = (bitset_t)calloc(BITSET_WORDS(n) ? BITSET_WORDS(n) : 1, sizeof(uint64_t));
+    if (!s) {
+        perror("Error with calloc");
+    }
+    return s;
+}
+
+void bitset_free(bitset_t* sp) {
+    if (!sp || !*sp) {
+        return;
+    }
+
+    free(*sp);
+    *sp = NULL;
+}
@@ -0,0 +1,60 @@
+#ifndef BITSET_H
+#define BITSET_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Fixed size sets of small integers, stored as arrays of 64-bit words.
+// All the sets combined by one operation must have the same size.
+
+typedef uint64_t* bitset_t;
+
+#define BITSET_WORDS(n) (((n) + 63) / 64)
+
+// Creates an empty set able to hold 0..n-1
+bitset_t bitset_new(int n);
+void bitset_free(bitset_t* sp);
+
+static inline void bitset_set(bitset_t s, int i) {
+    s[i >> 6] |= (uint64_t)1 << (i & 63);
+}
+
+static inline void bitset_clear(bitset_t s, int i) {
+    s[i >> 6] &= ~((uint64_t)1 << (i & 63));
+}
+
+static inline int bitset_test(const bitset_t s, int i) {
+    return (s[i >> 6] >> (i & 63)) & 1;
+}
+
+static inline void bitset_zero(bitset_t s, int words) {
+    memset(s, 0, words * sizeof(uint64_t));
+}
+
+static inline void bitset_copy(bitset_t dst, const bitset_t src, int words) {
+    memcpy(dst, src, words * sizeof(uint64_t));
+}
+
+// dst |= src, returns 1 if dst changed
+static inline int bitset_union(bitset_t dst, const bitset_t src, int words) {
+    uint64_t changed = 0;
+    for (int w = 0; w < words; w++) {
+        uint64_t v = dst[w] | src[w];
+        changed |= v ^ dst[w];
+        dst[w] = v;
+    }
+    return changed != 0;
+}
+
+// dst = a | (b & ~c)
+static inline void bitset_union_diff(bitset_t dst, const bitset_t a, const bitset_t b, const bitset_t c, int words) {
+    for (int w = 0; w < words; w++) {
+        dst[w] = a[w] | (b[w] & ~c[w]);
+    }
+}
+
+static inline int bitset_equal(const bitset_t a, const bitset_t b, int words) {
+    return !memcmp(a, b, words * sizeof(uint64_t));
+}
+
+#endif
@@ -0,0 +1,178 @@
+#include "buf.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BUF_MIN_CAP 64
+
+// Creates a new buffer with room for cap bytes
+buf_t buf_new(size_t cap) {
+    buf_t b = (buf_t)malloc(sizeof(_buf));
+    if (!b) {
+        perror("Error with malloc");
+        return NULL;
+    }
+
+    if (cap < BUF_MIN_CAP) {
+        cap = BUF_MIN_CAP;
+    }
+
+    b->data = (char*)malloc(cap);
+    if (!b->data) {
+        perror("Error with malloc");
+        free(b);
+        return NULL;
+    }
+
+    b->len = 0;
+    b->cap = cap;
+
+    return b;
+}
+
+// Makes room for at least n more bytes and returns a pointer
+// to the end of the data. The caller writes there and then
+// commits the bytes written with buf_commit.
+char* buf_reserve(buf_t b, size_t n) {
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap * 2;
+        while (cap < b->len + n) {
+            cap *= 2;
+        }
+
+        char* data = (char*)realloc(b->data, cap);
+        if (!data) {
+            perror("Error with realloc");
+            return NULL;
+        }
+
+        b->data = data;
+        b->cap = cap;
+    }
+
+    return b->data + b->len;
+}
+
+// Sets the end of the data to p, a pointer obtained from buf_reserve
+void buf_commit(buf_t b, char* p) {
+    b->len = (size_t)(p - b->data);
+}
+
+int buf_put(buf_t b, const char* s, size_t len) {
+    char* p = buf_reserve(b, len);
+    if (!p) {
+        return 0;
+    }
+
+    memcpy(p, s, len);
+    b->len += len;
+    return 1;
+}
+
+int buf_putc(buf_t b, char c) {
+    char* p = buf_reserve(b, 1);
+    if (!p) {
+        return 0;
+    }
+
+    *p = c;
+    b->len++;
+    return 1;
+}
+
+int buf_puts(buf_t b, const char* s) {
+    return buf_put(b, s, strlen(s));
+}
+
+int buf_put_int(buf_t b, int64_t v) {
+    char* p = buf_reserve(b, 21);
+    if (!p) {
+        return 0;
+    }
+
+    buf_commit(b, fmt_int(p, v));
+    return 1;
+}
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Formats v in decimal at p and returns the pointer past the
+// last digit. p must have room for 20 characters (21 if signed).
+char* fmt_uint(char* p, uint64_t v) {
+    // Fill a scratch buffer from the end, two digits at a time
+    char tmp[20];
+    char* t = tmp + sizeof(tmp);
+
+    while (v >= 100) {
+        unsigned pair = (unsigned)(v % 100) * 2;
+        v /= 100;
+        t -= 2;
+        t[0] = digit_pairs[pair];
+        t[1] = digit_pairs[pair + 1];
+    }
+
+    if (v >= 10) {
+        t -= 2;
+        t[0] = digit_pairs[v * 2];
+        t[1] = digit_pairs[v * 2 + 1];
+    } else {
+        *--t = (char)('0' + v);
+    }
+
+    size_t n = (size_t)(tmp + sizeof(tmp) - t);
+    memcpy(p, t, n);
+    return p + n;
+}
+
+char* fmt_int(char* p, int64_t v) {
+    if (v < 0) {
+        *p++ = '-';
+        return fmt_uint(p, -(uint64_t)v);
+    }
+
+    return fmt_uint(p, (uint64_t)v);
+}
+
+// Writes the whole buffer to fd, retrying on partial writes
+int buf_write(buf_t b, int fd) {
+    size_t off = 0;
+    while (off < b->len) {
+        ssize_t n = write(fd, b->data + off, b->len - off);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error writing output");
+            return 0;
+        }
+        off += (size_t)n;
+    }
+
+    return 1;
+}
+
+void buf_clear(buf_t b) {
+    b->len = 0;
+}
+
+void buf_free(buf_t* bp) {
+    if (!bp || !*bp) {
+        return;
+    }
+
+    free((*bp)->data);
+    free(*bp);
+    *bp = NULL;
+}
@@ -0,0 +1,45 @@
+#ifndef BUF_H
+#define BUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A growable memory buffer used to build output
+// before handing it to the kernel in one go
+typedef struct buf _buf, *buf_t;
+
+struct buf {
+    char* data;
+    size_t len;
+    size_t cap;
+};
+
+// Creates a new buffer with room for cap bytes
+buf_t buf_new(size_t cap);
+
+// Makes room for at least n more bytes and returns a pointer
+// to the end of the data. The caller writes there and then
+// commits the bytes written with buf_commit.
+char* buf_reserve(buf_t b, size_t n);
+
+// Sets the end of the data to p, a pointer obtained from buf_reserve
+void buf_commit(buf_t b, char* p);
+
+int buf_put(buf_t b, const char* s, size_t len);
+int buf_putc(buf_t b, char c);
+int buf_puts(buf_t b, const char* s);
+int buf_put_int(buf_t b, int64_t v);
+
+// Formats v in decimal at p and returns the pointer past the
+// last digit. p must have room for 20 characters (21 if signed).
+char* fmt_uint(char* p, uint64_t v);
+char* fmt_int(char* p, int64_t v);
+
+// Writes the whole buffer to fd, retrying on partial writes
+int buf_write(buf_t b, int fd);
+
+void buf_clear(buf_t b);
+
+void buf_free(buf_t* bp);
+
+#endif
@@ -0,0 +1,466 @@
+#include "cache.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Temporary files left by writers that died are removed by eviction once
+// they are this old (seconds)
+#define STALE_TMP_AGE 3600
+
+// ===================== PATHS =====================
+
+// Returns the path of the entry of key, or of its shard directory if
+// shard, to be freed by the caller
+static char* entry_path(cache_t c, hash128_t key, int shard) {
+    char hex[HASH128_HEX_LEN + 1];
+    hash128_hex(key, hex);
+
+    size_t n = strlen(c->dir) + HASH128_HEX_LEN + 3;
+    char* path = (char*)malloc(n);
+    if (!path) {
+        perror("Error with malloc");
+        return NULL;
+    }
+
+    if (shard) {
+        snprintf(path, n, "%s/%.2s", c->dir, hex);
+    } else {
+        snprintf(path, n, "%s/%.2s/%s", c->dir, hex, hex + 2);
+    }
+    return path;
+}
+
+static int write_all(int fd, const char* p, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+// ===================== STATISTICS =====================
+
+// Opens dir/stats and locks it, returns -1 on error
+static int stats_lock(cache_t c) {
+    size_t n = strlen(c->dir) + 7;
+    char* path = (char*)malloc(n);
+    if (!path) {
+        perror("Error with malloc");
+        return -1;
+    }
+    snprintf(path, n, "%s/stats", c->dir);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror(path);
+    } else if (flock(fd, LOCK_EX) < 0) {
+        perror(path);
+        close(fd);
+        fd = -1;
+    }
+
+    free(path);
+    return fd;
+}
+
+static void stats_read(int fd, cache_stats_t* stats) {
+    char text[128];
+    ssize_t n = pread(fd, text, sizeof(text) - 1, 0);
+    text[n > 0 ? n : 0] = '\0';
+
+    unsigned long long hits, misses, stores, size;
+    if (sscanf(text, "%llu %llu %llu %llu", &hits, &misses, &stores, &size) == 4) {
+        *stats = (cache_stats_t){hits, misses, stores, size};
+    } else {
+        *stats = (cache_stats_t){0};
+    }
+}
+
+static int stats_write(int fd, const cache_stats_t* stats) {
+    char text[128];
+    int n = snprintf(text, sizeof(text), "%llu %llu %llu %llu\n", (unsigned long long)stats->hits,
+                     (unsigned long long)stats->misses, (unsigned long long)stats->stores,
+                     (unsigned long long)stats->size);
+    return pwrite(fd, text, n, 0) == n && ftruncate(fd, n) == 0;
+}
+
+// ===================== EVICTION =====================
+
+typedef struct entry {
+    char* path;
+    struct timespec mtime;
+    uint64_t size;
+} entry_t;
+
+static int entry_cmp(const void* a, const void* b) {
+    const struct timespec* x = &((const entry_t*)a)->mtime;
+    const struct timespec* y = &((const entry_t*)b)->mtime;
+    if (x->tv_sec != y->tv_sec) {
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    }
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+// Appends the entries of one shard directory to *entries
+static int scan_shard(const char* shard, entry_t** entries, int* n, int* cap) {
+    DIR* d = opendir(shard);
+    if (!d) {
+        return errno == ENOENT;
+    }
+
+    size_t len = strlen(shard);
+    time_t now = time(NULL);
+    int ok = 1;
+    struct dirent* de;
+    while (ok && (de = readdir(d))) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+            continue;
+        }
+
+        char* path = (char*)malloc(len + strlen(de->d_name) + 2);
+        if (!path) {
+            perror("Error with malloc");
+            ok = 0;
+            break;
+        }
+        sprintf(path, "%s/%s", shard, de->d_name);
+
+        struct stat st;
+        if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+
+        // Temporary files of writers still at work are not entries yet
+        if (de->d_name[0] == '.') {
+            if (now - st.st_mtime > STALE_TMP_AGE) {
+                unlink(path);
+            }
+            free(path);
+            continue;
+        }
+
+        if (*n == *cap) {
+            int ncap = *cap ? 2 * *cap : 64;
+            entry_t* grown = (entry_t*)realloc(*entries, ncap * sizeof(entry_t));
+            if (!grown) {
+                perror("Error with realloc");
+                free(path);
+                ok = 0;
+                break;
+            }
+            *entries = grown;
+            *cap = ncap;
+        }
+        (*entries)[(*n)++] = (entry_t){path, st.st_mtim, (uint64_t)st.st_size};
+    }
+
+    closedir(d);
+    return ok;
+}
+
+// Removes the least recently used entries until the rest fit in
+// CACHE_EVICT_TO percent of the limit, and sets stats->size to what they
+// take. The entries are counted from the directories, which also
+// corrects the drift of concurrent stores of the same key.
+static int evict(cache_t c, cache_stats_t* stats) {
+    entry_t* entries = NULL;
+    int n = 0, cap = 0, ok = 1;
+
+    size_t len = strlen(c->dir) + 4;
+    char* shard = (char*)malloc(len);
+    if (!shard) {
+        perror("Error with malloc");
+        return 0;
+    }
+    for (int i = 0; ok && i < 256; i++) {
+        snprintf(shard, len, "%s/%02x", c->dir, i);
+        ok = scan_shard(shard, &entries, &n, &cap);
+    }
+    free(shard);
+
+    uint64_t size = 0;
+    for (int i = 0; i < n; i++) {
+        size += entries[i].size;
+    }
+
+    if (ok) {
+        qsort(entries, n, sizeof(entry_t), entry_cmp);
+        uint64_t target = c->max_size / 100 * CACHE_EVICT_TO;
+        for (int i = 0; i < n && size > target; i++) {
+            if (unlink(entries[i].path) == 0 || errno == ENOENT) {
+                size -= entries[i].size;
+            }
+        }
+        stats->size = size;
+    }
+
+    for (int i = 0; i < n; i++) {
+        free(entries[i].path);
+    }
+    free(entries);
+    return ok;
+}
+
+// Adds the pending counts to dir/stats, evicts if the entries got too
+// big, and stores the counters in *stats if it isn't NULL
+static int stats_flush(cache_t c, cache_stats_t* stats) {
+    int fd = stats_lock(c);
+    if (fd < 0) {
+        return 0;
+    }
+
+    cache_stats_t s;
+    stats_read(fd, &s);
+    s.hits += c->pending.hits;
+    s.misses += c->pending.misses;
+    s.stores += c->pending.stores;
+    s.size = (int64_t)s.size + c->pending_size > 0 ? s.size + c->pending_size : 0;
+
+    int ok = 1;
+    if (c->max_size && s.size > c->max_size) {
+        ok = evict(c, &s);
+    }
+    ok = stats_write(fd, &s) && ok;
+
+    // Closing releases the lock
+    close(fd);
+    c->pending = (cache_stats_t){0};
+    c->pending_size = 0;
+    c->known_size = s.size;
+    if (stats) {
+        *stats = s;
+    }
+    return ok;
+}
+
+// ===================== CACHE =====================
+
+// Opens the cache in dir, creating the directory if needed
+cache_t cache_open(const char* dir, uint64_t max_size) {
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror(dir);
+        return NULL;
+    }
+
+    cache_t c = (cache_t)malloc(sizeof(_cache));
+    if (!c) {
+        perror("Error with malloc");
+        return NULL;
+    }
+
+    c->dir = strdup(dir);
+    if (!c->dir) {
+        perror("Error with malloc");
+        free(c);
+        return NULL;
+    }
+    c->max_size = max_size;
+    c->pending = (cache_stats_t){0};
+    c->pending_size = 0;
+    c->known_size = 0;
+
+    return c;
+}
+
+// Returns the key of an output: the hash of the version of the compiler
+// that produced it, the options it was produced with and the source
+hash128_t cache_key(const char* version, const char* options, const void* src, size_t len) {
+    // Every part is hashed on its own, its length is part of its hash
+    hash128_t h = hash128(version, strlen(version), 0);
+    h = hash128_extend(h, options, strlen(options));
+    return hash128_extend(h, src, len);
+}
+
+// Copies the entry of key to fd, or appends it to out if fd is -1.
+// Returns 1 if there is one, 0 otherwise, -1 if it couldn't be copied.
+// Either way the outcome is counted.
+static int entry_get(cache_t c, hash128_t key, int fd, buf_t out) {
+    char* path = entry_path(c, key, 0);
+    if (!path) {
+        return -1;
+    }
+
+    int efd = open(path, O_RDONLY);
+    free(path);
+    if (efd < 0) {
+        c->pending.misses++;
+        return 0;
+    }
+
+    int ret = 1;
+    struct stat st;
+    if (fstat(efd, &st) < 0) {
+        ret = -1;
+    } else if (st.st_size > 0) {
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, efd, 0);
+        if (p == MAP_FAILED) {
+            ret = -1;
+        } else {
+            int ok = fd < 0 ? buf_put(out, (const char*)p, st.st_size) : write_all(fd, (const char*)p, st.st_size);
+            ret = ok ? 1 : -1;
+            munmap(p, st.st_size);
+        }
+    }
+
+    // The entry was just used, it's the last one to evict
+    if (ret == 1) {
+        futimens(efd, NULL);
+    } else {
+        perror("Error reading the cache");
+    }
+    close(efd);
+
+    c->pending.hits += ret == 1;
+    return ret;
+}
+
+// Writes the entry of key to fd and returns 1 if there is one, returns
+// 0 otherwise, -1 if it couldn't be written. Either way the outcome is
+// counted.
+int cache_get(cache_t c, hash128_t key, int fd) {
+    return entry_get(c, key, fd, NULL);
+}
+
+// Appends the entry of key to out, as cache_get does to a file
+int cache_read(cache_t c, hash128_t key, buf_t out) {
+    return entry_get(c, key, -1, out);
+}
+
+// Maps the entry of key in memory and returns it, with its length in
+// *lenp, NULL if there is none. Unlike cache_get it isn't counted, it's
+// for data the compiler keeps for itself rather than outputs.
+const void* cache_map(cache_t c, hash128_t key, size_t* lenp) {
+    char* path = entry_path(c, key, 0);
+    if (!path) {
+        return NULL;
+    }
+
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    // Empty entries have nothing to map
+    static const char empty[1];
+    const void* p = NULL;
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        p = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : empty;
+        if (p == MAP_FAILED) {
+            p = NULL;
+        } else {
+            *lenp = st.st_size;
+            futimens(fd, NULL);
+        }
+    }
+
+    close(fd);
+    return p;
+}
+
+// Unmaps an entry mapped with cache_map
+void cache_unmap(const void* p, size_t len) {
+    if (p && len) {
+        munmap((void*)p, len);
+    }
+}
+
+// Stores the len bytes at data as the entry of key, then evicts the
+// least recently used entries if the cache got too big
+int cache_put(cache_t c, hash128_t key, const void* data, size_t len) {
+    char* shard = entry_path(c, key, 1);
+    char* path = entry_path(c, key, 0);
+    char* tmp = shard ? (char*)malloc(strlen(shard) + 13) : NULL;
+    if (!shard || !path || !tmp) {
+        if (shard && path) {
+            perror("Error with malloc");
+        }
+        free(shard);
+        free(path);
+        free(tmp);
+        return 0;
+    }
+    sprintf(tmp, "%s/.tmp.XXXXXX", shard);
+
+    int ok = 1;
+    if (mkdir(shard, 0755) < 0 && errno != EEXIST) {
+        perror(shard);
+        ok = 0;
+    }
+
+    int fd = ok ? mkstemp(tmp) : -1;
+    if (ok && fd < 0) {
+        perror(tmp);
+        ok = 0;
+    }
+    if (ok) {
+        ok = write_all(fd, (const char*)data, len) && fchmod(fd, 0644) == 0;
+        ok = close(fd) == 0 && ok;
+        if (!ok) {
+            perror(tmp);
+        }
+    }
+
+    // The size of the entry replaced, if another process stored it first
+    struct stat st;
+    int64_t old = ok && stat(path, &st) == 0 ? st.st_size : 0;
+    if (ok && rename(tmp, path) < 0) {
+        perror(path);
+        ok = 0;
+    }
+    if (!ok && fd >= 0) {
+        unlink(tmp);
+    }
+
+    free(shard);
+    free(path);
+    free(tmp);
+    if (!ok) {
+        return 0;
+    }
+
+    // The entries are counted again by the next eviction, this only
+    // decides when it's due
+    c->pending.stores++;
+    c->pending_size += (int64_t)len - old;
+    int64_t size = (int64_t)c->known_size + c->pending_size;
+    return !c->max_size || size <= (int64_t)c->max_size || stats_flush(c, NULL);
+}
+
+// Reads the counters of the cache, those of this process included
+int cache_get_stats(cache_t c, cache_stats_t* stats) {
+    return stats_flush(c, stats);
+}
+
+// Adds the counts of this process to the counters and frees c
+void cache_free(cache_t* cp) {
+    if (!cp || !*cp) {
+        return;
+    }
+
+    cache_t c = *cp;
+    if (c->pending.hits || c->pending.misses || c->pending.stores) {
+        stats_flush(c, NULL);
+    }
+    free(c->dir);
+    free(c);
+
+    *cp = NULL;
+}
@@ -0,0 +1,83 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "buf.h"
+#include "hash.h"
+
+// A content-addressed cache of compiler outputs in a local directory,
+// shared by every process pointed at it. Entries are files named by the
+// hash of everything the output depends on, sharded in 256 directories
+// (dir/ab/cdef...). They are written to a temporary file and renamed
+// into place, so readers only ever see complete entries and concurrent
+// writers of the same key just replace each other's identical output.
+// The counters live in dir/stats. A process counts in memory and adds
+// its counts under an exclusive lock when it closes the cache, or once
+// its stores may have taken the entries over the size limit: then the
+// least recently used ones (by modification time, refreshed on every
+// hit) are removed.
+typedef struct cache _cache, *cache_t;
+
+typedef struct cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+
+    // Entries stored, and bytes they take
+    uint64_t stores;
+    uint64_t size;
+} cache_stats_t;
+
+struct cache {
+    char* dir;
+
+    // Bytes the entries may take, 0 for no limit
+    uint64_t max_size;
+
+    // The counts not yet added to dir/stats, with the bytes stored since
+    // (signed, in place of pending.size), and what the entries took then
+    cache_stats_t pending;
+    int64_t pending_size;
+    uint64_t known_size;
+};
+
+#define CACHE_DEFAULT_SIZE (64ull << 20)
+
+// Eviction removes entries until they take at most this percentage of
+// the limit, so that it doesn't run again on the next store
+#define CACHE_EVICT_TO 90
+
+// Opens the cache in dir, creating the directory if needed
+cache_t cache_open(const char* dir, uint64_t max_size);
+
+// Returns the key of an output: the hash of the version of the compiler
+// that produced it, the options it was produced with and the source
+hash128_t cache_key(const char* version, const char* options, const void* src, size_t len);
+
+// Writes the entry of key to fd and returns 1 if there is one, returns
+// 0 otherwise, -1 if it couldn't be written. Either way the outcome is
+// counted.
+int cache_get(cache_t c, hash128_t key, int fd);
+
+// Appends the entry of key to out, as cache_get does to a file
+int cache_read(cache_t c, hash128_t key, buf_t out);
+
+// Maps the entry of key in memory and returns it, with its length in
+// *lenp, NULL if there is none. Unlike cache_get it isn't counted, it's
+// for data the compiler keeps for itself rather than outputs.
+const void* cache_map(cache_t c, hash128_t key, size_t* lenp);
+
+// Unmaps an entry mapped with cache_map
+void cache_unmap(const void* p, size_t len);
+
+// Stores the len bytes at data as the entry of key, then evicts the
+// least recently used entries if the cache got too big
+int cache_put(cache_t c, hash128_t key, const void* data, size_t len);
+
+// Reads the counters of the cache, those of this process included
+int cache_get_stats(cache_t c, cache_stats_t* stats);
+
+// Adds the counts of this process to the counters and frees c
+void cache_free(cache_t* cp);
+
+#endif
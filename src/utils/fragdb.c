@@ -0,0 +1,139 @@
+#include "fragdb.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAGDB_MAGIC "DFDB"
+
+// Bytes of the header, and of each fragment before its data
+#define HEADER_SIZE 8
+#define RECORD_SIZE 20
+
+static int key_cmp(hash128_t a, hash128_t b) {
+    if (a.hi != b.hi) {
+        return a.hi < b.hi ? -1 : 1;
+    }
+    return (a.lo > b.lo) - (a.lo < b.lo);
+}
+
+static int fragment_cmp(const void* a, const void* b) {
+    return key_cmp(((const fragment_t*)a)->key, ((const fragment_t*)b)->key);
+}
+
+// Creates an empty database
+fragdb_t fragdb_new() {
+    fragdb_t db = (fragdb_t)malloc(sizeof(_fragdb));
+    if (!db) {
+        perror("Error with malloc");
+        return NULL;
+    }
+
+    db->items = NULL;
+    db->n = 0;
+    db->cap = 0;
+    db->base = NULL;
+
+    return db;
+}
+
+// Loads the serialized database of len bytes at data, which must stay
+// valid while it's in use. Returns 0 and leaves db empty if it isn't
+// one.
+int fragdb_load(fragdb_t db, const void* data, size_t len) {
+    const char* p = (const char*)data;
+    db->n = 0;
+    db->base = p;
+
+    uint32_t n;
+    if (len < HEADER_SIZE || memcmp(p, FRAGDB_MAGIC, 4)) {
+        return 0;
+    }
+    memcpy(&n, p + 4, 4);
+
+    size_t pos = HEADER_SIZE;
+    for (uint32_t i = 0; i < n; i++) {
+        fragment_t f;
+        if (len - pos < RECORD_SIZE) {
+            db->n = 0;
+            return 0;
+        }
+        memcpy(&f.key.lo, p + pos, 8);
+        memcpy(&f.key.hi, p + pos + 8, 8);
+        memcpy(&f.len, p + pos + 16, 4);
+        f.off = pos + RECORD_SIZE;
+
+        // Written sorted, anything else is corrupt
+        if (len - f.off < f.len || (db->n && key_cmp(db->items[db->n - 1].key, f.key) >= 0) ||
+            !fragdb_add(db, f.key, f.off, f.len)) {
+            db->n = 0;
+            return 0;
+        }
+        pos = f.off + f.len;
+    }
+
+    return 1;
+}
+
+// Returns the fragment of key, NULL if there is none
+const fragment_t* fragdb_find(fragdb_t db, hash128_t key) {
+    fragment_t f = {key, 0, 0};
+    return db->n ? (const fragment_t*)bsearch(&f, db->items, db->n, sizeof(fragment_t), fragment_cmp) : NULL;
+}
+
+// Adds the fragment of key at bytes [off, off + len) of the data
+int fragdb_add(fragdb_t db, hash128_t key, size_t off, size_t len) {
+    if (off > UINT32_MAX || len > UINT32_MAX - off) {
+        fprintf(stderr, "Error: fragment too big\n");
+        return 0;
+    }
+
+    if (db->n == db->cap) {
+        int ncap = db->cap ? 2 * db->cap : 16;
+        fragment_t* grown = (fragment_t*)realloc(db->items, ncap * sizeof(fragment_t));
+        if (!grown) {
+            perror("Error with realloc");
+            return 0;
+        }
+        db->items = grown;
+        db->cap = ncap;
+    }
+
+    db->items[db->n++] = (fragment_t){key, (uint32_t)off, (uint32_t)len};
+    return 1;
+}
+
+// Appends to b the database serialized, with the fragments read from
+// base. The fragments are sorted and duplicates removed first.
+int fragdb_save(fragdb_t db, const char* base, buf_t b) {
+    if (db->n) {
+        qsort(db->items, db->n, sizeof(fragment_t), fragment_cmp);
+    }
+    int n = 0;
+    for (int i = 0; i < db->n; i++) {
+        if (!n || key_cmp(db->items[n - 1].key, db->items[i].key)) {
+            db->items[n++] = db->items[i];
+        }
+    }
+    db->n = n;
+
+    uint32_t count = n;
+    int ok = buf_put(b, FRAGDB_MAGIC, 4) && buf_put(b, (const char*)&count, 4);
+    for (int i = 0; ok && i < n; i++) {
+        const fragment_t* f = &db->items[i];
+        ok = buf_put(b, (const char*)&f->key.lo, 8) && buf_put(b, (const char*)&f->key.hi, 8) &&
+             buf_put(b, (const char*)&f->len, 4) && buf_put(b, base + f->off, f->len);
+    }
+
+    return ok;
+}
+
+void fragdb_free(fragdb_t* dbp) {
+    if (!dbp || !*dbp) {
+        return;
+    }
+
+    free((*dbp)->items);
+    free(*dbp);
+
+    *dbp = NULL;
+}
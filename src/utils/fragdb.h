@@ -0,0 +1,52 @@
+#ifndef FRAGDB_H
+#define FRAGDB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "buf.h"
+#include "hash.h"
+
+// The output generated for each piece of a source file, by the hash of
+// the piece, so that the next compilation of the file only generates
+// the pieces that changed. Serialized as "DFDB", the number of
+// fragments, then each one's hash, length and bytes, sorted by hash.
+typedef struct fragment {
+    hash128_t key;
+
+    // Bytes [off, off + len) of the data the database refers to
+    uint32_t off;
+    uint32_t len;
+} fragment_t;
+
+typedef struct fragdb _fragdb, *fragdb_t;
+
+struct fragdb {
+    fragment_t* items;
+    int n;
+    int cap;
+
+    // The data of a loaded database, the offsets are relative to it
+    const char* base;
+};
+
+// Creates an empty database
+fragdb_t fragdb_new();
+
+// Loads the serialized database of len bytes at data, which must stay
+// valid while it's in use. Returns 0 and leaves db empty if it isn't
+// one.
+int fragdb_load(fragdb_t db, const void* data, size_t len);
+
+// Returns the fragment of key, NULL if there is none
+const fragment_t* fragdb_find(fragdb_t db, hash128_t key);
+
+// Adds the fragment of key at bytes [off, off + len) of the data
+int fragdb_add(fragdb_t db, hash128_t key, size_t off, size_t len);
+
+// Appends to b the database serialized, with the fragments read from
+// base. The fragments are sorted and duplicates removed first.
+int fragdb_save(fragdb_t db, const char* base, buf_t b);
+
+void fragdb_free(fragdb_t* dbp);
+
+#endif
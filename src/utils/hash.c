@@ -0,0 +1,101 @@
+#include "hash.h"
+#include <string.h>
+
+static uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t fmix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+// Hashes the len bytes at data (MurmurHash3, x64 128-bit variant),
+// seed chains it to other hashes
+hash128_t hash128(const void* data, size_t len, uint64_t seed) {
+    const uint8_t* p = (const uint8_t*)data;
+    const uint64_t c1 = 0x87c37b91114253d5ull;
+    const uint64_t c2 = 0x4cf5ad432745937full;
+    uint64_t h1 = seed, h2 = seed;
+
+    size_t nblocks = len / 16;
+    for (size_t i = 0; i < nblocks; i++) {
+        uint64_t k1, k2;
+        memcpy(&k1, p + 16 * i, 8);
+        memcpy(&k2, p + 16 * i + 8, 8);
+
+        k1 *= c1;
+        k1 = rotl(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+        h1 = rotl(h1, 27);
+        h1 += h2;
+        h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2;
+        k2 = rotl(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+        h2 = rotl(h2, 31);
+        h2 += h1;
+        h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    // The last 0-15 bytes, little-endian
+    const uint8_t* tail = p + 16 * nblocks;
+    uint64_t k1 = 0, k2 = 0;
+    for (size_t i = len & 15; i > 8; i--) {
+        k2 ^= (uint64_t)tail[i - 1] << (8 * (i - 9));
+    }
+    for (size_t i = (len & 15) < 8 ? len & 15 : 8; i > 0; i--) {
+        k1 ^= (uint64_t)tail[i - 1] << (8 * (i - 1));
+    }
+    if (len & 15) {
+        k2 *= c2;
+        k2 = rotl(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+        k1 *= c1;
+        k1 = rotl(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+    }
+
+    h1 ^= (uint64_t)len;
+    h2 ^= (uint64_t)len;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix(h1);
+    h2 = fmix(h2);
+    h1 += h2;
+    h2 += h1;
+
+    return (hash128_t){h1, h2};
+}
+
+// Derives a new hash from h and the len bytes at data, by hashing them
+// with h as the seed. It chains keys and differs from hashing the bytes
+// of h followed by data in one go: not a streaming hash.
+hash128_t hash128_extend(hash128_t h, const void* data, size_t len) {
+    hash128_t next = hash128(data, len, h.lo);
+    next.hi ^= rotl(h.hi, 17);
+    return next;
+}
+
+int hash128_equal(hash128_t a, hash128_t b) {
+    return a.lo == b.lo && a.hi == b.hi;
+}
+
+// Formats h as 32 lowercase hex digits and a terminator at p
+void hash128_hex(hash128_t h, char* p) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < 16; i++) {
+        p[i] = digits[(h.hi >> (60 - 4 * i)) & 15];
+        p[16 + i] = digits[(h.lo >> (60 - 4 * i)) & 15];
+    }
+    p[HASH128_HEX_LEN] = '\0';
+}
@@ -0,0 +1,30 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A 128-bit content hash, for keys that must not collide in practice
+// (cache entries), not for hash tables
+typedef struct hash128 {
+    uint64_t lo;
+    uint64_t hi;
+} hash128_t;
+
+#define HASH128_HEX_LEN 32
+
+// Hashes the len bytes at data (MurmurHash3, x64 128-bit variant),
+// seed chains it to other hashes
+hash128_t hash128(const void* data, size_t len, uint64_t seed);
+
+// Derives a new hash from h and the len bytes at data, by hashing them
+// with h as the seed. It chains keys and differs from hashing the bytes
+// of h followed by data in one go: not a streaming hash.
+hash128_t hash128_extend(hash128_t h, const void* data, size_t len);
+
+int hash128_equal(hash128_t a, hash128_t b);
+
+// Formats h as 32 lowercase hex digits and a terminator at p
+void hash128_hex(hash128_t h, char* p);
+
+#endif
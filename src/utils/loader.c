@@ -0,0 +1,575 @@
+#define _GNU_SOURCE
+#include "loader.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Entries of the submission queue, the completion queue has twice as
+// many. Each file has one operation in flight at a time.
+#define URING_ENTRIES 256
+
+// ===================== IO_URING =====================
+
+// A ring shared with the kernel: submission queue entries are filled in
+// and their indices published at the tail of the submission queue, the
+// kernel publishes completions at the tail of the completion queue
+typedef struct uring {
+    int fd;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe* sqes;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+
+    // The tail not yet published, entries not yet submitted, operations
+    // not yet completed
+    unsigned tail;
+    unsigned to_submit;
+    unsigned inflight;
+} uring_t;
+
+// The operations a file goes through, in order, in the low bits of the
+// user data
+enum { OP_OPEN, OP_STATX, OP_READ, OP_CLOSE, OP_BITS = 2 };
+
+static void uring_free(uring_t* u) {
+    if (u->sqes) {
+        munmap(u->sqes, u->sqes_size);
+    }
+    if (u->cq_ptr && u->cq_ptr != u->sq_ptr) {
+        munmap(u->cq_ptr, u->cq_size);
+    }
+    if (u->sq_ptr) {
+        munmap(u->sq_ptr, u->sq_size);
+    }
+    if (u->fd >= 0) {
+        close(u->fd);
+    }
+    memset(u, 0, sizeof(uring_t));
+    u->fd = -1;
+}
+
+// Whether the kernel knows the operations a file goes through
+static int uring_supports(uring_t* u) {
+    static const int ops[] = {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE};
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = (struct io_uring_probe*)calloc(1, size);
+    if (!probe) {
+        return 0;
+    }
+
+    int ok = syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (size_t i = 0; ok && i < sizeof(ops) / sizeof(*ops); i++) {
+        ok = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+// Sets up a ring, returns 0 if io_uring isn't there
+static int uring_init(uring_t* u) {
+    memset(u, 0, sizeof(uring_t));
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    u->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (u->fd < 0) {
+        return 0;
+    }
+
+    // Both queues may live in one mapping
+    u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        u->sq_size = u->cq_size = u->sq_size > u->cq_size ? u->sq_size : u->cq_size;
+    }
+
+    u->sq_ptr = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED) {
+        u->sq_ptr = NULL;
+        uring_free(u);
+        return 0;
+    }
+    u->cq_ptr = single ? u->sq_ptr
+                       : mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+                              IORING_OFF_CQ_RING);
+    if (u->cq_ptr == MAP_FAILED) {
+        u->cq_ptr = NULL;
+        uring_free(u);
+        return 0;
+    }
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe*)mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+                                         IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        uring_free(u);
+        return 0;
+    }
+
+    char* sq = (char*)u->sq_ptr;
+    char* cq = (char*)u->cq_ptr;
+    u->sq_head = (unsigned*)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned*)(sq + p.sq_off.array);
+    u->sq_entries = p.sq_entries;
+    u->cq_head = (unsigned*)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    u->tail = *u->sq_tail;
+
+    if (!uring_supports(u)) {
+        uring_free(u);
+        return 0;
+    }
+    return 1;
+}
+
+// Publishes the entries filled in, submits them and waits for wait
+// completions. Returns 0 on error.
+static int uring_submit(uring_t* u, unsigned wait, int* submissions) {
+    __atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE);
+    for (;;) {
+        int r = (int)syscall(__NR_io_uring_enter, u->fd, u->to_submit, wait, wait ? IORING_ENTER_GETEVENTS : 0,
+                             NULL, 0);
+        if (r >= 0) {
+            u->to_submit -= (unsigned)r;
+            (*submissions)++;
+            return 1;
+        }
+        if (errno != EINTR) {
+            perror("Error with io_uring_enter");
+            return 0;
+        }
+    }
+}
+
+// Returns a cleared submission queue entry, submitting those filled in
+// if the queue is full, NULL on error
+static struct io_uring_sqe* uring_sqe(uring_t* u, int* submissions) {
+    if (u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries &&
+        (!uring_submit(u, 0, submissions) || u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)) {
+        return NULL;
+    }
+
+    unsigned i = u->tail & *u->sq_mask;
+    struct io_uring_sqe* sqe = &u->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[i] = i;
+    u->tail++;
+    u->to_submit++;
+    u->inflight++;
+    return sqe;
+}
+
+// ===================== LOADER =====================
+
+// A file on its way
+typedef struct job {
+    int fd;
+    int error;
+
+    struct statx stx;
+    char* data;
+    size_t len;
+    size_t done;
+} job_t;
+
+struct loader {
+    const char* const* paths;
+    int n;
+
+    // The files started, and those loaded but not yet taken, from head
+    // to tail
+    int next;
+    loaded_t* ready;
+    int head;
+    int tail;
+    int delivered;
+
+    // Files started and not finished, their descriptor included
+    int active;
+
+    int use_uring;
+    uring_t ring;
+    job_t* jobs;
+
+    // The pool, the lock guards the fields above
+    pthread_t threads[LOADER_THREADS];
+    int nthreads;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    loader_stats_t stats;
+};
+
+static void push_ready(loader_t l, int i, char* data, size_t len, int error) {
+    l->ready[l->tail++] = (loaded_t){i, data, len, error};
+}
+
+// Queues an operation of file i, returns 0 on error
+static int queue_op(loader_t l, int i, int op) {
+    struct io_uring_sqe* sqe = uring_sqe(&l->ring, &l->stats.submissions);
+    if (!sqe) {
+        return 0;
+    }
+
+    job_t* j = &l->jobs[i];
+    sqe->user_data = (uint64_t)i << OP_BITS | op;
+    switch (op) {
+        case OP_OPEN:
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t)l->paths[i];
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            break;
+        case OP_STATX:
+            // Of the file opened, the path may have been replaced since
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = j->fd;
+            sqe->addr = (uintptr_t)"";
+            sqe->statx_flags = AT_EMPTY_PATH;
+            sqe->len = STATX_TYPE | STATX_SIZE;
+            sqe->off = (uintptr_t)&j->stx;
+            break;
+        case OP_READ:
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = j->fd;
+            sqe->addr = (uintptr_t)(j->data + j->done);
+            sqe->len = (unsigned)(j->len - j->done < (1u << 30) ? j->len - j->done : (1u << 30));
+            sqe->off = j->done;
+            break;
+        default:
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = j->fd;
+            j->fd = -1;
+            break;
+    }
+    return 1;
+}
+
+// Hands file i over, read or failed, and closes it. When stopping, the
+// file may not have a buffer yet.
+static int finish_job(loader_t l, int i) {
+    job_t* j = &l->jobs[i];
+    if (j->error) {
+        free(j->data);
+        j->data = NULL;
+        j->done = 0;
+    } else if (j->data) {
+        j->data[j->done] = '\0';
+    }
+    if (!l->stop) {
+        push_ready(l, i, j->data, j->done, j->error);
+        j->data = NULL;
+    }
+
+    if (j->fd < 0) {
+        l->active--;
+        return 1;
+    }
+    if (l->stop) {
+        close(j->fd);
+        j->fd = -1;
+        l->active--;
+        return 1;
+    }
+    return queue_op(l, i, OP_CLOSE);
+}
+
+// Reads file i once it's opened and its size known
+static int opened(loader_t l, int i) {
+    job_t* j = &l->jobs[i];
+    if (!j->error && !S_ISREG(j->stx.stx_mode)) {
+        j->error = S_ISDIR(j->stx.stx_mode) ? EISDIR : EINVAL;
+    }
+    if (j->error || l->stop) {
+        return finish_job(l, i);
+    }
+
+    j->len = (size_t)j->stx.stx_size;
+    j->data = (char*)malloc(j->len + 1);
+    if (!j->data) {
+        perror("Error with malloc");
+        j->error = ENOMEM;
+    }
+    return j->error || !j->len ? finish_job(l, i) : queue_op(l, i, OP_READ);
+}
+
+// Takes in the completions the kernel published
+static int reap(loader_t l) {
+    uring_t* u = &l->ring;
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    int ok = 1;
+
+    for (; ok && head != tail; head++) {
+        struct io_uring_cqe* cqe = &u->cqes[head & *u->cq_mask];
+        int i = (int)(cqe->user_data >> OP_BITS);
+        int op = (int)(cqe->user_data & ((1 << OP_BITS) - 1));
+        int res = cqe->res;
+        job_t* j = &l->jobs[i];
+        u->inflight--;
+
+        switch (op) {
+            case OP_OPEN:
+                // The statx needs the descriptor, it can't be linked to
+                // the open and follows its completion instead
+                if (res < 0) {
+                    j->error = -res;
+                } else {
+                    j->fd = res;
+                }
+                ok = j->error || l->stop ? finish_job(l, i) : queue_op(l, i, OP_STATX);
+                break;
+            case OP_STATX:
+                if (res < 0) {
+                    j->error = -res;
+                }
+                ok = opened(l, i);
+                break;
+            case OP_READ:
+                if (res == -EINTR || res == -EAGAIN) {
+                    ok = queue_op(l, i, OP_READ);
+                } else if (res < 0) {
+                    j->error = -res;
+                    ok = finish_job(l, i);
+                } else {
+                    // A file that shrank ends early
+                    j->done += (size_t)res;
+                    ok = res && j->done < j->len && !l->stop ? queue_op(l, i, OP_READ) : finish_job(l, i);
+                }
+                break;
+            default:
+                l->active--;
+                break;
+        }
+    }
+
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    return ok;
+}
+
+// Starts the files there is room for, submits what's queued and takes
+// in what completed
+static int uring_step(loader_t l) {
+    uring_t* u = &l->ring;
+    int ok = 1;
+    while (ok && l->next < l->n && l->active < LOADER_MAX_ACTIVE && l->tail - l->head < LOADER_MAX_ACTIVE) {
+        int i = l->next++;
+        l->jobs[i] = (job_t){-1, 0, {0}, NULL, 0, 0};
+        l->active++;
+        ok = queue_op(l, i, OP_OPEN);
+    }
+
+    if (ok && !u->inflight) {
+        fprintf(stderr, "Error: the loader has nothing to wait for\n");
+        return 0;
+    }
+    return ok && uring_submit(u, 1, &l->stats.submissions) && reap(l);
+}
+
+// Reads the file at path whole with pread
+static loaded_t load_file(const char* path, int i) {
+    loaded_t f = {i, NULL, 0, 0};
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        f.error = errno;
+    } else if (!S_ISREG(st.st_mode)) {
+        f.error = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+    } else if (!(f.data = (char*)malloc(st.st_size + 1))) {
+        f.error = ENOMEM;
+    }
+
+    // A file that shrank ends early
+    while (!f.error && f.len < (size_t)st.st_size) {
+        ssize_t r = pread(fd, f.data + f.len, st.st_size - f.len, f.len);
+        if (r < 0 && errno != EINTR) {
+            f.error = errno;
+        } else if (r == 0) {
+            break;
+        } else if (r > 0) {
+            f.len += (size_t)r;
+        }
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (f.error) {
+        free(f.data);
+        f.data = NULL;
+        f.len = 0;
+    } else {
+        f.data[f.len] = '\0';
+    }
+    return f;
+}
+
+// A thread of the pool: loads the next file not started while there's
+// room for it
+static void* pool_thread(void* arg) {
+    loader_t l = (loader_t)arg;
+    pthread_mutex_lock(&l->lock);
+    for (;;) {
+        while (!l->stop && l->next < l->n && l->tail - l->head + l->active >= LOADER_MAX_ACTIVE) {
+            pthread_cond_wait(&l->changed, &l->lock);
+        }
+        if (l->stop || l->next >= l->n) {
+            break;
+        }
+        int i = l->next++;
+        l->active++;
+        pthread_mutex_unlock(&l->lock);
+
+        loaded_t f = load_file(l->paths[i], i);
+
+        pthread_mutex_lock(&l->lock);
+        l->active--;
+        l->ready[l->tail++] = f;
+        pthread_cond_broadcast(&l->changed);
+    }
+    pthread_mutex_unlock(&l->lock);
+    return NULL;
+}
+
+// Starts loading the n files at paths, which must outlive the loader
+loader_t loader_new(const char* const* paths, int n, int flags) {
+    loader_t l = (loader_t)calloc(1, sizeof(_loader));
+    if (!l) {
+        perror("Error with malloc");
+        return NULL;
+    }
+
+    l->paths = paths;
+    l->n = n;
+    l->ready = (loaded_t*)malloc((n ? n : 1) * sizeof(loaded_t));
+    if (!l->ready) {
+        perror("Error with malloc");
+        free(l);
+        return NULL;
+    }
+    pthread_mutex_init(&l->lock, NULL);
+    pthread_cond_init(&l->changed, NULL);
+
+    l->use_uring = !(flags & LOADER_POOL) && uring_init(&l->ring);
+    l->stats.uring = l->use_uring;
+    if (l->use_uring) {
+        l->jobs = (job_t*)malloc((n ? n : 1) * sizeof(job_t));
+        if (!l->jobs) {
+            perror("Error with malloc");
+            loader_free(&l);
+        }
+        return l;
+    }
+
+    l->ring.fd = -1;
+    int nthreads = n < LOADER_THREADS ? n : LOADER_THREADS;
+    for (; l->nthreads < nthreads; l->nthreads++) {
+        int err = pthread_create(&l->threads[l->nthreads], NULL, pool_thread, l);
+        if (err) {
+            fprintf(stderr, "Error: can't start a loader thread: %s\n", strerror(err));
+            break;
+        }
+    }
+    if (nthreads && !l->nthreads) {
+        loader_free(&l);
+    }
+    return l;
+}
+
+// Waits for the next file to be loaded and stores it in *f. Returns 1 if
+// there was one, 0 once all were handed over, -1 on an error of the
+// loader itself, reported on stderr.
+int loader_next(loader_t l, loaded_t* f) {
+    if (l->use_uring) {
+        while (l->head == l->tail && l->delivered < l->n) {
+            if (!uring_step(l)) {
+                return -1;
+            }
+        }
+    } else {
+        pthread_mutex_lock(&l->lock);
+        while (l->head == l->tail && l->delivered < l->n) {
+            pthread_cond_wait(&l->changed, &l->lock);
+        }
+    }
+
+    int ret = l->head < l->tail;
+    if (ret) {
+        *f = l->ready[l->head++];
+        l->delivered++;
+    }
+
+    if (!l->use_uring) {
+        pthread_cond_broadcast(&l->changed);
+        pthread_mutex_unlock(&l->lock);
+    }
+    return ret;
+}
+
+loader_stats_t loader_get_stats(loader_t l) {
+    return l->stats;
+}
+
+// Stops loading and frees the loader, and the files not handed over
+void loader_free(loader_t* lp) {
+    loader_t l = *lp;
+    if (!l) {
+        return;
+    }
+
+    pthread_mutex_lock(&l->lock);
+    l->stop = 1;
+    pthread_cond_broadcast(&l->changed);
+    pthread_mutex_unlock(&l->lock);
+    for (int i = 0; i < l->nthreads; i++) {
+        pthread_join(l->threads[i], NULL);
+    }
+
+    // The kernel may still write into the buffers of the files in flight
+    if (l->use_uring && l->jobs) {
+        while (l->ring.inflight && uring_submit(&l->ring, 1, &l->stats.submissions) && reap(l)) {
+        }
+        for (int i = 0; i < l->next; i++) {
+            free(l->jobs[i].data);
+        }
+    }
+    uring_free(&l->ring);
+
+    for (; l->head < l->tail; l->head++) {
+        free(l->ready[l->head].data);
+    }
+    pthread_mutex_destroy(&l->lock);
+    pthread_cond_destroy(&l->changed);
+    free(l->jobs);
+    free(l->ready);
+    free(l);
+    *lp = NULL;
+}
@@ -0,0 +1,58 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stddef.h>
+
+// Loads the contents of many files at once, handing each over as soon
+// as it's read, in whatever order that is. With io_uring the open, statx,
+// read and close of every file are queued in a ring shared with the
+// kernel and submitted in batches, a system call for many files. Where
+// io_uring isn't available (an old kernel, a sandbox that forbids it) a
+// pool of threads opens and preads the files instead.
+typedef struct loader _loader, *loader_t;
+
+// Files being loaded and not yet taken at most, which bounds the memory
+// and the file descriptors in use
+#define LOADER_MAX_ACTIVE 64
+
+// Threads of the pool
+#define LOADER_THREADS 4
+
+// Flags of loader_new
+#define LOADER_POOL 1  // don't try io_uring
+
+// A file loaded
+typedef struct loaded {
+    // Its position in the paths given
+    int index;
+
+    // Its contents, terminated by a NUL past len, to free by the caller.
+    // NULL if it couldn't be read.
+    char* data;
+    size_t len;
+
+    // The errno of what failed, 0 if it was read
+    int error;
+} loaded_t;
+
+// How a loader went about it
+typedef struct loader_stats {
+    // Whether it used io_uring, and the io_uring_enter calls it made
+    int uring;
+    int submissions;
+} loader_stats_t;
+
+// Starts loading the n files at paths, which must outlive the loader
+loader_t loader_new(const char* const* paths, int n, int flags);
+
+// Waits for the next file to be loaded and stores it in *f. Returns 1 if
+// there was one, 0 once all were handed over, -1 on an error of the
+// loader itself, reported on stderr.
+int loader_next(loader_t l, loaded_t* f);
+
+loader_stats_t loader_get_stats(loader_t l);
+
+// Stops loading and frees the loader, and the files not handed over
+void loader_free(loader_t* lp);
+
+#endif
@@ -0,0 +1,164 @@
+#include "memstore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// An entry, in the chain of its bucket and in the list of entries from
+// the most to the least recently used
+typedef struct entry {
+    hash128_t key;
+    char* data;
+    size_t len;
+    time_t used;
+
+    struct entry* next;
+    struct entry* newer;
+    struct entry* older;
+} entry_t;
+
+struct memstore {
+    entry_t* buckets[MEMSTORE_BUCKETS];
+
+    // The most and least recently used entries
+    entry_t* newest;
+    entry_t* oldest;
+
+    size_t size;
+    size_t max_size;
+    int n;
+};
+
+// ===================== ENTRIES =====================
+
+static entry_t** find(memstore_t m, hash128_t key) {
+    entry_t** ep = &m->buckets[key.lo & (MEMSTORE_BUCKETS - 1)];
+    while (*ep && !hash128_equal((*ep)->key, key)) {
+        ep = &(*ep)->next;
+    }
+    return ep;
+}
+
+static void unlink_entry(memstore_t m, entry_t* e) {
+    *(e->newer ? &e->newer->older : &m->newest) = e->older;
+    *(e->older ? &e->older->newer : &m->oldest) = e->newer;
+    e->newer = e->older = NULL;
+}
+
+// Makes e the most recently used entry
+static void touch(memstore_t m, entry_t* e) {
+    if (m->newest != e) {
+        if (e->newer || e->older || m->oldest == e) {
+            unlink_entry(m, e);
+        }
+        e->older = m->newest;
+        *(m->newest ? &m->newest->newer : &m->oldest) = e;
+        m->newest = e;
+    }
+    e->used = time(NULL);
+}
+
+static void remove_entry(memstore_t m, entry_t* e) {
+    entry_t** ep = find(m, e->key);
+    *ep = e->next;
+    unlink_entry(m, e);
+    m->size -= e->len;
+    m->n--;
+    free(e->data);
+    free(e);
+}
+
+// ===================== STORE =====================
+
+// Creates a store of at most max_size bytes of entries
+memstore_t memstore_new(size_t max_size) {
+    memstore_t m = (memstore_t)calloc(1, sizeof(_memstore));
+    if (!m) {
+        perror("Error with malloc");
+        return NULL;
+    }
+    m->max_size = max_size;
+    return m;
+}
+
+// Returns the entry of key, with its length in *lenp, NULL if there is
+// none. It stays valid until the next store or removal.
+const void* memstore_get(memstore_t m, hash128_t key, size_t* lenp) {
+    entry_t* e = *find(m, key);
+    if (!e) {
+        return NULL;
+    }
+    touch(m, e);
+    *lenp = e->len;
+    return e->data;
+}
+
+// Stores a copy of the len bytes at data as the entry of key, then
+// removes the least recently used entries if the store got too big
+int memstore_put(memstore_t m, hash128_t key, const void* data, size_t len) {
+    // What can't fit isn't kept, rather than emptying the store for it
+    if (len > m->max_size) {
+        return 0;
+    }
+
+    char* copy = (char*)malloc(len ? len : 1);
+    if (!copy) {
+        perror("Error with malloc");
+        return 0;
+    }
+    memcpy(copy, data, len);
+
+    entry_t* e = *find(m, key);
+    if (e) {
+        m->size -= e->len;
+        free(e->data);
+    } else {
+        e = (entry_t*)calloc(1, sizeof(entry_t));
+        if (!e) {
+            perror("Error with malloc");
+            free(copy);
+            return 0;
+        }
+        e->key = key;
+        entry_t** bucket = &m->buckets[key.lo & (MEMSTORE_BUCKETS - 1)];
+        e->next = *bucket;
+        *bucket = e;
+        m->n++;
+    }
+    e->data = copy;
+    e->len = len;
+    m->size += len;
+    touch(m, e);
+
+    while (m->size > m->max_size && m->oldest != e) {
+        remove_entry(m, m->oldest);
+    }
+    return 1;
+}
+
+// Removes the entries last used before t
+void memstore_expire(memstore_t m, time_t t) {
+    while (m->oldest && m->oldest->used < t) {
+        remove_entry(m, m->oldest);
+    }
+}
+
+// Returns the bytes the entries take, and their number in *np
+size_t memstore_size(memstore_t m, int* np) {
+    if (np) {
+        *np = m->n;
+    }
+    return m->size;
+}
+
+void memstore_free(memstore_t* mp) {
+    if (!mp || !*mp) {
+        return;
+    }
+
+    memstore_t m = *mp;
+    while (m->oldest) {
+        remove_entry(m, m->oldest);
+    }
+    free(m);
+    *mp = NULL;
+}
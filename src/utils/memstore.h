@@ -0,0 +1,34 @@
+#ifndef MEMSTORE_H
+#define MEMSTORE_H
+
+#include <stddef.h>
+#include <time.h>
+#include "hash.h"
+
+// Outputs and other data a long-lived compiler keeps in memory between
+// compilations, by the same keys as the cache. Once the entries take
+// more than the size limit, the least recently used ones are removed.
+typedef struct memstore _memstore, *memstore_t;
+
+#define MEMSTORE_BUCKETS 4096
+
+// Creates a store of at most max_size bytes of entries
+memstore_t memstore_new(size_t max_size);
+
+// Returns the entry of key, with its length in *lenp, NULL if there is
+// none. It stays valid until the next store or removal.
+const void* memstore_get(memstore_t m, hash128_t key, size_t* lenp);
+
+// Stores a copy of the len bytes at data as the entry of key, then
+// removes the least recently used entries if the store got too big
+int memstore_put(memstore_t m, hash128_t key, const void* data, size_t len);
+
+// Removes the entries last used before t
+void memstore_expire(memstore_t m, time_t t);
+
+// Returns the bytes the entries take, and their number in *np
+size_t memstore_size(memstore_t m, int* np);
+
+void memstore_free(memstore_t* mp);
+
+#endif
@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+#include "reader.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// A block and what the reader put in it
+typedef struct block {
+    char* data;
+    size_t len;
+
+    // Set by the reader when it's filled, cleared by the consumer when
+    // it gives it back
+    int full;
+} block_t;
+
+struct reader {
+    int fd;
+    size_t block_size;
+    block_t blocks[2];
+
+    // The block the consumer has, -1 if none
+    int held;
+
+    // The block the consumer takes next
+    int next;
+
+    // Set by the reader at the end of the input or on an error, by the
+    // consumer to stop it
+    int eof;
+    int error;
+    int stop;
+
+    // Written to by the consumer to wake a reader waiting for input
+    int wake[2];
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+// The reader thread: fills the blocks in turns, waiting for the consumer
+// to give each back before filling it again
+static void* read_blocks(void* arg) {
+    reader_t r = (reader_t)arg;
+    int i = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&r->lock);
+        while (r->blocks[i].full && !r->stop) {
+            pthread_cond_wait(&r->changed, &r->lock);
+        }
+        int stop = r->stop;
+        pthread_mutex_unlock(&r->lock);
+        if (stop) {
+            return NULL;
+        }
+
+        // Waits for input or to be stopped, a pipe may stay open without
+        // ever being written to
+        struct pollfd fds[2] = {{r->fd, POLLIN, 0}, {r->wake[0], POLLIN, 0}};
+        int ready;
+        do {
+            ready = poll(fds, 2, -1);
+        } while (ready < 0 && errno == EINTR);
+        if (ready > 0 && fds[1].revents) {
+            return NULL;
+        }
+
+        // The block is the reader's until it's marked full
+        ssize_t n = -1;
+        if (ready > 0) {
+            do {
+                n = read(r->fd, r->blocks[i].data, r->block_size);
+            } while (n < 0 && errno == EINTR);
+        }
+        if (n < 0) {
+            perror("Error reading input");
+        }
+
+        pthread_mutex_lock(&r->lock);
+        if (n > 0) {
+            r->blocks[i].len = (size_t)n;
+            r->blocks[i].full = 1;
+        } else {
+            r->eof = 1;
+            r->error = n < 0;
+        }
+        pthread_cond_broadcast(&r->changed);
+        pthread_mutex_unlock(&r->lock);
+
+        if (n <= 0) {
+            return NULL;
+        }
+        i ^= 1;
+    }
+}
+
+// Starts reading fd, which stays open, in blocks of up to block_size
+// bytes
+reader_t reader_new(int fd, size_t block_size) {
+    reader_t r = (reader_t)calloc(1, sizeof(_reader));
+    if (!r) {
+        perror("Error with malloc");
+        return NULL;
+    }
+
+    r->fd = fd;
+    r->block_size = block_size;
+    r->held = -1;
+    r->blocks[0].data = (char*)malloc(block_size);
+    r->blocks[1].data = (char*)malloc(block_size);
+    if (!r->blocks[0].data || !r->blocks[1].data) {
+        perror("Error with malloc");
+        free(r->blocks[0].data);
+        free(r->blocks[1].data);
+        free(r);
+        return NULL;
+    }
+    if (pipe2(r->wake, O_CLOEXEC) < 0) {
+        perror("Error with pipe");
+        free(r->blocks[0].data);
+        free(r->blocks[1].data);
+        free(r);
+        return NULL;
+    }
+
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->changed, NULL);
+    int err = pthread_create(&r->thread, NULL, read_blocks, r);
+    if (err) {
+        fprintf(stderr, "Error: can't start the reader thread: %s\n", strerror(err));
+        pthread_mutex_destroy(&r->lock);
+        pthread_cond_destroy(&r->changed);
+        close(r->wake[0]);
+        close(r->wake[1]);
+        free(r->blocks[0].data);
+        free(r->blocks[1].data);
+        free(r);
+        return NULL;
+    }
+
+    return r;
+}
+
+// Gives back the block returned last and returns the next one, with
+// its length in *lenp. A block holds what one read() returned. Returns
+// NULL with *lenp set to 0 at the end of the input, and NULL with
+// *lenp set to 1 on a read error, reported on stderr.
+const char* reader_next(reader_t r, size_t* lenp) {
+    pthread_mutex_lock(&r->lock);
+    if (r->held >= 0) {
+        r->blocks[r->held].full = 0;
+        r->held = -1;
+        pthread_cond_broadcast(&r->changed);
+    }
+
+    block_t* b = &r->blocks[r->next];
+    while (!b->full && !r->eof) {
+        pthread_cond_wait(&r->changed, &r->lock);
+    }
+
+    // Blocks filled before the end of the input come first
+    const char* data = NULL;
+    *lenp = r->error;
+    if (b->full) {
+        data = b->data;
+        *lenp = b->len;
+        r->held = r->next;
+        r->next ^= 1;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return data;
+}
+
+// Stops the reader, which may be anywhere in the input or waiting for
+// more of it, and frees it
+void reader_free(reader_t* rp) {
+    reader_t r = *rp;
+    if (!r) {
+        return;
+    }
+
+    // A reader waiting for a block to be given back is woken by the
+    // condition, one waiting for input by the pipe
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_broadcast(&r->changed);
+    pthread_mutex_unlock(&r->lock);
+    ssize_t n;
+    do {
+        n = write(r->wake[1], "", 1);
+    } while (n < 0 && errno == EINTR);
+    pthread_join(r->thread, NULL);
+
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->changed);
+    close(r->wake[0]);
+    close(r->wake[1]);
+    free(r->blocks[0].data);
+    free(r->blocks[1].data);
+    free(r);
+    *rp = NULL;
+}
@@ -0,0 +1,28 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stddef.h>
+
+// Reads a file descriptor (a file, a pipe, stdin) on a thread of its
+// own, into two blocks taken in turns: while the consumer works on one
+// block the thread fills the other, so reading overlaps the work.
+typedef struct reader _reader, *reader_t;
+
+// Default size of each of the two blocks
+#define READER_BLOCK_SIZE (64 * 1024)
+
+// Starts reading fd, which stays open, in blocks of up to block_size
+// bytes
+reader_t reader_new(int fd, size_t block_size);
+
+// Gives back the block returned last and returns the next one, with
+// its length in *lenp. A block holds what one read() returned. Returns
+// NULL with *lenp set to 0 at the end of the input, and NULL with
+// *lenp set to 1 on a read error, reported on stderr.
+const char* reader_next(reader_t r, size_t* lenp);
+
+// Stops the reader, which may be anywhere in the input or waiting for
+// more of it, and frees it
+void reader_free(reader_t* rp);
+
+#endif
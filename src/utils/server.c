@@ -0,0 +1,344 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "buf.h"
+
+// What comes first, with the descriptors: the magic and the length of
+// the payload. The payload is the number of environment variables and
+// arguments, then the working directory, the variables and the
+// arguments, each terminated by a NUL.
+#define REQUEST_MAGIC "DSRQ"
+
+typedef struct header {
+    char magic[4];
+    uint32_t len;
+} header_t;
+
+// Seconds a client may take to send its request
+#define REQUEST_TIMEOUT 5
+
+extern char** environ;
+
+// ===================== SOCKETS =====================
+
+// Writes the path of the socket to p: $DISA_SERVER if set, or disa.sock
+// in $XDG_RUNTIME_DIR, or /tmp/disa-<uid>.sock
+void server_default_path(char* p, size_t n) {
+    const char* env = getenv("DISA_SERVER");
+    const char* run = getenv("XDG_RUNTIME_DIR");
+    if (env && *env) {
+        snprintf(p, n, "%s", env);
+    } else if (run && *run) {
+        snprintf(p, n, "%s/disa.sock", run);
+    } else {
+        snprintf(p, n, "/tmp/disa-%u.sock", (unsigned)getuid());
+    }
+}
+
+// Fills in the address of path, returns 0 if it's too long
+static int address(const char* path, struct sockaddr_un* a) {
+    memset(a, 0, sizeof(*a));
+    a->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(a->sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", path);
+        return 0;
+    }
+    strcpy(a->sun_path, path);
+    return 1;
+}
+
+// Connects to the socket at path, returns -1 if no one listens there
+static int connect_to(const char* path) {
+    struct sockaddr_un a;
+    if (!address(path, &a)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr*)&a, sizeof(a)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int write_all(int fd, const char* p, size_t len) {
+    while (len) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static int read_all(int fd, char* p, size_t len) {
+    while (len) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+// Listens on the socket at path, replacing one no server listens on.
+// Returns the socket, -1 on error.
+int server_listen(const char* path) {
+    struct sockaddr_un a;
+    if (!address(path, &a)) {
+        return -1;
+    }
+
+    int other = connect_to(path);
+    if (other >= 0) {
+        close(other);
+        fprintf(stderr, "Error: a server already listens on %s\n", path);
+        return -1;
+    }
+    unlink(path);
+
+    // Only the user may connect
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t mask = umask(077);
+    int ok = fd >= 0 && bind(fd, (struct sockaddr*)&a, sizeof(a)) == 0 && listen(fd, 64) == 0;
+    umask(mask);
+    if (!ok) {
+        fprintf(stderr, "Error: can't listen on %s: %s\n", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// ===================== REQUESTS =====================
+
+// Reads the header and the descriptors that come with it
+static int read_header(int conn, header_t* h, int fds[3]) {
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec iov = {h, sizeof(*h)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+
+    struct cmsghdr* c = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (c && c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+        size_t nfds = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < nfds; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            if (i < 3) {
+                fds[i] = fd;
+            } else {
+                close(fd);
+            }
+        }
+    }
+
+    // The rest of the header may come later, the descriptors may not
+    return n > 0 && !(msg.msg_flags & MSG_CTRUNC) && fds[0] >= 0 && fds[1] >= 0 && fds[2] >= 0 &&
+           read_all(conn, (char*)h + n, sizeof(*h) - n) && !memcmp(h->magic, REQUEST_MAGIC, 4) &&
+           h->len <= SERVER_MAX_REQUEST;
+}
+
+// Splits the payload of len bytes in the strings of r
+static int parse(request_t* r, size_t len) {
+    uint32_t counts[2];
+    if (len < sizeof(counts)) {
+        return 0;
+    }
+    memcpy(counts, r->payload, sizeof(counts));
+    if (counts[0] > len || counts[1] > len || !counts[1]) {
+        return 0;
+    }
+    r->nenv = (int)counts[0];
+    r->argc = (int)counts[1];
+    r->env = (char**)calloc(r->nenv + 1, sizeof(char*));
+    r->argv = (char**)calloc(r->argc + 1, sizeof(char*));
+    if (!r->env || !r->argv) {
+        perror("Error with malloc");
+        return 0;
+    }
+
+    char* p = r->payload + sizeof(counts);
+    char* end = r->payload + len;
+    for (int i = 0; i < 1 + r->nenv + r->argc; i++) {
+        char* nul = (char*)memchr(p, '\0', end - p);
+        if (!nul) {
+            return 0;
+        }
+        if (!i) {
+            r->cwd = p;
+        } else if (i <= r->nenv) {
+            r->env[i - 1] = p;
+        } else {
+            r->argv[i - 1 - r->nenv] = p;
+        }
+        p = nul + 1;
+    }
+    return p == end;
+}
+
+// Waits up to timeout milliseconds for the next request and stores it in
+// *r. Returns 1 if there was one, 0 if there wasn't, -1 on error.
+int server_accept(int sock, int timeout, request_t* r) {
+    memset(r, 0, sizeof(*r));
+    r->conn = r->fds[0] = r->fds[1] = r->fds[2] = -1;
+
+    struct pollfd p = {sock, POLLIN, 0};
+    int n = poll(&p, 1, timeout);
+    if (n <= 0) {
+        return n < 0 && errno != EINTR ? -1 : 0;
+    }
+    r->conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+    if (r->conn < 0) {
+        return errno == EINTR || errno == EAGAIN || errno == ECONNABORTED ? 0 : -1;
+    }
+
+    // Other users aren't served, and a client that doesn't send its
+    // request doesn't hold the others up
+    struct ucred cred;
+    socklen_t clen = sizeof(cred);
+    struct timeval tv = {REQUEST_TIMEOUT, 0};
+    header_t h;
+    int ok = !getsockopt(r->conn, SOL_SOCKET, SO_PEERCRED, &cred, &clen) && cred.uid == geteuid() &&
+             !setsockopt(r->conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) && read_header(r->conn, &h, r->fds);
+
+    r->payload = ok ? (char*)malloc(h.len + 1) : NULL;
+    ok = r->payload && read_all(r->conn, r->payload, h.len) && parse(r, h.len);
+    if (!ok) {
+        request_free(r);
+    }
+    return ok;
+}
+
+// Returns the value of the environment variable name of the client
+const char* request_getenv(const request_t* r, const char* name) {
+    size_t n = strlen(name);
+    for (int i = 0; i < r->nenv; i++) {
+        if (!strncmp(r->env[i], name, n) && r->env[i][n] == '=') {
+            return r->env[i] + n + 1;
+        }
+    }
+    return NULL;
+}
+
+// Sends the exit status to the client
+int server_reply(request_t* r, int status) {
+    int32_t s = status;
+    return write_all(r->conn, (const char*)&s, sizeof(s));
+}
+
+void request_free(request_t* r) {
+    for (int i = 0; i < 3; i++) {
+        if (r->fds[i] >= 0) {
+            close(r->fds[i]);
+        }
+        r->fds[i] = -1;
+    }
+    if (r->conn >= 0) {
+        close(r->conn);
+    }
+    r->conn = -1;
+    free(r->env);
+    free(r->argv);
+    free(r->payload);
+    r->env = r->argv = NULL;
+    r->payload = NULL;
+}
+
+// ===================== CLIENT =====================
+
+// Sends the header with the standard input, output and error
+static int send_header(int fd, uint32_t len) {
+    header_t h;
+    memcpy(h.magic, REQUEST_MAGIC, 4);
+    h.len = len;
+
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {&h, sizeof(h)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+    ssize_t n;
+    do {
+        n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n > 0 && write_all(fd, (const char*)&h + n, sizeof(h) - n);
+}
+
+// Runs the compiler with argv in the server at path and returns its exit
+// status, -1 if no server listens there
+int client_run(const char* path, int argc, char** argv) {
+    int fd = connect_to(path);
+    if (fd < 0) {
+        return -1;
+    }
+
+    char cwd[4096];
+    int nenv = 0;
+    for (char** e = environ; *e; e++) {
+        nenv += !strncmp(*e, "DISA_", 5);
+    }
+    uint32_t counts[2] = {(uint32_t)nenv, (uint32_t)argc};
+
+    buf_t b = buf_new(4096);
+    int ok = b && getcwd(cwd, sizeof(cwd)) && buf_put(b, (const char*)counts, sizeof(counts)) &&
+             buf_put(b, cwd, strlen(cwd) + 1);
+    for (char** e = environ; ok && *e; e++) {
+        ok = strncmp(*e, "DISA_", 5) || buf_put(b, *e, strlen(*e) + 1);
+    }
+    for (int i = 0; ok && i < argc; i++) {
+        ok = buf_put(b, argv[i], strlen(argv[i]) + 1);
+    }
+    ok = ok && b->len <= SERVER_MAX_REQUEST && send_header(fd, (uint32_t)b->len) && write_all(fd, b->data, b->len);
+    buf_free(&b);
+
+    int32_t status = 1;
+    if (!ok || !read_all(fd, (char*)&status, sizeof(status))) {
+        fprintf(stderr, "Error: the server on %s didn't complete the request\n", path);
+        status = 1;
+    }
+    close(fd);
+    return status;
+}
@@ -0,0 +1,54 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+
+// A compiler that stays up between compilations, on a Unix domain socket.
+// A client sends its arguments, working directory, the environment
+// variables starting with DISA_ and its standard input, output and error
+// (the descriptors themselves, so the output goes straight to it), then
+// waits for the exit status. Only clients of the same user are served.
+typedef struct request {
+    int conn;
+
+    // The standard input, output and error of the client
+    int fds[3];
+
+    const char* cwd;
+    int argc;
+    char** argv;
+    int nenv;
+    char** env;
+
+    // Where the strings above are
+    char* payload;
+} request_t;
+
+// Size of a request at most
+#define SERVER_MAX_REQUEST (64 << 20)
+
+// Writes the path of the socket to p: $DISA_SERVER if set, or disa.sock
+// in $XDG_RUNTIME_DIR, or /tmp/disa-<uid>.sock
+void server_default_path(char* p, size_t n);
+
+// Listens on the socket at path, replacing one no server listens on.
+// Returns the socket, -1 on error.
+int server_listen(const char* path);
+
+// Waits up to timeout milliseconds for the next request and stores it in
+// *r. Returns 1 if there was one, 0 if there wasn't, -1 on error.
+int server_accept(int sock, int timeout, request_t* r);
+
+// Returns the value of the environment variable name of the client
+const char* request_getenv(const request_t* r, const char* name);
+
+// Sends the exit status to the client
+int server_reply(request_t* r, int status);
+
+void request_free(request_t* r);
+
+// Runs the compiler with argv in the server at path and returns its exit
+// status, -1 if no server listens there
+int client_run(const char* path, int argc, char** argv);
+
+#endif
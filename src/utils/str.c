@@ -1,14 +1,56 @@
 #include "str.h"
 #include <ctype.h>
+#include <string.h>
 
+// Returns the end of the block comment whose body starts at p, in a
+// string, past its closing "*/", or NULL if the string ends first. Only
+// the slashes are looked at, found by strchr a word or vector at a time.
+static char* comment_end(char* p) {
+    for (char* s = p; (s = strchr(s, '/')); s++) {
+        if (s > p && s[-1] == '*') {
+            return s + 1;
+        }
+    }
+    return NULL;
+}
+
+// Skips the spaces and the comments at *strp. Comments are spaces to C,
+// a line comment runs to the newline (which is left to skip) and a block
+// comment to its closing "*/". A comment the string ends in isn't
+// skipped, *strp is left at its start.
 void skip_spaces(char** strp) {
     if (!strp || !*strp) {
         return;
     }
 
-    while (**strp && isspace(**strp)) {
-        (*strp)++;
+    char* s = *strp;
+    for (;;) {
+        while (*s && isspace(*s)) {
+            s++;
+        }
+        if (s[0] != '/' || (s[1] != '/' && s[1] != '*')) {
+            break;
+        }
+
+        char* end = s[1] == '/' ? strchr(s + 2, '\n') : comment_end(s + 2);
+        if (!end) {
+            break;
+        }
+        s = end;
+    }
+    *strp = s;
+}
+
+// Returns the end of the block comment whose body (past the opening
+// "/*") starts at p, past its closing "*/", or NULL if there is none
+// before end
+const char* block_comment_end(const char* p, const char* end) {
+    for (const char* s = p; s < end && (s = (const char*)memchr(s, '/', end - s)); s++) {
+        if (s > p && s[-1] == '*') {
+            return s + 1;
+        }
     }
+    return NULL;
 }
 
 // Advances a char* pointer without making checks
@@ -18,4 +60,4 @@ void str_advance(char** strp, int amount) {
     }
 
     (*strp) += amount;
-}
\ No newline at end of file
+}
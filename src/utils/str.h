@@ -1,8 +1,19 @@
 #ifndef STR_H
 #define STR_H
 
+#include <stddef.h>
+
+// Skips the spaces and the comments at *strp. Comments are spaces to C,
+// a line comment runs to the newline (which is left to skip) and a block
+// comment to its closing "*/". A comment the string ends in isn't
+// skipped, *strp is left at its start.
 void skip_spaces(char** strp);
 
+// Returns the end of the block comment whose body (past the opening
+// "/*") starts at p, past its closing "*/", or NULL if there is none
+// before end
+const char* block_comment_end(const char* p, const char* end);
+
 // Advances a char* pointer without making checks
 void str_advance(char** strp, int amount);
 
@@ -0,0 +1,173 @@
+#include "timereport.h"
+#include <stddef.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "allocount.h"
+
+static const char* phase_names[PHASE_COUNT] = {
+    "other", "read", "preprocess", "lex", "cache", "optimize", "codegen", "output",
+};
+
+// ===================== PHASES =====================
+
+static phase_stats_t stats[PHASE_COUNT];
+static phase_t current;
+static int measuring;
+
+// What the counters were at the last switch
+static phase_stats_t last;
+
+static int64_t ns(struct timespec t) {
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static int64_t tv_ns(struct timeval t) {
+    return (int64_t)t.tv_sec * 1000000000 + (int64_t)t.tv_usec * 1000;
+}
+
+// Reads the counters of the process
+static phase_stats_t sample() {
+    struct timespec wall;
+    struct rusage ru;
+    clock_gettime(CLOCK_MONOTONIC, &wall);
+    getrusage(RUSAGE_SELF, &ru);
+
+    phase_stats_t s;
+    s.calls = 0;
+    s.wall_ns = ns(wall);
+    s.cpu_ns = tv_ns(ru.ru_utime) + tv_ns(ru.ru_stime);
+    s.alloc_bytes = 0;
+    s.allocs = allocount_get ? allocount_get(&s.alloc_bytes) : 0;
+    s.rss_high_water_kb = ru.ru_maxrss;
+    return s;
+}
+
+// Charges what happened since the last switch to the current phase
+static void charge() {
+    phase_stats_t now = sample();
+    phase_stats_t* s = &stats[current];
+    s->wall_ns += now.wall_ns - last.wall_ns;
+    s->cpu_ns += now.cpu_ns - last.cpu_ns;
+    s->allocs += now.allocs - last.allocs;
+    s->alloc_bytes += now.alloc_bytes - last.alloc_bytes;
+    if (now.rss_high_water_kb > s->rss_high_water_kb) {
+        s->rss_high_water_kb = now.rss_high_water_kb;
+    }
+    last = now;
+}
+
+// Forgets what was measured and starts measuring, in PHASE_OTHER
+void timereport_start() {
+    memset(stats, 0, sizeof(stats));
+    current = PHASE_OTHER;
+    stats[PHASE_OTHER].calls = 1;
+    if (allocount_enable) {
+        allocount_enable(1);
+    }
+    measuring = 1;
+    last = sample();
+}
+
+// Makes p the current phase and returns the one it replaces, to restore
+// with phase_leave
+phase_t phase_enter(phase_t p) {
+    phase_t prev = current;
+    if (measuring && p != current) {
+        charge();
+        stats[p].calls++;
+        current = p;
+    }
+    return prev;
+}
+
+void phase_leave(phase_t prev) {
+    if (measuring && prev != current) {
+        charge();
+        current = prev;
+    }
+}
+
+// Returns what the phase p took so far, the total if p is PHASE_COUNT
+phase_stats_t timereport_get(phase_t p) {
+    if (measuring) {
+        charge();
+    }
+    if (p != PHASE_COUNT) {
+        return stats[p];
+    }
+
+    phase_stats_t total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        total.calls += stats[i].calls;
+        total.wall_ns += stats[i].wall_ns;
+        total.cpu_ns += stats[i].cpu_ns;
+        total.allocs += stats[i].allocs;
+        total.alloc_bytes += stats[i].alloc_bytes;
+        if (stats[i].rss_high_water_kb > total.rss_high_water_kb) {
+            total.rss_high_water_kb = stats[i].rss_high_water_kb;
+        }
+    }
+    return total;
+}
+
+// Allocations not counted (without the allocount object) show as "-" in
+// the table, null in JSON
+static void print_row(FILE* f, const char* name, const phase_stats_t* s, int64_t total_ns) {
+    char allocs_col[24] = "-", bytes_col[24] = "-";
+    if (allocount_get) {
+        snprintf(allocs_col, sizeof(allocs_col), "%lld", (long long)s->allocs);
+        snprintf(bytes_col, sizeof(bytes_col), "%.1f", s->alloc_bytes / 1024.0);
+    }
+    fprintf(f, "%-12s %8lld %10.3f %5.1f%% %10.3f %10s %12s %12lld\n", name, (long long)s->calls, s->wall_ns / 1e6,
+            total_ns ? 100.0 * s->wall_ns / total_ns : 0.0, s->cpu_ns / 1e6, allocs_col, bytes_col,
+            (long long)s->rss_high_water_kb);
+}
+
+static void print_json(FILE* f, const char* name, const phase_stats_t* s) {
+    char allocs_val[24] = "null", bytes_val[24] = "null";
+    if (allocount_get) {
+        snprintf(allocs_val, sizeof(allocs_val), "%lld", (long long)s->allocs);
+        snprintf(bytes_val, sizeof(bytes_val), "%lld", (long long)s->alloc_bytes);
+    }
+    fprintf(f,
+            "{\"name\": \"%s\", \"calls\": %lld, \"wall_ns\": %lld, \"cpu_ns\": %lld, \"allocs\": %s, "
+            "\"alloc_bytes\": %s, \"rss_high_water_kb\": %lld}",
+            name, (long long)s->calls, (long long)s->wall_ns, (long long)s->cpu_ns, allocs_val, bytes_val,
+            (long long)s->rss_high_water_kb);
+}
+
+// Stops measuring and writes a table of the phases to f, or if json an
+// object with the same
+void timereport_print(FILE* f, int json) {
+    phase_stats_t total = timereport_get(PHASE_COUNT);
+    measuring = 0;
+    if (allocount_enable) {
+        allocount_enable(0);
+    }
+
+    // Phases never entered aren't shown
+    if (json) {
+        fprintf(f, "{\"phases\": [");
+        for (int i = 0, n = 0; i < PHASE_COUNT; i++) {
+            if (stats[i].calls) {
+                fprintf(f, n++ ? ",\n  " : "\n  ");
+                print_json(f, phase_names[i], &stats[i]);
+            }
+        }
+        fprintf(f, "],\n \"total\": ");
+        print_json(f, "total", &total);
+        fprintf(f, "}\n");
+        return;
+    }
+
+    fprintf(f, "%-12s %8s %10s %6s %10s %10s %12s %12s\n", "phase", "calls", "wall ms", "wall", "cpu ms", "allocs",
+            "alloc KiB", "RSS hwm KiB");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (stats[i].calls) {
+            print_row(f, phase_names[i], &stats[i], total.wall_ns);
+        }
+    }
+    print_row(f, "total", &total, total.wall_ns);
+}
@@ -0,0 +1,59 @@
+#ifndef TIMEREPORT_H
+#define TIMEREPORT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Where the time of a compilation goes. The run is split in phases, one
+// current at a time, and every switch charges the wall time, the CPU time
+// of the process and the allocations made since the last one to the phase
+// that ends, and notes the high-water mark of its resident set size then.
+// Nothing is measured until timereport_start, and a switch costs a branch
+// until then. Allocations are only counted by builds with the allocount
+// object (see allocount.h).
+//
+// The phases are those of the thread that switches them, normally the
+// main one. The CPU time and allocations of other threads (the readers
+// and loaders of the input) count for the phase it's in meanwhile.
+typedef enum phase {
+    PHASE_OTHER,
+    PHASE_READ,
+    PHASE_PREPROCESS,
+    PHASE_LEX,
+    PHASE_CACHE,
+    PHASE_OPTIMIZE,
+    PHASE_CODEGEN,
+    PHASE_OUTPUT,
+    PHASE_COUNT,
+} phase_t;
+
+// What a phase took, over every time it was current
+typedef struct phase_stats {
+    int64_t calls;
+    int64_t wall_ns;
+    int64_t cpu_ns;
+    int64_t allocs;
+    int64_t alloc_bytes;
+
+    // The high-water mark of the resident set size of the process when
+    // the phase last ended: the phases before count in it too, it isn't
+    // what this one used
+    int64_t rss_high_water_kb;
+} phase_stats_t;
+
+// Forgets what was measured and starts measuring, in PHASE_OTHER
+void timereport_start();
+
+// Makes p the current phase and returns the one it replaces, to restore
+// with phase_leave
+phase_t phase_enter(phase_t p);
+void phase_leave(phase_t prev);
+
+// Returns what the phase p took so far, the total if p is PHASE_COUNT
+phase_stats_t timereport_get(phase_t p);
+
+// Stops measuring and writes a table of the phases to f, or if json an
+// object with the same
+void timereport_print(FILE* f, int json);
+
+#endif
@@ -1,23 +1,877 @@
 #include "tokenization/tokenizer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include "tests.h"
+#include "tokenization/preprocessor.h"
+#include "tokenization/spans.h"
+#include "tokenization/tstream.h"
+#include "utils/cache.h"
+#include "utils/fragdb.h"
+#include "utils/loader.h"
+#include "utils/memstore.h"
+#include "utils/server.h"
+#include "utils/timereport.h"
 
-int main(int argc, char** args) {
-    if (argc != 2) {
-        fprintf(stderr, "Wrong number of arguments! Usage: disa <file>, where <file> is a C file to compile\n");
-        return 1;
+#define DISA_VERSION "disa 0.1"
+
+// What the output is, part of the cache key
+#define OUTPUT_TEXT "tokens"
+#define OUTPUT_BIN "tokens-bin"
+
+// The key of the fragments of a file is that of its path
+#define FRAGMENTS_KIND "fragments"
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s [options] <file>..., where <file> is a C file to compile (- for the standard input), or\n"
+            "tokens dumped with --dump-tokens=bin. Many files are read at once and their tokens written in order,\n"
+            "a line each.\n"
+            "\n"
+            "Options:\n"
+            "  -I DIR             search DIR for included files\n"
+            "  -D NAME[=VALUE]    define the macro NAME as VALUE (default 1)\n"
+            "  --dump-tokens=FMT  write the tokens as text (the default) or bin, the binary token stream format\n"
+            "  --cache-dir=DIR    reuse the outputs of earlier runs stored in DIR (default $DISA_CACHE_DIR, none if\n"
+            "                     unset)\n"
+            "  --cache-size=N     bytes the cache may take, with an optional K, M or G suffix (default 64M)\n"
+            "  --no-cache         don't use the cache\n"
+            "  --cache-stats      print the hits, misses and size of the cache on stderr\n"
+            "  --server[=PATH]    serve compilations on the Unix socket PATH (default $DISA_SERVER, else\n"
+            "                     $XDG_RUNTIME_DIR/disa.sock or /tmp/disa-<uid>.sock) until SIGINT or SIGTERM. With\n"
+            "                     $DISA_SERVER set, the compiler runs there if the server is up\n"
+            "  --server-memory=N  bytes of outputs, and of headers, the server keeps (default 256M)\n"
+            "  --server-idle=S    seconds after which the server drops what it hasn't used (default 600)\n"
+            "  -time-report[=FMT] print the time, allocations (make COUNT_ALLOCS=1 builds) and memory high-water\n"
+            "                     mark of each phase on stderr, as a text table (the default) or json\n",
+            name);
+}
+
+static int parse_size(const char* s, uint64_t* sizep) {
+    char* end;
+    unsigned long long n = strtoull(s, &end, 10);
+    int shift = 0;
+    switch (*end) {
+        case 'K':
+            shift = 10;
+            break;
+        case 'M':
+            shift = 20;
+            break;
+        case 'G':
+            shift = 30;
+            break;
+        case '\0':
+            break;
+        default:
+            return 0;
+    }
+    if (end == s || (shift && end[1])) {
+        return 0;
+    }
+
+    *sizep = (uint64_t)n << shift;
+    return 1;
+}
+
+// Writes the version of the compiler to p: the release, and the size and
+// modification time of the executable, so that rebuilding it invalidates
+// what it cached
+static void compiler_version(char* p, size_t n) {
+    struct stat st;
+    if (stat("/proc/self/exe", &st) < 0) {
+        snprintf(p, n, "%s", DISA_VERSION);
+        return;
+    }
+    snprintf(p, n, "%s %lld %lld.%09ld", DISA_VERSION, (long long)st.st_size, (long long)st.st_mtim.tv_sec,
+             st.st_mtim.tv_nsec);
+}
+
+// Maps the source file in memory, returns 0 if it can't (tokenizing
+// reports why). Pipes aren't even opened, their input is streamed.
+static int map_source(const char* filename, const char** srcp, size_t* lenp) {
+    struct stat path_stat;
+    if (stat(filename, &path_stat) < 0 || !S_ISREG(path_stat.st_mode)) {
+        return 0;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    struct stat st;
+    int ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    *srcp = NULL;
+    *lenp = ok ? st.st_size : 0;
+    if (ok && st.st_size > 0) {
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ok = p != MAP_FAILED;
+        *srcp = ok ? (const char*)p : NULL;
+    }
+
+    close(fd);
+    return ok;
+}
+
+// What a server keeps between compilations: the outputs, manifests and
+// fragment databases of the files compiled, and the headers read and
+// lexed, each up to max_size bytes (of outputs, of header sources)
+typedef struct warm {
+    memstore_t store;
+    pp_t pp;
+    size_t max_size;
+
+    // Outputs taken from the store
+    int hits;
+} warm_t;
+
+// A -I or -D option
+typedef struct pp_arg {
+    int opt;
+    const char* arg;
+} pp_arg_t;
+
+// What the compilations of a run share
+typedef struct driver {
+    cache_t cache;
+    char version[128];
+    int binary;
+
+    // The -I and -D options in order, and the same as part of the key of
+    // the outputs
+    pp_arg_t* pp_args;
+    int pp_nargs;
+    buf_t pp_options;
+    int defines;
+
+    // What a server keeps, NULL outside of one
+    warm_t* warm;
+
+    incremental_stats_t inc;
+} driver_t;
+
+// Returns a preprocessor with the -I and -D options, NULL on error. Every
+// file gets a new one, so that the macros of one don't leak in the next,
+// but for the session a server keeps: it's reset, and the headers it
+// read stay lexed.
+static pp_t driver_pp(driver_t* d) {
+    pp_t pp = d->warm ? d->warm->pp : NULL;
+    if (pp && pp_size(pp) <= d->warm->max_size) {
+        pp_reset(pp);
+    } else {
+        pp_free(&pp);
+        pp = pp_new();
+    }
+    if (d->warm) {
+        d->warm->pp = pp;
+    }
+
+    int ok = pp != NULL;
+    for (int i = 0; ok && i < d->pp_nargs; i++) {
+        const pp_arg_t* a = &d->pp_args[i];
+        ok = a->opt == 'I' ? pp_add_include_dir(pp, a->arg) : pp_define(pp, a->arg);
+    }
+    if (!ok && !d->warm) {
+        pp_free(&pp);
+    }
+    return ok ? pp : NULL;
+}
+
+// Appends the output of key to out if the memory of a server or the
+// cache has it, as cache_read does
+static int store_get(driver_t* d, hash128_t key, buf_t out) {
+    phase_t prev = phase_enter(PHASE_CACHE);
+    memstore_t m = d->warm ? d->warm->store : NULL;
+    size_t len = 0;
+    const void* p = m ? memstore_get(m, key, &len) : NULL;
+    int hit = 0;
+    if (p) {
+        d->warm->hits++;
+        hit = buf_put(out, (const char*)p, len) ? 1 : -1;
+    } else if (d->cache) {
+        size_t mark = out->len;
+        hit = cache_read(d->cache, key, out);
+        if (hit > 0 && m) {
+            memstore_put(m, key, out->data + mark, out->len - mark);
+        }
+    }
+    phase_leave(prev);
+    return hit;
+}
+
+// Appends the data of key the compiler keeps for itself to b, as
+// cache_map finds it. Returns 0 if there is none.
+static int store_load(driver_t* d, hash128_t key, buf_t b) {
+    phase_t prev = phase_enter(PHASE_CACHE);
+    memstore_t m = d->warm ? d->warm->store : NULL;
+    size_t len = 0;
+    const void* p = m ? memstore_get(m, key, &len) : NULL;
+    int ok = 0;
+    if (p) {
+        ok = buf_put(b, (const char*)p, len);
+    } else if (d->cache && (p = cache_map(d->cache, key, &len))) {
+        ok = buf_put(b, (const char*)p, len);
+        if (ok && m) {
+            memstore_put(m, key, p, len);
+        }
+        cache_unmap(p, len);
+    }
+    phase_leave(prev);
+    return ok;
+}
+
+// Stores the len bytes at data as the entry of key, in the memory of a
+// server and the cache
+static void store_put(driver_t* d, hash128_t key, const void* data, size_t len) {
+    phase_t prev = phase_enter(PHASE_CACHE);
+    if (d->warm) {
+        memstore_put(d->warm->store, key, data, len);
+    }
+    if (d->cache) {
+        cache_put(d->cache, key, data, len);
+    }
+    phase_leave(prev);
+}
+
+// Tokenizes the len bytes at src, read from filename, into out one
+// top-level span (function definition or declaration) at a time. The
+// tokens of every span are kept in the cache in a database of the file,
+// by the hash of the span, so that the spans unchanged since the last
+// compilation are copied from it instead of tokenized again.
+static int compile_incremental(driver_t* d, const char* filename, const char* src, size_t len, buf_t out) {
+    char path[PATH_MAX];
+    if (!realpath(filename, path)) {
+        snprintf(path, sizeof(path), "%s", filename);
+    }
+    hash128_t key = cache_key(d->version, FRAGMENTS_KIND, path, strlen(path));
+
+    buf_t saved = buf_new(4096);
+    fragdb_t before = fragdb_new();
+    fragdb_t now = fragdb_new();
+    if (saved && before && store_load(d, key, saved)) {
+        fragdb_load(before, saved->data, saved->len);
+    }
+
+    int ok = before && now && tokenize_spans(src, len, before, now, out, &d->inc);
+
+    // Only complete outputs are worth reusing
+    if (ok) {
+        buf_t db = buf_new(out->len + 64);
+        if (db && fragdb_save(now, out->data, db)) {
+            store_put(d, key, db->data, db->len);
+        }
+        buf_free(&db);
     }
 
+    fragdb_free(&now);
+    fragdb_free(&before);
+    buf_free(&saved);
+    return ok;
+}
+
+// Writes the tokens to out, serialized if binary or formatted
+static int dump_tokens(tlist_t tokens, buf_t out, int binary) {
+    phase_t prev = phase_enter(PHASE_OUTPUT);
+    int ok = binary ? tstream_write(out, tokens) : tlist_format(out, tokens);
+    phase_leave(prev);
+    return ok;
+}
+
+// Tokenizes the len bytes at src, or if src is NULL filename (the
+// standard input if "-"), and dumps the tokens in out, returns 1 if the
+// whole file could be tokenized
+static int compile(const char* filename, const char* src, size_t len, buf_t out, int binary) {
+    phase_t prev = phase_enter(PHASE_LEX);
     tokenizer_t tokenizer = tokenizer_new();
-    tokenize(tokenizer, args[1]);
+    int ok = src                    ? tokenize_string(tokenizer, src, len)
+             : !strcmp(filename, "-") ? tokenize_fd(tokenizer, STDIN_FILENO)
+                                      : tokenize(tokenizer, filename);
+    phase_leave(prev);
 
     tlist_t tokens = get_tokens(tokenizer);
-    tlist_print(tokens);
+    ok = dump_tokens(tokens, out, binary) && ok;
     tlist_free(&tokens);
 
     tokenizer_free(&tokenizer);
+    return ok;
+}
 
-    // run_tests();
+// Dumps the tokens of a serialized token list in out
+static int reload(const tstream_t* s, buf_t out, int binary) {
+    tlist_t tokens;
+    phase_t prev = phase_enter(PHASE_LEX);
+    int ok = tstream_to_tlist(s, &tokens);
+    phase_leave(prev);
+    ok = ok && dump_tokens(tokens, out, binary);
+    tlist_free(&tokens);
+    return ok;
+}
 
+// Whether the source has preprocessing directives, lines starting with '#'
+static int has_directives(const char* src, size_t len) {
+    int start = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (start && src[i] == '#') {
+            return 1;
+        }
+        start = src[i] == '\n' || (start && (src[i] == ' ' || src[i] == '\t'));
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+// Preprocesses filename and dumps the tokens in out
+static int compile_preprocessed(pp_t pp, const char* filename, buf_t out, int binary) {
+    tlist_t tokens = NULL;
+    phase_t prev = phase_enter(PHASE_PREPROCESS);
+    int ok = preprocess(pp, filename, &tokens);
+    phase_leave(prev);
+    ok = ok && dump_tokens(tokens, out, binary);
+    tlist_free(&tokens);
+    return ok;
+}
+
+// Appends to b the files read by pp and the hashes of their contents, a
+// line each, or if pp is NULL the files listed in the manifest of len
+// bytes at m with the hashes of their current contents
+static int manifest(buf_t b, pp_t pp, const char* m, size_t len) {
+    int n = pp ? pp_nfiles(pp) : 0;
+    const char* end = m + len;
+    for (int i = 0; pp ? i < n : m < end; i++) {
+        char path[PATH_MAX];
+        hash128_t h = {0, 0};
+        if (pp) {
+            snprintf(path, sizeof(path), "%s", pp_file_path(pp, i));
+            h = pp_file_hash(pp, i);
+        } else {
+            const char* nl = (const char*)memchr(m, '\n', end - m);
+            size_t k = nl ? (size_t)(nl - m) : (size_t)(end - m);
+            if (k <= HASH128_HEX_LEN + 1 || k - HASH128_HEX_LEN - 1 >= sizeof(path)) {
+                return 0;
+            }
+            snprintf(path, sizeof(path), "%.*s", (int)(k - HASH128_HEX_LEN - 1), m + HASH128_HEX_LEN + 1);
+            m += k + 1;
+
+            // A file gone or unreadable has no hash, and can't match
+            const char* data;
+            size_t size;
+            if (map_source(path, &data, &size)) {
+                h = hash128(data, size, 0);
+                if (data) {
+                    munmap((void*)data, size);
+                }
+            }
+        }
+
+        char hex[HASH128_HEX_LEN + 1];
+        hash128_hex(h, hex);
+        if (!buf_put(b, hex, HASH128_HEX_LEN) || !buf_putc(b, ' ') || !buf_puts(b, path) || !buf_putc(b, '\n')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Returns the key of the output of a file with directives: the key of
+// its source and options, stored with the manifest of the files it
+// included the last time, extended with their current contents
+static hash128_t included_key(driver_t* d, hash128_t key) {
+    phase_t prev = phase_enter(PHASE_CACHE);
+    buf_t m = buf_new(1024);
+    buf_t saved = buf_new(1024);
+    if (m && saved && store_load(d, key, saved) && !manifest(m, NULL, saved->data, saved->len)) {
+        buf_clear(m);
+    }
+    buf_free(&saved);
+
+    hash128_t h = hash128_extend(key, m ? m->data : "", m ? m->len : 0);
+    buf_free(&m);
+    phase_leave(prev);
+    return h;
+}
+
+// Compiles filename into out, reusing the output of an earlier run if the
+// cache has it. If have_src, the len bytes at src are its contents (src
+// is NULL if there are none). Returns the exit status.
+static int compile_source(driver_t* d, const char* filename, const char* src, size_t len, int have_src, buf_t out) {
+    // Tokens dumped earlier are loaded rather than lexed
+    tstream_t dumped;
+    int serialized = have_src && len >= 4 && !memcmp(src, TSTREAM_MAGIC, 4);
+    if (serialized && !tstream_open(&dumped, src, len)) {
+        fprintf(stderr, "Error: %s isn't a token stream of version %d\n", filename, TSTREAM_VERSION);
+        return 1;
+    }
+    int cacheable = have_src && (d->cache || d->warm);
+
+    // Sources with directives are preprocessed, and their outputs depend
+    // on what they include too
+    int preprocessed = have_src && !serialized && (d->defines || has_directives(src, len));
+
+    hash128_t key;
+    if (cacheable) {
+        const char* kind = d->binary ? OUTPUT_BIN : OUTPUT_TEXT;
+        buf_t options_key = buf_new(64);
+        int ok = options_key && buf_puts(options_key, kind) &&
+                 buf_put(options_key, d->pp_options->data, d->pp_options->len) && buf_putc(options_key, '\0');
+        key = cache_key(d->version, ok ? options_key->data : kind, src, len);
+        buf_free(&options_key);
+
+        int hit = store_get(d, preprocessed ? included_key(d, key) : key, out);
+        if (hit) {
+            return hit < 0;
+        }
+    }
+
+    pp_t pp = NULL;
+    int ok = 0;
+    if (serialized) {
+        ok = reload(&dumped, out, d->binary);
+    } else if (preprocessed) {
+        pp = driver_pp(d);
+        ok = pp && compile_preprocessed(pp, filename, out, d->binary);
+    } else if (cacheable && !d->binary) {
+        phase_t prev = phase_enter(PHASE_LEX);
+        ok = compile_incremental(d, filename, src, len, out);
+        phase_leave(prev);
+    } else {
+        ok = compile(filename, src, len, out, d->binary);
+    }
+
+    // Only complete outputs are worth reusing. Those of preprocessed files
+    // go with the manifest of what they included.
+    if (ok && cacheable && preprocessed) {
+        buf_t m = buf_new(1024);
+        if (m && manifest(m, pp, NULL, 0)) {
+            store_put(d, key, m->data, m->len);
+            store_put(d, hash128_extend(key, m->data, m->len), out->data, out->len);
+        }
+        buf_free(&m);
+    } else if (ok && cacheable) {
+        store_put(d, key, out->data, out->len);
+    }
+    if (!d->warm) {
+        pp_free(&pp);
+    }
+
+    // Lexing reports its errors in the output, a corrupt dump or a failed
+    // preprocessing has none
+    if (!ok && preprocessed) {
+        buf_clear(out);
+    }
+    return (serialized || preprocessed) && !ok;
+}
+
+// Compiles a single file and writes its output
+static int compile_file(driver_t* d, const char* filename) {
+    const char* src = NULL;
+    size_t len = 0;
+    phase_t prev = phase_enter(PHASE_READ);
+    int mapped = map_source(filename, &src, &len);
+    phase_leave(prev);
+    buf_t out = buf_new(4096);
+    int ret = !out || compile_source(d, filename, src, len, mapped, out);
+
+    prev = phase_enter(PHASE_OUTPUT);
+    fflush(stdout);
+    if (out && !buf_write(out, STDOUT_FILENO)) {
+        ret = 1;
+    }
+    phase_leave(prev);
+    buf_free(&out);
+    if (src) {
+        munmap((void*)src, len);
+    }
+    return ret;
+}
+
+// Compiles the n files, each as soon as it's read, and writes their
+// outputs in order, a line each, each as soon as those before it are out
+static int compile_files(driver_t* d, const char* const* files, int n) {
+    loader_t l = loader_new(files, n, 0);
+    buf_t* outs = (buf_t*)calloc(n, sizeof(buf_t));
+    char* done = (char*)calloc(n, 1);
+    if (!l || !outs || !done) {
+        loader_free(&l);
+        free(outs);
+        free(done);
+        return 1;
+    }
+
+    int ret = 0;
+    int next = 0;
+    int r;
+    loaded_t f;
+    phase_t prev = phase_enter(PHASE_READ);
+    while ((r = loader_next(l, &f)) == 1) {
+        phase_leave(prev);
+        buf_t out = buf_new(4096);
+        if (f.error) {
+            fprintf(stderr, "Error: can't read %s: %s\n", files[f.index], strerror(f.error));
+            ret = 1;
+        } else if (!out || compile_source(d, files[f.index], f.data, f.len, 1, out)) {
+            ret = 1;
+        }
+        free(f.data);
+        outs[f.index] = out;
+        done[f.index] = 1;
+
+        phase_enter(PHASE_OUTPUT);
+        fflush(stdout);
+        for (; next < n && done[next]; next++) {
+            if (outs[next] && outs[next]->len && (!buf_putc(outs[next], '\n') || !buf_write(outs[next], STDOUT_FILENO))) {
+                ret = 1;
+            }
+            buf_free(&outs[next]);
+        }
+        phase_enter(PHASE_READ);
+    }
+    phase_leave(prev);
+    ret |= r < 0;
+
+    for (int i = next; i < n; i++) {
+        buf_free(&outs[i]);
+    }
+    free(outs);
+    free(done);
+    loader_free(&l);
+    return ret;
+}
+
+// Default of --server-memory, and seconds after which what a server
+// keeps and hasn't used is dropped
+#define SERVER_DEFAULT_MEMORY (256ull << 20)
+#define SERVER_DEFAULT_IDLE 600
+
+static int serve(const char* path, uint64_t memory, int idle);
+
+// Runs the compiler with the arguments given, cache_env being the value
+// of $DISA_CACHE_DIR, in a server if w isn't NULL. Returns the exit
+// status.
+static int run(warm_t* w, const char* cache_env, int argc, char** args) {
+    enum {
+        OPT_DUMP_TOKENS = 256,
+        OPT_CACHE_DIR,
+        OPT_CACHE_SIZE,
+        OPT_NO_CACHE,
+        OPT_CACHE_STATS,
+        OPT_SERVER,
+        OPT_SERVER_MEMORY,
+        OPT_SERVER_IDLE,
+        OPT_TIME_REPORT,
+    };
+    static const struct option options[] = {
+        {"dump-tokens", required_argument, NULL, OPT_DUMP_TOKENS},
+        {"cache-dir", required_argument, NULL, OPT_CACHE_DIR},
+        {"cache-size", required_argument, NULL, OPT_CACHE_SIZE},
+        {"no-cache", no_argument, NULL, OPT_NO_CACHE},
+        {"cache-stats", no_argument, NULL, OPT_CACHE_STATS},
+        {"server", optional_argument, NULL, OPT_SERVER},
+        {"server-memory", required_argument, NULL, OPT_SERVER_MEMORY},
+        {"server-idle", required_argument, NULL, OPT_SERVER_IDLE},
+        {"time-report", optional_argument, NULL, OPT_TIME_REPORT},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    const char* cache_dir = cache_env;
+    uint64_t cache_size = CACHE_DEFAULT_SIZE;
+    int print_stats = 0;
+    char server_path[PATH_MAX] = "";
+    int server = 0;
+    uint64_t server_memory = SERVER_DEFAULT_MEMORY;
+    int server_idle = SERVER_DEFAULT_IDLE;
+    int time_report = 0;
+    int json = 0;
+
+    driver_t d;
+    memset(&d, 0, sizeof(d));
+    d.warm = w;
+    d.pp_args = (pp_arg_t*)malloc(argc * sizeof(pp_arg_t));
+    d.pp_options = buf_new(256);
+    if (!d.pp_args || !d.pp_options) {
+        free(d.pp_args);
+        buf_free(&d.pp_options);
+        return 1;
+    }
+
+    // A server parses the arguments of every request from the start. Long
+    // options take one dash too, as in -time-report.
+    optind = 0;
+    int ret = -1;
+    int opt;
+    while (ret < 0 && (opt = getopt_long_only(argc, args, "I:D:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'I':
+            case 'D':
+                if (!buf_puts(d.pp_options, opt == 'I' ? " -I" : " -D") || !buf_puts(d.pp_options, optarg)) {
+                    ret = 1;
+                }
+                d.pp_args[d.pp_nargs++] = (pp_arg_t){opt, optarg};
+                d.defines += opt == 'D';
+                break;
+            case OPT_DUMP_TOKENS:
+                if (strcmp(optarg, "text") && strcmp(optarg, "bin")) {
+                    fprintf(stderr, "Error: invalid token format '%s', expected text or bin\n", optarg);
+                    ret = 1;
+                }
+                d.binary = !strcmp(optarg, "bin");
+                break;
+            case OPT_CACHE_DIR:
+                cache_dir = optarg;
+                break;
+            case OPT_CACHE_SIZE:
+            case OPT_SERVER_MEMORY:
+                if (!parse_size(optarg, opt == OPT_CACHE_SIZE ? &cache_size : &server_memory)) {
+                    fprintf(stderr, "Error: invalid %s size '%s'\n", opt == OPT_CACHE_SIZE ? "cache" : "memory", optarg);
+                    ret = 1;
+                }
+                break;
+            case OPT_NO_CACHE:
+                cache_dir = NULL;
+                break;
+            case OPT_CACHE_STATS:
+                print_stats = 1;
+                break;
+            case OPT_SERVER:
+                server = 1;
+                if (optarg) {
+                    snprintf(server_path, sizeof(server_path), "%s", optarg);
+                }
+                break;
+            case OPT_TIME_REPORT:
+                if (optarg && strcmp(optarg, "text") && strcmp(optarg, "json")) {
+                    fprintf(stderr, "Error: invalid report format '%s', expected text or json\n", optarg);
+                    ret = 1;
+                }
+                time_report = 1;
+                json = optarg && !strcmp(optarg, "json");
+                break;
+            case OPT_SERVER_IDLE:
+                server_idle = atoi(optarg);
+                if (server_idle <= 0) {
+                    fprintf(stderr, "Error: invalid idle time '%s'\n", optarg);
+                    ret = 1;
+                }
+                break;
+            case 'h':
+                usage(args[0]);
+                ret = 0;
+                break;
+            default:
+                usage(args[0]);
+                ret = 1;
+                break;
+        }
+    }
+
+    // Statistics alone need no file, a server takes none
+    int nfiles = argc - optind;
+    if (ret < 0 && server && (w || nfiles)) {
+        fprintf(stderr, "Error: %s\n", w ? "the server can't start another" : "--server takes no file");
+        ret = 1;
+    } else if (ret < 0 && !server && !nfiles && !print_stats) {
+        fprintf(stderr, "Wrong number of arguments! Usage: disa <file>..., where <file> is a C file to compile\n");
+        ret = 1;
+    }
+    for (int i = optind; ret < 0 && nfiles > 1 && i < argc; i++) {
+        if (!strcmp(args[i], "-")) {
+            fprintf(stderr, "Error: the standard input can only be compiled alone\n");
+            ret = 1;
+        }
+    }
+    if (ret < 0 && nfiles > 1 && d.binary) {
+        fprintf(stderr, "Error: --dump-tokens=bin takes a single file\n");
+        ret = 1;
+    }
+
+    // The options are checked once, before any file is read
+    if (ret < 0 && !server) {
+        pp_t pp = driver_pp(&d);
+        ret = pp ? -1 : 1;
+        if (!w) {
+            pp_free(&pp);
+        }
+    }
+    if (ret >= 0) {
+        buf_free(&d.pp_options);
+        free(d.pp_args);
+        return ret;
+    }
+
+    if (server) {
+        if (!*server_path) {
+            server_default_path(server_path, sizeof(server_path));
+        }
+        buf_free(&d.pp_options);
+        free(d.pp_args);
+        return serve(server_path, server_memory, server_idle);
+    }
+
+    if (time_report) {
+        timereport_start();
+    }
+    d.cache = cache_dir && *cache_dir ? cache_open(cache_dir, cache_size) : NULL;
+    compiler_version(d.version, sizeof(d.version));
+
+    ret = 0;
+    if (nfiles == 1) {
+        ret = compile_file(&d, args[optind]);
+    } else if (nfiles > 1) {
+        ret = compile_files(&d, (const char* const*)args + optind, nfiles);
+    }
+
+    cache_stats_t stats;
+    if (print_stats && d.cache && cache_get_stats(d.cache, &stats)) {
+        fprintf(stderr, "cache: %s: %llu hits, %llu misses, %llu stores, %llu of %llu bytes\n", d.cache->dir,
+                (unsigned long long)stats.hits, (unsigned long long)stats.misses, (unsigned long long)stats.stores,
+                (unsigned long long)stats.size, (unsigned long long)d.cache->max_size);
+    } else if (print_stats && !d.cache) {
+        fprintf(stderr, "cache: disabled\n");
+    }
+    if (print_stats && d.inc.spans) {
+        fprintf(stderr, "cache: %s: %d of %d top-level spans regenerated\n", nfiles == 1 ? args[optind] : "all files",
+                d.inc.regenerated, d.inc.spans);
+    }
+    if (print_stats && w) {
+        int n = 0;
+        size_t size = memstore_size(w->store, &n);
+        fprintf(stderr, "server: %d outputs from memory, %zu bytes in %d entries, %zu bytes of headers\n", w->hits,
+                size, n, w->pp ? pp_size(w->pp) : 0);
+        w->hits = 0;
+    }
+    if (time_report) {
+        timereport_print(stderr, json);
+    }
+    cache_free(&d.cache);
+    buf_free(&d.pp_options);
+    free(d.pp_args);
+    return ret;
+}
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+// Runs a request in the working directory of the client, with its
+// standard streams
+static int handle(warm_t* w, request_t* r) {
+    int saved[3] = {-1, -1, -1};
+    int cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int ok = cwd >= 0;
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; ok && i < 3; i++) {
+        saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+        ok = saved[i] >= 0 && dup2(r->fds[i], i) == i;
+    }
+
+    int status = 1;
+    if (ok && chdir(r->cwd) < 0) {
+        fprintf(stderr, "Error: can't enter %s: %s\n", r->cwd, strerror(errno));
+    } else if (ok) {
+        status = run(w, request_getenv(r, "DISA_CACHE_DIR"), r->argc, r->argv);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 3; i++) {
+        if (saved[i] >= 0) {
+            dup2(saved[i], i);
+            close(saved[i]);
+        }
+    }
+    if (cwd >= 0) {
+        if (fchdir(cwd) < 0) {
+            perror("Error going back to the server directory");
+        }
+        close(cwd);
+    }
+    return status;
+}
+
+// Serves the requests of clients on the socket at path until stopped by
+// SIGINT or SIGTERM, keeping up to memory bytes of what compilations
+// produced and read, and dropping what hasn't been used for idle seconds
+static int serve(const char* path, uint64_t memory, int idle) {
+    int sock = server_listen(path);
+    if (sock < 0) {
+        return 1;
+    }
+
+    warm_t w = {memstore_new(memory), NULL, memory, 0};
+    if (!w.store) {
+        close(sock);
+        return 1;
+    }
+
+    // A client gone is no reason to stop
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "server: listening on %s\n", path);
+
+    time_t last = time(NULL);
+    int ret = 0;
+    while (!stopping) {
+        request_t r;
+        int got = server_accept(sock, 1000 * (idle < 60 ? idle : 60), &r);
+        if (got < 0) {
+            perror("Error accepting a request");
+            ret = 1;
+            break;
+        }
+
+        time_t now = time(NULL);
+        memstore_expire(w.store, now - idle);
+        if (now - last >= idle) {
+            pp_free(&w.pp);
+        }
+        if (got) {
+            server_reply(&r, handle(&w, &r));
+            request_free(&r);
+            last = time(NULL);
+        }
+    }
+
+    unlink(path);
+    close(sock);
+    memstore_free(&w.store);
+    pp_free(&w.pp);
+    return ret;
+}
+
+int main(int argc, char** args) {
+    // With DISA_SERVER set, the server there compiles if it's up
+    const char* server = getenv("DISA_SERVER");
+    int serving = 0;
+    for (int i = 1; i < argc && strcmp(args[i], "--"); i++) {
+        serving |= !strncmp(args[i], "--server", 8) && (!args[i][8] || args[i][8] == '=');
+    }
+    if (server && *server && !serving) {
+        int status = client_run(server, argc, args);
+        if (status >= 0) {
+            return status;
+        }
+    }
+
+    int ret = run(NULL, getenv("DISA_CACHE_DIR"), argc, args);
+
+    // run_tests();
+
+    return ret;
+}
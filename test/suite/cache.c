@@ -0,0 +1,327 @@
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+#include "tests.h"
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "tokenization/spans.h"
+#include "tokenization/tokenizer.h"
+#include "utils/allocount.h"
+#include "utils/cache.h"
+#include "utils/fragdb.h"
+#include "utils/memstore.h"
+#include "utils/server.h"
+#include "utils/timereport.h"
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+// Returns whether the entry of key is in the cache and holds expected
+static int holds(cache_t c, hash128_t key, const char* expected) {
+    FILE* fp = tmpfile();
+    if (!fp) {
+        return 0;
+    }
+
+    char data[64] = {0};
+    int hit = cache_get(c, key, fileno(fp)) == 1;
+    rewind(fp);
+    size_t n = fread(data, 1, sizeof(data) - 1, fp);
+    fclose(fp);
+    return hit && n == strlen(expected) && !memcmp(data, expected, n);
+}
+
+// Makes the entry of key look last used at time t
+static void age(cache_t c, hash128_t key, time_t t) {
+    char hex[HASH128_HEX_LEN + 1], path[4096];
+    hash128_hex(key, hex);
+    snprintf(path, sizeof(path), "%s/%.2s/%s", c->dir, hex, hex + 2);
+    struct timespec times[2] = {{t, 0}, {t, 0}};
+    utimensat(AT_FDCWD, path, times, 0);
+}
+
+void output_cache() {
+    printf("======================= Testing for the output cache ======================\n");
+
+    // Reference values of MurmurHash3 x64 128
+    hash128_t h = hash128("hello", 5, 0);
+    char hex[HASH128_HEX_LEN + 1];
+    hash128_hex(h, hex);
+    int pass = h.lo == 0xcbd8a7b341bd9b02ull && h.hi == 0x5b1e906a48ae1d19ull &&
+               !strcmp(hex, "5b1e906a48ae1d19cbd8a7b341bd9b02") && hash128_equal(hash128("", 0, 0), (hash128_t){0, 0});
+    printf("hash128(hello): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // The version, the options and the source all count, and where one
+    // ends doesn't shift into the next
+    hash128_t k = cache_key("v1", "tokens", "int x;", 6);
+    pass = hash128_equal(k, cache_key("v1", "tokens", "int x;", 6)) &&
+           !hash128_equal(k, cache_key("v2", "tokens", "int x;", 6)) &&
+           !hash128_equal(k, cache_key("v1", "asm", "int x;", 6)) &&
+           !hash128_equal(k, cache_key("v1", "tokens", "int y;", 6)) &&
+           !hash128_equal(cache_key("v1", "tokensint", " x;", 3), k);
+    printf("cache_key(): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    char dir[] = "/tmp/disa_cache_XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("mkdtemp(): ❌ FAIL\n");
+        return;
+    }
+
+    // A miss, then the stored output comes back
+    cache_t c = cache_open(dir, 100);
+    hash128_t a = cache_key("v1", "tokens", "a", 1), b = cache_key("v1", "tokens", "b", 1);
+    hash128_t d = cache_key("v1", "tokens", "d", 1), e = cache_key("v1", "tokens", "e", 1);
+    const char* out = "tlist[K_INT, I_IDENTIFIER(x), S_SEMICOLON]";
+    cache_stats_t stats;
+    pass = c && !holds(c, a, "") && cache_put(c, a, out, strlen(out)) && holds(c, a, out) &&
+           cache_get_stats(c, &stats) && stats.hits == 1 && stats.misses == 1 && stats.stores == 1 &&
+           stats.size == strlen(out);
+    printf("cache_get(miss, hit): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // Replacing an entry doesn't count it twice
+    pass = c && cache_put(c, a, "30 bytes of tokens, no more...", 30) && cache_get_stats(c, &stats) &&
+           stats.size == 30 && holds(c, a, "30 bytes of tokens, no more...");
+    printf("cache_put(replace): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // Over 100 bytes, the least recently used go until at most 90 are left:
+    // a was used last, b is the oldest
+    pass = c && cache_put(c, b, "30 bytes of tokens, no more...", 30) &&
+           cache_put(c, d, "30 bytes of tokens, no more...", 30);
+    if (pass) {
+        age(c, b, 1000);
+        age(c, d, 2000);
+        age(c, a, 3000);
+    }
+    pass = pass && cache_put(c, e, "30 bytes of tokens, no more...", 30) && cache_get_stats(c, &stats) &&
+           stats.size == 90 && !holds(c, b, "") && holds(c, a, "30 bytes of tokens, no more...") &&
+           holds(c, d, "30 bytes of tokens, no more...") && holds(c, e, "30 bytes of tokens, no more...");
+    printf("cache_put(evict LRU): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // Another process sees the counts of this one once it closes the cache
+    cache_t other = cache_open(dir, 100);
+    cache_stats_t seen;
+    pass = c && other && cache_get_stats(c, &stats) && !holds(c, b, "") &&
+           holds(c, a, "30 bytes of tokens, no more...") && cache_get_stats(other, &seen) && seen.hits == stats.hits && seen.misses == stats.misses;
+    cache_free(&c);
+    pass = pass && cache_get_stats(other, &seen) && seen.hits == stats.hits + 1 && seen.misses == stats.misses + 1;
+    printf("cache_free(counts): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    cache_free(&other);
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// Returns whether tokenizing the spans of src one by one gives the
+// tokens of the whole of it
+static int same_tokens(const char* src, const span_t* spans, int n) {
+    buf_t whole = buf_new(256), parts = buf_new(256);
+    tokenizer_t t = tokenizer_new();
+    int ok = whole && parts && t && tokenize_string(t, src, strlen(src));
+    tlist_t tokens = get_tokens(t);
+    ok = ok && tlist_format_tokens(whole, tokens);
+    tlist_free(&tokens);
+
+    for (int i = 0; ok && i < n; i++) {
+        ok = tokenize_string(t, src + spans[i].start, spans[i].end - spans[i].start);
+        tokens = get_tokens(t);
+        ok = ok && (!tokens || !parts->len || buf_put(parts, ", ", 2)) && tlist_format_tokens(parts, tokens);
+        tlist_free(&tokens);
+    }
+    ok = ok && whole->len == parts->len && !memcmp(whole->data, parts->data, whole->len);
+
+    tokenizer_free(&t);
+    buf_free(&whole);
+    buf_free(&parts);
+    return ok;
+}
+
+void incremental_compilation() {
+    printf("======================= Testing for incremental compilation ===============\n");
+
+    // Braces and semicolons in literals don't count
+    const char* src = "int x = 1;\nint f(int a) {\n    char* s = \"};\";\n    if (a) { return '}'; }\n    return a;\n}\n"
+                      "int g(void);\n\n";
+    span_t* spans = NULL;
+    int n = split_spans(src, strlen(src), &spans);
+    int pass = n == 4 && !spans[0].function && !strncmp(src + spans[0].start, "int x = 1;", spans[0].end) &&
+               spans[1].function && src[spans[1].end - 1] == '}' && spans[1].end - spans[1].start == 78 &&
+               !spans[2].function && spans[3].end == strlen(src) && same_tokens(src, spans, n);
+    printf("split_spans(): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    free(spans);
+
+    // Saved, loaded, and the fragments found by their hash
+    const char* base = "K_INT, I_IDENTIFIER(x)K_RETURN";
+    hash128_t a = hash128("a", 1, 0), b = hash128("b", 1, 0), c = hash128("c", 1, 0);
+    fragdb_t db = fragdb_new(), loaded = fragdb_new();
+    buf_t saved = buf_new(64);
+    pass = db && loaded && saved && fragdb_add(db, b, 22, 8) && fragdb_add(db, a, 0, 22) && fragdb_add(db, a, 0, 22) &&
+           fragdb_save(db, base, saved) && db->n == 2 && fragdb_load(loaded, saved->data, saved->len) &&
+           loaded->n == 2 && !fragdb_find(loaded, c);
+    const fragment_t* f = pass ? fragdb_find(loaded, b) : NULL;
+    pass = pass && f && f->len == 8 && !memcmp(loaded->base + f->off, "K_RETURN", 8);
+    printf("fragdb_save(), fragdb_load(): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // A truncated database is none
+    pass = saved && !fragdb_load(loaded, saved->data, saved->len - 1) && loaded->n == 0 &&
+           !fragdb_load(loaded, "DFDX", 4);
+    printf("fragdb_load(corrupt): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    buf_free(&saved);
+    fragdb_free(&loaded);
+    fragdb_free(&db);
+
+    // A lex error ends the output where tokenizing whole does, with the
+    // spans before it copied from an earlier compilation
+    const char* good = "int x = 1;\n";
+    const char* bad = "int x = 1;\nint f(void) { return 0x; }\nint y;\n";
+    buf_t full = buf_new(256), first = buf_new(256), inc = buf_new(256);
+    db = fragdb_new();
+    loaded = fragdb_new();
+    fragdb_t now = fragdb_new();
+    saved = buf_new(256);
+    tokenizer_t t = tokenizer_new();
+    incremental_stats_t stats = {0, 0};
+    pass = full && first && inc && db && loaded && now && saved && t && !tokenize_string(t, bad, strlen(bad));
+    tlist_t tokens = get_tokens(t);
+    pass = pass && tlist_format(full, tokens) && tokenize_spans(good, strlen(good), loaded, db, first, &stats) &&
+           fragdb_save(db, first->data, saved) && fragdb_load(loaded, saved->data, saved->len);
+    stats = (incremental_stats_t){0, 0};
+    pass = pass && !tokenize_spans(bad, strlen(bad), loaded, now, inc, &stats) && stats.spans == 4 &&
+           stats.regenerated == 1 && inc->len == full->len && !memcmp(inc->data, full->data, full->len);
+    printf("tokenize_spans(lex error): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    tlist_free(&tokens);
+    tokenizer_free(&t);
+    buf_free(&saved);
+    fragdb_free(&now);
+    fragdb_free(&loaded);
+    fragdb_free(&db);
+    buf_free(&inc);
+    buf_free(&first);
+    buf_free(&full);
+}
+
+// What the server thread of the test got
+typedef struct served {
+    int sock;
+    int ok;
+} served_t;
+
+static void* serve_one(void* arg) {
+    served_t* s = (served_t*)arg;
+    request_t r;
+    if (server_accept(s->sock, 5000, &r) == 1) {
+        const char* cache_dir = request_getenv(&r, "DISA_CACHE_DIR");
+        s->ok = r.argc == 3 && !strcmp(r.argv[1], "-I") && !strcmp(r.argv[2], "a b") && !r.argv[3] && r.cwd[0] == '/' &&
+                cache_dir && !strcmp(cache_dir, "/tmp/x") && r.fds[1] >= 0;
+        server_reply(&r, 7);
+        request_free(&r);
+    }
+    return NULL;
+}
+
+void compile_server() {
+    printf("======================= Testing for the compile server ====================\n");
+
+    // The least recently used entries go first, those too big aren't kept
+    memstore_t m = memstore_new(10);
+    hash128_t a = hash128("a", 1, 0), b = hash128("b", 1, 0), c = hash128("c", 1, 0);
+    size_t len = 0;
+    int pass = m && memstore_put(m, a, "aaaa", 4) && memstore_put(m, b, "bbbb", 4) && memstore_get(m, a, &len) &&
+               memstore_put(m, c, "cccc", 4) && !memstore_get(m, b, &len) && memstore_get(m, c, &len) && len == 4 &&
+               !memstore_put(m, b, "bbbbbbbbbbb", 11) && memstore_size(m, NULL) == 8;
+    printf("memstore_put(evict): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // Replaced in place, and expired by the time of their last use
+    const char* p = pass && memstore_put(m, a, "AA", 2) ? (const char*)memstore_get(m, a, &len) : NULL;
+    int n = 0;
+    pass = p && len == 2 && !memcmp(p, "AA", 2) && memstore_size(m, &n) == 6 && n == 2;
+    memstore_expire(m, time(NULL) + 1);
+    pass = pass && memstore_size(m, &n) == 0 && n == 0 && !memstore_get(m, a, &len);
+    printf("memstore_expire(): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    memstore_free(&m);
+
+    // A request goes through with its arguments, directory, environment
+    // and standard streams, the exit status comes back
+    char dir[] = "/tmp/disa_server_XXXXXX", path[256];
+    pass = mkdtemp(dir) != NULL;
+    snprintf(path, sizeof(path), "%s/s.sock", dir);
+    served_t s = {pass ? server_listen(path) : -1, 0};
+    pthread_t server;
+    pass = s.sock >= 0 && !pthread_create(&server, NULL, serve_one, &s);
+    char* argv[] = {"disa", "-I", "a b", NULL};
+    setenv("DISA_CACHE_DIR", "/tmp/x", 1);
+    int status = pass ? client_run(path, 3, argv) : -1;
+    unsetenv("DISA_CACHE_DIR");
+    if (pass) {
+        pthread_join(server, NULL);
+    }
+    pass = pass && status == 7 && s.ok;
+    printf("client_run(): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // With the server gone, no one answers
+    if (s.sock >= 0) {
+        close(s.sock);
+    }
+    int again = client_run(path, 3, argv) == -1 ? server_listen(path) : -1;
+    printf("client_run(no server): %s\n", again >= 0 ? "✅ OK" : "❌ FAIL");
+    if (again >= 0) {
+        close(again);
+    }
+
+    remove(path);
+    rmdir(dir);
+}
+
+void time_report() {
+    printf("========================= Testing for the time report =====================\n");
+
+    // What's done in a phase is charged to it, the rest to other. The
+    // allocations are counted only with the allocount object linked in.
+    timereport_start();
+    phase_t prev = phase_enter(PHASE_LEX);
+    char* volatile p = (char*)malloc(100);
+    free(p);
+    phase_leave(prev);
+    phase_stats_t lex = timereport_get(PHASE_LEX), total = timereport_get(PHASE_COUNT);
+    int pass = prev == PHASE_OTHER && lex.calls == 1 && lex.wall_ns > 0 && lex.cpu_ns >= 0 &&
+               lex.rss_high_water_kb > 0;
+    pass = pass && (allocount_get ? lex.allocs >= 1 && lex.alloc_bytes >= 100 : !lex.allocs && !lex.alloc_bytes);
+    pass = pass && total.calls == 2 && total.wall_ns >= lex.wall_ns && timereport_get(PHASE_CODEGEN).calls == 0;
+    printf("timereport_get(): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // The aligned allocations and reallocarray count too
+    int64_t before = 0, after = 0, n = allocount_get ? allocount_get(&before) : 0;
+    void* a = NULL;
+    pass = !posix_memalign(&a, 64, 256);
+    free(a);
+    a = aligned_alloc(64, 128);
+    pass = pass && a;
+    free(a);
+    a = reallocarray(NULL, 16, 8);
+    pass = pass && a;
+    free(a);
+    n = allocount_get ? allocount_get(&after) - n : 3;
+    pass = pass && n == 3 && (!allocount_get || after - before == 256 + 128 + 128);
+    printf("allocount_get(aligned, reallocarray): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // Only the phases entered are listed
+    FILE* f = tmpfile();
+    char out[4096] = {0};
+    if (f) {
+        timereport_print(f, 1);
+        rewind(f);
+        out[fread(out, 1, sizeof(out) - 1, f)] = '\0';
+        fclose(f);
+    }
+    pass = strstr(out, "\"phases\"") && strstr(out, "\"lex\"") && strstr(out, "\"total\"") && !strstr(out, "\"codegen\"");
+    printf("timereport_print(json): %s\n", pass ? "✅ OK" : "❌ FAIL");
+}
@@ -0,0 +1,1164 @@
+#include "tests.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include "codegen/abi.h"
+#include "codegen/arith.h"
+#include "codegen/compress.h"
+#include "codegen/cond.h"
+#include "codegen/dce.h"
+#include "codegen/emit.h"
+#include "codegen/encode.h"
+#include "codegen/frame.h"
+#include "codegen/gvn.h"
+#include "codegen/inline.h"
+#include "codegen/loop.h"
+#include "codegen/object.h"
+#include "codegen/regalloc.h"
+#include "codegen/sched.h"
+#include "codegen/target.h"
+#include "machine.h"
+
+// Evaluates the straight-line code of f with x in a0 and
+// returns the value of a1 at the end. Helper calls are
+// evaluated with the host arithmetic, sp points to the
+// bottom of a small stack.
+static uint32_t eval(mfunc_t f, uint32_t x) {
+    uint32_t* regs = calloc(R_VIRT + f->nvregs, sizeof(uint32_t));
+    uint32_t stack[256] = {0};
+    regs[R_A0] = x;
+
+    for (inst_t i = f->head; i; i = i->next) {
+        uint32_t a = i->rs1 >= 0 ? regs[i->rs1] : 0;
+        uint32_t b = i->rs2 >= 0 ? regs[i->rs2] : 0;
+        uint32_t imm = (uint32_t)i->imm;
+        uint32_t r = 0;
+
+        switch (i->op) {
+            case OP_ADDI: r = a + imm; break;
+            case OP_ANDI: r = a & imm; break;
+            case OP_XORI: r = a ^ imm; break;
+            case OP_SLLI: r = a << imm; break;
+            case OP_SRLI: r = a >> imm; break;
+            case OP_SRAI: r = (uint32_t)((int32_t)a >> imm); break;
+            case OP_ADD: r = a + b; break;
+            case OP_SUB: r = a - b; break;
+            case OP_SLTU: r = a < b; break;
+            case OP_SLT: r = (int32_t)a < (int32_t)b; break;
+            case OP_XOR: r = a ^ b; break;
+            case OP_AND: r = a & b; break;
+            case OP_OR: r = a | b; break;
+            case OP_LI: r = imm; break;
+            case OP_LW: r = stack[((a + imm) / 4) % 256]; break;
+            case OP_SW: stack[((a + imm) / 4) % 256] = b; continue;
+            case OP_CALL: {
+                uint32_t n = regs[R_A0], d = regs[R_A1];
+                if (!strcmp(i->sym, ARITH_MUL_HELPER)) {
+                    r = n * d;
+                } else if (!strcmp(i->sym, ARITH_UDIV_HELPER)) {
+                    r = n / d;
+                } else if (!strcmp(i->sym, ARITH_UMOD_HELPER)) {
+                    r = n % d;
+                } else if (!strcmp(i->sym, ARITH_DIV_HELPER)) {
+                    r = (uint32_t)((int32_t)n / (int32_t)d);
+                } else {
+                    r = (uint32_t)((int32_t)n % (int32_t)d);
+                }
+                regs[R_A0] = r;
+                continue;
+            }
+            default: {
+                fprintf(stderr, "eval: unsupported instruction %s\n", opcode_to_str(i->op));
+                break;
+            }
+        }
+
+        if (i->rd > 0) {
+            regs[i->rd] = r;
+        }
+    }
+
+    uint32_t res = regs[R_A1];
+    free(regs);
+    return res;
+}
+
+static uint32_t reference(token_type_t op, uint32_t x, int32_t c, int is_unsigned) {
+    if (op == AO_MUL) {
+        return x * (uint32_t)c;
+    }
+
+    if (is_unsigned) {
+        return op == AO_DIV ? x / (uint32_t)c : x % (uint32_t)c;
+    }
+
+    // INT32_MIN / -1 overflows in C, RV32 wraps around
+    if ((int32_t)x == INT32_MIN && c == -1) {
+        return op == AO_DIV ? x : 0;
+    }
+    return op == AO_DIV ? (uint32_t)((int32_t)x / c) : (uint32_t)((int32_t)x % c);
+}
+
+static void run_arith_test(token_type_t op, int32_t c, int is_unsigned) {
+    static const uint32_t inputs[] = {0,          1,          2,          3,          7,          9,
+                                      10,         99,         100,        12345,      65535,      65536,
+                                      0x7FFFFFFE, 0x7FFFFFFF, 0x80000000, 0x80000001, 0xFFFFFFFF, 0xFFFFFFFE,
+                                      0xFFFFFFF9, 0xFFFF0000, 0xDEADBEEF, 1234567891, 4000000000u};
+
+    mfunc_t f = mfunc_new("test");
+    int ok = arith_lower_const(f, op, R_A1, R_A0, c, is_unsigned);
+
+    uint32_t x = 0, got = 0, expected = 0;
+    uint32_t seed = 12345;
+    for (int n = 0; ok && n < 2000; n++) {
+        if (n < (int)(sizeof(inputs) / sizeof(inputs[0]))) {
+            x = inputs[n];
+        } else {
+            seed = seed * 1103515245u + 12345u;
+            x = seed ^ (seed >> 7);
+        }
+
+        got = eval(f, x);
+        expected = reference(op, x, c, is_unsigned);
+        if (got != expected) {
+            ok = 0;
+        }
+    }
+
+    printf("arith_lower_const(%s, %s%d): %s (%d insts)\n", token_type_to_str(op), is_unsigned ? "(unsigned) " : "", c,
+           ok ? "✅ OK" : "❌ FAIL", f->ninsts);
+    if (!ok) {
+        printf("\t-x: %u, expected: %u, got: %u\n", x, expected, got);
+        mfunc_print(f);
+    }
+
+    mfunc_free(&f);
+}
+
+void arith_lowering() {
+    printf("======================= Testing for arithmetic lowering ===================\n");
+
+    static const int32_t constants[] = {1,    -1,    2,     -2,     3,       5,          7,         -7,
+                                        10,   12,    16,    -16,    100,     641,        1000,      4096,
+                                        7919, 65536, 99999, -99999, 1 << 30, 0x7FFFFFFF, INT32_MIN, 0};
+    static const int32_t uconstants[] = {1,     2,         3,          7,          10,         641,
+                                         65536, 1000000,   0x7FFFFFFF, (int32_t)0x80000001u, (int32_t)0xFFFFFFFFu,
+                                         (int32_t)0x80000000u};
+
+    for (size_t i = 0; i < sizeof(constants) / sizeof(constants[0]); i++) {
+        run_arith_test(AO_MUL, constants[i], 0);
+        if (constants[i]) {
+            run_arith_test(AO_DIV, constants[i], 0);
+            run_arith_test(AO_MOD, constants[i], 0);
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(uconstants) / sizeof(uconstants[0]); i++) {
+        run_arith_test(AO_DIV, uconstants[i], 1);
+        run_arith_test(AO_MOD, uconstants[i], 1);
+    }
+
+    // The usual divisors are expanded inline, signed or not
+    static const int32_t inlined[] = {3, 10, 1000};
+    int pass = 1;
+    for (size_t i = 0; i < sizeof(inlined) / sizeof(inlined[0]); i++) {
+        for (int k = 0; k < 4; k++) {
+            mfunc_t f = mfunc_new("test");
+            pass = pass && arith_lower_const(f, k & 1 ? AO_MOD : AO_DIV, R_A1, R_A0, inlined[i], k >> 1);
+            for (inst_t inst = f->head; inst; inst = inst->next) {
+                pass = pass && inst->op != OP_CALL;
+            }
+            mfunc_free(&f);
+        }
+    }
+    printf("arith_lower_const(3, 10, 1000 without calls): %s\n", pass ? "✅ OK" : "❌ FAIL");
+}
+
+static void run_emit_test(const char* label, mfunc_t f, const char* expected) {
+    FILE* tmp = tmpfile();
+    emitter_t e = emitter_new(fileno(tmp));
+    emit_function(e, f);
+    emitter_free(&e);
+
+    char got[1024] = {0};
+    rewind(tmp);
+    size_t n = fread(got, 1, sizeof(got) - 1, tmp);
+    got[n] = '\0';
+    fclose(tmp);
+
+    int pass = !strcmp(got, expected);
+    printf("%s: %s\n", label, pass ? "✅ OK" : "❌ FAIL");
+    if (!pass) {
+        printf("\t-expected:\n%s\t-got:\n%s", expected, got);
+    }
+}
+
+void asm_emission() {
+    printf("======================= Testing for assembly emission =====================\n");
+
+    mfunc_t f = mfunc_new("fn");
+    int loop = mfunc_new_label(f);
+    int v = mfunc_new_vreg(f);
+    mfunc_append(f, inst_new_i(OP_ADDI, v, R_ZERO, R_NONE, 0));
+    mfunc_append(f, inst_new_label(loop));
+    mfunc_append(f, inst_new_r(OP_ADD, v, v, R_A0));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A0, R_A0, R_NONE, -1));
+    mfunc_append(f, inst_new_branch(OP_BNE, R_NONE, R_A0, R_ZERO, loop));
+    mfunc_append(f, inst_new_i(OP_SW, R_NONE, R_SP, v, 12));
+    mfunc_append(f, inst_new_i(OP_LUI, R_T0, R_NONE, R_NONE, 0x12345000));
+    mfunc_append(f, inst_new_i(OP_LI, R_A1, R_NONE, R_NONE, -2147483647 - 1));
+    mfunc_append(f, inst_new_sym(OP_CALL, R_RA, "__mulsi3"));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A0, v, R_NONE, 0));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+
+    run_emit_test("emit_function(fn)", f,
+                  "\n    .text\n    .globl fn\n    .type fn, @function\n    .p2align 2\nfn:\n"
+                  "    li v0, 0\n"
+                  ".Lfn_0:\n"
+                  "    add v0, v0, a0\n"
+                  "    addi a0, a0, -1\n"
+                  "    bnez a0, .Lfn_0\n"
+                  "    sw v0, 12(sp)\n"
+                  "    lui t0, 74565\n"
+                  "    li a1, -2147483648\n"
+                  "    call __mulsi3\n"
+                  "    mv a0, v0\n"
+                  "    ret\n"
+                  "    .size fn, .-fn\n");
+
+    mfunc_free(&f);
+}
+
+void object_emission() {
+    printf("======================= Testing for object emission =======================\n");
+
+    module_t m = module_new();
+    mfunc_t f = mfunc_new("sum");
+    int loop = mfunc_new_label(f);
+    mfunc_append(f, inst_new_i(OP_ADDI, R_T0, R_ZERO, R_NONE, 0));
+    mfunc_append(f, inst_new_label(loop));
+    mfunc_append(f, inst_new_r(OP_ADD, R_T0, R_T0, R_A0));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A0, R_A0, R_NONE, -1));
+    mfunc_append(f, inst_new_branch(OP_BNE, R_NONE, R_A0, R_ZERO, loop));
+    mfunc_append(f, inst_new_sym(OP_LA, R_A1, "table"));
+    mfunc_append(f, inst_new_i(OP_LW, R_A2, R_A1, R_NONE, 4));
+    mfunc_append(f, inst_new_i(OP_SW, R_NONE, R_SP, R_A2, -8));
+    mfunc_append(f, inst_new_i(OP_LI, R_A3, R_NONE, R_NONE, 0x12345fff));
+    mfunc_append(f, inst_new_sym(OP_CALL, R_RA, "__mulsi3"));
+    mfunc_append(f, inst_new_sym(OP_TAIL, R_NONE, "sum"));
+    module_add_function(m, f);
+
+    int32_t table[] = {1, 2, 3};
+    module_add_data(m, "table", SEC_DATA, table, sizeof(table), 4);
+
+    // Reference encodings from llvm-mc -triple=riscv32
+    static const uint32_t expected[] = {0x00000293, 0x00a282b3, 0xfff50513, 0xfe051ce3, 0x000005b7,
+                                        0x00058593, 0x0045a603, 0xfec12c23, 0x123466b7, 0xfff68693,
+                                        0x00000097, 0x000080e7, 0x00000317, 0x00030067};
+    size_t nexpected = sizeof(expected) / sizeof(expected[0]);
+
+    buf_t code = buf_new(64);
+    relocs_t relocs = relocs_new();
+    int pass = encode_function(f, code, relocs) && code->len == 4 * nexpected;
+    for (size_t i = 0; pass && i < nexpected; i++) {
+        uint32_t word;
+        memcpy(&word, code->data + 4 * i, 4);
+        pass = word == expected[i];
+    }
+    printf("encode_function(sum): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    pass = relocs->n == 4 && relocs->items[0].type == R_RISCV_HI20 && relocs->items[0].offset == 0x10 &&
+           relocs->items[1].type == R_RISCV_LO12_I && relocs->items[1].offset == 0x14 &&
+           relocs->items[2].type == R_RISCV_CALL && !strcmp(relocs->items[2].sym, "__mulsi3") &&
+           relocs->items[3].type == R_RISCV_CALL && relocs->items[3].offset == 0x30;
+    printf("encode_function(sum) relocations: %s\n", pass ? "✅ OK" : "❌ FAIL");
+    relocs_free(&relocs);
+    buf_free(&code);
+
+    // Virtual registers must have been allocated before encoding
+    mfunc_t g = mfunc_new("virt");
+    mfunc_append(g, inst_new_r(OP_ADD, mfunc_new_vreg(g), R_A0, R_A1));
+    code = buf_new(64);
+    relocs = relocs_new();
+    pass = !encode_function(g, code, relocs);
+    printf("encode_function(virt) rejected: %s\n", pass ? "✅ OK" : "❌ FAIL");
+    relocs_free(&relocs);
+    buf_free(&code);
+    mfunc_free(&g);
+
+    FILE* tmp = tmpfile();
+    pass = object_write(m, fileno(tmp));
+
+    Elf32_Ehdr eh;
+    Elf32_Shdr text;
+    rewind(tmp);
+    pass = pass && fread(&eh, sizeof(eh), 1, tmp) == 1 && !memcmp(eh.e_ident, ELFMAG, SELFMAG) &&
+           eh.e_ident[EI_CLASS] == ELFCLASS32 && eh.e_type == ET_REL && eh.e_machine == EM_RISCV;
+    pass = pass && !fseek(tmp, eh.e_shoff + sizeof(Elf32_Shdr), SEEK_SET) && fread(&text, sizeof(text), 1, tmp) == 1 &&
+           text.sh_type == SHT_PROGBITS && text.sh_size == 4 * nexpected;
+    printf("object_write(module): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    fclose(tmp);
+
+    module_free(&m);
+}
+
+void string_pool() {
+    printf("======================= Testing for string pooling ========================\n");
+
+    // Duplicates share a symbol, "dog" is the tail of "lazy dog"
+    module_t m = module_new();
+    const char* lazy = module_add_string(m, "lazy dog", 9);
+    const char* dog = module_add_string(m, "dog", 4);
+    const char* again = module_add_string(m, "lazy dog", 9);
+    const char* cat = module_add_string(m, "cat", 4);
+    int pass = lazy && dog && cat && again == lazy && strcmp(lazy, dog) && strcmp(dog, cat) && m->nstrings == 3;
+    printf("module_add_string(duplicates): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    mfunc_t f = mfunc_new("strs");
+    mfunc_append(f, inst_new_sym(OP_LA, R_A0, dog));
+    mfunc_append(f, inst_new_sym(OP_LA, R_A1, cat));
+    mfunc_append(f, inst_new_sym(OP_LA, R_A2, lazy));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+    module_add_function(m, f);
+
+    int ok = module_pool_strings(m) && module_pool_strings(m);
+    mdata_t pool = m->ndata == 1 ? m->data[0] : NULL;
+    inst_t la = f->head;
+    pass = ok && pool && !strcmp(pool->name, MODULE_STRINGS) && pool->section == SEC_RODATA &&
+           pool->align == MODULE_STRINGS_ALIGN && pool->size == 13 && !memcmp(pool->bytes, "lazy dog\0cat", 13) &&
+           !strcmp(la->sym, MODULE_STRINGS) && la->imm == 5 && la->next->imm == 9 && la->next->next->imm == 0 &&
+           !module_add_string(m, "late", 5);
+    printf("module_pool_strings(suffix): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // The offset is the addend of both relocations of the address pair
+    buf_t code = buf_new(64);
+    relocs_t relocs = relocs_new();
+    pass = encode_function(f, code, relocs) && relocs->n == 6 && relocs->items[0].addend == 5 &&
+           relocs->items[1].addend == 5 && !strcmp(relocs->items[2].sym, MODULE_STRINGS);
+    printf("encode_function(la .strings+5): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    relocs_free(&relocs);
+    buf_free(&code);
+
+    module_free(&m);
+
+    // Each module has its own pool: main returns "A"[0] + "BB"[1]
+    // through other, defined in a second module with its own literal
+    const char* paths[] = {"/tmp/disa_pool_test_1.o", "/tmp/disa_pool_test_2.o"};
+    ok = 1;
+    for (int k = 0; k < 2; k++) {
+        m = module_new();
+        f = mfunc_new(k ? "other" : "main");
+        const char* s = k ? module_add_string(m, "BB", 3) : module_add_string(m, "A", 2);
+        mfunc_append(f, inst_new_sym(OP_LA, R_A1, s));
+        mfunc_append(f, inst_new_i(OP_LBU, R_A1, R_A1, R_NONE, k));
+        if (k) {
+            mfunc_append(f, inst_new_r(OP_ADD, R_A0, R_A0, R_A1));
+            mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+        } else {
+            mfunc_append(f, inst_new_i(OP_ADDI, R_A0, R_A1, R_NONE, 0));
+            mfunc_append(f, inst_new_sym(OP_TAIL, R_NONE, "other"));
+        }
+        module_add_function(m, f);
+
+        FILE* fp = fopen(paths[k], "w");
+        ok = ok && fp && object_write(m, fileno(fp));
+        if (fp) {
+            fclose(fp);
+        }
+        module_free(&m);
+    }
+
+    machine_t sim = machine_new(MACHINE_BASE, MACHINE_MEM_SIZE);
+    pass = ok && sim && machine_load(sim, (char**)paths, 2, "main") && machine_run(sim) &&
+           sim->exit_code == 'A' + 'B';
+    printf("machine_load(two modules with literals): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    machine_free(&sim);
+    remove(paths[0]);
+    remove(paths[1]);
+
+    // Nor is it made global in the assembly
+    m = module_new();
+    f = mfunc_new("str");
+    mfunc_append(f, inst_new_sym(OP_LA, R_A0, module_add_string(m, "A", 2)));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+    module_add_function(m, f);
+
+    FILE* tmp = tmpfile();
+    emitter_t e = emitter_new(fileno(tmp));
+    ok = module_pool_strings(m) && emit_module(e, m);
+    emitter_free(&e);
+    char got[1024] = {0};
+    rewind(tmp);
+    got[fread(got, 1, sizeof(got) - 1, tmp)] = '\0';
+    fclose(tmp);
+    pass = ok && strstr(got, MODULE_STRINGS ":\n") && !strstr(got, ".globl " MODULE_STRINGS);
+    printf("emit_module(local .strings): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    module_free(&m);
+}
+
+void register_allocation() {
+    printf("======================= Testing for register allocation ===================\n");
+
+    // More values live at once than there are registers
+    mfunc_t f = mfunc_new("pressure");
+    int v[40];
+    for (int k = 0; k < 40; k++) {
+        v[k] = mfunc_new_vreg(f);
+        mfunc_append(f, inst_new_i(OP_ADDI, v[k], R_A0, R_NONE, k * k));
+    }
+    int sum = mfunc_new_vreg(f);
+    mfunc_append(f, inst_new_i(OP_LI, sum, R_NONE, R_NONE, 0));
+    for (int k = 39; k >= 0; k--) {
+        int next = mfunc_new_vreg(f);
+        mfunc_append(f, inst_new_r(k % 2 ? OP_ADD : OP_SUB, next, sum, v[k]));
+        sum = next;
+    }
+    mfunc_append(f, inst_new_r(OP_ADD, R_A1, sum, sum));
+
+    uint32_t expected = eval(f, 1000);
+    int ok = regalloc(f, NULL);
+
+    int virt = 0, spills = 0;
+    for (inst_t i = f->head; i; i = i->next) {
+        virt |= reg_is_virtual(i->rd) || reg_is_virtual(i->rs1) || reg_is_virtual(i->rs2);
+        spills += i->op == OP_SW;
+    }
+
+    int pass = ok && !virt && spills > 0 && eval(f, 1000) == expected;
+    printf("regalloc(pressure): %s (%d spills)\n", pass ? "✅ OK" : "❌ FAIL", spills);
+    if (!pass) {
+        mfunc_print(f);
+    }
+    mfunc_free(&f);
+
+    // A value live across a call has to survive it
+    f = mfunc_new("across");
+    int a = mfunc_new_vreg(f), b = mfunc_new_vreg(f);
+    mfunc_append(f, inst_new_i(OP_ADDI, a, R_A0, R_NONE, 1));
+    mfunc_append(f, inst_new_i(OP_ADDI, b, R_A0, R_NONE, 2));
+    mfunc_append(f, inst_new_sym(OP_CALL, R_RA, "g"));
+    mfunc_append(f, inst_new_r(OP_ADD, R_A1, a, R_ZERO));
+    ok = regalloc(f, NULL);
+    pass = ok && reg_is_callee_saved(f->head->rd) && !reg_is_callee_saved(f->head->next->rd);
+    printf("regalloc(across): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    mfunc_free(&f);
+}
+
+void dead_code_elimination() {
+    printf("===================== Testing for dead code elimination ===================\n");
+
+    // if (3 < 5) a1 = a0 + a0; else a1 = a0 + 1; with a dead value
+    mfunc_t f = mfunc_new("dead");
+    int x = mfunc_new_vreg(f), y = mfunc_new_vreg(f), c = mfunc_new_vreg(f), unused = mfunc_new_vreg(f);
+    int other = mfunc_new_label(f), done = mfunc_new_label(f);
+    mfunc_append(f, inst_new_i(OP_LI, x, R_NONE, R_NONE, 3));
+    mfunc_append(f, inst_new_i(OP_LI, y, R_NONE, R_NONE, 5));
+    mfunc_append(f, inst_new_r(OP_SLT, c, x, y));
+    mfunc_append(f, inst_new_branch(OP_BEQ, R_NONE, c, R_ZERO, other));
+    mfunc_append(f, inst_new_i(OP_SLLI, unused, R_A0, R_NONE, 3));
+    mfunc_append(f, inst_new_r(OP_ADD, R_A1, R_A0, R_A0));
+    mfunc_append(f, inst_new_branch(OP_JAL, R_ZERO, R_NONE, R_NONE, done));
+    mfunc_append(f, inst_new_label(other));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A1, R_A0, R_NONE, 1));
+    mfunc_append(f, inst_new_label(done));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+
+    dce_stats_t stats = {0};
+    int ok = dce(f, &stats);
+    int pass = ok && f->ninsts == 2 && f->head->op == OP_ADD && inst_is_ret(f->tail) && stats.folded == 1 &&
+               stats.blocks == 1 && stats.insts == 6;
+    printf("dce(constant branch): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    if (!pass) {
+        mfunc_print(f);
+    }
+    mfunc_free(&f);
+
+    // A loop keeps the values it carries, a store keeps its operands
+    f = mfunc_new("loop");
+    int i = mfunc_new_vreg(f), dead = mfunc_new_vreg(f);
+    int loop = mfunc_new_label(f);
+    mfunc_append(f, inst_new_i(OP_LI, i, R_NONE, R_NONE, 10));
+    mfunc_append(f, inst_new_label(loop));
+    mfunc_append(f, inst_new_i(OP_ADDI, dead, i, R_NONE, 7));
+    mfunc_append(f, inst_new_i(OP_SW, R_NONE, R_SP, i, 0));
+    mfunc_append(f, inst_new_i(OP_ADDI, i, i, R_NONE, -1));
+    mfunc_append(f, inst_new_branch(OP_BNE, R_NONE, i, R_ZERO, loop));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+
+    stats = (dce_stats_t){0};
+    ok = dce(f, &stats);
+    pass = ok && f->ninsts == 6 && stats.insts == 1 && stats.folded == 0;
+    printf("dce(loop): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    if (!pass) {
+        mfunc_print(f);
+    }
+    mfunc_free(&f);
+
+    // A block only reached by a jump moves in place of the jump
+    f = mfunc_new("chain");
+    int far = mfunc_new_label(f), skip = mfunc_new_label(f);
+    mfunc_append(f, inst_new_branch(OP_BEQ, R_NONE, R_A0, R_ZERO, skip));
+    mfunc_append(f, inst_new_branch(OP_JAL, R_ZERO, R_NONE, R_NONE, far));
+    mfunc_append(f, inst_new_label(skip));
+    mfunc_append(f, inst_new_i(OP_LI, R_A0, R_NONE, R_NONE, 1));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+    mfunc_append(f, inst_new_label(far));
+    mfunc_append(f, inst_new_i(OP_LI, R_A0, R_NONE, R_NONE, 2));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+
+    stats = (dce_stats_t){0};
+    ok = dce(f, &stats);
+    inst_t second = f->head ? f->head->next : NULL;
+    pass = ok && f->ninsts == 6 && stats.merged == 1 && second && second->op == OP_LI && second->imm == 2;
+    printf("dce(chain): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    if (!pass) {
+        mfunc_print(f);
+    }
+    mfunc_free(&f);
+}
+
+// twice(x) = x + x, fact(n) recursive, main calls both
+static module_t inlining_module() {
+    module_t m = module_new();
+
+    mfunc_t f = mfunc_new("twice");
+    int x = mfunc_new_vreg(f), y = mfunc_new_vreg(f);
+    mfunc_append(f, inst_new_i(OP_ADDI, x, R_A0, R_NONE, 0));
+    mfunc_append(f, inst_new_r(OP_ADD, y, x, x));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A0, y, R_NONE, 0));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+    module_add_function(m, f);
+
+    f = mfunc_new("fact");
+    int done = mfunc_new_label(f);
+    mfunc_append(f, inst_new_branch(OP_BEQ, R_NONE, R_A0, R_ZERO, done));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A0, R_A0, R_NONE, -1));
+    mfunc_append(f, inst_new_sym(OP_CALL, R_RA, "fact"));
+    mfunc_append(f, inst_new_label(done));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+    module_add_function(m, f);
+
+    f = mfunc_new("main");
+    mfunc_append(f, inst_new_sym(OP_CALL, R_RA, "twice"));
+    mfunc_append(f, inst_new_sym(OP_CALL, R_RA, "fact"));
+    mfunc_append(f, inst_new_sym(OP_TAIL, R_NONE, "twice"));
+    module_add_function(m, f);
+
+    return m;
+}
+
+static int count_calls(mfunc_t f, const char* name) {
+    int n = 0;
+    for (inst_t i = f->head; i; i = i->next) {
+        n += (i->op == OP_CALL || i->op == OP_TAIL) && !strcmp(i->sym, name);
+    }
+    return n;
+}
+
+void function_inlining() {
+    printf("======================= Testing for function inlining =====================\n");
+
+    module_t m = inlining_module();
+    int ok = inline_module(m, 16, 100, NULL);
+    mfunc_t main_f = module_find_function(m, "main");
+    mfunc_t fact = module_find_function(m, "fact");
+
+    int rets = 0, jumps = 0;
+    for (inst_t i = main_f->head; i; i = i->next) {
+        rets += inst_is_ret(i);
+        jumps += i->op == OP_JAL;
+    }
+
+    // The tail call site keeps the callee's return, the other one jumps past it
+    int pass = ok && !count_calls(main_f, "twice") && count_calls(main_f, "fact") == 1 &&
+               count_calls(fact, "fact") == 1 && rets == 1 && jumps == 1 && main_f->nvregs == 4;
+    printf("inline_module(small callees): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    if (!pass) {
+        mfunc_print(main_f);
+    }
+    module_free(&m);
+
+    m = inlining_module();
+    ok = inline_module(m, 16, 0, NULL);
+    pass = ok && count_calls(module_find_function(m, "main"), "twice") == 2;
+    printf("inline_module(no growth budget): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    module_free(&m);
+
+    m = inlining_module();
+    ok = inline_module(m, 3, 100, NULL);
+    pass = ok && count_calls(module_find_function(m, "main"), "twice") == 2;
+    printf("inline_module(over threshold): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    module_free(&m);
+}
+
+// Runs a function made of li, addi, sub, slt, labels, jumps and branches
+// from a0 = x and a1 = y, and returns a2
+static uint32_t run_branches(mfunc_t f, uint32_t x, uint32_t y) {
+    uint32_t* regs = calloc(R_VIRT + f->nvregs, sizeof(uint32_t));
+    regs[R_A0] = x;
+    regs[R_A1] = y;
+
+    for (inst_t i = f->head; i; i = i->next) {
+        uint32_t a = i->rs1 >= 0 ? regs[i->rs1] : 0;
+        uint32_t b = i->rs2 >= 0 ? regs[i->rs2] : 0;
+        int jump = 0;
+
+        switch (i->op) {
+            case OP_LI: regs[i->rd] = (uint32_t)i->imm; break;
+            case OP_ADDI: regs[i->rd] = a + (uint32_t)i->imm; break;
+            case OP_SUB: regs[i->rd] = a - b; break;
+            case OP_SLT: regs[i->rd] = (int32_t)a < (int32_t)b; break;
+            case OP_BEQ: jump = a == b; break;
+            case OP_BNE: jump = a != b; break;
+            case OP_BLT: jump = (int32_t)a < (int32_t)b; break;
+            case OP_BGE: jump = (int32_t)a >= (int32_t)b; break;
+            case OP_BLTU: jump = a < b; break;
+            case OP_BGEU: jump = a >= b; break;
+            case OP_JAL: jump = 1; break;
+            case OP_LABEL: break;
+            default: fprintf(stderr, "run_branches: unsupported instruction %s\n", opcode_to_str(i->op)); break;
+        }
+
+        if (jump) {
+            inst_t target = f->head;
+            while (target && !(target->op == OP_LABEL && target->label == i->label)) {
+                target = target->next;
+            }
+            i = target;
+        }
+        if (!i) {
+            break;
+        }
+    }
+
+    uint32_t res = regs[R_A2];
+    free(regs);
+    return res;
+}
+
+void loop_optimization() {
+    printf("====================== Testing for loop optimizations =====================\n");
+
+    // for (i = 0; i < 10; i++) sum += i * s;
+    mfunc_t f = mfunc_new("loop");
+    int n = mfunc_new_vreg(f), s = mfunc_new_vreg(f), i = mfunc_new_vreg(f), sum = mfunc_new_vreg(f);
+    int t = mfunc_new_vreg(f), p = mfunc_new_vreg(f), next = mfunc_new_vreg(f), step = mfunc_new_vreg(f);
+    int loop = mfunc_new_label(f), done = mfunc_new_label(f);
+    mfunc_append(f, inst_new_i(OP_ADDI, s, R_A0, R_NONE, 0));
+    mfunc_append(f, inst_new_i(OP_LI, i, R_NONE, R_NONE, 0));
+    mfunc_append(f, inst_new_i(OP_LI, sum, R_NONE, R_NONE, 0));
+    mfunc_append(f, inst_new_label(loop));
+    mfunc_append(f, inst_new_i(OP_LI, n, R_NONE, R_NONE, 10));
+    mfunc_append(f, inst_new_r(OP_SLT, t, i, n));
+    mfunc_append(f, inst_new_branch(OP_BEQ, R_NONE, t, R_ZERO, done));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A0, i, R_NONE, 0));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A1, s, R_NONE, 0));
+    mfunc_append(f, inst_new_sym(OP_CALL, R_RA, ARITH_MUL_HELPER));
+    mfunc_append(f, inst_new_i(OP_ADDI, p, R_A0, R_NONE, 0));
+    mfunc_append(f, inst_new_r(OP_ADD, next, sum, p));
+    mfunc_append(f, inst_new_i(OP_ADDI, sum, next, R_NONE, 0));
+    mfunc_append(f, inst_new_i(OP_ADDI, step, i, R_NONE, 1));
+    mfunc_append(f, inst_new_i(OP_ADDI, i, step, R_NONE, 0));
+    mfunc_append(f, inst_new_branch(OP_JAL, R_ZERO, R_NONE, R_NONE, loop));
+    mfunc_append(f, inst_new_label(done));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A0, sum, R_NONE, 0));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+
+    loop_stats_t stats = {0};
+    int ok = loop_optimize(f, &stats, NULL) && dce(f, NULL);
+
+    // The multiplication only runs once, before the loop, which
+    // ends on a decremented counter
+    int labels = 0, calls_inside = 0, bnez = 0;
+    for (inst_t k = f->head; k; k = k->next) {
+        labels += k->op == OP_LABEL;
+        calls_inside += labels && k->op == OP_CALL;
+        bnez += k->op == OP_BNE && k->rs2 == R_ZERO;
+    }
+    int pass = ok && stats.loops == 1 && stats.hoisted == 1 && stats.reduced == 1 && stats.counted == 1 &&
+               !calls_inside && bnez == 1;
+    printf("loop_optimize(i * s): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    if (!pass) {
+        mfunc_print(f);
+    }
+    mfunc_free(&f);
+
+    // for (i = a0; i < a1; i += step) a2++; counted down, also when a1 - a0
+    // doesn't fit in 32 signed bits
+    static const struct {
+        int32_t from, to, step;
+    } spans[] = {{0, 10, 1},  {0, 10, 3},          {0, 9, 3},           {5, 5, 3},
+                 {7, -7, 1},  {-1, 1, 2047},        {INT32_MIN, INT32_MAX, 2047},
+                 {-2000000000, 2000000000, 2000}};
+    pass = 1;
+    for (int k = 0; pass && k < (int)(sizeof(spans) / sizeof(spans[0])); k++) {
+        f = mfunc_new("count");
+        i = mfunc_new_vreg(f), n = mfunc_new_vreg(f), next = mfunc_new_vreg(f);
+        loop = mfunc_new_label(f), done = mfunc_new_label(f);
+        mfunc_append(f, inst_new_i(OP_ADDI, i, R_A0, R_NONE, 0));
+        mfunc_append(f, inst_new_i(OP_ADDI, n, R_A1, R_NONE, 0));
+        mfunc_append(f, inst_new_i(OP_LI, R_A2, R_NONE, R_NONE, 0));
+        mfunc_append(f, inst_new_label(loop));
+        mfunc_append(f, inst_new_branch(OP_BGE, R_NONE, i, n, done));
+        mfunc_append(f, inst_new_i(OP_ADDI, R_A2, R_A2, R_NONE, 1));
+        mfunc_append(f, inst_new_i(OP_ADDI, next, i, R_NONE, spans[k].step));
+        mfunc_append(f, inst_new_i(OP_ADDI, i, next, R_NONE, 0));
+        mfunc_append(f, inst_new_branch(OP_JAL, R_ZERO, R_NONE, R_NONE, loop));
+        mfunc_append(f, inst_new_label(done));
+        mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+
+        int64_t span = (int64_t)spans[k].to - spans[k].from;
+        uint32_t expected = span > 0 ? (uint32_t)((span + spans[k].step - 1) / spans[k].step) : 0;
+        stats = (loop_stats_t){0};
+        ok = loop_optimize(f, &stats, NULL) && dce(f, NULL);
+        pass = ok && stats.counted == 1 &&
+               run_branches(f, (uint32_t)spans[k].from, (uint32_t)spans[k].to) == expected;
+        if (!pass) {
+            mfunc_print(f);
+        }
+        mfunc_free(&f);
+    }
+    printf("loop_optimize(wide spans): %s\n", pass ? "✅ OK" : "❌ FAIL");
+}
+
+// Counts the instructions of f with the opcode that read or write sp
+static int count_sp(mfunc_t f, opcode_t op) {
+    int n = 0;
+    for (inst_t i = f->head; i; i = i->next) {
+        n += i->op == op && (i->rd == R_SP || i->rs1 == R_SP);
+    }
+    return n;
+}
+
+void frame_lowering() {
+    printf("======================= Testing for frame lowering ========================\n");
+
+    // A leaf function that only uses caller-saved registers has no frame
+    mfunc_t f = mfunc_new("leaf");
+    mfunc_append(f, inst_new_r(OP_ADD, R_A0, R_A0, R_A1));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+    int pass = frame_lower(f) && f->ninsts == 2 && !count_sp(f, OP_ADDI);
+    printf("frame_lower(leaf): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    mfunc_free(&f);
+
+    // Only the callee-saved registers written are saved, and no ra
+    f = mfunc_new("saves");
+    mfunc_append(f, inst_new_i(OP_ADDI, R_S1, R_A0, R_NONE, 1));
+    mfunc_append(f, inst_new_r(OP_ADD, R_A0, R_S1, R_S1));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+    pass = frame_lower(f) && count_sp(f, OP_SW) == 1 && count_sp(f, OP_LW) == 1 && f->head->next->rs2 == R_S1;
+    printf("frame_lower(saves): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    if (!pass) {
+        mfunc_print(f);
+    }
+    mfunc_free(&f);
+
+    // A call followed by a ret becomes a tail call, so ra is left alone
+    f = mfunc_new("forward");
+    int done = mfunc_new_label(f);
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A0, R_A0, R_NONE, 1));
+    mfunc_append(f, inst_new_sym(OP_CALL, R_RA, "g"));
+    mfunc_append(f, inst_new_branch(OP_JAL, R_ZERO, R_NONE, R_NONE, done));
+    mfunc_append(f, inst_new_label(done));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+    pass = frame_lower(f) && f->head->next->op == OP_TAIL && !count_sp(f, OP_SW) && !count_sp(f, OP_ADDI);
+    printf("frame_lower(tail call): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    if (!pass) {
+        mfunc_print(f);
+    }
+    mfunc_free(&f);
+
+    // A recursive call in tail position jumps back after the prologue
+    f = mfunc_new("sum");
+    done = mfunc_new_label(f);
+    mfunc_append(f, inst_new_branch(OP_BEQ, R_NONE, R_A0, R_ZERO, done));
+    mfunc_append(f, inst_new_r(OP_ADD, R_S0, R_A1, R_A0));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A1, R_S0, R_NONE, 0));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A0, R_A0, R_NONE, -1));
+    mfunc_append(f, inst_new_sym(OP_CALL, R_RA, "sum"));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+    mfunc_append(f, inst_new_label(done));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A0, R_A1, R_NONE, 0));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+    int ok = frame_lower(f);
+
+    int calls = 0, back = 0, entry = -1;
+    for (inst_t i = f->head; i; i = i->next) {
+        calls += inst_is_call(i);
+        if (i->op == OP_LABEL && entry < 0) {
+            entry = i->label;
+            pass = i->prev && i->prev->op == OP_SW && i->prev->rs2 == R_S0;
+        }
+        back += i->op == OP_JAL && i->label == entry;
+    }
+    pass = pass && ok && !calls && back == 1 && count_sp(f, OP_LW) == 1;
+    printf("frame_lower(recursive tail call): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    if (!pass) {
+        mfunc_print(f);
+    }
+    mfunc_free(&f);
+}
+
+void calling_convention() {
+    printf("======================= Testing for calling convention ====================\n");
+
+    // Nine words and a 64-bit value: a0-a7, then the stack with
+    // the pair aligned on 8 bytes
+    mfunc_t f = mfunc_new("caller");
+    abi_value_t args[10], r;
+    for (int k = 0; k < 9; k++) {
+        args[k] = ABI_WORD(mfunc_new_vreg(f));
+    }
+    args[9] = ABI_PAIR(mfunc_new_vreg(f), mfunc_new_vreg(f));
+    int ok = abi_call(f, "g", args, 10, &r, 1);
+
+    int offsets[3] = {-1, -1, -1}, nstores = 0, moves = 0;
+    for (inst_t i = f->head; i; i = i->next) {
+        if (i->op == OP_SW && i->area == FRAME_OUTGOING && nstores < 3) {
+            offsets[nstores++] = i->imm;
+        }
+        moves += i->op == OP_ADDI && i->rd == R_A0 + moves && i->rs1 == args[moves].lo;
+    }
+    int pass = ok && f->out_size == 16 && moves == 8 && offsets[0] == 0 && offsets[1] == 8 && offsets[2] == 12 &&
+               r.hi != R_NONE && f->tail->rs1 == R_A1;
+    printf("abi_call(9 words, 1 pair): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    if (!pass) {
+        mfunc_print(f);
+    }
+    mfunc_free(&f);
+
+    // A pair starting in a7 has its high word on the stack
+    f = mfunc_new("callee");
+    int wide[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    abi_value_t p[8];
+    ok = abi_params(f, wide, 8, p);
+    pass = ok && f->in_size == 4 && f->tail->op == OP_LW && f->tail->area == FRAME_INCOMING && f->tail->imm == 0 &&
+           f->tail->rd == p[7].hi && f->tail->prev->rs1 == R_A7;
+    printf("abi_params(pair in a7): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // Once laid out, the incoming arguments are above the frame
+    int slot = mfunc_new_slot(f, 4, 4);
+    mfunc_append(f, inst_new_i(OP_SW, R_NONE, R_SP, p[7].hi, slot));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A0, p[7].lo, R_NONE, 0));
+    ok = abi_return(f, NULL) && regalloc(f, NULL) && frame_lower(f);
+    int frame = -f->head->imm, loaded = -1;
+    for (inst_t i = f->head; i; i = i->next) {
+        if (i->op == OP_LW && i->area == FRAME_INCOMING) {
+            loaded = i->imm;
+        }
+    }
+    pass = ok && frame == 16 && loaded == frame;
+    printf("frame_lower(incoming arguments): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    if (!pass) {
+        mfunc_print(f);
+    }
+    mfunc_free(&f);
+}
+
+void condition_lowering() {
+    printf("======================= Testing for condition lowering ====================\n");
+
+    // a2 = (a < b && a != 0) || !(b >= 10u), the constant of the last
+    // comparison is only loaded if it's reached
+    mfunc_t f = mfunc_new("cond");
+    int ten = mfunc_new_vreg(f), no = mfunc_new_label(f), done = mfunc_new_label(f);
+    cond_t lhs = cond_new_logic(LO_AND, cond_new_cmp(RO_LT, R_A0, R_A1, 0), cond_new_test(R_A0));
+    mfunc_append(f, inst_new_i(OP_LI, ten, R_NONE, R_NONE, 10));
+    cond_t rhs = cond_new_cmp(RO_GE, R_A1, ten, 1);
+    cond_take_code(rhs, f, NULL);
+    cond_t c = cond_new_logic(LO_OR, lhs, cond_new_logic(LO_NOT, rhs, NULL));
+
+    int ok = cond_branch(f, c, 0, no);
+    cond_free(&c);
+    mfunc_append(f, inst_new_i(OP_LI, R_A2, R_NONE, R_NONE, 1));
+    mfunc_append(f, inst_new_branch(OP_JAL, R_ZERO, R_NONE, R_NONE, done));
+    mfunc_append(f, inst_new_label(no));
+    mfunc_append(f, inst_new_i(OP_LI, R_A2, R_NONE, R_NONE, 0));
+    mfunc_append(f, inst_new_label(done));
+
+    int values = 0, deferred = 0, branches = 0;
+    for (inst_t i = f->head; i; i = i->next) {
+        values += i->op == OP_SLT || i->op == OP_SLTU || i->op == OP_XOR || i->op == OP_SLTIU;
+        branches += inst_is_branch(i);
+        deferred |= i->op == OP_LI && i->rd == ten && branches >= 2;
+    }
+
+    int correct = 1;
+    int32_t samples[] = {-5, 0, 3, 9, 10, 12};
+    for (int x = 0; x < 6; x++) {
+        for (int y = 0; y < 6; y++) {
+            uint32_t a = (uint32_t)samples[x], b = (uint32_t)samples[y];
+            uint32_t expected = ((int32_t)a < (int32_t)b && a != 0) || !(b >= 10u);
+            correct &= run_branches(f, a, b) == expected;
+        }
+    }
+    int pass = ok && correct && !values && deferred && branches == 3;
+    printf("cond_branch((a < b && a) || !(b >= 10)): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    if (!pass) {
+        mfunc_print(f);
+    }
+    mfunc_free(&f);
+
+    // As a value, a comparison is computed without branches
+    f = mfunc_new("value");
+    c = cond_new_cmp(RO_LE, R_A0, R_A1, 0);
+    ok = cond_value(f, R_A2, c);
+    cond_free(&c);
+    pass = ok && f->ninsts == 2 && f->head->op == OP_SLT && f->head->rs1 == R_A1 && f->tail->op == OP_XORI;
+    printf("cond_value(a <= b): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    mfunc_free(&f);
+
+    // Comparisons with a zero constant branch against the zero register:
+    // goto out unless (a0 != 0 && 0 >= a1 && a2 >= 0u), the last is always true
+    f = mfunc_new("zero");
+    int zero = mfunc_new_vreg(f), out = mfunc_new_label(f);
+    mfunc_append(f, inst_new_i(OP_LI, zero, R_NONE, R_NONE, 0));
+    c = cond_new_logic(LO_AND, cond_new_cmp(RO_NEQ, R_A0, zero, 0),
+                       cond_new_logic(LO_AND, cond_new_cmp(RO_GE, zero, R_A1, 0), cond_new_cmp(RO_GE, R_A2, zero, 1)));
+    ok = cond_branch(f, c, 0, out);
+    cond_free(&c);
+    mfunc_append(f, inst_new_i(OP_LI, R_A0, R_NONE, R_NONE, 1));
+    mfunc_append(f, inst_new_label(out));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+    if (!ok) {
+        printf("cond_branch(x op 0): ❌ FAIL\n");
+    }
+    run_emit_test("cond_branch(x op 0)", f,
+                  "\n    .text\n    .globl zero\n    .type zero, @function\n    .p2align 2\nzero:\n"
+                  "    li v0, 0\n"
+                  "    beqz a0, .Lzero_0\n"
+                  "    bgtz a1, .Lzero_0\n"
+                  "    li a0, 1\n"
+                  ".Lzero_0:\n"
+                  "    ret\n"
+                  "    .size zero, .-zero\n");
+    mfunc_free(&f);
+}
+
+void instruction_scheduling() {
+    printf("======================= Testing for instruction scheduling ================\n");
+
+    // a0 = (p[0] + p[0]) + (p[1] + p[1]) after p[2] = a1: both loads
+    // issue before their uses, the second one can't pass the store
+    mfunc_t f = mfunc_new("sched");
+    int v1 = mfunc_new_vreg(f), v2 = mfunc_new_vreg(f), v3 = mfunc_new_vreg(f), v4 = mfunc_new_vreg(f);
+    mfunc_append(f, inst_new_i(OP_LW, v1, R_A0, R_NONE, 0));
+    mfunc_append(f, inst_new_r(OP_ADD, v2, v1, v1));
+    mfunc_append(f, inst_new_i(OP_SW, R_NONE, R_A0, R_A1, 4));
+    mfunc_append(f, inst_new_i(OP_LW, v3, R_A0, R_NONE, 4));
+    mfunc_append(f, inst_new_r(OP_ADD, v4, v3, v3));
+    mfunc_append(f, inst_new_r(OP_ADD, R_A0, v2, v4));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+
+    target_t t = TARGET_DEFAULT;
+    sched_stats_t stats = {0};
+    int ok = schedule(f, &t, &stats);
+
+    int pos = 0, load1 = -1, use1 = -1, store = -1, load2 = -1;
+    for (inst_t i = f->head; i; i = i->next, pos++) {
+        load1 = i->op == OP_LW && i->rd == v1 ? pos : load1;
+        use1 = i->op == OP_ADD && i->rs1 == v1 ? pos : use1;
+        store = i->op == OP_SW ? pos : store;
+        load2 = i->op == OP_LW && i->rd == v3 ? pos : load2;
+    }
+    int pass = ok && stats.stalls_before == 2 && stats.stalls_after < 2 && use1 > load1 + 1 && load2 > store &&
+               f->ninsts == 7 && inst_is_ret(f->tail);
+    printf("schedule(lw; add; sw; lw; add; add): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    if (!pass) {
+        mfunc_print(f);
+    }
+    mfunc_free(&f);
+
+    // The target file overrides the latencies it names
+    const char* path = "/tmp/disa_sched_test.target";
+    FILE* fp = fopen(path, "w");
+    if (fp) {
+        fprintf(fp, "# test core\nname = slow-load\nload = 3   # two stall cycles\n\nmul = 5\n");
+        fclose(fp);
+    }
+    t = TARGET_DEFAULT;
+    pass = fp && target_load(path, &t) && !strcmp(t.name, "slow-load") && t.load == 3 && t.mul == 5 && t.alu == 1;
+    printf("target_load(slow-load): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // An unknown key is rejected
+    fp = fopen(path, "w");
+    if (fp) {
+        fprintf(fp, "fpu = 4\n");
+        fclose(fp);
+    }
+    pass = fp && !target_load(path, &t);
+    printf("target_load(unknown key): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    remove(path);
+}
+
+static int count_op(mfunc_t f, opcode_t op) {
+    int n = 0;
+    for (inst_t i = f->head; i; i = i->next) {
+        n += i->op == op;
+    }
+    return n;
+}
+
+void value_numbering() {
+    printf("======================= Testing for value numbering =======================\n");
+
+    // p[1] = p[0] + n; if (n) a0 = (n + p[0]) + p[0] after the store:
+    // the load and the sum are reused past the branch, the load after
+    // the store isn't
+    mfunc_t f = mfunc_new("gvn");
+    int p = mfunc_new_vreg(f), n = mfunc_new_vreg(f), x = mfunc_new_vreg(f), sum = mfunc_new_vreg(f);
+    int y = mfunc_new_vreg(f), again = mfunc_new_vreg(f), z = mfunc_new_vreg(f), r = mfunc_new_vreg(f);
+    int zero = mfunc_new_label(f);
+    mfunc_append(f, inst_new_i(OP_ADDI, p, R_A0, R_NONE, 0));
+    mfunc_append(f, inst_new_i(OP_ADDI, n, R_A1, R_NONE, 0));
+    mfunc_append(f, inst_new_i(OP_LW, x, p, R_NONE, 0));
+    mfunc_append(f, inst_new_r(OP_ADD, sum, x, n));
+    mfunc_append(f, inst_new_branch(OP_BEQ, R_NONE, n, R_ZERO, zero));
+    mfunc_append(f, inst_new_i(OP_LW, y, p, R_NONE, 0));
+    mfunc_append(f, inst_new_r(OP_ADD, again, n, y));
+    mfunc_append(f, inst_new_i(OP_SW, R_NONE, p, again, 4));
+    mfunc_append(f, inst_new_i(OP_LW, z, p, R_NONE, 0));
+    mfunc_append(f, inst_new_r(OP_ADD, r, again, z));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A0, r, R_NONE, 0));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+    mfunc_append(f, inst_new_label(zero));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A0, sum, R_NONE, 0));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+
+    gvn_stats_t stats = {0};
+    int ok = gvn(f, &stats) && dce(f, NULL);
+    int pass = ok && stats.loads == 1 && stats.exprs == 1 && count_op(f, OP_LW) == 2 && count_op(f, OP_ADD) == 2;
+    printf("gvn(p[0] + n, n + p[0]): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    if (!pass) {
+        mfunc_print(f);
+    }
+    mfunc_free(&f);
+
+    // a * b and b * a call the helper once, a + b isn't kept across a call
+    f = mfunc_new("calls");
+    int a = mfunc_new_vreg(f), b = mfunc_new_vreg(f), m1 = mfunc_new_vreg(f), m2 = mfunc_new_vreg(f);
+    int s1 = mfunc_new_vreg(f), s2 = mfunc_new_vreg(f), t = mfunc_new_vreg(f);
+    mfunc_append(f, inst_new_i(OP_ADDI, a, R_A0, R_NONE, 0));
+    mfunc_append(f, inst_new_i(OP_ADDI, b, R_A1, R_NONE, 0));
+    arith_lower(f, AO_MUL, m1, a, b, 0);
+    arith_lower(f, AO_MUL, m2, b, a, 0);
+    mfunc_append(f, inst_new_r(OP_ADD, s1, a, b));
+    mfunc_append(f, inst_new_sym(OP_CALL, R_RA, "use"));
+    mfunc_append(f, inst_new_r(OP_ADD, s2, b, a));
+    mfunc_append(f, inst_new_r(OP_ADD, t, m1, m2));
+    mfunc_append(f, inst_new_r(OP_ADD, t, t, s1));
+    mfunc_append(f, inst_new_r(OP_ADD, R_A0, t, s2));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+
+    stats = (gvn_stats_t){0};
+    ok = gvn(f, &stats) && dce(f, NULL);
+    pass = ok && stats.calls == 1 && stats.exprs == 0 && count_calls(f, ARITH_MUL_HELPER) == 1 &&
+           count_op(f, OP_ADD) == 5;
+    printf("gvn(a * b, b * a, a + b across a call): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    if (!pass) {
+        mfunc_print(f);
+    }
+    mfunc_free(&f);
+}
+
+void compression() {
+    printf("======================= Testing for instruction compression ===============\n");
+
+    // add a0, a1, a0 and beq zero, a0 are turned around to fit c.add and
+    // c.beqz, sub a2, a3, a4 has no 16-bit form
+    mfunc_t f = mfunc_new("c");
+    int skip = mfunc_new_label(f);
+    mfunc_append(f, inst_new_i(OP_ADDI, R_SP, R_SP, R_NONE, -16));
+    mfunc_append(f, inst_new_i(OP_SW, R_NONE, R_SP, R_RA, 12));
+    mfunc_append(f, inst_new_r(OP_ADD, R_A0, R_A1, R_A0));
+    mfunc_append(f, inst_new_branch(OP_BEQ, R_NONE, R_ZERO, R_A0, skip));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_A0, R_A0, R_NONE, 1));
+    mfunc_append(f, inst_new_i(OP_LI, R_A1, R_NONE, R_NONE, 5));
+    mfunc_append(f, inst_new_i(OP_LW, R_A0, R_A1, R_NONE, 4));
+    mfunc_append(f, inst_new_label(skip));
+    mfunc_append(f, inst_new_i(OP_LW, R_RA, R_SP, R_NONE, 12));
+    mfunc_append(f, inst_new_i(OP_ADDI, R_SP, R_SP, R_NONE, 16));
+    mfunc_append(f, inst_new_r(OP_SUB, R_A2, R_A3, R_A4));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+
+    compress_stats_t stats = {0};
+    int ok = compress(f, &stats);
+    int pass = ok && stats.insts == 11 && stats.compressed == 10 && stats.bytes_before == 44 &&
+               stats.bytes_after == 24 && compress_count(f) == 10;
+    printf("compress(c): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // Reference encodings from llvm-mc -triple=riscv32 -mattr=+c
+    static const uint16_t expected[] = {0x1141, 0xc606, 0x952e, 0xc501, 0x0505, 0x4595,
+                                        0x41c8, 0x40b2, 0x0141, 0x8633, 0x40e6, 0x8082};
+    size_t nexpected = sizeof(expected) / sizeof(expected[0]);
+
+    buf_t code = buf_new(64);
+    relocs_t relocs = relocs_new();
+    pass = ok && encode_function(f, code, relocs) && code->len == 2 * nexpected;
+    for (size_t i = 0; pass && i < nexpected; i++) {
+        uint16_t half;
+        memcpy(&half, code->data + 2 * i, 2);
+        pass = half == expected[i];
+    }
+    printf("encode_function(c): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    relocs_free(&relocs);
+    buf_free(&code);
+
+    run_emit_test("emit_function(c)", f,
+                  "\n    .text\n    .option push\n    .option rvc\n    .globl c\n    .type c, @function\n"
+                  "    .p2align 1\nc:\n"
+                  "    c.addi sp, -16\n"
+                  "    c.swsp ra, 12(sp)\n"
+                  "    c.add a0, a1\n"
+                  "    c.beqz a0, .Lc_0\n"
+                  "    c.addi a0, 1\n"
+                  "    c.li a1, 5\n"
+                  "    c.lw a0, 4(a1)\n"
+                  ".Lc_0:\n"
+                  "    c.lwsp ra, 12(sp)\n"
+                  "    c.addi sp, 16\n"
+                  "    sub a2, a3, a4\n"
+                  "    c.jr ra\n"
+                  "    .size c, .-c\n"
+                  "    .option pop\n");
+    mfunc_free(&f);
+
+    // A branch over more than 256 bytes keeps its full encoding
+    f = mfunc_new("far");
+    int end = mfunc_new_label(f);
+    mfunc_append(f, inst_new_branch(OP_BNE, R_NONE, R_A0, R_ZERO, end));
+    for (int k = 0; k < 100; k++) {
+        mfunc_append(f, inst_new_r(OP_ADD, R_T0, R_T1, R_T2));
+    }
+    mfunc_append(f, inst_new_label(end));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+
+    stats = (compress_stats_t){0};
+    ok = compress(f, &stats);
+    pass = ok && !f->head->compressed && f->tail->compressed && stats.compressed == 1 && stats.bytes_after == 406 &&
+           encode_size(f) == 406;
+    printf("compress(far branch): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    mfunc_free(&f);
+
+    // The chain is computed in place in x8-x15, which c.sub needs: only
+    // the first add and the shift to a0 keep their full encoding
+    f = mfunc_new("chain");
+    int a = mfunc_new_vreg(f), b = mfunc_new_vreg(f), c = mfunc_new_vreg(f);
+    mfunc_append(f, inst_new_r(OP_ADD, a, R_A0, R_A1));
+    mfunc_append(f, inst_new_r(OP_ADD, b, a, R_A2));
+    mfunc_append(f, inst_new_r(OP_SUB, c, b, R_A3));
+    mfunc_append(f, inst_new_i(OP_SRLI, R_A0, c, R_NONE, 1));
+    mfunc_append(f, inst_new_i(OP_JALR, R_ZERO, R_RA, R_NONE, 0));
+
+    target_t t = TARGET_DEFAULT;
+    t.compressed = 1;
+    stats = (compress_stats_t){0};
+    ok = regalloc(f, &t) && compress(f, &stats);
+    pass = ok && stats.insts == 5 && stats.compressed == 3 && f->head->next->next->compressed;
+    printf("regalloc(compressed chain): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    if (!pass) {
+        mfunc_print(f);
+    }
+    mfunc_free(&f);
+}
@@ -1,7 +1,16 @@
 #include "tests.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "tokenization/preprocessor.h"
+#include "tokenization/spans.h"
 #include "tokenization/tokenizer.h"
+#include "tokenization/tstream.h"
+#include "utils/loader.h"
 
 void run_token_test(const char* label, match_t (*token_fn)(char**, token_t*), const char* str, match_t expected_result,
                     const char* expected_str, token_type_t expected_token_type, token_t* tp) {
@@ -284,6 +293,27 @@ void token_matching() {
     t = NULL;
     run_token_test("match_integer_literal(123456789123456789 )", match_integer_literal, str, MATCH_FULL, "", L_I, &t);
 
+    str = "  0x1Fu)";
+    t = NULL;
+    run_token_test("match_integer_literal(  0x1Fu))", match_integer_literal, str, MATCH_FULL, ")", L_I, &t);
+
+    str = "  0x";
+    t = NULL;
+    run_token_test("match_integer_literal(  0x)", match_integer_literal, str, MATCH_PARTIAL, "0x", T_NOVALUE, &t);
+
+    str = "  09;";
+    t = NULL;
+    run_token_test("match_integer_literal(  09;)", match_integer_literal, str, MATCH_ERR, "09;", T_NOVALUE, &t);
+
+    str = "  12abc;";
+    t = NULL;
+    run_token_test("match_integer_literal(  12abc;)", match_integer_literal, str, MATCH_ERR, "12abc;", T_NOVALUE, &t);
+
+    str = "  18446744073709551616;";
+    t = NULL;
+    run_token_test("match_integer_literal(  18446744073709551616;)", match_integer_literal, str, MATCH_ERR,
+                   "18446744073709551616;", T_NOVALUE, &t);
+
     // ================== IDENTIFIERS ==================
     str = "  abc";
     t = NULL;
@@ -308,4 +338,527 @@ void token_matching() {
     str = "int_5";
     t = NULL;
     run_token_test("match_identifier(int_5)", match_identifier, str, MATCH_PARTIAL, "int_5", T_NOVALUE, &t);
-}
\ No newline at end of file
+}
+
+// Returns whether the two lists format the same
+static int same_format(tlist_t a, tlist_t b) {
+    buf_t x = buf_new(256), y = buf_new(256);
+    int same = x && y && tlist_format(x, a) && tlist_format(y, b) && x->len == y->len &&
+               !memcmp(x->data, y->data, x->len);
+    buf_free(&x);
+    buf_free(&y);
+    return same;
+}
+
+void token_serialization() {
+    printf("======================= Testing for token serialization ===================\n");
+
+    const char* src = "int f(int x) { char* s = \"x\"; return x + 'a' * 100000000000; }";
+    tokenizer_t tk = tokenizer_new();
+    tokenize_string(tk, src, strlen(src));
+    tlist_t tokens = get_tokens(tk);
+    tlist_insert_token(&tokens, token_new_int(-5));
+
+    // Identifier and string literal "x" are one string, read in place
+    buf_t b = buf_new(256);
+    tstream_t s;
+    tlist_t loaded = NULL;
+    int pass = b && tstream_write(b, tokens) && tstream_open(&s, b->data, b->len) && s.ntokens == 22 &&
+               s.nstrings == 3 && tstream_to_tlist(&s, &loaded) && same_format(tokens, loaded);
+    printf("tstream_write(), tstream_to_tlist(): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    tstream_cursor_t c = tstream_begin(&s);
+    tstream_token_t t;
+    int n = 0, strings_inside = 1, r;
+    int64_t first = 0;
+    while (pass && (r = tstream_next(&c, &t)) == 1) {
+        first = n++ ? first : t.ivalue;
+        if (t.svalue) {
+            strings_inside &= t.svalue >= b->data && t.svalue < b->data + b->len;
+        }
+    }
+    pass = pass && r == 0 && n == 22 && first == -5 && strings_inside;
+    printf("tstream_next(zero-copy): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // Cut short, another version, or a string index out of the table
+    pass = b && !tstream_open(&s, b->data, b->len - 1);
+    if (pass) {
+        b->data[4] = TSTREAM_VERSION + 1;
+        pass = !tstream_open(&s, b->data, b->len);
+        b->data[4] = TSTREAM_VERSION;
+        b->data[12] = 1;
+        pass = pass && tstream_open(&s, b->data, b->len);
+        tlist_t bad = NULL;
+        pass = pass && !tstream_to_tlist(&s, &bad);
+        tlist_free(&bad);
+    }
+    printf("tstream_open(corrupt): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    buf_free(&b);
+    tlist_free(&loaded);
+    tlist_free(&tokens);
+    tokenizer_free(&tk);
+}
+
+// Writes the file name in dir with the given contents
+static int write_file(const char* dir, const char* name, const char* contents, char* path) {
+    snprintf(path, 256, "%s/%s", dir, name);
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        return 0;
+    }
+    fputs(contents, f);
+    return !fclose(f);
+}
+
+// Returns whether the file preprocesses to the tokens of expected
+static int preprocesses_to(pp_t pp, const char* path, const char* expected) {
+    tokenizer_t tk = tokenizer_new();
+    tokenize_string(tk, expected, strlen(expected));
+    tlist_t want = get_tokens(tk), got = NULL;
+    int same = preprocess(pp, path, &got) && same_format(got, want);
+    tlist_free(&got);
+    tlist_free(&want);
+    tokenizer_free(&tk);
+    return same;
+}
+
+void preprocessing() {
+    printf("======================= Testing for preprocessing =========================\n");
+
+    char dir[] = "/tmp/disa_pp_XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("mkdtemp(): ❌ FAIL\n");
+        return;
+    }
+
+    char guarded[256], once[256], plain[256], main_c[256], inc[256];
+    snprintf(inc, sizeof(inc), "%s/inc", dir);
+    int pass = mkdir(inc, 0700) == 0 && write_file(dir, "inc/guarded.h",
+                                           "#ifndef GUARDED_H\n#define GUARDED_H\n#define SQ(x) ((x) * (x))\n"
+                                           "int g;\n#endif\n",
+                                           guarded) &&
+               write_file(dir, "once.h", "#pragma once\nint o;\n", once) &&
+               write_file(dir, "plain.h", "int p;\n", plain) &&
+               write_file(dir, "main.c",
+                          "#include <guarded.h>\n#include \"once.h\"\n#include <guarded.h>\n#include \"once.h\"\n"
+                          "#include \"plain.h\"\n#include \"plain.h\"\n#define f(x) x + f(x)\n"
+                          "#if defined(GUARDED_H) && N << 1 == 8\nint s = SQ(N) + f(1);\n#else\nint bad;\n#endif\n",
+                          main_c);
+
+    // Macros expand once, a macro isn't expanded again inside itself
+    pp_t pp = pp_new();
+    pass = pass && pp && pp_add_include_dir(pp, inc) && pp_define(pp, "N=4") &&
+           preprocesses_to(pp, main_c, "int g; int o; int p; int p; int s = ((4) * (4)) + 1 + f(1);");
+    printf("preprocess(): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // The second inclusions of the guarded and #pragma once headers are
+    // skipped, that of plain.h reuses the file read the first time too
+    pp_stats_t stats = pp ? pp_get_stats(pp) : (pp_stats_t){0};
+    pass = pass && stats.files == 4 && stats.includes == 6 && stats.skipped == 2 && stats.reused == 3;
+    printf("preprocess(include guards): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // The session keeps its files, main.c among them, and the macros
+    // defined by the last run
+    pass = pass && preprocesses_to(pp, main_c, "int p; int p; int s = ((4) * (4)) + 1 + f(1);");
+    stats = pp ? pp_get_stats(pp) : (pp_stats_t){0};
+    pass = pass && stats.files == 4 && stats.includes == 12 && stats.skipped == 6 && stats.reused == 10;
+    printf("preprocess(session): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // Reset for another translation unit, the files stay read, but for
+    // those changed since
+    if (pp) {
+        pp_reset(pp);
+    }
+    pass = pass && pp_add_include_dir(pp, inc) && pp_define(pp, "N=4") &&
+           preprocesses_to(pp, main_c, "int g; int o; int p; int p; int s = ((4) * (4)) + 1 + f(1);");
+    stats = pp ? pp_get_stats(pp) : (pp_stats_t){0};
+    pass = pass && stats.files == 0 && pp_nfiles(pp) == 4;
+    pass = pass && write_file(dir, "plain.h", "int pq;\n", plain);
+    if (pass) {
+        pp_reset(pp);
+    }
+    pass = pass && pp_add_include_dir(pp, inc) &&
+           preprocesses_to(pp, main_c, "int g; int o; int pq; int pq; int bad;");
+    stats = pp ? pp_get_stats(pp) : (pp_stats_t){0};
+    pass = pass && stats.files == 1 && pp_nfiles(pp) == 4;
+    printf("pp_reset(): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // A missing file is an error
+    char missing[256];
+    snprintf(missing, sizeof(missing), "%s/missing.c", dir);
+    tlist_t none = NULL;
+    pass = pp && !preprocess(pp, missing, &none);
+    tlist_free(&none);
+    printf("preprocess(missing): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // Dividing by zero is only an error in an operand that's evaluated
+    char cond[256] = "", divzero[256] = "";
+    pass = write_file(dir, "cond.c",
+                      "#if 0 && (1 / 0)\nint a;\n#endif\n#if 1 || (1 % 0)\nint b;\n#endif\n"
+                      "#if 1 ? 2 : (1 / 0)\nint c;\n#endif\n#if 0 ? 1 / 0 : 0 && 1 % 0\nint d;\n#endif\n",
+                      cond) &&
+           preprocesses_to(pp, cond, "int b; int c;");
+    pass = pass && write_file(dir, "divzero.c", "#if 1 && (1 / 0)\nint a;\n#endif\n", divzero) &&
+           !preprocess(pp, divzero, &none);
+    tlist_free(&none);
+    printf("preprocess(#if short-circuit): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // Values are intmax_t, or uintmax_t when unsigned, which makes the
+    // other operand unsigned too but for shifts
+    char types[256] = "";
+    pass = write_file(dir, "types.c",
+                      "#if -1 < 0u\nint a;\n#endif\n#if 0xFFFFFFFFFFFFFFFF > 0\nint b;\n#endif\n"
+                      "#if -1 >> 63 == -1 && -1 >> 63u == -1\nint c;\n#endif\n#if -1u >> 63 == 1\nint d;\n#endif\n"
+                      "#if -7 / 2 == -3 && -7 % 2 == -1\nint e;\n#endif\n#if -7u / 2 > 0 && -7 % 2u == 1\nint f;\n#endif\n"
+                      "#if 0xFFFFFFFF > -1 && 2147483648 > -1\nint g;\n#endif\n#if (1 ? -1 : 0u) > 0\nint h;\n#endif\n",
+                      types) &&
+           preprocesses_to(pp, types, "int b; int c; int d; int e; int f; int g; int h;");
+    printf("preprocess(#if signedness): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // The type lexed for each form of literal decides, those that only
+    // take an unsigned type on the target being signed here
+    char forms[256] = "";
+    pass = write_file(dir, "forms.c",
+                      "#if 1u - 2 > 0 && 1ul - 2 > 0 && 1LU - 2 > 0 && 1ull - 2 > 0 && 0x8000000000000000 > 0\n"
+                      "int a;\n#endif\n#if 1 - 2 < 0 && 1l - 2 < 0 && 1ll - 2 < 0 && -0x80000000 < 0 && "
+                      "-037777777777 < 0 && -0b1 < 0 && -0xFFFFFFFFL < 0\nint b;\n#endif\n",
+                      forms) &&
+           preprocesses_to(pp, forms, "int a; int b;");
+    printf("preprocess(#if literal types): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    pp_free(&pp);
+    remove(cond);
+    remove(divzero);
+    remove(types);
+    remove(forms);
+    remove(guarded);
+    remove(once);
+    remove(plain);
+    remove(main_c);
+    rmdir(inc);
+    rmdir(dir);
+}
+
+// Returns whether src lexes to the tokens of expected
+static int lexes_to(const char* src, const char* expected) {
+    tokenizer_t a = tokenizer_new(), b = tokenizer_new();
+    int same = a && b && tokenize_string(a, src, strlen(src)) && tokenize_string(b, expected, strlen(expected));
+    tlist_t got = a ? get_tokens(a) : NULL, want = b ? get_tokens(b) : NULL;
+    same = same && same_format(got, want);
+    tlist_free(&got);
+    tlist_free(&want);
+    tokenizer_free(&a);
+    tokenizer_free(&b);
+    return same;
+}
+
+// Returns whether src, given to the tokenizer in parts of part bytes,
+// lexes to the tokens of expected
+static int lexes_in_parts_to(const char* src, size_t part, const char* expected) {
+    tokenizer_t a = tokenizer_new(), b = tokenizer_new();
+    int same = a && b && tokenize_string(b, expected, strlen(expected));
+    size_t len = strlen(src);
+    for (size_t i = 0; same && i < len; i += part) {
+        same = tokenize_part(a, src + i, len - i < part ? len - i : part);
+    }
+    same = same && tokenize_end(a);
+
+    tlist_t got = a ? get_tokens(a) : NULL, want = b ? get_tokens(b) : NULL;
+    same = same && same_format(got, want);
+    tlist_free(&got);
+    tlist_free(&want);
+    tokenizer_free(&a);
+    tokenizer_free(&b);
+    return same;
+}
+
+// Pads b with c up to len bytes, then appends s
+static void pad_to(char* b, size_t len, char c, const char* s) {
+    size_t n = strlen(b);
+    memset(b + n, c, len - n);
+    strcpy(b + len, s);
+}
+
+void comment_skipping() {
+    printf("======================= Testing for comment skipping ======================\n");
+
+    int pass = lexes_to("int /* a * / b */ x = 6 / 2; // y = 1;\nchar* s = \"/* //\"; /**/ /*/ z */ x /= 1;",
+                        "int x = 6 / 2; char* s = \"/* //\"; x /= 1;");
+    printf("tokenize_string(comments): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    span_t* spans = NULL;
+    const char* decls = "int a; // };\n/* ; } */ int b; /* ;";
+    pass = split_spans(decls, strlen(decls), &spans) == 3 && spans[1].end == 29;
+    printf("split_spans(comments): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    free(spans);
+
+    // The "*/" of a block comment and the "//" of a line comment are cut
+    // by the end of 4096-byte parts, and a division too
+    static char src[20000];
+    snprintf(src, sizeof(src), "int a;\n/*");
+    pad_to(src, 4095, 'x', "*/\nint b; //");
+    pad_to(src, 8200, '/', "\nint c = 6 ");
+    pad_to(src, 12287, ' ', "/ 2;\nint d = 1 ");
+    pad_to(src, 16383, ' ', "// comment\nint e;\n");
+    pass = lexes_in_parts_to(src, 4096, "int a; int b; int c = 6 / 2; int d = 1 int e;");
+    printf("tokenize_part(comments across parts): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // Directives in comments aren't, comments in directives go
+    char dir[] = "/tmp/disa_pp_XXXXXX";
+    char main_c[256];
+    pp_t pp = pp_new();
+    pass = mkdtemp(dir) && pp &&
+           write_file(dir, "main.c",
+                      "/*\n#include \"missing.h\"\n*/\n#define X 1 /* one\n#error */\n#pragma once // again\n"
+                      "int x = X; // #error\n",
+                      main_c) &&
+           preprocesses_to(pp, main_c, "int x = 1;");
+    printf("preprocess(comments): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    pp_free(&pp);
+    remove(main_c);
+    rmdir(dir);
+}
+
+// Returns whether src lexes to tokens formatted as expected
+static int formats_to(const char* src, const char* expected) {
+    tokenizer_t tk = tokenizer_new();
+    buf_t b = buf_new(256);
+    int ok = tk && b && tokenize_string(tk, src, strlen(src));
+    tlist_t tokens = tk ? get_tokens(tk) : NULL;
+    ok = ok && tlist_format(b, tokens) && buf_putc(b, '\0') && !strcmp(b->data, expected);
+    tlist_free(&tokens);
+    buf_free(&b);
+    tokenizer_free(&tk);
+    return ok;
+}
+
+void integer_literals() {
+    printf("======================= Testing for integer literals ======================\n");
+
+    // Past 8 digits the SWAR conversion takes over, up to the 20 of the
+    // largest value
+    int pass = formats_to("0 7 1234567 12345678 123456789 1234567890123456 12345678901234567 9223372036854775807",
+                          "tlist[L_I(0), L_I(7), L_I(1234567), L_I(12345678), L_I(123456789), L_I(1234567890123456LL), "
+                          "L_I(12345678901234567LL), L_I(9223372036854775807LL)]");
+    printf("decimal: %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    pass = formats_to("0x1F 0XffFFffFF 017 0b101 0xffffffffffffffff",
+                      "tlist[L_I(31), L_I(4294967295U), L_I(15), L_I(5), L_I(18446744073709551615ULL)]");
+    printf("hexadecimal, octal, binary: %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // On RV32 long is as wide as int, decimals past int go to long long
+    pass = formats_to("42u 42l 42UL 42lu 42ll 42uLL 2147483648 0x80000000 0x100000000 4294967296u",
+                      "tlist[L_I(42U), L_I(42L), L_I(42UL), L_I(42UL), L_I(42LL), L_I(42ULL), L_I(2147483648LL), "
+                      "L_I(2147483648U), L_I(4294967296LL), L_I(4294967296ULL)]");
+    printf("suffixes and types: %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // The type goes through the binary token stream too
+    tokenizer_t tk = tokenizer_new();
+    const char* src = "42ul 0xffffffffffffffff -1";
+    pass = tk && tokenize_string(tk, src, strlen(src));
+    tlist_t tokens = tk ? get_tokens(tk) : NULL, loaded = NULL;
+    buf_t b = buf_new(256);
+    tstream_t s;
+    pass = pass && b && tstream_write(b, tokens) && tstream_open(&s, b->data, b->len) &&
+           tstream_to_tlist(&s, &loaded) && same_format(tokens, loaded);
+    printf("tstream_write(typed): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    buf_free(&b);
+    tlist_free(&loaded);
+    tlist_free(&tokens);
+    tokenizer_free(&tk);
+}
+
+static int count_tokens(tlist_t l) {
+    int n = 0;
+    for (; l; l = tlist_next(l)) {
+        n++;
+    }
+    return n;
+}
+
+// What a writer thread writes to a pipe, and in writes of how many bytes
+typedef struct pipe_source {
+    int fd;
+    const char* data;
+    size_t len;
+    size_t step;
+} pipe_source_t;
+
+static void* write_pipe(void* arg) {
+    pipe_source_t* p = (pipe_source_t*)arg;
+    for (size_t i = 0; i < p->len; i += p->step) {
+        size_t n = p->len - i < p->step ? p->len - i : p->step;
+        if (write(p->fd, p->data + i, n) != (ssize_t)n) {
+            break;
+        }
+    }
+    close(p->fd);
+    return NULL;
+}
+
+void streaming_input() {
+    printf("======================= Testing for streaming input =======================\n");
+
+    // A string literal far longer than a part, and than the old 256-byte
+    // carry-over
+    static char src[300000];
+    snprintf(src, sizeof(src), "char* s = \"");
+    pad_to(src, 100011, 'x', "\"; int after;");
+    tokenizer_t tk = tokenizer_new();
+    int pass = tk != NULL;
+    for (size_t i = 0, len = strlen(src); pass && i < len; i += 4096) {
+        pass = tokenize_part(tk, src + i, len - i < 4096 ? len - i : 4096);
+    }
+    pass = pass && tokenize_end(tk);
+    tlist_t tokens = tk ? get_tokens(tk) : NULL;
+    const char* literal = token_get_string(tlist_token(tlist_next(tlist_next(tlist_next(tlist_next(tokens))))));
+    pass = pass && literal && strlen(literal) == 100000 && count_tokens(tokens) == 9;
+    printf("tokenize_part(long literal): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    tlist_free(&tokens);
+    tokenizer_free(&tk);
+
+    // A byte at a time, every token is cut
+    const char* code = "int f(int x) { /* sum */ return x + 0x1Fu * 'a' - 100000000000; } // end\nchar* s = \"a b\";";
+    pass = lexes_in_parts_to(code, 1, code);
+    printf("tokenize_part(1 byte parts): %s\n", pass ? "✅ OK" : "❌ FAIL");
+
+    // Through a pipe, written in small pieces while the tokenizer reads
+    size_t len = 0;
+    for (int i = 0; i < 2000; i++) {
+        len += snprintf(src + len, sizeof(src) - len, "x%d = %d; // line %d of the generated code\n", i, i * 7, i);
+    }
+    int fds[2];
+    pthread_t writer;
+    pipe_source_t source = {-1, src, len, 1000};
+    pass = !pipe(fds);
+    if (pass) {
+        source.fd = fds[1];
+        pass = !pthread_create(&writer, NULL, write_pipe, &source);
+        if (!pass) {
+            close(fds[1]);
+        }
+    }
+
+    tk = tokenizer_new();
+    tokenizer_t whole = tokenizer_new();
+    pass = pass && tk && whole && tokenize_fd(tk, fds[0]) && tokenize_string(whole, src, len);
+    if (source.fd >= 0) {
+        pthread_join(writer, NULL);
+        close(fds[0]);
+    }
+    tlist_t got = tk ? get_tokens(tk) : NULL, want = whole ? get_tokens(whole) : NULL;
+    pass = pass && count_tokens(got) == 8000 && same_format(got, want);
+    printf("tokenize_fd(pipe): %s\n", pass ? "✅ OK" : "❌ FAIL");
+    tlist_free(&got);
+    tlist_free(&want);
+    tokenizer_free(&tk);
+    tokenizer_free(&whole);
+
+    // A lex error stops reading a pipe that stays open, rather than
+    // waiting for input that never comes. The code before the error
+    // leaves the reader the time to wait for more.
+    len = 0;
+    for (int i = 0; i < 4000; i++) {
+        len += snprintf(src + len, sizeof(src) - len, "x = %d; ", i);
+    }
+    len += snprintf(src + len, sizeof(src) - len, "x = 0x;\n");
+    pass = !pipe(fds);
+    if (pass) {
+        pass = write(fds[1], src, len) == (ssize_t)len;
+        tk = tokenizer_new();
+        pass = pass && tk && !tokenize_fd(tk, fds[0]);
+        tokenizer_free(&tk);
+        close(fds[0]);
+        close(fds[1]);
+    }
+    printf("tokenize_fd(lex error, open pipe): %s\n", pass ? "✅ OK" : "❌ FAIL");
+}
+
+// Loads the files at paths with the loader, checks that every one comes
+// once with the contents written, or the error expected, and returns the
+// statistics in *stats
+static int loads_all(const char* const* paths, int n, const char* const* contents, int flags, loader_stats_t* stats) {
+    loader_t l = loader_new(paths, n, flags);
+    char* seen = (char*)calloc(n, 1);
+    int pass = l && seen;
+
+    loaded_t f;
+    int r, count = 0;
+    while (pass && (r = loader_next(l, &f)) == 1) {
+        pass = f.index >= 0 && f.index < n && !seen[f.index];
+        if (pass && contents[f.index]) {
+            pass = !f.error && f.len == strlen(contents[f.index]) && !memcmp(f.data, contents[f.index], f.len) &&
+                   !f.data[f.len];
+        } else if (pass) {
+            pass = f.error == ENOENT && !f.data;
+        }
+        if (pass) {
+            seen[f.index] = 1;
+        }
+        count++;
+        free(f.data);
+    }
+    pass = pass && !r && count == n;
+
+    if (l) {
+        *stats = loader_get_stats(l);
+    }
+    loader_free(&l);
+    free(seen);
+    return pass;
+}
+
+void batch_loading() {
+    printf("======================= Testing for batch loading =========================\n");
+
+    // More files than can be in flight at once, with one missing
+    enum { N = 200 };
+    static char paths[N][256], texts[N][64];
+    const char* path_list[N];
+    const char* contents[N];
+    char dir[] = "/tmp/disa_load_XXXXXX";
+    int pass = mkdtemp(dir) != NULL;
+    for (int i = 0; i < N; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "f%d.c", i);
+        snprintf(texts[i], sizeof(texts[i]), "int f%d(int x) { return x * %d; }\n", i, i);
+        pass = pass && write_file(dir, name, texts[i], paths[i]);
+        path_list[i] = paths[i];
+        contents[i] = texts[i];
+    }
+    pass = pass && !remove(paths[7]);
+    contents[7] = NULL;
+
+    // A file far larger than the others
+    static char big[1 << 20];
+    pad_to(big, sizeof(big) - 1, 'y', "");
+    contents[3] = big;
+    pass = pass && write_file(dir, "f3.c", big, paths[3]);
+
+    loader_stats_t stats = {0, 0};
+    int ok = pass && loads_all(path_list, N, contents, 0, &stats);
+    printf("loader_next(%s): %s\n", stats.uring ? "io_uring" : "pool", ok ? "✅ OK" : "❌ FAIL");
+
+    // With io_uring the operations of many files go in one system call
+    ok = !stats.uring || stats.submissions < N;
+    printf("loader_get_stats(submissions): %s\n", ok ? "✅ OK" : "❌ FAIL");
+
+    ok = pass && loads_all(path_list, N, contents, LOADER_POOL, &stats) && !stats.uring;
+    printf("loader_next(pool): %s\n", ok ? "✅ OK" : "❌ FAIL");
+
+    // Freed with files still in flight
+    loader_t l = loader_new(path_list, N, 0);
+    loaded_t f;
+    ok = l && loader_next(l, &f) == 1;
+    if (ok) {
+        free(f.data);
+    }
+    loader_free(&l);
+    printf("loader_free(early): %s\n", ok && !l ? "✅ OK" : "❌ FAIL");
+
+    for (int i = 0; i < N; i++) {
+        remove(paths[i]);
+    }
+    rmdir(dir);
+}
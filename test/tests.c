@@ -2,4 +2,28 @@
 
 void run_tests() {
     token_matching();
+    token_serialization();
+    preprocessing();
+    comment_skipping();
+    integer_literals();
+    streaming_input();
+    batch_loading();
+    arith_lowering();
+    asm_emission();
+    object_emission();
+    string_pool();
+    register_allocation();
+    dead_code_elimination();
+    function_inlining();
+    loop_optimization();
+    frame_lowering();
+    calling_convention();
+    condition_lowering();
+    instruction_scheduling();
+    value_numbering();
+    compression();
+    output_cache();
+    incremental_compilation();
+    compile_server();
+    time_report();
 }
\ No newline at end of file
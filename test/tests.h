@@ -2,6 +2,35 @@
 #define TESTS_H
 
 void token_matching();
+void token_serialization();
+void preprocessing();
+void comment_skipping();
+void integer_literals();
+void streaming_input();
+void batch_loading();
+
+void arith_lowering();
+
+void asm_emission();
+
+void object_emission();
+void string_pool();
+
+void register_allocation();
+void dead_code_elimination();
+void function_inlining();
+void loop_optimization();
+void frame_lowering();
+void calling_convention();
+void condition_lowering();
+void instruction_scheduling();
+void value_numbering();
+void compression();
+
+void output_cache();
+void incremental_compilation();
+void compile_server();
+void time_report();
 
 void run_tests();
 